@@ -0,0 +1,1985 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+// SOURCE FILES
+#include "common.h"
+#include "mesh_utils.h"
+#include "mesh.h"
+
+// MACROS
+#undef LOG
+#define LOG(fmt, ...)  do { fprintf(stdout, fmt, ##__VA_ARGS__); fflush(stdout); } while (0)
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Headless benchmark of the CPU side of the pipeline.
+/// Needs neither a window nor an OpenGL context: the meshes are parsed and
+/// the transforms computed exactly like in the demo, but only the CPU code
+/// paths are timed.
+///
+/// Usage: ./cpu_bench [update|keys|key32|xform|parse|import|locality|vertex|
+///                     lodscale|lodmetric|basemesh|rootcull|flythrough|
+///                     backface]
+///                    [options]
+///                    [<mesh file> ...]
+///   update: updates until the tree is stable, from the roots or from the
+///           keys of a uniform level, keys/second of the BinTreeCPU update
+///           against the thread count, and cost of the culled list (render
+///           records or indices) and of the key layout (uvec4 or packed)
+///   keys  : parity of the native 64 bit key algebra (ltree64.h) with the
+///           uvec2 port of the GLSL code (ltree_cpu.h), and ns/op of both
+///   key32 : same as keys for the 32 bit keys of FLAG_KEY32 (levels 0 to 30),
+///           and key size picked by BinTree for each mesh and edge length
+///   xform : ns/op of the triangle xforms decoded bit by bit against the 4
+///           and 8 bit tables, at levels 10, 20, 40 and 60
+///   parse : parity of the .obj float parser with strtof, parse time of
+///           the memory mapped tokenizer against sscanf, and of the chunked
+///           parse against the thread count, load time of the .tessmesh
+///           cache, and vertex welding with a std::map against the hash
+///           tables (default meshes: bigguy.obj and bunny.obj)
+///   import: round trip of the .obj meshes through binary .ply and .glb
+///           files, import time against the .obj parse and parity of the
+///           imported meshes (same default meshes as parse)
+///   locality: vertex cache misses, fetch stride and centroid step of the
+///           polygons in file order and sorted by meshutils::ReorderForLocality,
+///           and update time of the converged CPU bintree for both
+///   vertex: size of the float and quantized mesh vertices, bytes fetched
+///           by a cull pass of the converged tree, quantization time and
+///           largest errors of the quantized vertices
+///   lodscale: drawn leaves and screen space error (projected edge and
+///           chord error) of the global LoD and of the per polygon LoD
+///           scales, and drawn leaves of the global LoD at the same error
+///   lodmetric: drawn leaves and projected edge error of the distance based
+///           LoD and of the projected edge LoD (FLAG_LOD_PROJECTED) on the
+///           displaced terrain and the meshes, and drawn leaves of the
+///           distance based LoD at the same error
+///   basemesh: simplification of the meshes into cages of 1/4, 1/16 and 1/64
+///           of their triangles, build time, size and error of their base
+///           maps, and keys and update time of the converged CPU bintree on
+///           each cage, at the default camera and at a far one
+///   rootcull: keys, drawn nodes and update time of the converged CPU
+///           bintree with and without the root BVH, for views with more and
+///           more of the mesh out of the frustum, and walk time of the BVH
+///   flythrough: keys, drawn nodes and update time of the CPU bintree along
+///           a flight over the displaced terrain, one update per frame, with
+///           the nodes outside the frustum refined as usual and capped at
+///           floor levels 0, 4 and 8 (FLAG_CULL_REFINE); no mesh file
+///   backface: keys, drawn nodes and update time of the converged CPU
+///           bintree without and with the normal cones of the linear, PN
+///           and Phong surfaces (FLAG_BACKFACE), at the default camera and
+///           a close up view, and build time of the cones
+/// Options:
+///   --res <px>     screen resolution used by the LoD        (default 1920)
+///   --edge <px>    target edge length of the rendered grid  (default 2)
+///   --updates <n>  timed updates per thread count, or parses (default 20)
+///   --threads <n>  highest thread count         (default: hardware threads)
+///   --keys <n>     random keys per level for keys and xform (default 4096)
+///                  (64 times as many random floats for parse)
+///
+
+struct BenchSettings {
+    int res = 1920;
+    float edge = 2.0f;
+    int updates = 20;
+    int threads = 0;
+    int keys = 4096;
+    vector<string> files;
+} settings;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+double msSince(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+/*
+ * Params of the CPU update for a camera: LoD of the demo for the target edge
+ * length and resolution of bench_settings, frustum culling on
+ */
+BinTreeCPU::Params defaultParams(const BenchSettings& bench_settings,
+                                 const CameraManager& cam,
+                                 const Mesh_Data& mesh_data)
+{
+    BinTreeCPU::Params params = {};
+    params.lod_factor = BinTree::ComputeLodFactor(bench_settings.res, cam.fov,
+                                                  bench_settings.edge, 2,
+                                                  mesh_data.avg_e_length);
+    params.cull_on = true;
+    params.screen_res = bench_settings.res;
+    return params;
+}
+
+/*
+ * Updates an initialized CPU bintree until it splits and merges nothing, or
+ * for max_updates updates, and returns the number of updates run
+ */
+int convergeCpuTree(BinTreeCPU& bintree, const TransformBlock& block,
+                    const BinTreeCPU::Params& params, int max_updates = 128)
+{
+    int updates = 0;
+    do {
+        bintree.Update(block, params);
+        ++updates;
+    } while (bintree.GetChangeCount() > 0 && updates < max_updates);
+    return updates;
+}
+
+/*
+ * Loads a mesh file like Mesh::LoadMeshData and Mesh::LoadMeshBuffers do, minus
+ * the buffer creation
+ */
+bool loadMesh(const string& filepath, Mesh_Data& mesh_data, int& polygon_type)
+{
+    mesh_data = {};
+    Mesh::LoadMeshFile(filepath, mesh_data);
+    if (mesh_data.quad_count > 0 && mesh_data.triangle_count == 0) {
+        polygon_type = QUADS;
+    } else if (mesh_data.quad_count == 0 && mesh_data.triangle_count > 0) {
+        polygon_type = TRIANGLES;
+    } else {
+        LOG("ERROR when parsing %s\n", filepath.c_str());
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Update benchmark
+///
+
+void benchUpdate(const string& filepath)
+{
+    Mesh_Data mesh_data;
+    int polygon_type;
+    if (!loadMesh(filepath, mesh_data, polygon_type))
+        return;
+
+    // Default mesh camera of the demo, on a square framebuffer
+    CameraManager cam;
+    cam.Init(MESH);
+    cam.fb_width = cam.fb_height = settings.res;
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+
+    BinTreeCPU::Params params = defaultParams(settings, cam, mesh_data);
+
+    // Subdivides until the tree stops changing, so that every timed update
+    // processes the same keys: this is the startup latency of the converging
+    // demo
+    BinTreeCPU bintree;
+    Clock::time_point t0 = Clock::now();
+    bintree.Init(&mesh_data, polygon_type);
+    int converge_updates = convergeCpuTree(bintree, transforms.GetBlock(),
+                                           params);
+    double converge_ms = msSince(t0);
+    size_t key_count = bintree.GetFullNodes().size();
+
+    LOG("\n%s: %d %s, %zu keys, %zu drawn\n", filepath.c_str(),
+        (polygon_type == TRIANGLES) ? mesh_data.triangle_count
+                                    : mesh_data.quad_count,
+        (polygon_type == TRIANGLES) ? "triangles" : "quads",
+        key_count, bintree.GetCulledCount());
+    LOG("Stable after %d updates (%.3f ms)\n", converge_updates, converge_ms);
+
+    // Uniform subdivision at the level closest to the adaptive key count:
+    // keys written directly at that level, or split from the roots
+    size_t root_count = (polygon_type == TRIANGLES) ? mesh_data.triangle_count
+                                                    : 2 * mesh_data.quad_count;
+    int uniform_lvl = 0;
+    while ((root_count << (uniform_lvl + 1)) <= key_count)
+        ++uniform_lvl;
+    BinTreeCPU::Params uniform_params = params;
+    uniform_params.uniform_on = true;
+    uniform_params.uniform_lvl = uniform_lvl;
+    BinTreeCPU uniform_tree;
+    LOG("%14s %8s %10s %12s\n", "uniform lvl", "updates", "ms", "keys");
+    for (int direct = 0; direct < 2; ++direct) {
+        t0 = Clock::now();
+        uniform_tree.Init(&mesh_data, polygon_type, direct ? uniform_lvl : 0);
+        int updates = convergeCpuTree(uniform_tree, transforms.GetBlock(),
+                                      uniform_params);
+        LOG("%8d %5s %8d %10.3f %12zu\n", uniform_lvl,
+            direct ? "init" : "split", updates, msSince(t0),
+            uniform_tree.GetFullNodes().size());
+    }
+    LOG("%8s %12s %12s %10s\n", "threads", "ms/update", "Mkeys/s", "speedup");
+
+    double ref_ms = 0.0;
+    int max_threads = (settings.threads > 0) ? settings.threads
+                                             : ThreadPool::HardwareThreadCount();
+    for (int t = 1; ; t = std::min(t * 2, max_threads)) {
+        bintree.SetThreadCount(t);
+        bintree.Update(transforms.GetBlock(), params); // warm up
+        Clock::time_point t0 = Clock::now();
+        for (int i = 0; i < settings.updates; ++i)
+            bintree.Update(transforms.GetBlock(), params);
+        double ms = msSince(t0) / settings.updates;
+        if (t == 1)
+            ref_ms = ms;
+        LOG("%8d %12.3f %12.3f %9.2fx\n", t, ms,
+            key_count / (ms * 1e3), ref_ms / ms);
+        if (t == max_threads)
+            break;
+    }
+
+    // Culled list stored as render records or as indices in the key buffer:
+    // write traffic of the cull pass and memory of the node pool (the render
+    // pass decodes the keys again with the indices)
+    LOG("%12s %12s %14s %12s\n", "culled list", "ms/update", "culled MB/upd",
+        "pool B/node");
+    for (int indices = 0; indices < 2; ++indices) {
+        params.culled_indices = (indices == 1);
+        bintree.Update(transforms.GetBlock(), params); // warm up
+        Clock::time_point t0 = Clock::now();
+        for (int i = 0; i < settings.updates; ++i)
+            bintree.Update(transforms.GetBlock(), params);
+        double ms = msSince(t0) / settings.updates;
+        size_t entry_size = indices ? sizeof(uint) : sizeof(RenderRecord);
+        LOG("%12s %12.3f %14.3f %12zu\n", indices ? "indices" : "records", ms,
+            bintree.GetCulledCount() * entry_size / double(1 << 20),
+            2 * sizeof(uvec4) + entry_size);
+    }
+    params.culled_indices = false;
+
+    // Keys stored as uvec4 or packed in 12 bytes: key buffer traffic of an
+    // update (read and write the tree), and cost of packing the CPU keys for
+    // the upload
+    const vector<uvec4>& keys = bintree.GetFullNodes();
+    vector<uvec3> packed(keys.size());
+    t0 = Clock::now();
+    for (int i = 0; i < settings.updates; ++i)
+        for (size_t k = 0; k < keys.size(); ++k)
+            packed[k] = ltree64::lt_packKey_64(keys[k], polygon_type);
+    double pack_ms = msSince(t0) / settings.updates;
+    size_t mismatches = 0;
+    for (size_t k = 0; k < keys.size(); ++k)
+        mismatches += (ltree64::lt_unpackKey_64(packed[k], polygon_type) != keys[k]);
+
+    LOG("%12s %8s %12s %10s\n", "key layout", "B/key", "key MB/upd", "pack ms");
+    LOG("%12s %8zu %12.3f %10s\n", "uvec4", sizeof(uvec4),
+        2 * keys.size() * sizeof(uvec4) / double(1 << 20), "-");
+    LOG("%12s %8zu %12.3f %10.3f\n", "packed", sizeof(uvec3),
+        2 * keys.size() * sizeof(uvec3) / double(1 << 20),
+        pack_ms);
+    if (mismatches > 0) {
+        LOG("ERROR: %zu keys do not survive packing\n", mismatches);
+    }
+
+    mesh_data.FreeArrays();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Key algebra benchmark
+///
+
+/*
+ * Random nodeIDs, settings.keys per level from 0 (root) to level_count - 1,
+ * plus the extreme keys of each level
+ */
+vector<uint64> randomNodeIDs(int level_count = 64)
+{
+    std::mt19937_64 rng(0x5eed);
+    vector<uint64> nodeIDs;
+    for (int lvl = 0; lvl < level_count; ++lvl) {
+        uint64 msb = uint64(1) << lvl;
+        nodeIDs.push_back(msb);
+        nodeIDs.push_back(msb | (msb - 1));
+        for (int i = 0; i < settings.keys; ++i)
+            nodeIDs.push_back(msb | (rng() & (msb - 1)));
+    }
+    std::shuffle(nodeIDs.begin(), nodeIDs.end(), rng);
+    return nodeIDs;
+}
+
+bool sameXform(const glm::mat3x2& ref, const ltree64::Xform& xf)
+{
+    const float* m = glm::value_ptr(ref);
+    for (int i = 0; i < 6; ++i)
+        if (m[i] != xf.m[i])
+            return false;
+    return true;
+}
+
+/*
+ * Compares every function of ltree64.h with its uvec2 counterpart, the xforms
+ * must match bit for bit
+ */
+bool checkKeyParity(const vector<uint64>& nodeIDs)
+{
+    size_t mismatch_count = 0;
+    for (size_t i = 0; i < nodeIDs.size(); ++i) {
+        uint64 id = nodeIDs[i];
+        uvec2 id2 = ltree64::lt_uvec2_64(id);
+        uvec2 children2[2];
+        ltree::lt_children_64(id2, children2);
+        ltree64::Children children = ltree64::lt_children_64(id);
+        glm::mat3x2 xf2, pxf2;
+        ltree::lt_getTriangleXform_64(id2, xf2, pxf2);
+        ltree64::XformPair xf = ltree64::lt_getTriangleXform_64(id);
+        ltree64::XformPair xf_loop = ltree64::lt_getTriangleXformLoop_64(id);
+
+        bool ok = ltree64::lt_nodeID_64(id2) == id
+                && ltree64::lt_level_64(id) == ltree::lt_level_64(id2)
+                && ltree64::lt_isLeaf_64(id) == ltree::lt_isLeaf_64(id2)
+                && ltree64::lt_isRoot_64(id) == ltree::lt_isRoot_64(id2)
+                && ltree64::lt_isZeroChild_64(id) == ltree::lt_isZeroChild_64(id2)
+                && ltree64::lt_uvec2_64(ltree64::lt_parent_64(id))
+                   == ltree::lt_parent_64(id2)
+                && sameXform(xf2, xf.xform)
+                && sameXform(pxf2, xf.parent_xform)
+                && sameXform(xf2, xf_loop.xform)
+                && sameXform(pxf2, xf_loop.parent_xform);
+        // Children of leaves overflow, and are never created
+        if (!ltree64::lt_isLeaf_64(id))
+            ok = ok && ltree64::lt_uvec2_64(children.id[0]) == children2[0]
+                    && ltree64::lt_uvec2_64(children.id[1]) == children2[1];
+        if (!ok && mismatch_count++ < 8) {
+            LOG("  mismatch for nodeID 0x%016llx\n", (unsigned long long)id);
+        }
+    }
+    LOG("Parity with ltree_cpu.h: %zu keys, %zu mismatches\n",
+        nodeIDs.size(), mismatch_count);
+    return mismatch_count == 0;
+}
+
+/*
+ * Average time of f over all the keys, the results are accumulated in sink so
+ * that the calls are not optimized away
+ */
+template <typename Key, typename F>
+double nsPerOp(const vector<Key>& nodeIDs, float& sink, F f)
+{
+    const int reps = 4;
+    Clock::time_point t0 = Clock::now();
+    for (int r = 0; r < reps; ++r)
+        for (size_t i = 0; i < nodeIDs.size(); ++i)
+            sink += f(nodeIDs[i]);
+    return msSince(t0) * 1e6 / (double(reps) * nodeIDs.size());
+}
+
+template <typename Key, typename F2, typename F64>
+void benchKeyFunction(const char* name, const vector<uvec2>& nodeIDs2,
+                      const vector<Key>& nodeIDs, float& sink,
+                      F2 f2, F64 f64)
+{
+    double ref = nsPerOp(nodeIDs2, sink, f2);
+    double ns = nsPerOp(nodeIDs, sink, f64);
+    LOG("%-26s %12.2f %12.2f %9.2fx\n", name, ref, ns, ref / ns);
+}
+
+bool benchKeys()
+{
+    using namespace ltree64;
+    vector<uint64> nodeIDs = randomNodeIDs();
+    vector<uvec2> nodeIDs2(nodeIDs.size());
+    for (size_t i = 0; i < nodeIDs.size(); ++i)
+        nodeIDs2[i] = lt_uvec2_64(nodeIDs[i]);
+
+    LOG("Key algebra benchmark, levels 0 to 63\n");
+    bool parity = checkKeyParity(nodeIDs);
+
+    float sink = 0.0f;
+    LOG("%-26s %12s %12s %10s\n", "function", "uvec2 ns/op", "uint64 ns/op",
+        "speedup");
+    benchKeyFunction("lt_level_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) { return float(ltree::lt_level_64(id)); },
+        [](uint64 id) { return float(lt_level_64(id)); });
+    benchKeyFunction("lt_isLeaf_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) { return float(ltree::lt_isLeaf_64(id)); },
+        [](uint64 id) { return float(lt_isLeaf_64(id)); });
+    benchKeyFunction("lt_isRoot_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) { return float(ltree::lt_isRoot_64(id)); },
+        [](uint64 id) { return float(lt_isRoot_64(id)); });
+    benchKeyFunction("lt_parent_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) { return float(ltree::lt_parent_64(id).y); },
+        [](uint64 id) { return float(uint(lt_parent_64(id))); });
+    benchKeyFunction("lt_children_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) {
+            uvec2 children[2];
+            ltree::lt_children_64(id, children);
+            return float(children[1].y);
+        },
+        [](uint64 id) { return float(uint(lt_children_64(id).id[1])); });
+    benchKeyFunction("lt_getTriangleXform_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) {
+            glm::mat3x2 xf, pxf;
+            ltree::lt_getTriangleXform_64(id, xf, pxf);
+            return xf[2].x + pxf[2].y;
+        },
+        [](uint64 id) {
+            XformPair xf = lt_getTriangleXform_64(id);
+            return xf.xform.m[4] + xf.parent_xform.m[5];
+        });
+    benchKeyFunction("lt_getTriangleXformLoop_64", nodeIDs2, nodeIDs, sink,
+        [](uvec2 id) {
+            glm::mat3x2 xf, pxf;
+            ltree::lt_getTriangleXform_64(id, xf, pxf);
+            return xf[2].x + pxf[2].y;
+        },
+        [](uint64 id) {
+            XformPair xf = lt_getTriangleXformLoop_64(id);
+            return xf.xform.m[4] + xf.parent_xform.m[5];
+        });
+    LOG("(checksum %g)\n", sink);
+    return parity;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Triangle xform benchmark
+///
+
+float maxXformError(const ltree64::XformPair& ref, const ltree64::XformPair& xf)
+{
+    float e = 0.0f;
+    for (int i = 0; i < 6; ++i) {
+        e = std::max(e, std::abs(ref.xform.m[i] - xf.xform.m[i]));
+        e = std::max(e, std::abs(ref.parent_xform.m[i] - xf.parent_xform.m[i]));
+    }
+    return e;
+}
+
+void benchXform()
+{
+    using namespace ltree64;
+    const int levels[] = {10, 20, 40, 60};
+    std::mt19937_64 rng(0x5eed);
+
+    LOG("Triangle xform benchmark (xform and parent xform of each key)\n");
+    LOG("%6s %12s %12s %12s %9s %9s %12s\n", "level", "loop ns/op",
+        "lut4 ns/op", "lut8 ns/op", "lut4", "lut8", "max error");
+    float sink = 0.0f;
+    for (int lvl : levels) {
+        uint64 msb = uint64(1) << lvl;
+        vector<uint64> nodeIDs(settings.keys * 16);
+        for (size_t i = 0; i < nodeIDs.size(); ++i)
+            nodeIDs[i] = msb | (rng() & (msb - 1));
+
+        float error = 0.0f;
+        for (size_t i = 0; i < nodeIDs.size(); ++i) {
+            XformPair ref = lt_getTriangleXform_64(nodeIDs[i]);
+            error = std::max(error, maxXformError(ref,
+                             lt_getTriangleXformLUT_64<4>(nodeIDs[i])));
+            error = std::max(error, maxXformError(ref,
+                             lt_getTriangleXformLUT_64<8>(nodeIDs[i])));
+        }
+
+        double loop = nsPerOp(nodeIDs, sink, [](uint64 id) {
+            XformPair xf = lt_getTriangleXformLoop_64(id);
+            return xf.xform.m[4] + xf.parent_xform.m[5];
+        });
+        double lut4 = nsPerOp(nodeIDs, sink, [](uint64 id) {
+            XformPair xf = lt_getTriangleXformLUT_64<4>(id);
+            return xf.xform.m[4] + xf.parent_xform.m[5];
+        });
+        double lut8 = nsPerOp(nodeIDs, sink, [](uint64 id) {
+            XformPair xf = lt_getTriangleXformLUT_64<8>(id);
+            return xf.xform.m[4] + xf.parent_xform.m[5];
+        });
+        LOG("%6d %12.2f %12.2f %12.2f %8.2fx %8.2fx %12g\n", lvl, loop,
+            lut4, lut8, loop / lut4, loop / lut8, error);
+    }
+    LOG("(checksum %g)\n", sink);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// 32 bit keys benchmark
+///
+
+/*
+ * Port of the FLAG_KEY32 variant of ltree_jk.glsl: the nodeIDs of the trees
+ * of at most 31 levels are handled as a single uint
+ */
+namespace key32 {
+
+uint level(uint nodeID) { return uint(ltree64::lt_findMSB_64(nodeID)); }
+bool isLeaf(uint nodeID) { return level(nodeID) == uint(BinTree::KEY32_MAX_LEVEL); }
+uint parent(uint nodeID) { return nodeID >> 1; }
+uint child(uint nodeID, uint bit) { return (nodeID << 1) | bit; }
+
+void triangleXform(uint nodeID, glm::mat3x2& xform, glm::mat3x2& parent_xform)
+{
+    glm::mat3x2 xf = glm::mat3x2(1, 0, 0, 1, 0, 0);
+    if (nodeID == 1u) {
+        xform = parent_xform = xf;
+        return;
+    }
+    for (uint id = nodeID >> 1; id > 1u; id >>= 1)
+        xf = ltree::mul(ltree::jk_bitToMatrix(id & 1u), xf);
+    parent_xform = xf;
+    xform = ltree::mul(parent_xform, ltree::jk_bitToMatrix(nodeID & 1u));
+}
+
+} // namespace key32
+
+/*
+ * Same as benchKeys for the 32 bit keys of FLAG_KEY32 against the uvec2
+ * emulation of the 64 bit keys, on levels 0 to 30, followed by the key size
+ * BinTree picks for each mesh and target edge length
+ */
+bool benchKey32()
+{
+    LOG("32 bit keys benchmark, levels 0 to %d\n", BinTree::KEY32_MAX_LEVEL - 1);
+    vector<uint64> nodeIDs = randomNodeIDs(BinTree::KEY32_MAX_LEVEL);
+    vector<uvec2> nodeIDs2(nodeIDs.size());
+    vector<uint> nodeIDs32(nodeIDs.size());
+    size_t mismatch_count = 0;
+    for (size_t i = 0; i < nodeIDs.size(); ++i) {
+        nodeIDs2[i] = ltree64::lt_uvec2_64(nodeIDs[i]);
+        nodeIDs32[i] = uint(nodeIDs[i]);
+
+        uvec2 id2 = nodeIDs2[i];
+        uint id = nodeIDs32[i];
+        uvec2 children2[2];
+        ltree::lt_children_64(id2, children2);
+        glm::mat3x2 xf2, pxf2, xf, pxf;
+        ltree::lt_getTriangleXform_64(id2, xf2, pxf2);
+        key32::triangleXform(id, xf, pxf);
+        bool ok = key32::level(id) == ltree::lt_level_64(id2)
+                && key32::parent(id) == ltree::lt_parent_64(id2).y
+                && key32::child(id, 0u) == children2[0].y
+                && key32::child(id, 1u) == children2[1].y
+                && xf == xf2 && pxf == pxf2;
+        if (!ok && mismatch_count++ < 8) {
+            LOG("  mismatch for nodeID 0x%08x\n", id);
+        }
+    }
+    LOG("Parity with ltree_cpu.h: %zu keys, %zu mismatches\n",
+        nodeIDs.size(), mismatch_count);
+
+    float sink = 0.0f;
+    LOG("%-24s %12s %12s %10s\n", "function", "uvec2 ns/op", "uint32 ns/op",
+        "speedup");
+    benchKeyFunction("lt_level_64", nodeIDs2, nodeIDs32, sink,
+        [](uvec2 id) { return float(ltree::lt_level_64(id)); },
+        [](uint id) { return float(key32::level(id)); });
+    benchKeyFunction("lt_isLeaf_64", nodeIDs2, nodeIDs32, sink,
+        [](uvec2 id) { return float(ltree::lt_isLeaf_64(id)); },
+        [](uint id) { return float(key32::isLeaf(id)); });
+    benchKeyFunction("lt_parent_64", nodeIDs2, nodeIDs32, sink,
+        [](uvec2 id) { return float(ltree::lt_parent_64(id).y); },
+        [](uint id) { return float(key32::parent(id)); });
+    benchKeyFunction("lt_children_64", nodeIDs2, nodeIDs32, sink,
+        [](uvec2 id) {
+            uvec2 children[2];
+            ltree::lt_children_64(id, children);
+            return float(children[1].y);
+        },
+        [](uint id) { return float(key32::child(id, 1u)); });
+    benchKeyFunction("lt_getTriangleXform_64", nodeIDs2, nodeIDs32, sink,
+        [](uvec2 id) {
+            glm::mat3x2 xf, pxf;
+            ltree::lt_getTriangleXform_64(id, xf, pxf);
+            return xf[2].x + pxf[2].y;
+        },
+        [](uint id) {
+            glm::mat3x2 xf, pxf;
+            key32::triangleXform(id, xf, pxf);
+            return xf[2].x + pxf[2].y;
+        });
+    LOG("(checksum %g)\n", sink);
+
+    // Automatic choice of the demo, with its default camera and CPU LoD
+    CameraManager cam;
+    cam.Init(MESH);
+    cam.fb_width = cam.fb_height = settings.res;
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    BinTree::Settings bt_settings = {};
+    bt_settings.near_plane = transforms.GetNearPlane();
+    LOG("\n%-24s %8s %10s %8s\n", "mesh", "edge px", "max level", "keys");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(settings.files[i], mesh_data, polygon_type))
+            continue;
+        for (float edge = 1.0f; edge <= 64.0f; edge *= 4.0f) {
+            bt_settings.lod_factor = BinTree::ComputeLodFactor(
+                        settings.res, cam.fov, edge, 2, mesh_data.avg_e_length);
+            int lvl = BinTree::PredictMaxLevel(bt_settings);
+            LOG("%-24s %8.0f %10d %8s\n", settings.files[i].c_str(), edge, lvl,
+                (lvl < BinTree::KEY32_MAX_LEVEL - 2) ? "32 bit" : "64 bit");
+        }
+        mesh_data.FreeArrays();
+    }
+    return mismatch_count == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// .obj parse benchmark
+///
+
+/*
+ * Tokenizer replaced by meshutils::ParseObjText: copies each line in a
+ * 256 char buffer and reads it with sscanf
+ */
+void sscanfParseObj(const char* begin, const char* end, meshutils::ObjData& obj)
+{
+    char line[256];
+    for (const char* p = begin; p < end; ) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        size_t size = std::min(size_t(eol - p), sizeof(line) - 1);
+        memcpy(line, p, size);
+        line[size] = '\0';
+        p = eol + 1;
+        float x, y, z;
+        if (line[0] == 'v' && line[1] == ' ') {
+            if (sscanf(line, "v %f %f %f", &x, &y, &z) == 3)
+                obj.verts.push_back(vec4(x, y, z, 1.0f));
+        } else if (line[0] == 'v' && line[1] == 't') {
+            if (sscanf(line, "vt %f %f", &x, &y) == 2)
+                obj.uvs.push_back(vec2(x, y));
+        } else if (line[0] == 'v' && line[1] == 'n') {
+            if (sscanf(line, "vn %f %f %f", &x, &y, &z) == 3)
+                obj.normals.push_back(vec4(x, y, z, 0.0f));
+        } else if (line[0] == 'f' && line[1] == ' ') {
+            int vi = -1, ti = -1, ni = -1;
+            const char* cp = &line[2];
+            while (*cp == ' ') cp++;
+            while (sscanf(cp, "%d/%d/%d", &vi, &ti, &ni) > 0) {
+                obj.faceverts.push_back(vi - 1);
+                if (ti > 0) obj.faceuvs.push_back(ti - 1);
+                if (ni > 0) obj.facenormals.push_back(ni - 1);
+                while (*cp && *cp != ' ') cp++;
+                while (*cp == ' ') cp++;
+            }
+            obj.face_count++;
+        }
+    }
+}
+
+/*
+ * Welding replaced by meshutils::WeldVertices: std::map keyed by the
+ * attribute indices packed in 32 bits, looked up twice per corner
+ */
+void mapWeldVertices(const meshutils::ObjData& obj, vector<Vertex>& vertices,
+                     vector<uint>& indices)
+{
+    map<uint, uint> uniqueIDX_to_vectorIDX;
+    Vertex current_v;
+    int Nv = obj.verts.size();
+    int Nn = obj.normals.size();
+    bool with_normals = obj.facenormals.size() > 0;
+    bool with_uvs = obj.faceuvs.size() > 0;
+    int iv = 0, it = 0, in = 0;
+    uint unique_idx;
+    for (size_t i = 0; i < obj.faceverts.size(); ++i) {
+        iv = obj.faceverts[i];
+        if (with_normals) in = obj.facenormals[i];
+        if (with_uvs) it = obj.faceuvs[i];
+        unique_idx = iv + Nv * (in + Nn * it);
+        if (uniqueIDX_to_vectorIDX.count(unique_idx) == 0) {
+            current_v.p = obj.verts[iv];
+            if (with_normals) current_v.n = obj.normals[in];
+            if (with_uvs) current_v.uv = obj.uvs[it];
+            uniqueIDX_to_vectorIDX[unique_idx] = vertices.size();
+            vertices.push_back(current_v);
+        }
+        indices.push_back(uniqueIDX_to_vectorIDX[unique_idx]);
+    }
+}
+
+bool sameVertices(const vector<Vertex>& a, const vector<Vertex>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].p != b[i].p || a[i].n != b[i].n || a[i].uv != b[i].uv)
+            return false;
+    return true;
+}
+
+/*
+ * Parity of obj::parseFloat with strtof on random numbers in the formats of
+ * the modelling tools, then parse time of each .obj: tokenization of the
+ * mapped file against the sscanf tokenizer, whole meshutils::ParseObj,
+ * load from the .tessmesh cache, chunked tokenization against the thread
+ * count, and vertex welding with the hash tables against the std::map
+ */
+bool benchParse()
+{
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::uniform_int_distribution<int> exponent(-30, 30);
+    const char* formats[] = {"%.6f", "%.9g", "%.7e", "%.3f"};
+    size_t mismatch_count = 0, count = 0;
+    char buf[64];
+    for (int i = 0; i < settings.keys * 64; ++i) {
+        float x = uniform(rng) * std::pow(10.0f, float(exponent(rng) / 3));
+        snprintf(buf, sizeof(buf), formats[i % 4], x);
+        const char* p = buf;
+        float fast;
+        bool ok = meshutils::obj::parseFloat(p, buf + strlen(buf), fast);
+        float ref = strtof(buf, NULL);
+        if (!ok || fast != ref) {
+            if (mismatch_count < 8) {
+                LOG("  mismatch for %s: %.9g instead of %.9g\n", buf, fast, ref);
+            }
+            ++mismatch_count;
+        }
+        ++count;
+    }
+    LOG("Float parity with strtof: %zu numbers, %zu mismatches\n", count,
+        mismatch_count);
+
+    LOG("\n%-24s %8s %10s %10s %10s %8s %12s\n", "mesh", "MB", "mmap ms",
+        "sscanf ms", "MB/s", "speedup", "ParseObj ms");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        size_t size = 0;
+        double ms[2];
+        for (int sscanf_ref = 0; sscanf_ref < 2; ++sscanf_ref) {
+            Clock::time_point t0 = Clock::now();
+            for (int k = 0; k < settings.updates; ++k) {
+                meshutils::MappedFile file(name);
+                if (!file.IsOpen()) {
+                    LOG("ERROR: cannot open %s\n", name.c_str());
+                    return false;
+                }
+                meshutils::ObjData obj;
+                if (sscanf_ref)
+                    sscanfParseObj(file.Data(), file.Data() + file.Size(), obj);
+                else
+                    meshutils::ParseObjText(file.Data(),
+                                            file.Data() + file.Size(), 0, obj);
+                size = file.Size();
+            }
+            ms[sscanf_ref] = msSince(t0) / settings.updates;
+        }
+        Mesh_Data mesh_data = {};
+        Clock::time_point t0 = Clock::now();
+        meshutils::ParseObj(name, 0, &mesh_data);
+        double parse_ms = msSince(t0);
+        LOG("%-24s %8.2f %10.3f %10.3f %10.1f %7.2fx %12.3f\n", name.c_str(),
+            size / double(1 << 20), ms[0], ms[1],
+            size / double(1 << 20) / (ms[0] * 1e-3), ms[1] / ms[0], parse_ms);
+        mesh_data.FreeArrays();
+    }
+
+    // Load from the .tessmesh cache against parse and reorder, and check
+    // that the mapped arrays are identical to the processed ones
+    bool identical = true;
+    LOG("\n%-24s %14s %10s %10s %8s %10s\n", "mesh", "parse+reorder",
+        "write ms", "load ms", "speedup", "identical");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data parsed = {};
+        Clock::time_point t0 = Clock::now();
+        meshutils::ParseObj(name, 0, &parsed);
+        Mesh::reorderIndices(parsed.t_idx_array, parsed.v_array,
+                             parsed.t_idx.count);
+        double parse_ms = msSince(t0);
+        uint64_t hash, size;
+        t0 = Clock::now();
+        bool written = meshutils::HashFile(name, hash, size)
+                    && meshutils::WriteTessMesh(name, hash, size, 0, parsed);
+        double write_ms = msSince(t0);
+        Mesh_Data cached = {};
+        bool loaded = written;
+        t0 = Clock::now();
+        for (int k = 0; loaded && k < settings.updates; ++k) {
+            cached.FreeArrays();
+            loaded = meshutils::HashFile(name, hash, size)
+                  && meshutils::LoadTessMesh(name, hash, size, 0, &cached);
+        }
+        double load_ms = msSince(t0) / settings.updates;
+        auto sameArray = [](const void* a, const void* b, size_t size) {
+            return size == 0 || (a && b && !memcmp(a, b, size));
+        };
+        bool same = loaded && cached.v.count == parsed.v.count
+                 && cached.t_idx.count == parsed.t_idx.count
+                 && cached.q_idx.count == parsed.q_idx.count
+                 && cached.avg_e_length == parsed.avg_e_length
+                 && sameArray(cached.v_array, parsed.v_array,
+                              parsed.v.count * sizeof(Vertex))
+                 && sameArray(cached.t_idx_array, parsed.t_idx_array,
+                              parsed.t_idx.count * sizeof(uint))
+                 && sameArray(cached.q_idx_array, parsed.q_idx_array,
+                              parsed.q_idx.count * sizeof(uint));
+        identical &= same;
+        LOG("%-24s %14.3f %10.3f %10.3f %7.1fx %10s\n", name.c_str(),
+            parse_ms, write_ms, load_ms, parse_ms / load_ms,
+            same ? "yes" : "NO");
+        parsed.FreeArrays();
+        cached.FreeArrays();
+    }
+
+    // Chunked parse against the thread count, and check that the merged
+    // chunks are identical to the serial parse
+    int max_threads = (settings.threads > 0) ? settings.threads
+                                             : ThreadPool::HardwareThreadCount();
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        meshutils::MappedFile file(settings.files[i]);
+        const char* begin = file.Data();
+        const char* end = begin + file.Size();
+        meshutils::ObjData ref;
+        meshutils::ParseObjText(begin, end, 0, ref);
+        LOG("\n%s: %d faces\n", settings.files[i].c_str(), ref.face_count);
+        LOG("%8s %8s %10s %10s %10s\n", "threads", "chunks", "ms", "speedup",
+            "identical");
+        double ref_ms = 0.0;
+        ThreadPool pool;
+        for (int t = 1; ; t = std::min(t * 2, max_threads)) {
+            pool.SetThreadCount(t);
+            meshutils::ObjData obj;
+            Clock::time_point t0 = Clock::now();
+            for (int k = 0; k < settings.updates; ++k) {
+                obj = meshutils::ObjData();
+                meshutils::ParseObjTextParallel(begin, end, 0, pool, obj);
+            }
+            double ms = msSince(t0) / settings.updates;
+            if (t == 1)
+                ref_ms = ms;
+            bool same = obj.verts == ref.verts && obj.uvs == ref.uvs
+                     && obj.normals == ref.normals
+                     && obj.faceverts == ref.faceverts
+                     && obj.faceuvs == ref.faceuvs
+                     && obj.facenormals == ref.facenormals
+                     && obj.face_count == ref.face_count;
+            identical &= same;
+            LOG("%8d %8zu %10.3f %9.2fx %10s\n", t,
+                meshutils::ObjChunkCount(file.Size(), t), ms,
+                ref_ms / ms, same ? "yes" : "NO");
+            if (t == max_threads)
+                break;
+        }
+
+        // Vertex welding: std::map, serial hash table, then sharded hash
+        // tables against the thread count
+        vector<Vertex> ref_vertices;
+        vector<uint> ref_indices;
+        Clock::time_point t0 = Clock::now();
+        for (int k = 0; k < settings.updates; ++k) {
+            ref_vertices.clear();
+            ref_indices.clear();
+            mapWeldVertices(ref, ref_vertices, ref_indices);
+        }
+        double map_ms = msSince(t0) / settings.updates;
+        LOG("\nwelding: %zu corners, %zu vertices\n", ref.faceverts.size(),
+            ref_vertices.size());
+        LOG("%-12s %8s %10s %10s %10s\n", "method", "threads", "ms", "speedup",
+            "identical");
+        LOG("%-12s %8d %10.3f %9.2fx %10s\n", "std::map", 1, map_ms, 1.0, "-");
+        for (int t = 0; ; t = std::min(std::max(t * 2, 1), max_threads)) {
+            vector<Vertex> vertices;
+            vector<uint> indices;
+            pool.SetThreadCount(std::max(t, 1));
+            t0 = Clock::now();
+            for (int k = 0; k < settings.updates; ++k) {
+                if (t == 0)
+                    meshutils::WeldVertices(ref, vertices, indices);
+                else
+                    meshutils::WeldVerticesParallel(ref, pool, vertices,
+                                                    indices);
+            }
+            double ms = msSince(t0) / settings.updates;
+            bool same = sameVertices(vertices, ref_vertices)
+                     && indices == ref_indices;
+            identical &= same;
+            LOG("%-12s %8d %10.3f %9.2fx %10s\n", t ? "sharded" : "hash",
+                std::max(t, 1), ms, map_ms / ms, same ? "yes" : "NO");
+            if (t == max_threads)
+                break;
+        }
+    }
+    return mismatch_count == 0 && identical;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Binary importers benchmark
+///
+
+/*
+ * Writes the vertices (float position, normal, uv) and polygons of
+ * mesh_data in a binary .ply of the given endianness
+ */
+bool writePly(const string& name, const Mesh_Data& mesh_data, bool big_endian)
+{
+    std::ofstream out(name.c_str(), std::ios::binary);
+    bool quads = mesh_data.quad_count > 0;
+    const uint* idx = quads ? mesh_data.q_idx_array : mesh_data.t_idx_array;
+    int face_size = quads ? 4 : 3;
+    int face_count = quads ? mesh_data.quad_count : mesh_data.triangle_count;
+    out << "ply\nformat " << (big_endian ? "binary_big_endian"
+                                         : "binary_little_endian")
+        << " 1.0\ncomment cpu_bench import\n"
+        << "element vertex " << mesh_data.v.count << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "property float s\nproperty float t\n"
+        << "element face " << face_count << "\n"
+        << "property list uchar uint vertex_indices\nend_header\n";
+    auto put = [&](const void* value, size_t size) {
+        char b[4];
+        memcpy(b, value, size);
+        if (big_endian)
+            std::reverse(b, b + size);
+        out.write(b, size);
+    };
+    for (uint i = 0; i < mesh_data.v.count; ++i) {
+        const Vertex& v = mesh_data.v_array[i];
+        float values[8] = {v.p.x, v.p.y, v.p.z, v.n.x, v.n.y, v.n.z,
+                           v.uv.x, v.uv.y};
+        for (int k = 0; k < 8; ++k)
+            put(&values[k], 4);
+    }
+    for (int f = 0; f < face_count; ++f) {
+        uint8_t count = uint8_t(face_size);
+        put(&count, 1);
+        for (int k = 0; k < face_size; ++k)
+            put(&idx[f * face_size + k], 4);
+    }
+    return bool(out);
+}
+
+/*
+ * Writes mesh_data in a .glb with 16 or 32 bit indices, the quads split in
+ * two triangles like meshutils::MeshBuilder does
+ */
+bool writeGlb(const string& name, const Mesh_Data& mesh_data, int index_bits)
+{
+    vector<uint> triangles;
+    if (mesh_data.quad_count > 0) {
+        for (int q = 0; q < mesh_data.quad_count; ++q) {
+            const uint* quad = &mesh_data.q_idx_array[4 * q];
+            uint split[6] = {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]};
+            triangles.insert(triangles.end(), split, split + 6);
+        }
+    } else {
+        triangles.assign(mesh_data.t_idx_array,
+                         mesh_data.t_idx_array + mesh_data.t_idx.count);
+    }
+    // Interleaved position, normal, uv, then the indices
+    string bin;
+    for (uint i = 0; i < mesh_data.v.count; ++i) {
+        const Vertex& v = mesh_data.v_array[i];
+        float values[8] = {v.p.x, v.p.y, v.p.z, v.n.x, v.n.y, v.n.z,
+                           v.uv.x, 1.0f - v.uv.y};
+        bin.append((const char*)values, sizeof(values));
+    }
+    size_t index_offset = bin.size();
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        if (index_bits == 16) {
+            uint16_t index = uint16_t(triangles[i]);
+            bin.append((const char*)&index, 2);
+        } else {
+            bin.append((const char*)&triangles[i], 4);
+        }
+    }
+    bin.resize((bin.size() + 3) / 4 * 4, '\0');
+
+    std::ostringstream json;
+    json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"cpu_bench\"},"
+         << "\"buffers\":[{\"byteLength\":" << bin.size() << "}],"
+         << "\"bufferViews\":["
+         << "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << index_offset
+         << ",\"byteStride\":32},"
+         << "{\"buffer\":0,\"byteOffset\":" << index_offset
+         << ",\"byteLength\":" << triangles.size() * index_bits / 8 << "}],"
+         << "\"accessors\":["
+         << "{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,"
+         << "\"count\":" << mesh_data.v.count << ",\"type\":\"VEC3\"},"
+         << "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,"
+         << "\"count\":" << mesh_data.v.count << ",\"type\":\"VEC3\"},"
+         << "{\"bufferView\":0,\"byteOffset\":24,\"componentType\":5126,"
+         << "\"count\":" << mesh_data.v.count << ",\"type\":\"VEC2\"},"
+         << "{\"bufferView\":1,\"componentType\":"
+         << (index_bits == 16 ? 5123 : 5125) << ",\"count\":"
+         << triangles.size() << ",\"type\":\"SCALAR\"}],"
+         << "\"meshes\":[{\"name\":\"m\\u00e9sh\",\"primitives\":[{"
+         << "\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},"
+         << "\"indices\":3,\"mode\":4}]}]}";
+    string json_chunk = json.str();
+    json_chunk.resize((json_chunk.size() + 3) / 4 * 4, ' ');
+
+    std::ofstream out(name.c_str(), std::ios::binary);
+    uint32_t header[5] = {0x46546C67, 2,
+                          uint32_t(12 + 8 + json_chunk.size() + 8 + bin.size()),
+                          uint32_t(json_chunk.size()), 0x4E4F534A};
+    uint32_t bin_header[2] = {uint32_t(bin.size()), 0x004E4942};
+    out.write((const char*)header, sizeof(header));
+    out.write(json_chunk.data(), json_chunk.size());
+    out.write((const char*)bin_header, sizeof(bin_header));
+    out.write(bin.data(), bin.size());
+    return bool(out);
+}
+
+/*
+ * Largest difference between the vertex attributes of two meshes with the
+ * same indices (after splitting the quads of ref for the triangle
+ * meshes), or -1 if the counts or indices differ
+ */
+float importError(const Mesh_Data& mesh, const Mesh_Data& ref)
+{
+    vector<uint> ref_idx;
+    if (mesh.quad_count > 0) {
+        ref_idx.assign(ref.q_idx_array, ref.q_idx_array + ref.q_idx.count);
+    } else if (ref.quad_count > 0) {
+        for (int q = 0; q < ref.quad_count; ++q) {
+            const uint* quad = &ref.q_idx_array[4 * q];
+            uint split[6] = {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]};
+            ref_idx.insert(ref_idx.end(), split, split + 6);
+        }
+    } else {
+        ref_idx.assign(ref.t_idx_array, ref.t_idx_array + ref.t_idx.count);
+    }
+    const uint* idx = (mesh.quad_count > 0) ? mesh.q_idx_array
+                                            : mesh.t_idx_array;
+    size_t idx_count = (mesh.quad_count > 0) ? mesh.q_idx.count
+                                             : mesh.t_idx.count;
+    if (mesh.v.count != ref.v.count || idx_count != ref_idx.size()
+        || !std::equal(ref_idx.begin(), ref_idx.end(), idx))
+        return -1.0f;
+    float error = 0.0f;
+    for (uint i = 0; i < mesh.v.count; ++i) {
+        const Vertex& a = mesh.v_array[i];
+        const Vertex& b = ref.v_array[i];
+        error = std::max(error, glm::compMax(glm::abs(a.p - b.p)));
+        error = std::max(error, glm::compMax(glm::abs(a.n - b.n)));
+        error = std::max(error, glm::compMax(glm::abs(a.uv - b.uv)));
+    }
+    return error;
+}
+
+/*
+ * Round trip of each .obj through binary .ply files (little and big endian)
+ * and .glb files (16 bit indices when they fit, and 32 bit): import time
+ * against meshutils::ParseObj, and largest attribute difference with the
+ * parsed mesh. The files are parsed with axis 1, their vertices already
+ * went through the axis conversion of ParseObj
+ */
+bool benchImport()
+{
+    struct Format { const char* name; const char* extension; int option; };
+    const Format formats[] = {
+        {"ply LE", ".ply", 0}, {"ply BE", ".ply", 1},
+        {"glb u16", ".glb", 16}, {"glb u32", ".glb", 32}
+    };
+    bool ok = true;
+    LOG("%-24s %-8s %8s %10s %12s %8s %10s\n", "mesh", "format", "MB",
+        "import ms", "ParseObj ms", "speedup", "max error");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data ref = {};
+        Clock::time_point t0 = Clock::now();
+        for (int k = 0; k < settings.updates; ++k) {
+            ref.FreeArrays();
+            ref = {};
+            meshutils::ParseObj(name, 0, &ref);
+        }
+        double parse_ms = msSince(t0) / settings.updates;
+        if (ref.v.count == 0) {
+            LOG("ERROR: cannot parse %s\n", name.c_str());
+            return false;
+        }
+        for (const Format& format : formats) {
+            if (format.option == 16 && ref.v.count > 65536)
+                continue;
+            string path = string("cpu_bench_import") + format.extension;
+            bool written = (format.extension[1] == 'p')
+                         ? writePly(path, ref, format.option == 1)
+                         : writeGlb(path, ref, format.option);
+            uint64_t hash, size = 0;
+            meshutils::HashFile(path, hash, size);
+            Mesh_Data mesh = {};
+            bool imported = written;
+            t0 = Clock::now();
+            for (int k = 0; imported && k < settings.updates; ++k) {
+                mesh.FreeArrays();
+                mesh = {};
+                imported = meshutils::ParseMeshFile(path, 1, &mesh);
+            }
+            double ms = msSince(t0) / settings.updates;
+            float error = imported ? importError(mesh, ref) : -1.0f;
+            bool same = error >= 0.0f && error < 1e-5f;
+            ok &= same;
+            LOG("%-24s %-8s %8.2f %10.3f %12.3f %7.2fx %10s\n", name.c_str(),
+                format.name, size / double(1 << 20), ms, parse_ms,
+                parse_ms / ms, same ? std::to_string(error).c_str() : "NO");
+            mesh.FreeArrays();
+            std::remove(path.c_str());
+        }
+        ref.FreeArrays();
+    }
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Fetch locality benchmark
+///
+
+/*
+ * ms per update of the converged BinTreeCPU (one thread, camera of
+ * benchUpdate moved back by pull_back along its view direction), and its key
+ * count
+ */
+double timeConvergedUpdate(const Mesh_Data& mesh_data, int polygon_type,
+                           size_t& key_count, float pull_back = 0.0f)
+{
+    CameraManager cam;
+    cam.Init(MESH);
+    cam.fb_width = cam.fb_height = settings.res;
+    cam.Position -= pull_back * cam.Direction;
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    BinTreeCPU::Params params = defaultParams(settings, cam, mesh_data);
+
+    BinTreeCPU bintree;
+    bintree.SetThreadCount(1);
+    bintree.Init(&mesh_data, polygon_type);
+    convergeCpuTree(bintree, transforms.GetBlock(), params);
+    key_count = bintree.GetFullNodes().size();
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < settings.updates; ++i)
+        bintree.Update(transforms.GetBlock(), params);
+    return msSince(t0) / settings.updates;
+}
+
+/*
+ * Locality of the vertex fetches in file order and after
+ * meshutils::ReorderForLocality, reordering time, and update time of the
+ * converged CPU bintree on both
+ */
+bool benchLocality()
+{
+    LOG("%-24s %-8s %10s %12s %10s %12s %10s %10s\n", "mesh", "order",
+        "FIFO32 miss", "stride B", "step", "reorder ms", "ms/update",
+        "keys");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data = {};
+        if (!meshutils::ParseMeshFile(name, 0, &mesh_data))
+            return false;
+        Mesh::reorderIndices(mesh_data.t_idx_array, mesh_data.v_array,
+                             mesh_data.t_idx.count);
+        int polygon_type = (mesh_data.triangle_count > 0) ? TRIANGLES : QUADS;
+        size_t key_count[2];
+        for (int sorted = 0; sorted < 2; ++sorted) {
+            double reorder_ms = 0.0;
+            if (sorted) {
+                Clock::time_point t0 = Clock::now();
+                meshutils::ReorderForLocality(&mesh_data);
+                reorder_ms = msSince(t0);
+            }
+            meshutils::LocalityStats stats =
+                meshutils::MeasureLocality(mesh_data);
+            double ms = timeConvergedUpdate(mesh_data, polygon_type,
+                                            key_count[sorted]);
+            char reorder[32] = "-";
+            if (sorted)
+                snprintf(reorder, sizeof(reorder), "%.3f", reorder_ms);
+            LOG("%-24s %-8s %10.3f %12.1f %10.2f %12s %10.3f %10zu\n",
+                name.c_str(), sorted ? "morton" : "file", stats.acmr,
+                stats.stride, stats.step, reorder, ms, key_count[sorted]);
+        }
+        if (key_count[0] != key_count[1]) {
+            LOG("  (the key counts differ by the cull tests of polygons "
+                "that moved)\n");
+        }
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Vertex format benchmark
+///
+
+/*
+ * Size of the float and quantized vertices (VERTEX_QUANTIZED), vertex bytes
+ * fetched by one cull pass of the converged tree (3 vertices per key),
+ * quantization time and largest errors against the float vertices
+ */
+bool benchVertexFormat()
+{
+    LOG("%-24s %-10s %8s %10s %12s %10s %12s %10s %10s\n", "mesh", "format",
+        "B/vertex", "buffer KB", "MB/pass", "encode ms", "pos (edges)",
+        "normal deg", "uv");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(name, mesh_data, polygon_type))
+            return false;
+        size_t key_count;
+        timeConvergedUpdate(mesh_data, polygon_type, key_count);
+
+        meshutils::QuantizedBox box;
+        vector<meshutils::QuantizedVertex> vertices;
+        Clock::time_point t0 = Clock::now();
+        for (int k = 0; k < settings.updates; ++k)
+            meshutils::QuantizeVertices(mesh_data, box, vertices,
+                                        settings.threads);
+        double encode_ms = msSince(t0) / settings.updates;
+        meshutils::QuantizationError error =
+            meshutils::MeasureQuantization(mesh_data, box, vertices);
+
+        size_t sizes[2] = {sizeof(Vertex), sizeof(meshutils::QuantizedVertex)};
+        for (int q = 0; q < 2; ++q) {
+            double buffer_kb = (mesh_data.v.count * sizes[q]
+                                + (q ? sizeof(box) : 0)) / 1024.0;
+            double pass_mb = key_count * 3.0 * sizes[q] / (1024.0 * 1024.0);
+            if (q) {
+                LOG("%-24s %-10s %8zu %10.1f %12.3f %10.3f %12.2e %10.4f "
+                    "%10.2e\n", name.c_str(), "quantized", sizes[q],
+                    buffer_kb, pass_mb, encode_ms, error.position,
+                    error.normal, error.uv);
+            } else {
+                LOG("%-24s %-10s %8zu %10.1f %12.3f %10s %12s %10s %10s\n",
+                    name.c_str(), "float", sizes[q], buffer_kb, pass_mb, "-",
+                    "-", "-", "-");
+            }
+        }
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// LoD scale benchmark
+///
+
+// Screen space error of the drawn leaves of a converged tree
+struct LeafError {
+    size_t keys = 0;
+    size_t drawn = 0;
+    float edge_mean = 0.0f;  // Longest projected leaf edge (px)
+    float edge_p95 = 0.0f;
+    float chord_mean = 0.0f; // Chord error of the curved surface (px)
+    float chord_p95 = 0.0f;
+    double converge_ms = 0.0; // Updates until the tree is stable
+};
+
+float percentile95(vector<float>& values)
+{
+    if (values.empty())
+        return 0.0f;
+    size_t k = (values.size() * 95) / 100;
+    k = std::min(k, values.size() - 1);
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+/*
+ * Converges the CPU bintree of the default mesh camera for an edge target
+ * and the LoD scales (NULL for LOD_SCALE_GLOBAL), and measures its drawn
+ * leaves: the longest projected edge e and the chord error e * angle / 8 of
+ * an arc of that length turning by the largest angle between the normals
+ * interpolated at the leaf corners, which is what the flat leaf misses of
+ * the surface
+ * In TERRAIN mode, the leaves of the displaced terrain are measured from
+ * the default terrain camera
+ */
+LeafError measureLeafError(const Mesh_Data& mesh_data, int polygon_type,
+                           float edge, const float* lod_scales,
+                           uint mode = MESH, int lod_metric = LOD_DISTANCE)
+{
+    const float DISPLACE_FACTOR = 0.3f;
+    CameraManager cam;
+    cam.Init(mode);
+    cam.fb_width = cam.fb_height = settings.res;
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    BenchSettings leaf_settings = settings;
+    leaf_settings.edge = edge;
+    BinTreeCPU::Params params = defaultParams(leaf_settings, cam, mesh_data);
+    params.displace_on = (mode == TERRAIN);
+    params.displace_factor = DISPLACE_FACTOR;
+    params.lod_scales = lod_scales;
+    params.lod_projected = (lod_metric == LOD_PROJECTED);
+    params.target_length = edge;
+    params.cpu_lod = 2;
+
+    BinTreeCPU bintree;
+    bintree.SetThreadCount(settings.threads);
+    bintree.Init(&mesh_data, polygon_type);
+    Clock::time_point t0 = Clock::now();
+    convergeCpuTree(bintree, transforms.GetBlock(), params);
+    double converge_ms = msSince(t0);
+
+    const mat4& MVP = transforms.GetBlock().MVP;
+    const vector<RenderRecord>& records = bintree.GetRenderRecords();
+    const vec2 corners[3] = {vec2(0, 0), vec2(1, 0), vec2(0, 1)};
+    vector<float> edges, chords;
+    edges.reserve(records.size());
+    chords.reserve(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        const RenderRecord& r = records[i];
+        ltree::Triangle t;
+        ltree::lt_getIndexedTriangle(
+                    mesh_data, uvec3(r.vertexID[0], r.vertexID[1],
+                                     r.vertexID[2]), t);
+        glm::mat3x2 xform(r.xform[0], r.xform[1], r.xform[2]);
+        vec2 screen[3];
+        vec3 normal[3];
+        bool visible = true;
+        for (int k = 0; k < 3; ++k) {
+            vec2 uv = xform * vec3(corners[k], 1);
+            vec3 p = vec3(ltree::lt_mapTo3DTriangle(t, uv));
+            if (params.displace_on)
+                p = noise::displaceVertex(p, transforms.GetBlock().cam_pos,
+                                          DISPLACE_FACTOR);
+            vec4 clip = MVP * vec4(p, 1);
+            visible = visible && (clip.w > 0.0f);
+            screen[k] = vec2(clip) / clip.w * (settings.res / 2.0f);
+            normal[k] = (1.0f - uv.x - uv.y) * vec3(t.vertex[0].n)
+                      + uv.x * vec3(t.vertex[2].n)
+                      + uv.y * vec3(t.vertex[1].n);
+        }
+        if (!visible)
+            continue;
+        float e = 0.0f, angle = 0.0f;
+        for (int a = 0; a < 3; ++a) {
+            int b = (a + 1) % 3;
+            e = std::max(e, glm::distance(screen[a], screen[b]));
+            if (normal[a] == vec3(0) || normal[b] == vec3(0))
+                continue;
+            angle = std::max(angle, std::atan2(
+                                 glm::length(glm::cross(normal[a], normal[b])),
+                                 glm::dot(normal[a], normal[b])));
+        }
+        edges.push_back(e);
+        chords.push_back(e * angle / 8.0f);
+    }
+
+    LeafError error;
+    error.keys = bintree.GetFullNodes().size();
+    error.drawn = edges.size();
+    for (size_t i = 0; i < edges.size(); ++i) {
+        error.edge_mean += edges[i];
+        error.chord_mean += chords[i];
+    }
+    error.edge_mean /= std::max(edges.size(), size_t(1));
+    error.chord_mean /= std::max(chords.size(), size_t(1));
+    error.edge_p95 = percentile95(edges);
+    error.chord_p95 = percentile95(chords);
+    error.converge_ms = converge_ms;
+    return error;
+}
+
+void logLeafError(const string& name, const char* lod_scale, float edge,
+                  const LeafError& error)
+{
+    LOG("%-24s %-14s %8.3f %10zu %10zu %9.2f %9.2f %10.4f %10.4f\n",
+        name.c_str(), lod_scale, edge, error.keys, error.drawn,
+        error.edge_mean, error.edge_p95, error.chord_mean, error.chord_p95);
+}
+
+/*
+ * Drawn leaves and screen space error of the global LoD and of the per
+ * polygon LoD scales (meshutils::ComputeLodScales), then the edge target of
+ * the global LoD that gives the same 95th percentile error as each of the
+ * scaled ones, found by bisection: the triangle counts at equal visual error.
+ * The error is the chord error, or the projected edge for meshes without
+ * normals
+ */
+bool benchLodScale()
+{
+    LOG("%-24s %-14s %8s %10s %10s %9s %9s %10s %10s\n", "mesh", "lod scale",
+        "edge px", "keys", "drawn", "edge", "edge p95", "chord", "chord p95");
+    const char* names[NUM_LOD_SCALES] = {"global", "edge", "curvature"};
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(name, mesh_data, polygon_type))
+            return false;
+        vector<meshutils::PolygonLodStats> stats;
+        Clock::time_point t0 = Clock::now();
+        meshutils::ComputePolygonLodStats(mesh_data, polygon_type, stats);
+        vector<float> scales[NUM_LOD_SCALES];
+        for (int mode = LOD_SCALE_EDGE; mode < NUM_LOD_SCALES; ++mode)
+            meshutils::ComputeLodScales(stats, mesh_data.avg_e_length, true,
+                                        mode == LOD_SCALE_CURVATURE,
+                                        scales[mode]);
+        double scales_ms = msSince(t0);
+
+        LeafError errors[NUM_LOD_SCALES];
+        for (int mode = 0; mode < NUM_LOD_SCALES; ++mode) {
+            errors[mode] = measureLeafError(
+                        mesh_data, polygon_type, settings.edge,
+                        mode ? scales[mode].data() : NULL);
+            logLeafError(name, names[mode], settings.edge, errors[mode]);
+        }
+        bool chord = (errors[LOD_SCALE_GLOBAL].chord_p95 > 0.0f);
+        for (int mode = LOD_SCALE_EDGE; mode < NUM_LOD_SCALES; ++mode) {
+            float target = chord ? errors[mode].chord_p95
+                                 : errors[mode].edge_p95;
+            // The error grows with the edge target
+            float lo = settings.edge / 16.0f, hi = settings.edge * 16.0f;
+            LeafError error;
+            for (int k = 0; k < 20; ++k) {
+                float edge = std::sqrt(lo * hi);
+                error = measureLeafError(mesh_data, polygon_type, edge, NULL);
+                float value = chord ? error.chord_p95 : error.edge_p95;
+                if (value > target)
+                    hi = edge;
+                else
+                    lo = edge;
+            }
+            error = measureLeafError(mesh_data, polygon_type, lo, NULL);
+            string label = string("global=") + names[mode];
+            logLeafError(name, label.c_str(), lo, error);
+            LOG("  %s at equal %s error: %zu drawn instead of %zu (%.1f%%)\n",
+                names[mode], chord ? "chord" : "edge", errors[mode].drawn,
+                error.drawn, 100.0 * (double(errors[mode].drawn)
+                                      / std::max(error.drawn, size_t(1))
+                                      - 1.0));
+        }
+        LOG("  LoD scales of %zu polygons: %.3f ms\n", stats.size(),
+            scales_ms);
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+/*
+ * Drawn leaves and projected edge error of the distance based LoD and of
+ * the projected edge LoD (FLAG_LOD_PROJECTED) for the same edge target,
+ * then the edge target of the distance based LoD that gives the same 95th
+ * percentile error as the projected one, found by bisection: the triangle
+ * counts at equal pixel error. On the displaced terrain, seen at a grazing
+ * angle, and on the meshes
+ */
+bool benchLodMetric()
+{
+    LOG("%-24s %-14s %8s %10s %10s %9s %9s %10s %10s\n", "mesh", "lod metric",
+        "edge px", "keys", "drawn", "edge", "edge p95", "chord", "chord p95");
+    const char* names[NUM_LOD_METRICS] = {"distance", "projected"};
+    for (size_t i = 0; i <= settings.files.size(); ++i) {
+        // The terrain first
+        uint mode = (i == 0) ? TERRAIN : MESH;
+        string name = (i == 0) ? "terrain" : settings.files[i - 1];
+        Mesh_Data mesh_data = {};
+        int polygon_type = TRIANGLES;
+        if (mode == TERRAIN) {
+            meshutils::LoadGrid(&mesh_data);
+            Mesh::reorderIndices(mesh_data.t_idx_array, mesh_data.v_array,
+                                 mesh_data.t_idx.count);
+        } else if (!loadMesh(name, mesh_data, polygon_type)) {
+            return false;
+        }
+
+        LeafError errors[NUM_LOD_METRICS];
+        for (int metric = 0; metric < NUM_LOD_METRICS; ++metric) {
+            errors[metric] = measureLeafError(mesh_data, polygon_type,
+                                              settings.edge, NULL, mode,
+                                              metric);
+            logLeafError(name, names[metric], settings.edge, errors[metric]);
+        }
+        // The error grows with the edge target
+        float target = errors[LOD_PROJECTED].edge_p95;
+        float lo = settings.edge / 16.0f, hi = settings.edge * 16.0f;
+        LeafError error;
+        for (int k = 0; k < 20; ++k) {
+            float edge = std::sqrt(lo * hi);
+            error = measureLeafError(mesh_data, polygon_type, edge, NULL, mode,
+                                     LOD_DISTANCE);
+            if (error.edge_p95 > target)
+                hi = edge;
+            else
+                lo = edge;
+        }
+        error = measureLeafError(mesh_data, polygon_type, lo, NULL, mode,
+                                 LOD_DISTANCE);
+        logLeafError(name, "distance=proj", lo, error);
+        LOG("  projected at equal edge error: %zu drawn instead of %zu "
+            "(%.1f%%)\n", errors[LOD_PROJECTED].drawn, error.drawn,
+            100.0 * (double(errors[LOD_PROJECTED].drawn)
+                     / std::max(error.drawn, size_t(1)) - 1.0));
+        LOG("  updates until stable: %.1f ms (distance), %.1f ms "
+            "(projected)\n", errors[LOD_DISTANCE].converge_ms,
+            errors[LOD_PROJECTED].converge_ms);
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Base mesh benchmark
+///
+
+/*
+ * Simplification of the input mesh into cages of 1/4, 1/16 and 1/64 of its
+ * triangles (meshutils::SimplifyMesh) and their base maps
+ * (meshutils::BuildBaseMap): build times, map size and distance of the mapped
+ * cage to the input surface, then roots, converged keys and update time at
+ * the default camera and at a far one, where the input mesh is subdivided
+ * far less than its root count
+ */
+bool benchBaseMesh()
+{
+    const float FAR_PULL_BACK = 32.0f;
+    LOG("%-24s %6s %8s %10s %10s %9s %10s %10s %10s %10s %10s %10s\n",
+        "mesh", "ratio", "roots", "simplify", "map ms", "map KB",
+        "err mean", "err max", "keys", "ms/update", "far keys",
+        "far ms");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(name, mesh_data, polygon_type))
+            return false;
+        uint input_count = (polygon_type == TRIANGLES)
+                         ? mesh_data.triangle_count : 2 * mesh_data.quad_count;
+        for (uint ratio = 1; ratio <= 64; ratio *= 4) {
+            Mesh_Data base = {};
+            const Mesh_Data* mesh = &mesh_data;
+            int mesh_type = polygon_type;
+            double simplify_ms = 0.0, map_ms = 0.0;
+            meshutils::BaseMapError error;
+            if (ratio > 1) {
+                Clock::time_point t0 = Clock::now();
+                if (!meshutils::SimplifyMesh(mesh_data, polygon_type,
+                                             input_count / ratio, &base)) {
+                    LOG("ERROR when simplifying %s\n", name.c_str());
+                    return false;
+                }
+                Mesh::reorderIndices(base.t_idx_array, base.v_array,
+                                     base.t_idx.count);
+                meshutils::ReorderForLocality(&base);
+                simplify_ms = msSince(t0);
+                t0 = Clock::now();
+                meshutils::BuildBaseMap(
+                            mesh_data, polygon_type,
+                            meshutils::BaseMapResolution(
+                                float(input_count) / base.triangle_count),
+                            &base, settings.threads);
+                map_ms = msSince(t0);
+                error = meshutils::MeasureBaseMap(mesh_data, polygon_type,
+                                                  base, settings.threads);
+                mesh = &base;
+                mesh_type = TRIANGLES;
+            }
+            size_t keys, far_keys;
+            double ms = timeConvergedUpdate(*mesh, mesh_type, keys);
+            double far_ms = timeConvergedUpdate(*mesh, mesh_type, far_keys,
+                                                FAR_PULL_BACK);
+            uint roots = (mesh_type == TRIANGLES) ? mesh->triangle_count
+                                                  : 2 * mesh->quad_count;
+            char label[16];
+            snprintf(label, sizeof(label), "1/%u", ratio);
+            double map_kb = base.base_map_array.size()
+                          * sizeof(BaseMapSample) / 1024.0;
+            LOG("%-24s %6s %8u %10.3f %10.3f %9.1f %10.4f %10.4f %10zu "
+                "%10.3f %10zu %10.3f\n", name.c_str(), label, roots,
+                simplify_ms, map_ms, map_kb, error.mean, error.max, keys, ms,
+                far_keys, far_ms);
+            base.FreeArrays();
+        }
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Root culling benchmark
+///
+
+// Converged tree of one view, with or without the root BVH
+struct RootCullRun {
+    size_t visible_roots;
+    size_t keys;
+    size_t drawn;
+    double update_ms;   // Per update, root BVH walk included
+    double walk_ms;     // Per walk of the root BVH
+};
+
+/*
+ * Converges the CPU bintree for a camera, the roots outside the frustum
+ * collapsed when bvh is not NULL, and times its updates (one thread)
+ */
+RootCullRun runRootCull(const Mesh_Data& mesh_data, int polygon_type,
+                        CameraManager& cam,
+                        const vector<meshutils::RootBvhNode>* bvh)
+{
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    const TransformBlock& block = transforms.GetBlock();
+    BinTreeCPU::Params params = defaultParams(settings, cam, mesh_data);
+    vector<uint> visible;
+
+    // The camera does not move: one walk of the BVH holds for every update
+    RootCullRun run = {};
+    if (bvh) {
+        run.visible_roots = meshutils::CullRootBvh(
+                    *bvh, block.frustum_planes, 0.0f, visible);
+        params.root_visibility = visible.data();
+    }
+    BinTreeCPU bintree;
+    bintree.SetThreadCount(1);
+    bintree.Init(&mesh_data, polygon_type);
+    convergeCpuTree(bintree, block, params);
+    run.keys = bintree.GetFullNodes().size();
+    run.drawn = bintree.GetCulledCount();
+    if (!bvh)
+        run.visible_roots = (polygon_type == TRIANGLES)
+                          ? mesh_data.triangle_count : 2 * mesh_data.quad_count;
+
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < settings.updates; ++i) {
+        if (bvh)
+            meshutils::CullRootBvh(*bvh, block.frustum_planes, 0.0f, visible);
+        bintree.Update(block, params);
+    }
+    run.update_ms = msSince(t0) / settings.updates;
+    if (bvh) {
+        const int WALKS = 100;
+        t0 = Clock::now();
+        for (int i = 0; i < WALKS; ++i)
+            meshutils::CullRootBvh(*bvh, block.frustum_planes, 0.0f, visible);
+        run.walk_ms = msSince(t0) / WALKS;
+    }
+    return run;
+}
+
+/*
+ * Keys, drawn nodes and update time of the converged CPU bintree with and
+ * without the root BVH (FLAG_ROOT_CULL), for the default mesh camera, a
+ * close up view, a view turned 25 degrees to the side and one turned away
+ * from the mesh. The drawn nodes must not change
+ */
+bool benchRootCull()
+{
+    LOG("%-24s %-8s %-4s %10s %10s %10s %10s %10s\n", "mesh", "view", "bvh",
+        "roots", "keys", "drawn", "ms/update", "walk ms");
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(name, mesh_data, polygon_type))
+            return false;
+        vector<meshutils::RootBvhNode> bvh;
+        Clock::time_point t0 = Clock::now();
+        meshutils::BuildRootBvh(mesh_data, polygon_type, bvh);
+        double build_ms = msSince(t0);
+
+        const char* views[] = {"default", "close", "side", "away"};
+        for (int view = 0; view < 4; ++view) {
+            CameraManager cam;
+            cam.Init(MESH);
+            cam.fb_width = cam.fb_height = settings.res;
+            if (view == 1) {
+                cam.Position += 1.4f * cam.Direction;
+            } else if (view > 1) {
+                float yaw = (view == 2) ? 25.0f : 180.0f;
+                cam.ProcessMouseLeft(yaw / cam.look_sensitivity, 0.0f);
+            }
+            RootCullRun runs[2];
+            for (int on = 0; on < 2; ++on) {
+                runs[on] = runRootCull(mesh_data, polygon_type, cam,
+                                       on ? &bvh : NULL);
+                char walk[32] = "-";
+                if (on)
+                    snprintf(walk, sizeof(walk), "%.4f", runs[on].walk_ms);
+                LOG("%-24s %-8s %-4s %10zu %10zu %10zu %10.3f %10s\n",
+                    name.c_str(), views[view], on ? "on" : "off",
+                    runs[on].visible_roots, runs[on].keys, runs[on].drawn,
+                    runs[on].update_ms, walk);
+            }
+            if (runs[0].drawn != runs[1].drawn) {
+                LOG("ERROR: the root BVH changed the drawn nodes\n");
+                return false;
+            }
+        }
+        LOG("  Root BVH of %s: %zu nodes, %.3f ms\n", name.c_str(),
+            bvh.size(), build_ms);
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Fly-through benchmark
+///
+
+// Statistics of one flight, over its frames
+struct FlightRun {
+    double mean_keys;
+    size_t max_keys;
+    double mean_drawn;
+    double update_ms;   // Mean over the frames
+    double max_ms;
+    double drawn_diff;  // Mean of |drawn - reference drawn| / reference drawn
+};
+
+/*
+ * Flies the terrain camera of the demo forward over the grid while sweeping
+ * its yaw 60 degrees to each side, one update of the CPU bintree per frame
+ * like the demo, after converging at the start of the flight. The drawn
+ * counts of each frame are stored in drawn when reference is set, else
+ * compared to them
+ */
+FlightRun runFlight(const Mesh_Data& mesh_data, bool cull_refine_on,
+                    int cull_floor, vector<size_t>& drawn, bool reference)
+{
+    const int FRAMES = 240;
+    const float DISTANCE = 6.0f, YAW_SWEEP = 60.0f;
+    CameraManager cam;
+    cam.Init(TERRAIN);
+    cam.fb_width = cam.fb_height = settings.res;
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    vec3 start = cam.Position;
+    vec3 forward = glm::normalize(vec3(cam.Direction.x, cam.Direction.y, 0));
+    float start_yaw = cam.Yaw;
+
+    BinTreeCPU::Params params = defaultParams(settings, cam, mesh_data);
+    params.displace_on = true;
+    params.displace_factor = 0.3f;
+    params.cull_refine_on = cull_refine_on;
+    params.cull_floor = cull_floor;
+
+    BinTreeCPU bintree;
+    bintree.SetThreadCount(1);
+    bintree.Init(&mesh_data, TRIANGLES);
+    convergeCpuTree(bintree, transforms.GetBlock(), params);
+
+    FlightRun run = {};
+    if (reference)
+        drawn.resize(FRAMES);
+    for (int f = 0; f < FRAMES; ++f) {
+        float t = float(f) / float(FRAMES - 1);
+        float yaw = start_yaw + YAW_SWEEP * sin(2.0f * glm::pi<float>() * t);
+        cam.ProcessMouseLeft((yaw - cam.Yaw) / cam.look_sensitivity, 0.0f);
+        cam.Position = start + (DISTANCE * t) * forward;
+        transforms.UpdateForNewView(cam);
+
+        Clock::time_point t0 = Clock::now();
+        bintree.Update(transforms.GetBlock(), params);
+        double ms = msSince(t0);
+        size_t keys = bintree.GetFullNodes().size();
+        size_t frame_drawn = bintree.GetCulledCount();
+        run.mean_keys += double(keys) / FRAMES;
+        run.max_keys = std::max(run.max_keys, keys);
+        run.mean_drawn += double(frame_drawn) / FRAMES;
+        run.update_ms += ms / FRAMES;
+        run.max_ms = std::max(run.max_ms, ms);
+        if (reference)
+            drawn[f] = frame_drawn;
+        else
+            run.drawn_diff += fabs(double(frame_drawn) - double(drawn[f]))
+                            / double(drawn[f]) / FRAMES;
+    }
+    return run;
+}
+
+/*
+ * Flights over the displaced terrain without and with the cull-aware
+ * refinement (FLAG_CULL_REFINE) at a few floor levels. A node entering the
+ * frustum below its usual level takes a few frames to refine, which shows
+ * as a difference with the drawn nodes of the flight without it
+ */
+bool benchFlythrough()
+{
+    Mesh_Data mesh_data = {};
+    meshutils::LoadGrid(&mesh_data);
+    Mesh::reorderIndices(mesh_data.t_idx_array, mesh_data.v_array,
+                         mesh_data.t_idx.count);
+
+    LOG("Terrain fly-through, %dpx, %.2fpx edges, 240 frames\n",
+        settings.res, settings.edge);
+    LOG("%-12s %10s %10s %10s %10s %10s %10s\n", "refine", "mean keys",
+        "max keys", "mean drawn", "drawn diff", "ms/update", "max ms");
+    vector<size_t> drawn;
+    const int floors[] = {-1, 0, 4, 8};
+    for (int i = 0; i < 4; ++i) {
+        bool on = (floors[i] >= 0);
+        FlightRun run = runFlight(mesh_data, on, floors[i], drawn, !on);
+        char name[32] = "off";
+        if (on)
+            snprintf(name, sizeof(name), "floor %d", floors[i]);
+        LOG("%-12s %10.0f %10zu %10.0f %9.2f%% %10.3f %10.3f\n", name,
+            run.mean_keys, run.max_keys, run.mean_drawn,
+            100.0 * run.drawn_diff, run.update_ms, run.max_ms);
+    }
+    mesh_data.FreeArrays();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Backface culling benchmark
+///
+
+// Converged tree of one view, with or without the normal cones
+struct BackfaceRun {
+    size_t keys;
+    size_t drawn;
+    double update_ms;
+};
+
+/*
+ * Converges the CPU bintree for a camera, the back-facing nodes culled and
+ * capped at the default floor level when cones is not NULL, and times its
+ * updates (one thread)
+ */
+BackfaceRun runBackface(const Mesh_Data& mesh_data, int polygon_type,
+                        CameraManager& cam,
+                        const vector<itpl::NormalCone>* cones)
+{
+    TransformsManager transforms;
+    transforms.SetUp(cam);
+    BinTreeCPU::Params params = defaultParams(settings, cam, mesh_data);
+    params.cull_floor = 4;
+    params.normal_cones = cones ? cones->data() : NULL;
+
+    BinTreeCPU bintree;
+    bintree.SetThreadCount(1);
+    bintree.Init(&mesh_data, polygon_type);
+    convergeCpuTree(bintree, transforms.GetBlock(), params);
+
+    BackfaceRun run = {};
+    run.keys = bintree.GetFullNodes().size();
+    run.drawn = bintree.GetCulledCount();
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < settings.updates; ++i)
+        bintree.Update(transforms.GetBlock(), params);
+    run.update_ms = msSince(t0) / settings.updates;
+    return run;
+}
+
+/*
+ * Keys, drawn nodes and update time of the converged CPU bintree without
+ * and with the normal cone test (FLAG_BACKFACE), for the cones of the
+ * linear, PN and Phong surfaces, at the default mesh camera and a close up
+ * view. The test can only remove nodes
+ */
+bool benchBackface()
+{
+    LOG("%-24s %-8s %-8s %10s %10s %10s %10s\n", "mesh", "view", "cones",
+        "cullable", "keys", "drawn", "ms/update");
+    const char* itpl_names[] = {"linear", "PN", "Phong"};
+    for (size_t i = 0; i < settings.files.size(); ++i) {
+        const string& name = settings.files[i];
+        Mesh_Data mesh_data;
+        int polygon_type;
+        if (!loadMesh(name, mesh_data, polygon_type))
+            return false;
+        vector<itpl::NormalCone> cones[3];
+        size_t cullable[3] = {0, 0, 0};
+        double build_ms[3];
+        for (int type = 0; type < 3; ++type) {
+            Clock::time_point t0 = Clock::now();
+            itpl::ComputeNormalCones(mesh_data, polygon_type, type,
+                                     cones[type]);
+            build_ms[type] = msSince(t0);
+            for (size_t c = 0; c < cones[type].size(); ++c)
+                if (cones[type][c].sin_angle < 1.0f)
+                    ++cullable[type];
+        }
+
+        const char* views[] = {"default", "close"};
+        for (int view = 0; view < 2; ++view) {
+            CameraManager cam;
+            cam.Init(MESH);
+            cam.fb_width = cam.fb_height = settings.res;
+            if (view == 1)
+                cam.Position += 1.4f * cam.Direction;
+            BackfaceRun off = runBackface(mesh_data, polygon_type, cam, NULL);
+            LOG("%-24s %-8s %-8s %10s %10zu %10zu %10.3f\n", name.c_str(),
+                views[view], "off", "-", off.keys, off.drawn, off.update_ms);
+            for (int type = 0; type < 3; ++type) {
+                BackfaceRun on = runBackface(mesh_data, polygon_type, cam,
+                                             &cones[type]);
+                LOG("%-24s %-8s %-8s %10zu %10zu %10zu %10.3f\n",
+                    name.c_str(), views[view], itpl_names[type],
+                    cullable[type], on.keys, on.drawn, on.update_ms);
+                if (on.drawn > off.drawn) {
+                    LOG("ERROR: the backface test added drawn nodes\n");
+                    return false;
+                }
+            }
+        }
+        LOG("  Normal cones of %s: %zu triangles, %.3f / %.3f / %.3f ms, "
+            "%zu boundary edges\n", name.c_str(), cones[0].size(),
+            build_ms[0], build_ms[1], build_ms[2],
+            meshutils::CountBoundaryEdges(mesh_data, polygon_type));
+        mesh_data.FreeArrays();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Main
+///
+
+int main(int argc, char** argv)
+{
+    string mode = "update";
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--res") && i + 1 < argc)
+            settings.res = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--edge") && i + 1 < argc)
+            settings.edge = float(atof(argv[++i]));
+        else if (!strcmp(argv[i], "--updates") && i + 1 < argc)
+            settings.updates = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            settings.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--keys") && i + 1 < argc)
+            settings.keys = std::max(1, atoi(argv[++i]));
+        else if (i == 1 && !strchr(argv[i], '.'))
+            mode = argv[i];
+        else
+            settings.files.push_back(argv[i]);
+    }
+    if (settings.files.empty()) {
+        settings.files.push_back("bigguy.obj");
+        settings.files.push_back((mode == "parse" || mode == "import")
+                                 ? "bunny.obj" : "tangle_cube.obj");
+    }
+
+    if (mode == "update") {
+        LOG("CPU update benchmark, %d hardware threads, %dpx, %.2fpx edges\n",
+            ThreadPool::HardwareThreadCount(), settings.res, settings.edge);
+        for (size_t i = 0; i < settings.files.size(); ++i)
+            benchUpdate(settings.files[i]);
+    } else if (mode == "keys") {
+        return benchKeys() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "key32") {
+        return benchKey32() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "xform") {
+        benchXform();
+    } else if (mode == "parse") {
+        return benchParse() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "import") {
+        return benchImport() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "locality") {
+        return benchLocality() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "vertex") {
+        return benchVertexFormat() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "lodscale") {
+        return benchLodScale() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "lodmetric") {
+        return benchLodMetric() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "basemesh") {
+        return benchBaseMesh() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "rootcull") {
+        return benchRootCull() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "flythrough") {
+        return benchFlythrough() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (mode == "backface") {
+        return benchBackface() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        LOG("Unknown benchmark: %s\n", mode.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,8 +1,13 @@
 #ifndef BINTREE_H
 #define BINTREE_H
 
+#include <chrono>
+
 #include "commands.h"
 #include "common.h"
+#include "bintree_cpu.h"
+#include "interpolation_cpu.h"
+#include "mesh_utils.h"
 
 class BinTree
 {
@@ -32,6 +37,32 @@ public:
         int itpl_type;    // Switch interpolation type
         float itpl_alpha; // Control interpolation factor
 
+        int backend;      // Switch between GPU and CPU update of the keys
+        int cpu_threads;  // Threads of the CPU backend, 0 for all cores
+
+        int node_budget_mb; // Memory budget of the node pool, in MB
+        int culled_list;    // Store the culled nodes as records or indices
+        int key_layout;     // Store the keys as uvec4 or packed in 12 bytes
+        int key_bits;       // 32 or 64 bit nodeIDs, or chosen from the depth
+        float near_plane;   // Closest camera distance, bounds the depth
+        int vertex_format;  // Mesh vertices as floats or quantized in 16 B
+        int lod_scale;      // LoD of all polygons from avg_e_length, or scaled
+                            // per polygon
+        int lod_metric;     // LoD from the distance to the nodes, or from the
+                            // projected length of their edges
+        bool root_cull_on;  // Collapse the roots outside the frustum (root
+                            // BVH), with cull_on
+        bool cull_refine_on; // Cap the level of the nodes outside the
+                             // frustum, with cull_on
+        bool backface_on;    // Skip the nodes facing away from the camera
+                             // (normal cones), with cull_on, not displace_on
+        bool occlusion_on;   // Skip the nodes hidden behind the depth of the
+                             // last frame (Hi-Z), with cull_on, GPU backend
+        int cull_floor;      // Deepest level of the culled nodes
+
+        int converge_mode;     // When to update until the tree is stable
+        int converge_max_iter; // Most updates of a converging frame
+
         void Upload(uint pid)
         {
             utility::SetUniformBool(pid, "u_uniform_subdiv", uniform_on);
@@ -42,25 +73,72 @@ public:
             utility::SetUniformInt(pid, "u_color_mode", color_mode);
             utility::SetUniformBool(pid, "u_render_MVP", MVP_on);
             utility::SetUniformInt(pid, "u_cpu_lod", cpu_lod);
+            utility::SetUniformInt(pid, "u_cull_floor", cull_floor);
 
             utility::SetUniformFloat(pid, "u_itpl_alpha", itpl_alpha);
         }
     } settings;
 
     uint full_node_count, drawn_node_count;
+    uint refused_split_count, dropped_node_count;
+    uint occluded_node_count = 0; // Hidden by the depth pyramid
+
+    // Time from the last reset of the tree (Init, Reinitialize, new uniform
+    // level...) to the first update that split and merged nothing
+    struct StableLatency {
+        bool stable;
+        int frames;     // Frames drawn, including the stable one
+        int updates;    // Updates run, more than frames when converging
+        double ms;      // Wall clock time
+    } stable_latency = {};
 
 private:
     CommandManager* commands_;
+    BinTreeCPU* cpu_bintree_;
 
     struct ssbo_indices {
         int read = 0;
         int write_full = 1;
-        int write_culled = 2;
     } ssbo_idx_;
 
     // Buffers and Arrays
-    GLuint nodes_bo_[3];
+    GLuint nodes_bo_[2];
+    GLuint culled_bo_ = 0;
+    vector<uvec3> packed_keys_; // Staging of the CPU keys with KEYS_PACKED
+
+    // nodeIDs of the programs: 32 bits (FLAG_KEY32) or 64 bits
+    bool key32_ = false;
+    // Uniforms set from outside, restored when the programs are rebuilt for
+    // another key size
+    uint mode_ = TERRAIN;
+    vec3 light_pos_;
+    bool light_pos_set_ = false; // Else keep the default of the shader
+    GLuint render_records_bo_ = 0;
     GLuint transfo_bo_;
+    GLuint xform_lut_bo_ = 0;
+    GLuint quantized_v_bo_ = 0; // Mesh vertices of VERTEX_QUANTIZED
+    GLuint patches_bo_ = 0;     // Coefficients of the PN or Phong patches
+    GLuint lod_scales_bo_ = 0;  // Per polygon LoD scales of FLAG_LOD_SCALE
+    vector<float> lod_scales_;  // Same, for the CPU backend
+    float min_lod_scale_ = 1.0f;
+    vector<meshutils::RootBvhNode> root_bvh_;
+    vector<uint> root_visible_;     // Visibility bits of FLAG_ROOT_CULL
+    GLuint root_visibility_bo_ = 0; // Same, for the compute pass
+    size_t visible_root_count_ = 0;
+    vec3 base_map_min_, base_map_max_; // Range of the base map offsets
+    vector<itpl::NormalCone> normal_cones_; // Cones of FLAG_BACKFACE
+    GLuint normal_cones_bo_ = 0;            // Same, for the compute pass
+    size_t boundary_edge_count_ = 0;
+    // Depth pyramid of FLAG_OCCLUSION, built after the render pass, and the
+    // viewport and transforms of the frame it was built from
+    GLuint hiz_depth_tex_ = 0;  // Copy of the depth of the viewport
+    GLuint hiz_tex_ = 0;        // Farthest depth under each texel, per level
+    glm::ivec2 hiz_size_ = glm::ivec2(0);
+    int hiz_levels_ = 0;
+    bool hiz_ready_ = false;    // Built since the last change of the settings
+    glm::ivec4 hiz_viewport_ = glm::ivec4(0);
+    mat4 hiz_mvp_, next_mvp_;   // Transforms of the pyramid, and of the update
+    bool view_moving_ = false;  // Transforms changed since the last update
 
     BufferCombo leaf_;
 
@@ -68,13 +146,31 @@ private:
     Mesh_Data* mesh_data_;
 
     //Programs
-    GLuint render_program_, compute_program_, copy_program_;
+    GLuint render_program_, compute_program_, copy_program_, init_program_;
+    GLuint hiz_program_ = 0;
 
     //Compute Shader parameters
     uvec3 wg_local_size_;
     uint wg_local_count_;
     uint init_node_count_, wg_init_global_count_;
     int max_node_count_;
+    int screen_res_;
+
+    // Level of the keys written by initNodesBuffers, and uniform level they
+    // were written for (-1 for the adaptive subdivision)
+    int init_level_ = 0;
+    int init_uniform_lvl_ = -1;
+    bool converge_pending_ = false;
+    bool measuring_latency_ = false;
+    std::chrono::steady_clock::time_point reset_time_;
+    static const int STABLE_LATENCY_MAX_FRAMES = 1024;
+
+    // Frame of an update whose change count is being read back
+    struct LatencySample {
+        int frames, updates;
+        std::chrono::steady_clock::time_point time;
+    };
+    vector<LatencySample> latency_samples_;
 
     djg_clock* compute_clock_;
     djg_clock* render_clock_;
@@ -92,6 +188,11 @@ private:
                                mesh_data_->quad_count);
         utility::SetUniformInt(compute_program_, "u_max_node_count",
                                max_node_count_);
+        meshutils::GetBaseMapBounds(*mesh_data_, base_map_min_, base_map_max_);
+        utility::SetUniformVec3(compute_program_, "u_base_map_min",
+                                base_map_min_);
+        utility::SetUniformVec3(compute_program_, "u_base_map_max",
+                                base_map_max_);
         settings.Upload(compute_program_);
     }
 
@@ -99,6 +200,8 @@ private:
     {
         utility::SetUniformInt(copy_program_, "u_num_vertices", leaf_.v.count);
         utility::SetUniformInt(copy_program_, "u_num_indices", leaf_.idx.count);
+        utility::SetUniformInt(copy_program_, "u_max_node_count",
+                               max_node_count_);
 
     }
 
@@ -132,6 +235,34 @@ private:
         djgp_push_string(djp, "#define NODECOUNTER_CULLED_B %i\n", NODECOUNTER_CULLED_B);
         djgp_push_string(djp, "#define LEAF_VERT_B %i\n", LEAF_VERT_B);
         djgp_push_string(djp, "#define LEAF_IDX_B %i\n", LEAF_IDX_B);
+        djgp_push_string(djp, "#define XFORM_LUT_B %i\n", XFORM_LUT_B);
+        djgp_push_string(djp, "#define RENDER_RECORDS_B %i\n", RENDER_RECORDS_B);
+        djgp_push_string(djp, "#define NODE_POOL_B %i\n", NODE_POOL_B);
+        djgp_push_string(djp, "#define PATCHES_B %i\n", PATCHES_B);
+        djgp_push_string(djp, "#define LOD_SCALES_B %i\n", LOD_SCALES_B);
+        djgp_push_string(djp, "#define BASE_MAP_B %i\n", BASE_MAP_B);
+        djgp_push_string(djp, "#define ROOT_VISIBILITY_B %i\n",
+                         ROOT_VISIBILITY_B);
+        djgp_push_string(djp, "#define NORMAL_CONES_B %i\n", NORMAL_CONES_B);
+        if (settings.culled_list == CULLED_INDICES)
+            djgp_push_string(djp, "#define FLAG_CULLED_INDICES 1\n");
+        if (settings.key_layout == KEYS_PACKED)
+            djgp_push_string(djp, "#define FLAG_KEY_PACKED 1\n");
+        if (key32_)
+            djgp_push_string(djp, "#define FLAG_KEY32 1\n");
+        if (settings.vertex_format == VERTEX_QUANTIZED)
+            djgp_push_string(djp, "#define FLAG_VERTEX_QUANTIZED 1\n");
+        if (settings.lod_scale != LOD_SCALE_GLOBAL)
+            djgp_push_string(djp, "#define FLAG_LOD_SCALE 1\n");
+        if (settings.lod_metric == LOD_PROJECTED)
+            djgp_push_string(djp, "#define FLAG_LOD_PROJECTED 1\n");
+        if (mesh_data_->base_map_res > 0) {
+            djgp_push_string(djp, "#define FLAG_BASE_MAP 1\n");
+            djgp_push_string(djp, "#define BASE_MAP_RES %u\n",
+                             mesh_data_->base_map_res);
+        }
+        if (LT_XFORM_LUT_BITS > 0)
+            djgp_push_string(djp, "#define FLAG_XFORM_LUT %i\n", LT_XFORM_LUT_BITS);
 
         djgp_push_string(djp, "#define MESH_V_B %i\n", MESH_V_B);
         djgp_push_string(djp, "#define MESH_Q_IDX_B %i\n", MESH_Q_IDX_B);
@@ -145,6 +276,7 @@ private:
 
     bool loadComputeProgram()
     {
+        loadNormalConeBuffer();
         cout << "Bintree - Loading Compute Program... ";
         if (!glIsProgram(compute_program_))
             compute_program_ = 0;
@@ -152,6 +284,14 @@ private:
         pushMacrosToProgram(djp);
         if(settings.cull_on)
             djgp_push_string(djp, "#define FLAG_CULL 1\n");
+        if (rootCullOn())
+            djgp_push_string(djp, "#define FLAG_ROOT_CULL 1\n");
+        if (settings.cull_on && settings.cull_refine_on)
+            djgp_push_string(djp, "#define FLAG_CULL_REFINE 1\n");
+        if (backfaceOn())
+            djgp_push_string(djp, "#define FLAG_BACKFACE 1\n");
+        if (occlusionOn())
+            djgp_push_string(djp, "#define FLAG_OCCLUSION 1\n");
         char buf[1024];
         if (settings.displace_on) {
             djgp_push_file(djp, strcat2(buf, shader_dir, "gpu_noise_lib.glsl"));
@@ -170,6 +310,7 @@ private:
         djgp_release(djp);
         cout << "OK" << endl;
         configureComputeProgram();
+        hiz_ready_ = false;
         return (glGetError() == GL_NO_ERROR);
     }
 
@@ -197,6 +338,55 @@ private:
         return (glGetError() == GL_NO_ERROR);
     }
 
+    bool loadInitProgram()
+    {
+        cout << "Bintree - Loading Init Program... ";
+        if (!glIsProgram(init_program_))
+            init_program_ = 0;
+        djg_program* djp = djgp_create();
+        pushMacrosToProgram(djp);
+
+        char buf[1024];
+
+        djgp_push_file(djp, strcat2(buf, shader_dir, "ltree_jk.glsl"));
+        djgp_push_file(djp, strcat2(buf, shader_dir, "bintree_init.glsl"));
+        if (!djgp_to_gl(djp, 450, false, true, &init_program_))
+        {
+            cout << "X" << endl;
+            djgp_release(djp);
+
+            return false;
+        }
+        djgp_release(djp);
+        cout << "OK" << endl;
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+
+    bool loadHizProgram()
+    {
+        cout << "Bintree - Loading Hi-Z Program... ";
+        if (!glIsProgram(hiz_program_))
+            hiz_program_ = 0;
+        djg_program* djp = djgp_create();
+
+        char buf[1024];
+
+        djgp_push_file(djp, strcat2(buf, shader_dir, "bintree_hiz.glsl"));
+        if (!djgp_to_gl(djp, 450, false, true, &hiz_program_))
+        {
+            cout << "X" << endl;
+            djgp_release(djp);
+
+            return false;
+        }
+        djgp_release(djp);
+        cout << "OK" << endl;
+        utility::SetUniformInt(hiz_program_, "u_depth", 0);
+        utility::SetUniformInt(hiz_program_, "u_src", 0);
+        utility::SetUniformInt(hiz_program_, "u_dst", 1);
+        return (glGetError() == GL_NO_ERROR);
+    }
 
     bool loadRenderProgram()
     {
@@ -255,6 +445,8 @@ private:
         bool v = true;
         v &= loadComputeProgram();
         v &= loadCopyProgram();
+        v &= loadInitProgram();
+        v &= loadHizProgram();
         v &= loadRenderProgram();
         return v;
     }
@@ -264,41 +456,436 @@ private:
     /// Buffer Function
     ///
 
+    // Bytes of a key in the key buffers
+    size_t keySize() const
+    {
+        return (settings.key_layout == KEYS_PACKED) ? sizeof(uvec3)
+                                                    : sizeof(uvec4);
+    }
+
+    // Bytes of the culled list per node: the render record of the key, or
+    // its index in the key buffer
+    size_t culledEntrySize() const
+    {
+        return (settings.culled_list == CULLED_INDICES) ? sizeof(uint)
+                                                        : sizeof(RenderRecord);
+    }
+
+    /*
+     * Allocates the node pool: the 2 pingpong key buffers and the culled list,
+     * sized from the memory budget of the settings (and the largest SSBO
+     * allowed)
+     * The key buffers are filled on the GPU by initNodesBuffers
+     */
     bool loadNodesBuffers()
     {
-        int max_ssbo_size;
-        glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_ssbo_size);
-        max_ssbo_size /= 8;
-        max_node_count_ = max_ssbo_size / sizeof(uvec4);
-         cout << "max_num_nodes  " << max_node_count_ << endl;
-         cout << "max_ssbo_size " << max_ssbo_size << "B" << endl;
-        uvec4* nodes_array =  new uvec4[max_node_count_];
-        if (settings.polygon_type == TRIANGLES) {
+        GLint64 max_ssbo_size;
+        glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_ssbo_size);
+        // Each node takes one key in each key buffer and one culled list entry
+        const size_t node_size = 2 * keySize() + culledEntrySize();
+        size_t budget = size_t(settings.node_budget_mb) << 20;
+        size_t max_entry_size = std::max(keySize(), culledEntrySize());
+        size_t node_count = std::min(budget / node_size,
+                                     size_t(max_ssbo_size) / max_entry_size);
+        max_node_count_ = int(std::min(node_count, size_t(INT32_MAX)));
+
+        if (settings.polygon_type == TRIANGLES)
             init_node_count_ = mesh_data_->triangle_count;
-            for (int ctr = 0; ctr < (int)init_node_count_; ++ctr) {
-                nodes_array[ctr] = uvec4(0, 0x1, uint(ctr*3), 0);
-            }
-        } else if (settings.polygon_type == QUADS) {
+        else if (settings.polygon_type == QUADS)
             init_node_count_ = 2 * mesh_data_->quad_count;
-            for (int ctr = 0; ctr < (int)init_node_count_; ++ctr) {
-                nodes_array[2*ctr+0] = uvec4(0, 0x1, uint(ctr*4), 0);
-                nodes_array[2*ctr+1] = uvec4(0, 0x1, uint(ctr*4), 1);
-            }
-        }
+
+        cout << "Bintree - Node pool: " << max_node_count_ << " nodes, "
+             << (max_node_count_ * node_size) / (1 << 20) << "MB ("
+             << node_size << "B per node)" << endl;
+        if (init_node_count_ > uint(max_node_count_))
+            cout << "Bintree - The node pool cannot hold the "
+                 << init_node_count_ << " root nodes" << endl;
 
         utility::EmptyBuffer(&nodes_bo_[0]);
         utility::EmptyBuffer(&nodes_bo_[1]);
-        utility::EmptyBuffer(&nodes_bo_[2]);
+        utility::EmptyBuffer(&culled_bo_);
+        utility::EmptyBuffer(&render_records_bo_);
+
+        glCreateBuffers(2, nodes_bo_);
+        glCreateBuffers(1, &culled_bo_);
+        glCreateBuffers(1, &render_records_bo_);
+
+        // Dynamic storage lets the CPU backend upload its keys
+        GLsizeiptr nodes_size = max_node_count_ * keySize();
+        glNamedBufferStorage(nodes_bo_[0], nodes_size, NULL,
+                             GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferStorage(nodes_bo_[1], nodes_size, NULL,
+                             GL_DYNAMIC_STORAGE_BIT);
+        // The culled list is either the render records, or the indices
+        // of the culled keys (the record buffer is then left empty)
+        bool indices = (settings.culled_list == CULLED_INDICES);
+        glNamedBufferStorage(culled_bo_,
+                             indices ? max_node_count_ * sizeof(uint)
+                                     : sizeof(uint),
+                             NULL, GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferStorage(render_records_bo_,
+                             indices ? sizeof(RenderRecord)
+                                     : max_node_count_ * sizeof(RenderRecord),
+                             NULL, GL_DYNAMIC_STORAGE_BIT);
+
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    /*
+     * Writes one root key per mesh triangle, or two per mesh quad, at the
+     * beginning of both key buffers, with the init program
+     * With the uniform subdivision, the keys are written directly at the
+     * uniform level, if the node pool can hold them, instead of being split
+     * one level per update
+     */
+    void initNodesBuffers()
+    {
+        init_level_ = 0;
+        init_uniform_lvl_ = settings.uniform_on ? settings.uniform_lvl : -1;
+        if (settings.uniform_on && settings.uniform_lvl <= KEY32_MAX_LEVEL) {
+            if ((uint64(init_node_count_) << settings.uniform_lvl)
+                    <= uint64(max_node_count_))
+                init_level_ = settings.uniform_lvl;
+            else
+                cout << "Bintree - The node pool cannot hold the keys of level "
+                     << settings.uniform_lvl << ", splitting the roots" << endl;
+        }
+        wg_init_global_count_ = ceil(getInitKeyCount() / float(wg_local_count_));
 
-        glCreateBuffers(3, nodes_bo_);
+        glUseProgram(init_program_);
+        utility::SetUniformInt(init_program_, "u_num_roots", init_node_count_);
+        utility::SetUniformInt(init_program_, "u_level", init_level_);
+        for (int i = 0; i < 2; ++i) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_FULL_B,
+                             nodes_bo_[i]);
+            glDispatchCompute(wg_init_global_count_, 1, 1);
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(0);
+    }
 
-        glNamedBufferStorage(nodes_bo_[0], max_ssbo_size, nodes_array, 0);
-        glNamedBufferStorage(nodes_bo_[1], max_ssbo_size, nodes_array, 0);
-        glNamedBufferStorage(nodes_bo_[2], max_ssbo_size, nodes_array, 0);
+    // Number of keys written by initNodesBuffers
+    uint getInitKeyCount() const { return init_node_count_ << init_level_; }
 
+    /*
+     * Restarts the GPU and CPU trees from the keys of initNodesBuffers, and
+     * the measure of the stable latency
+     */
+    void resetTree()
+    {
+        initNodesBuffers();
+        cpu_bintree_->Init(mesh_data_, settings.polygon_type, init_level_);
+        commands_->Init(leaf_.idx.count, wg_init_global_count_,
+                        init_level_ > 0 ? getInitKeyCount() : 0);
+        stable_latency = {false, 0, 0, 0.0};
+        measuring_latency_ = true;
+        latency_samples_.clear();
+        reset_time_ = std::chrono::steady_clock::now();
+        converge_pending_ = (settings.converge_mode == CONVERGE_ON_RESET);
+        hiz_ready_ = false;
+    }
+
+    /*
+     * Uploads the table of the triangle xforms used by FLAG_XFORM_LUT, the
+     * same one as the CPU backend
+     */
+    bool loadXformLutBuffer()
+    {
+#if LT_XFORM_LUT_BITS > 0
+        typedef ltree64::XformLUT<LT_XFORM_LUT_BITS> LUT;
+        utility::EmptyBuffer(&xform_lut_bo_);
+        glCreateBuffers(1, &xform_lut_bo_);
+        glNamedBufferStorage(xform_lut_bo_, LUT::SIZE * sizeof(ltree64::Xform),
+                             LUT::Get(), 0);
+#endif
         return (glGetError() == GL_NO_ERROR);
     }
 
+    /*
+     * Quantizes the mesh vertices in a buffer of VERTEX_QUANTIZED: the box
+     * of the positions followed by the uvec4 vertices, and prints their
+     * largest errors against the float vertices
+     */
+    bool loadQuantizedVertexBuffer()
+    {
+        utility::EmptyBuffer(&quantized_v_bo_);
+        if (settings.vertex_format != VERTEX_QUANTIZED)
+            return true;
+        meshutils::QuantizedBox box;
+        vector<meshutils::QuantizedVertex> vertices;
+        meshutils::QuantizeVertices(*mesh_data_, box, vertices);
+        meshutils::QuantizationError error =
+            meshutils::MeasureQuantization(*mesh_data_, box, vertices);
+        cout << "Bintree - Quantized vertices: "
+             << sizeof(meshutils::QuantizedVertex) << " B instead of "
+             << sizeof(Vertex) << " B, largest error: position "
+             << error.position << " edges, normal " << error.normal
+             << " deg, uv " << error.uv << endl;
+
+        size_t size = sizeof(box)
+                    + vertices.size() * sizeof(meshutils::QuantizedVertex);
+        glCreateBuffers(1, &quantized_v_bo_);
+        glNamedBufferStorage(quantized_v_bo_, size, NULL,
+                             GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferSubData(quantized_v_bo_, 0, sizeof(box), &box);
+        glNamedBufferSubData(quantized_v_bo_, sizeof(box),
+                             size - sizeof(box), vertices.data());
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    /*
+     * Computes the coefficients of the PN or Phong patch of every target
+     * triangle of the mesh (see interpolation_cpu.h) for the current
+     * interpolation type, read by the render pass instead of setting up the
+     * patch in every vertex
+     */
+    bool loadPatchBuffer()
+    {
+        utility::EmptyBuffer(&patches_bo_);
+        if (settings.itpl_type != PN && settings.itpl_type != PHONG)
+            return true;
+        auto t0 = std::chrono::steady_clock::now();
+        vector<itpl::PnCoeffs> pn;
+        vector<itpl::PhongCoeffs> phong;
+        const void* data;
+        size_t size;
+        if (settings.itpl_type == PN) {
+            itpl::ComputePatches(*mesh_data_, settings.polygon_type,
+                                 itpl::GetPnCoeffs, pn);
+            data = pn.data();
+            size = pn.size() * sizeof(itpl::PnCoeffs);
+        } else {
+            itpl::ComputePatches(*mesh_data_, settings.polygon_type,
+                                 itpl::GetPhongCoeffs, phong);
+            data = phong.data();
+            size = phong.size() * sizeof(itpl::PhongCoeffs);
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+        cout << "Bintree - " << (settings.itpl_type == PN ? "PN" : "Phong")
+             << " patches of "
+             << itpl::TargetTriangleCount(*mesh_data_, settings.polygon_type)
+             << " triangles: " << size / 1024 << " KB, " << ms << " ms"
+             << endl;
+
+        glCreateBuffers(1, &patches_bo_);
+        // An empty buffer cannot be bound
+        glNamedBufferStorage(patches_bo_, std::max(size, sizeof(float)), NULL,
+                             GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferSubData(patches_bo_, 0, size, data);
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    /*
+     * Computes the LoD scale of every root polygon of the mesh (see
+     * meshutils::ComputeLodScales) for Settings::lod_scale, without their
+     * edge term with LOD_PROJECTED, and the smallest scale for
+     * PredictMaxLevel
+     */
+    bool loadLodScaleBuffer()
+    {
+        utility::EmptyBuffer(&lod_scales_bo_);
+        lod_scales_.clear();
+        min_lod_scale_ = 1.0f;
+        bool projected = (settings.lod_metric == LOD_PROJECTED);
+        if (settings.lod_scale == LOD_SCALE_GLOBAL && !projected)
+            return true;
+        vector<meshutils::PolygonLodStats> stats;
+        meshutils::ComputePolygonLodStats(*mesh_data_, settings.polygon_type,
+                                          stats);
+        if (settings.lod_scale != LOD_SCALE_GLOBAL) {
+            min_lod_scale_ = meshutils::ComputeLodScales(
+                        stats, mesh_data_->avg_e_length, !projected,
+                        settings.lod_scale == LOD_SCALE_CURVATURE,
+                        lod_scales_);
+            float max_scale = 0.0f;
+            for (size_t i = 0; i < lod_scales_.size(); ++i)
+                max_scale = std::max(max_scale, lod_scales_[i]);
+            cout << "Bintree - LoD scales of " << lod_scales_.size()
+                 << " polygons: " << min_lod_scale_ << " to " << max_scale
+                 << endl;
+
+            glCreateBuffers(1, &lod_scales_bo_);
+            glNamedBufferStorage(lod_scales_bo_,
+                                 std::max(lod_scales_.size(), size_t(1))
+                                 * sizeof(float), NULL, GL_DYNAMIC_STORAGE_BIT);
+            glNamedBufferSubData(lod_scales_bo_, 0,
+                                 lod_scales_.size() * sizeof(float),
+                                 lod_scales_.data());
+        }
+        if (projected)
+            min_lod_scale_ = meshutils::ProjectedMinLodScale(
+                        stats, mesh_data_->avg_e_length, lod_scales_);
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    /*
+     * Builds the BVH of the roots of the mesh (see meshutils::BuildRootBvh),
+     * and the buffer of their visibility bits, all visible until the first
+     * UpdateRootVisibility
+     */
+    bool loadRootBvh()
+    {
+        utility::EmptyBuffer(&root_visibility_bo_);
+        auto t0 = std::chrono::steady_clock::now();
+        meshutils::BuildRootBvh(*mesh_data_, settings.polygon_type, root_bvh_);
+        double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+        uint root_count = root_bvh_.empty() ? 0u : root_bvh_[0].count;
+        cout << "Bintree - Root BVH of " << root_count << " roots: "
+             << root_bvh_.size() << " nodes, " << ms << " ms" << endl;
+
+        root_visible_.assign((root_count + 31) / 32, ~0u);
+        visible_root_count_ = root_count;
+        glCreateBuffers(1, &root_visibility_bo_);
+        glNamedBufferStorage(root_visibility_bo_,
+                             std::max(root_visible_.size(), size_t(1))
+                             * sizeof(uint), NULL, GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferSubData(root_visibility_bo_, 0,
+                             root_visible_.size() * sizeof(uint),
+                             root_visible_.data());
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    bool rootCullOn() const
+    {
+        return settings.cull_on && settings.root_cull_on;
+    }
+
+    /*
+     * Computes the normal cone of every target triangle of the mesh (see
+     * itpl::ComputeNormalCones) for the backface test, from the base map or
+     * the current interpolation type, and counts the boundary edges of the
+     * mesh, through which its back may show
+     * The occlusion test of the meshes only reads the bulge of the cones
+     */
+    bool loadNormalConeBuffer()
+    {
+        utility::EmptyBuffer(&normal_cones_bo_);
+        normal_cones_.clear();
+        if (!backfaceOn() && !(occlusionOn() && !settings.displace_on))
+            return true;
+        auto t0 = std::chrono::steady_clock::now();
+        itpl::ComputeNormalCones(*mesh_data_, settings.polygon_type,
+                                 settings.itpl_type, normal_cones_);
+        double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+        size_t cullable = 0;
+        for (size_t i = 0; i < normal_cones_.size(); ++i)
+            if (normal_cones_[i].sin_angle < 1.0f)
+                ++cullable;
+        cout << "Bintree - Normal cones of " << normal_cones_.size()
+             << " triangles: " << cullable << " narrower than a half space, "
+             << ms << " ms" << endl;
+        if (backfaceOn()) {
+            boundary_edge_count_ = meshutils::CountBoundaryEdges(
+                        *mesh_data_, settings.polygon_type);
+            if (boundary_edge_count_ > 0)
+                cout << "Bintree - Open mesh (" << boundary_edge_count_
+                     << " boundary edges): its back may show through its holes"
+                     << endl;
+        }
+
+        glCreateBuffers(1, &normal_cones_bo_);
+        glNamedBufferStorage(normal_cones_bo_,
+                             std::max(normal_cones_.size(), size_t(1))
+                             * sizeof(itpl::NormalCone), NULL,
+                             GL_DYNAMIC_STORAGE_BIT);
+        glNamedBufferSubData(normal_cones_bo_, 0,
+                             normal_cones_.size() * sizeof(itpl::NormalCone),
+                             normal_cones_.data());
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    // The displaced terrain has no normal cones
+    bool backfaceOn() const
+    {
+        return settings.cull_on && settings.backface_on && !settings.displace_on;
+    }
+
+    // The pyramid is built on the GPU, which the CPU backend does not read
+    // back
+    bool occlusionOn() const
+    {
+        return settings.cull_on && settings.occlusion_on
+                && settings.backend == BACKEND_GPU;
+    }
+
+    /*
+     * Allocates the depth pyramid of a viewport of the given size: the copy
+     * of its depth, and the levels down to 1x1, floor halved each time
+     */
+    bool loadDepthPyramid(glm::ivec2 size)
+    {
+        utility::EmptyTexture(&hiz_depth_tex_);
+        utility::EmptyTexture(&hiz_tex_);
+        hiz_size_ = size;
+        hiz_levels_ = 1 + int(std::floor(std::log2(float(
+                                  std::max(size.x, size.y)))));
+        glCreateTextures(GL_TEXTURE_2D, 1, &hiz_depth_tex_);
+        glTextureStorage2D(hiz_depth_tex_, 1, GL_DEPTH_COMPONENT32F,
+                           size.x, size.y);
+        glCreateTextures(GL_TEXTURE_2D, 1, &hiz_tex_);
+        glTextureStorage2D(hiz_tex_, hiz_levels_, GL_R32F, size.x, size.y);
+        hiz_ready_ = false;
+        return (glGetError() == GL_NO_ERROR);
+    }
+
+    /*
+     * Copies the depth of the viewport after the render pass, and reduces it
+     * level by level to the farthest depth under each texel, for the
+     * occlusion test of the next update
+     */
+    void buildDepthPyramid()
+    {
+        glm::ivec4 viewport;
+        glGetIntegerv(GL_VIEWPORT, &viewport.x);
+        glm::ivec2 size = glm::ivec2(viewport.z, viewport.w);
+        if (size != hiz_size_)
+            loadDepthPyramid(size);
+
+        // The depth is read from the framebuffer just drawn
+        GLint draw_fb, read_fb;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fb);
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fb);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_fb);
+        glCopyTextureSubImage2D(hiz_depth_tex_, 0, 0, 0, viewport.x,
+                                viewport.y, size.x, size.y);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fb);
+
+        glUseProgram(hiz_program_);
+        glBindTextureUnit(0, hiz_depth_tex_);
+        glm::ivec2 src_size = size;
+        for (int level = 0; level < hiz_levels_; ++level) {
+            utility::SetUniformInt(hiz_program_, "u_level", level);
+            utility::SetUniformIVec2(hiz_program_, "u_src_size", src_size);
+            if (level > 0)
+                glBindImageTexture(0, hiz_tex_, level - 1, GL_FALSE, 0,
+                                   GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, hiz_tex_, level, GL_FALSE, 0,
+                               GL_WRITE_ONLY, GL_R32F);
+            glm::ivec2 dst_size = (level > 0)
+                    ? glm::max(src_size / 2, glm::ivec2(1)) : src_size;
+            glDispatchCompute((dst_size.x + 7) / 8, (dst_size.y + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            src_size = dst_size;
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        glBindTextureUnit(0, 0);
+        glUseProgram(0);
+
+        hiz_viewport_ = viewport;
+        hiz_mvp_ = next_mvp_;
+        hiz_ready_ = true;
+    }
+
+    // Buffer bound to MESH_V_B
+    GLuint meshVertexBuffer() const
+    {
+        return (settings.vertex_format == VERTEX_QUANTIZED) ? quantized_v_bo_
+                                                            : mesh_data_->v.bo;
+    }
+
     vector<vec2> getLeafVertices(uint level)
     {
         vector<vec2> vertices;
@@ -402,18 +989,338 @@ private:
         return (glGetError() == GL_NO_ERROR);
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// CPU backend functions
+    ///
+
+    BinTreeCPU::Params getCpuParams()
+    {
+        BinTreeCPU::Params p;
+        p.uniform_on = settings.uniform_on;
+        p.uniform_lvl = settings.uniform_lvl;
+        p.lod_factor = settings.lod_factor;
+        p.cull_on = settings.cull_on;
+        p.displace_on = settings.displace_on;
+        p.displace_factor = settings.displace_factor;
+        p.screen_res = screen_res_;
+        p.lod_projected = (settings.lod_metric == LOD_PROJECTED);
+        p.target_length = settings.target_length;
+        p.cpu_lod = settings.cpu_lod;
+        p.culled_indices = (settings.culled_list == CULLED_INDICES);
+        p.lod_scales = lod_scales_.empty() ? NULL : lod_scales_.data();
+        p.root_visibility = rootCullOn() ? root_visible_.data() : NULL;
+        p.cull_refine_on = settings.cull_refine_on;
+        p.normal_cones = (backfaceOn() && !normal_cones_.empty())
+                ? normal_cones_.data() : NULL;
+        p.cull_floor = settings.cull_floor;
+        p.base_map_min = base_map_min_;
+        p.base_map_max = base_map_max_;
+        return p;
+    }
+
+    // Uploads the first count keys of the CPU backend in the layout of the
+    // GPU programs
+    void uploadKeys(GLuint bo, const vector<uvec4>& keys, uint count)
+    {
+        if (settings.key_layout == KEYS_PACKED) {
+            packed_keys_.resize(count);
+            for (uint i = 0; i < count; ++i)
+                packed_keys_[i] = ltree64::lt_packKey_64(keys[i],
+                                                         settings.polygon_type);
+            glNamedBufferSubData(bo, 0, count * sizeof(uvec3),
+                                 packed_keys_.data());
+        } else {
+            glNamedBufferSubData(bo, 0, count * sizeof(uvec4), keys.data());
+        }
+    }
+
+    /*
+     * Replaces the compute pass when the CPU backend is selected:
+     * - Reads back the transforms used by the GPU programs
+     * - Updates and culls the keys on the CPU
+     * - Uploads the keys, render records and node counts where the copy and
+     *   render passes expect the compute pass to write them
+     */
+    void cpuComputePass()
+    {
+        TransformBlock transforms;
+        glGetNamedBufferSubData(transfo_bo_, 0, sizeof(TransformBlock),
+                                &transforms);
+        cpu_bintree_->SetThreadCount(settings.cpu_threads);
+        cpu_bintree_->Update(transforms, getCpuParams());
+
+        const vector<uvec4>& full = cpu_bintree_->GetFullNodes();
+        const vector<RenderRecord>& records = cpu_bintree_->GetRenderRecords();
+        uint full_count = std::min(full.size(), size_t(max_node_count_));
+        uint culled_count = std::min(cpu_bintree_->GetCulledCount(),
+                                     size_t(max_node_count_));
+        uploadKeys(nodes_bo_[ssbo_idx_.write_full], full, full_count);
+        if (settings.culled_list == CULLED_INDICES)
+            glNamedBufferSubData(culled_bo_, 0, culled_count * sizeof(uint),
+                                 cpu_bintree_->GetCulledIndices().data());
+        else
+            glNamedBufferSubData(render_records_bo_, 0,
+                                 culled_count * sizeof(RenderRecord),
+                                 records.data());
+        commands_->SetNodeCounts(full_count, culled_count);
+        commands_->SetPoolStatus(cpu_bintree_->GetSplitCount()
+                                 + cpu_bintree_->GetRefusedSplitCount(),
+                                 cpu_bintree_->GetRefusedSplitCount(),
+                                 full.size() - full_count,
+                                 cpu_bintree_->GetMergeCount());
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     ///
     /// Pingpong functions
     ///
     void pingpong()
     {
-        ssbo_idx_.read = ssbo_idx_.write_full;
-        ssbo_idx_.write_full = (ssbo_idx_.read + 1) % 3;
-        ssbo_idx_.write_culled = (ssbo_idx_.read + 2) % 3;
+        std::swap(ssbo_idx_.read, ssbo_idx_.write_full);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Update functions
+    ///
+
+    /*
+     * One update of the tree: its keys are split, kept or merged once, and
+     * the ones to render this frame are culled
+     */
+    void updatePass(float deltaT)
+    {
+        pingpong();
+
+        /*
+         * COMPUTE PASS
+         * - Reads the keys in the SSBO
+         * - Evaluates the LoD
+         * - Writes the new keys in opposite SSBO
+         * - Performs culling
+         * Done by cpuComputePass instead when the CPU backend is selected
+         */
+        if (settings.backend == BACKEND_CPU) {
+            cpuComputePass();
+        } else {
+            glUseProgram(compute_program_);
+            {
+                utility::SetUniformFloat(compute_program_, "deltaT", deltaT);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_IN_B,
+                                 nodes_bo_[ssbo_idx_.read]);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_FULL_B,
+                                 nodes_bo_[ssbo_idx_.write_full]);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_CULLED_B,
+                                 culled_bo_);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDER_RECORDS_B,
+                                 render_records_bo_);
+
+                glBindBufferBase(GL_UNIFORM_BUFFER, 0, transfo_bo_);
+                commands_->BindForCompute(compute_program_);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_V_B,
+                                 meshVertexBuffer());
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_Q_IDX_B,
+                                 mesh_data_->q_idx.bo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_T_IDX_B,
+                                 mesh_data_->t_idx.bo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, XFORM_LUT_B,
+                                 xform_lut_bo_);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LOD_SCALES_B,
+                                 lod_scales_bo_);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BASE_MAP_B,
+                                 mesh_data_->base_map.bo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ROOT_VISIBILITY_B,
+                                 root_visibility_bo_);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NORMAL_CONES_B,
+                                 normal_cones_bo_);
+                if (occlusionOn())
+                    glBindTextureUnit(0, hiz_tex_);
+
+                glDispatchComputeIndirect((long)NULL);
+
+                glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT
+                                | GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            glUseProgram(0);
+        }
+
+        /*
+         * COPY PASS
+         * - Reads the number of primitive written in previous Compute Pass
+         * - Write the number of instances in the Draw Command Buffer
+         * - Write the number of workgroups in the Dispatch Command Buffer
+         */
+        glUseProgram(copy_program_);
+        {
+            commands_->BindForCopy(copy_program_);
+            glBindBufferBase(GL_UNIFORM_BUFFER, LEAF_VERT_B, leaf_.v.bo);
+            glBindBufferBase(GL_UNIFORM_BUFFER, LEAF_IDX_B, leaf_.idx.bo);
+
+            glDispatchCompute(1,1,1);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+        }
+        glUseProgram(0);
+    }
+
+    /*
+     * Repeats the update until it splits and merges nothing, or for
+     * converge_max_iter updates, so that the tree reaches the LoD of the view
+     * within one frame instead of one level per frame
+     * The change count is read back after each update, which stalls the GPU
+     * Returns the change count of the last update
+     */
+    uint convergePass(float deltaT)
+    {
+        uint change_count = 0;
+        int i = 0;
+        do {
+            updatePass(deltaT);
+            change_count = commands_->GetChangeCount();
+            if (measuring_latency_)
+                ++stable_latency.updates;
+        } while (change_count > 0 && ++i < settings.converge_max_iter);
+        return change_count;
+    }
+
+    /*
+     * Ends the measure of the stable latency on the first update that does
+     * not change the tree. A tree that keeps changing (moving camera, auto
+     * LoD) stops being measured after STABLE_LATENCY_MAX_FRAMES frames
+     */
+    void endStableLatency(const LatencySample& sample, uint change_count)
+    {
+        if (change_count == 0) {
+            // The frames and updates counted since are not part of it
+            stable_latency.frames = sample.frames;
+            stable_latency.updates = sample.updates;
+            stable_latency.ms = std::chrono::duration<double, std::milli>(
+                        sample.time - reset_time_).count();
+            stable_latency.stable = true;
+            measuring_latency_ = false;
+            printf("Bintree - Stable after %d frames, %d updates (%.1f ms)\n",
+                   stable_latency.frames, stable_latency.updates,
+                   stable_latency.ms);
+        } else if (sample.frames >= STABLE_LATENCY_MAX_FRAMES) {
+            stable_latency.frames = sample.frames;
+            measuring_latency_ = false;
+            printf("Bintree - Not stable after %d frames\n",
+                   stable_latency.frames);
+        }
+    }
+
+    /*
+     * Measures the stable latency without stalling: the change count of the
+     * frame is read back once the GPU has written it, a frame or two later,
+     * and credited to the frame it belongs to. A frame whose read back could
+     * not be queued is skipped, the next one (stable as well) ends the measure
+     */
+    void updateStableLatency()
+    {
+        ++stable_latency.frames;
+        LatencySample sample = {stable_latency.frames, stable_latency.updates,
+                                std::chrono::steady_clock::now()};
+        if (commands_->RequestChangeCount())
+            latency_samples_.push_back(sample);
+        readLatencySamples();
+    }
+
+    // Credits the change counts read back so far to their frames
+    void readLatencySamples()
+    {
+        uint change_count;
+        while (measuring_latency_ && commands_->PollChangeCount(change_count)) {
+            endStableLatency(latency_samples_.front(), change_count);
+            latency_samples_.erase(latency_samples_.begin());
+        }
+    }
+
+    /*
+     * Picks the key size from Settings::key_bits, or from the predicted depth
+     * of the tree with KEY_BITS_AUTO. The margin keeps the auto LoD, which
+     * changes the target edge length every frame, from toggling the programs
+     * back and forth around the limit
+     * Returns true if the key size changed
+     */
+    bool selectKeyBits()
+    {
+        bool key32 = key32_;
+        if (settings.key_bits == KEY_BITS_32) {
+            key32 = true;
+        } else if (settings.key_bits == KEY_BITS_64) {
+            key32 = false;
+        } else {
+            int lvl = PredictMaxLevel(settings, min_lod_scale_);
+            if (key32_ && lvl >= KEY32_MAX_LEVEL)
+                key32 = false;
+            else if (!key32_ && lvl < KEY32_MAX_LEVEL - 2)
+                key32 = true;
+        }
+        if (key32 == key32_)
+            return false;
+        key32_ = key32;
+        return true;
+    }
+
+    /*
+     * Rebuilds the programs for the current key size, and restores their
+     * uniforms. The 64 bit keys deeper than 31 levels are not valid 32 bit
+     * keys, so the tree restarts from the roots when switching to 32 bits
+     */
+    void reloadForKeyBits()
+    {
+        cout << "Bintree - Switching to " << (key32_ ? 32 : 64)
+             << " bit keys" << endl;
+        loadPrograms();
+        ReconfigureShaders();
+        UploadSettings();
+        UpdateMode(mode_);
+        UpdateScreenRes(screen_res_);
+        if (light_pos_set_)
+            UpdateLightPos(light_pos_);
+        if (key32_)
+            resetTree();
     }
 
 public:
+    // Deepest level of the nodeIDs of FLAG_KEY32
+    static const int KEY32_MAX_LEVEL = 31;
+
+    /*
+     * Deepest level the LoD can ask for: the uniform level, or the distance
+     * based level of a node at the near plane distance (see distanceToLod) on
+     * the polygon of the smallest LoD scale (see
+     * meshutils::ProjectedMinLodScale for LOD_PROJECTED)
+     * Also used by the headless tools, which have no BinTree instance
+     */
+    static int PredictMaxLevel(const Settings& s, float min_lod_scale = 1.0f)
+    {
+        if (s.uniform_on)
+            return s.uniform_lvl;
+        float lod = utility::clamp(s.near_plane * s.lod_factor * min_lod_scale,
+                                   0.0f, 1.0f);
+        if (lod == 0.0f)
+            return 63;
+        return std::min(int(std::ceil(-2.0f * std::log2(lod))), 63);
+    }
+
+    // Whether the programs currently use 32 bit nodeIDs
+    bool IsKey32() const { return key32_; }
+
+    // Smallest per polygon LoD scale, 1 with LOD_SCALE_GLOBAL
+    float GetMinLodScale() const { return min_lod_scale_; }
+
+    // Roots found in the frustum by the last UpdateRootVisibility, and roots
+    // of the mesh
+    size_t GetVisibleRootCount() const { return visible_root_count_; }
+    size_t GetRootCount() const
+    {
+        return root_bvh_.empty() ? 0 : root_bvh_[0].count;
+    }
+
+    // Edges of the mesh with a single triangle, counted with the normal cones
+    size_t GetBoundaryEdgeCount() const { return boundary_edge_count_; }
+
     struct Ticks {
         double cpu;
         double gpu_compute, gpu_render;
@@ -432,6 +1339,8 @@ public:
 
     void ReloadRenderProgram()
     {
+        loadPatchBuffer();
+        loadNormalConeBuffer();
         loadRenderProgram();
         configureRenderProgram();
         UploadSettings();
@@ -456,45 +1365,93 @@ public:
         loadLeafBuffers(settings.cpu_lod);
         loadLeafVao();
         loadNodesBuffers();
+        loadQuantizedVertexBuffer();
+        loadPatchBuffer();
+        loadLodScaleBuffer();
+        loadRootBvh();
+        cpu_bintree_->SetMaxNodeCount(max_node_count_);
+        selectKeyBits();
         loadPrograms();
-        commands_->Init(leaf_.idx.count, wg_init_global_count_);
+        resetTree();
+    }
+
+    // Number of keys the node pool can hold
+    int GetMaxNodeCount() const { return max_node_count_; }
+
+    // Bytes allocated for the node pool (keys and culled list)
+    size_t GetNodePoolSize() const
+    {
+        return max_node_count_ * (2 * keySize() + culledEntrySize());
     }
 
     void UploadSettings()
     {
+        if (selectKeyBits())
+            reloadForKeyBits();
         settings.Upload(compute_program_);
         settings.Upload(render_program_);
+        // The surface may have moved (displacement, interpolation...)
+        hiz_ready_ = false;
+        // A new uniform level is written directly, instead of being reached
+        // one level per update
+        if (settings.uniform_on && settings.uniform_lvl != init_uniform_lvl_)
+            resetTree();
+        else if (!settings.uniform_on)
+            init_uniform_lvl_ = -1;
+    }
+
+    // Updates until the tree is stable on the next frame, e.g. after the
+    // camera jumped somewhere else
+    void Converge()
+    {
+        converge_pending_ = true;
     }
 
     void UpdateLightPos(vec3 lp)
     {
+        light_pos_ = lp;
+        light_pos_set_ = true;
         utility::SetUniformVec3(render_program_, "u_light_pos", lp);
     }
 
     void UpdateMode(uint mode)
     {
+        mode_ = mode;
         utility::SetUniformInt(compute_program_, "u_mode", mode);
         utility::SetUniformInt(render_program_, "u_mode", mode);
     }
 
     void UpdateScreenRes(int s)
     {
+        screen_res_ = s;
         utility::SetUniformInt(compute_program_, "u_screen_res", s);
         utility::SetUniformInt(render_program_, "u_screen_res", s);
     }
 
-    void UpdateLodFactor(int res, float fov) {
+    // Factor of the distance based LoD for which the edges of the rendered
+    // grid are target_length pixels long
+    // Also used by the headless tools, which have no BinTree instance
+    static float ComputeLodFactor(int res, float fov, float target_length,
+                                  int cpu_lod, float avg_e_length,
+                                  bool* capped = NULL)
+    {
         float l = 2.0f * tan(glm::radians(fov) / 2.0f)
-                * settings.target_length
-                * (1 << settings.cpu_lod)
+                * target_length
+                * (1 << cpu_lod)
                 / float(res);
-        capped = false;
         const float cap = 0.43f;
-        if (l > cap) {
-            capped = true;
+        if (capped)
+            *capped = (l > cap);
+        if (l > cap)
             l = cap;
-        }
-        settings.lod_factor = l / float(mesh_data_->avg_e_length);;
+        return l / avg_e_length;
+    }
+
+    void UpdateLodFactor(int res, float fov) {
+        settings.lod_factor = ComputeLodFactor(res, fov, settings.target_length,
+                                               settings.cpu_lod,
+                                               mesh_data_->avg_e_length,
+                                               &capped);
     }
 
 
@@ -510,6 +1467,7 @@ public:
      * - Generate the leaf geometry
      * - Load the buffers for the nodes and the leaf geometry
      * - Load the glsl programs
+     * - Write the root nodes (or the uniform level) in the node buffers
      * - Initialize the command class instance
      * - Update the uniform values once again, after all these loadings
      */
@@ -519,8 +1477,11 @@ public:
         cout << "BINTREE" << endl;
         mesh_data_ = m_data;
         settings = init_settings;
+        loadLodScaleBuffer();
+        selectKeyBits();
 
         commands_ = new CommandManager();
+        cpu_bintree_ = new BinTreeCPU();
         compute_clock_ = djgc_create();
         render_clock_ = djgc_create();
 
@@ -530,20 +1491,67 @@ public:
         loadLeafBuffers(settings.cpu_lod);
         loadLeafVao();
         loadNodesBuffers();
-
-        wg_init_global_count_ = ceil(init_node_count_ / float(wg_local_count_));
+        loadXformLutBuffer();
+        loadQuantizedVertexBuffer();
+        loadPatchBuffer();
+        loadRootBvh();
+        cpu_bintree_->SetMaxNodeCount(max_node_count_);
 
         if (!loadPrograms())
             throw std::runtime_error("shader creation error");
+        resetTree();
 
         transfo_bo_ = transfo_bo;
-        commands_->Init(leaf_.idx.count, wg_init_global_count_);
 
         ReconfigureShaders();
 
         glUseProgram(0);
     }
 
+    /*
+     * Walks the root BVH against the frustum of the transforms of the next
+     * update, and uploads the visibility bits of the roots (FLAG_ROOT_CULL).
+     * The compute pass collapses the subtrees of the hidden roots instead of
+     * refining them
+     */
+    void UpdateRootVisibility(const TransformBlock& transforms)
+    {
+        if (!rootCullOn() || settings.freeze || root_bvh_.empty())
+            return;
+        float height = settings.displace_on
+                ? noise::maxHeight(settings.displace_factor) : 0.0f;
+        visible_root_count_ = meshutils::CullRootBvh(
+                    root_bvh_, transforms.frustum_planes, height,
+                    root_visible_);
+        glNamedBufferSubData(root_visibility_bo_, 0,
+                             root_visible_.size() * sizeof(uint),
+                             root_visible_.data());
+    }
+
+    /*
+     * Tells the compute pass whether the depth pyramid of the last frame
+     * still matches the view of the next update (FLAG_OCCLUSION): same
+     * viewport and same transforms. Else, e.g. while the camera moves, every
+     * node in the frustum is drawn, and the pyramid of this frame is not
+     * built either: the next transforms are likely to change as well (mesh
+     * rotation), so it would not be trusted
+     */
+    void UpdateOcclusion(const TransformBlock& transforms)
+    {
+        if (!occlusionOn())
+            return;
+        glm::ivec4 viewport;
+        glGetIntegerv(GL_VIEWPORT, &viewport.x);
+        bool valid = hiz_ready_ && viewport == hiz_viewport_
+                && transforms.MVP == hiz_mvp_;
+        view_moving_ = (transforms.MVP != next_mvp_);
+        next_mvp_ = transforms.MVP;
+        utility::SetUniformBool(compute_program_, "u_hiz_valid", valid);
+        utility::SetUniformIVec2(compute_program_, "u_hiz_size", hiz_size_);
+        utility::SetUniformInt(compute_program_, "u_hiz_levels", hiz_levels_);
+        utility::SetUniformInt(compute_program_, "u_hiz", 0);
+    }
+
     /*
      * Render function
      */
@@ -552,59 +1560,25 @@ public:
         if (settings.freeze)
             goto RENDER_PASS;
 
-        pingpong();
-
-        /*
-         * COMPUTE PASS
-         * - Reads the keys in the SSBO
-         * - Evaluates the LoD
-         * - Writes the new keys in opposite SSBO
-         * - Performs culling
-         */
         glEnable(GL_RASTERIZER_DISCARD);
         djgc_start(compute_clock_);
-        glUseProgram(compute_program_);
-        {
-            utility::SetUniformFloat(compute_program_, "deltaT", deltaT);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_IN_B,
-                             nodes_bo_[ssbo_idx_.read]);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_FULL_B,
-                             nodes_bo_[ssbo_idx_.write_full]);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_CULLED_B,
-                             nodes_bo_[ssbo_idx_.write_culled]);
-
-            glBindBufferBase(GL_UNIFORM_BUFFER, 0, transfo_bo_);
-            commands_->BindForCompute(compute_program_);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_V_B,
-                             mesh_data_->v.bo);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_Q_IDX_B,
-                             mesh_data_->q_idx.bo);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_T_IDX_B,
-                             mesh_data_->t_idx.bo);
-
-            glDispatchComputeIndirect((long)NULL);
-
-            glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
-        }
-        glUseProgram(0);
-
-        /*
-         * COPY PASS
-         * - Reads the number of primitive written in previous Compute Pass
-         * - Write the number of instances in the Draw Command Buffer
-         * - Write the number of workgroups in the Dispatch Command Buffer
-         */
-        glUseProgram(copy_program_);
-        {
-            commands_->BindForCopy(copy_program_);
-            glBindBufferBase(GL_UNIFORM_BUFFER, LEAF_VERT_B, leaf_.v.bo);
-            glBindBufferBase(GL_UNIFORM_BUFFER, LEAF_IDX_B, leaf_.idx.bo);
-
-            glDispatchCompute(1,1,1);
-            glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+        if (converge_pending_ || settings.converge_mode == CONVERGE_ALWAYS) {
+            uint change_count = convergePass(deltaT);
+            // The samples in flight are older, and ready after the read back
+            readLatencySamples();
+            if (measuring_latency_)
+                endStableLatency({++stable_latency.frames,
+                                  stable_latency.updates,
+                                  std::chrono::steady_clock::now()},
+                                 change_count);
+            converge_pending_ = false;
+        } else {
+            updatePass(deltaT);
+            if (measuring_latency_) {
+                ++stable_latency.updates;
+                updateStableLatency();
+            }
         }
-        glUseProgram(0);
-
         djgc_stop(compute_clock_);
         djgc_ticks(compute_clock_, &ticks.cpu, &ticks.gpu_compute);
 
@@ -613,10 +1587,14 @@ RENDER_PASS:
         if (settings.map_nodecount) {
             drawn_node_count = commands_->GetDrawnNodeCount();
             full_node_count = commands_->GetFullNodeCount();
+            commands_->GetPoolStatus(refused_split_count, dropped_node_count);
+            occluded_node_count = occlusionOn()
+                    ? commands_->GetOccludedCount() : 0;
         }
         /*
          * RENDER PASS
-         * - Reads the updated keys that did not get culled
+         * - Reads the render records of the updated keys that did not get
+         *   culled
          * - Performs the morphing
          * - Render the triangles
          */
@@ -629,14 +1607,25 @@ RENDER_PASS:
         glUseProgram(render_program_);
         {
             djgc_start(render_clock_);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDER_RECORDS_B,
+                             render_records_bo_);
+            // Keys of the drawn nodes, read through the culled indices by
+            // lt_getInstanceRecord with FLAG_CULLED_INDICES
             glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_IN_B,
-                             nodes_bo_[ssbo_idx_.write_culled]);
+                             nodes_bo_[ssbo_idx_.read]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_OUT_CULLED_B,
+                             culled_bo_);
             glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_V_B,
-                             mesh_data_->v.bo);
+                             meshVertexBuffer());
             glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_Q_IDX_B,
                              mesh_data_->q_idx.bo);
             glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_T_IDX_B,
                              mesh_data_->t_idx.bo);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, XFORM_LUT_B,
+                             xform_lut_bo_);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCHES_B, patches_bo_);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BASE_MAP_B,
+                             mesh_data_->base_map.bo);
             glBindBufferBase(GL_UNIFORM_BUFFER, 0, transfo_bo_);
 
             commands_->BindForRender();
@@ -647,15 +1636,30 @@ RENDER_PASS:
         }
         glUseProgram(0);
         djgc_ticks(render_clock_, &ticks.cpu, &ticks.gpu_render);
+
+        if (occlusionOn() && !view_moving_)
+            buildDepthPyramid();
     }
 
     void CleanUp()
     {
         glUseProgram(0);
-        glDeleteBuffers(3, nodes_bo_);
+        glDeleteBuffers(2, nodes_bo_);
+        utility::EmptyBuffer(&culled_bo_);
+        utility::EmptyBuffer(&render_records_bo_);
+        utility::EmptyBuffer(&xform_lut_bo_);
+        utility::EmptyBuffer(&quantized_v_bo_);
+        utility::EmptyBuffer(&patches_bo_);
+        utility::EmptyBuffer(&lod_scales_bo_);
+        utility::EmptyBuffer(&root_visibility_bo_);
+        utility::EmptyBuffer(&normal_cones_bo_);
         utility::EmptyBuffer(&transfo_bo_);
+        utility::EmptyTexture(&hiz_depth_tex_);
+        utility::EmptyTexture(&hiz_tex_);
         glDeleteProgram(compute_program_);
         glDeleteProgram(copy_program_);
+        glDeleteProgram(init_program_);
+        glDeleteProgram(hiz_program_);
         glDeleteProgram(render_program_);
         glDeleteBuffers(1, &leaf_.v.bo);
         glDeleteBuffers(1, &leaf_.idx.bo);
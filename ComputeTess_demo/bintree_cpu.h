@@ -0,0 +1,613 @@
+#ifndef BINTREE_CPU_H
+#define BINTREE_CPU_H
+
+#include "common.h"
+#include "interpolation_cpu.h"
+#include "ltree_cpu.h"
+#include "noise_cpu.h"
+#include "thread_pool.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// CPU backend of the bintree update.
+/// Reference implementation of bintree_compute.glsl (computePass,
+/// updateSubdBuffer, cullPass) and of the LoD functions in LoD.glsl, working
+/// on the same uvec4 keys and Mesh_Data as the GPU programs.
+/// It does not issue any OpenGL call, so it can run on machines without GPU.
+/// The keys are processed in parallel on a work stealing thread pool. Each
+/// thread appends to its own output buffers, which are concatenated at the
+/// end of the update from the prefix sum of their sizes, instead of having
+/// all threads increment one shared counter like the compute pass does.
+/// The splits are budgeted like on the GPU: at most (max node count - current
+/// node count) splits are granted per update, the other ones are refused and
+/// keep their key.
+/// The number of splits and merges of an update tells when the tree has
+/// converged to the LoD of the view.
+///
+
+class BinTreeCPU
+{
+public:
+    // Mirrors the uniforms and macros read by the compute program
+    struct Params
+    {
+        bool uniform_on;       // u_uniform_subdiv
+        int uniform_lvl;       // u_uniform_level
+        float lod_factor;      // u_lod_factor
+        bool cull_on;          // FLAG_CULL
+        bool displace_on;      // FLAG_DISPLACE
+        float displace_factor; // u_displace_factor
+        int screen_res;        // u_screen_res
+        bool lod_projected;    // FLAG_LOD_PROJECTED
+        float target_length;   // u_target_edge_length
+        int cpu_lod;           // u_cpu_lod
+        bool culled_indices;   // FLAG_CULLED_INDICES
+        const float* lod_scales; // u_LodScale with FLAG_LOD_SCALE, else NULL
+        const uint* root_visibility; // u_RootVisible with FLAG_ROOT_CULL,
+                                     // else NULL
+        bool cull_refine_on;   // FLAG_CULL_REFINE
+        const itpl::NormalCone* normal_cones; // u_NormalCones with
+                                              // FLAG_BACKFACE, else NULL
+        int cull_floor;        // u_cull_floor
+        vec3 base_map_min;     // u_base_map_min
+        vec3 base_map_max;     // u_base_map_max
+    };
+
+private:
+    const Mesh_Data* mesh_data_;
+    int polygon_type_;
+
+    // Same roles as the nodes SSBOs of the GPU implementation
+    vector<uvec4> nodes_in_;
+    vector<uvec4> nodes_out_full_;
+    vector<uint> nodes_out_culled_idx_;
+    vector<RenderRecord> render_records_;
+
+    // Per thread output, replacing the atomic counters of the compute pass
+    struct ThreadOutput {
+        vector<uvec4> full;
+        vector<uint> culled_idx;
+        vector<RenderRecord> records;
+        size_t refused_splits;
+        size_t merges;
+    };
+    vector<ThreadOutput> thread_outputs_;
+    ThreadPool pool_;
+
+    // Node pool budget, and splits granted during the current update
+    size_t max_node_count_ = ~size_t(0);
+    std::atomic<size_t> split_count_;
+    size_t split_budget_;
+    size_t refused_split_count_ = 0;
+    size_t granted_split_count_ = 0;
+    size_t merge_count_ = 0;
+
+    // Number of keys processed by a thread before looking for more work
+    static const size_t KEYS_PER_CHUNK = 1024;
+
+    // Per update values, shared by all keys (uniforms on the GPU)
+    Params params_;
+    TransformBlock transforms_;
+    float cam_height_;
+    float max_height_; // Bound of the terrain heights with displace_on
+    vec3 cam_mesh_;    // Camera position in mesh space
+
+    const vec2 unit_O = vec2(0, 0);
+    const vec2 unit_R = vec2(1, 0);
+    const vec2 unit_U = vec2(0, 1);
+    const vec2 triangle_centroid = vec2(0.5);
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// LoD.glsl functions
+    ///
+
+    float lodScale(uvec4 key)
+    {
+        if (!params_.lod_scales)
+            return 1.0f;
+        return params_.lod_scales[key.z / (polygon_type_ == TRIANGLES ? 3u
+                                                                      : 4u)];
+    }
+
+    float distanceToLod(vec3 pos, float lod_scale)
+    {
+        float d = glm::distance(pos, transforms_.cam_pos);
+        float lod = (d * params_.lod_factor * lod_scale);
+        lod = utility::clamp(lod, 0.0f, 1.0f);
+        return - 2.0f * std::log2(lod);
+    }
+
+    float projectedEdgeLength(const vec3 c[3])
+    {
+        float angle = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            vec3 a = c[i] - transforms_.cam_pos;
+            vec3 b = c[(i + 1) % 3] - transforms_.cam_pos;
+            angle = std::max(angle, std::atan2(glm::length(glm::cross(a, b)),
+                                               glm::dot(a, b)));
+        }
+        return angle * transforms_.P[1][1] * 0.5f * float(params_.screen_res);
+    }
+
+    float projectedToLod(const vec3 c[3], float key_lvl, float lod_scale)
+    {
+        float e = projectedEdgeLength(c) / std::exp2(float(params_.cpu_lod));
+        return std::max(key_lvl + 2.0f * std::log2(
+                            e / (params_.target_length * lod_scale)), 0.0f);
+    }
+
+    void projectedTessLvlWithParent(uvec4 key, float& lvl, float& parent_lvl)
+    {
+        vec4 c_mesh[3], pc_mesh[3];
+        ltree::lt_Node_n_Parent_to_MeshCorners(*mesh_data_, polygon_type_, key,
+                                               c_mesh, pc_mesh);
+        vec3 c[3], pc[3];
+        for (int i = 0; i < 3; ++i) {
+            c[i]  = vec3(transforms_.M * c_mesh[i]);
+            pc[i] = vec3(transforms_.M * pc_mesh[i]);
+            if (params_.displace_on) {
+                c[i].z = cam_height_;
+                pc[i].z = cam_height_;
+            }
+        }
+        float key_lvl = float(ltree64::lt_level_64(
+                                  ltree64::lt_nodeID_64(uvec2(key.x, key.y))));
+        float lod_scale = lodScale(key);
+        lvl        = projectedToLod(c, key_lvl, lod_scale);
+        parent_lvl = projectedToLod(pc, key_lvl - 1.0f, lod_scale);
+    }
+
+    void computeTessLvlWithParent(uvec4 key, float& lvl, float& parent_lvl)
+    {
+        if (params_.lod_projected) {
+            projectedTessLvlWithParent(key, lvl, parent_lvl);
+            return;
+        }
+        vec4 p_mesh, pp_mesh;
+        ltree::lt_Leaf_n_Parent_to_MeshPosition(*mesh_data_, polygon_type_,
+                                                triangle_centroid, key,
+                                                p_mesh, pp_mesh);
+        p_mesh  = transforms_.M * p_mesh;
+        pp_mesh = transforms_.M * pp_mesh;
+        if (params_.displace_on) {
+            p_mesh.z = cam_height_;
+            pp_mesh.z = cam_height_;
+        }
+
+        float lod_scale = lodScale(key);
+        lvl        = distanceToLod(vec3(p_mesh), lod_scale);
+        parent_lvl = distanceToLod(vec3(pp_mesh), lod_scale);
+    }
+
+    bool culltest(vec3 bmin, vec3 bmax)
+    {
+        bool inside = true;
+        for (int i = 0; i < 6; ++i) {
+            const vec4& plane = transforms_.frustum_planes[i];
+            vec3 n = vec3(plane.x > 0 ? bmax.x : bmin.x,
+                          plane.y > 0 ? bmax.y : bmin.y,
+                          plane.z > 0 ? bmax.z : bmin.z);
+            inside = inside && (glm::dot(vec4(n, 1.0), plane) >= 0);
+        }
+        return inside;
+    }
+
+    // Box of the flat triangle of a node
+    void flatBounds(const ltree::Triangle& mesh_t, const glm::mat3x2& xform,
+                    vec3& b_min, vec3& b_max)
+    {
+        b_min = vec3(FLT_MAX);
+        b_max = vec3(-FLT_MAX);
+        const vec2 corners[3] = {unit_O, unit_U, unit_R};
+        for (int i = 0; i < 3; ++i) {
+            vec3 p = vec3(ltree::lt_mapTo3DTriangle(mesh_t,
+                                                    xform * vec3(corners[i], 1)));
+            b_min = glm::min(b_min, p);
+            b_max = glm::max(b_max, p);
+        }
+    }
+
+    // Same as backfacing in bintree_compute.glsl
+    bool backfacing(uint triangleID, vec3 b_min, vec3 b_max)
+    {
+        const itpl::NormalCone& cone = params_.normal_cones[triangleID];
+        vec3 axis = vec3(cone.axis[0], cone.axis[1], cone.axis[2]);
+        vec3 d = 0.5f * (b_min + b_max) - cam_mesh_;
+        float r = 0.5f * glm::distance(b_min, b_max) + cone.bulge;
+        float dist = glm::length(d);
+        if (dist <= r)
+            return false;
+        float cos_phi = glm::dot(d, axis) / dist;
+        float sin_phi = std::sqrt(std::max(0.0f, 1.0f - cos_phi * cos_phi));
+        return dist * (cos_phi * cone.cos_angle - sin_phi * cone.sin_angle) > r;
+    }
+
+    // Same as refine_isCulled in bintree_compute.glsl
+    bool refineIsCulled(const ltree::Triangle& mesh_t, uint triangleID,
+                        const ltree64::Xform& xf)
+    {
+        vec3 b_min, b_max;
+        flatBounds(mesh_t, xf.toMat(), b_min, b_max);
+        if (params_.normal_cones && backfacing(triangleID, b_min, b_max))
+            return true;
+        if (!params_.cull_refine_on)
+            return false;
+        if (mesh_data_->base_map_res > 0) {
+            b_min += params_.base_map_min;
+            b_max += params_.base_map_max;
+        }
+        if (params_.displace_on) {
+            b_min.z = -max_height_;
+            b_max.z = max_height_;
+        }
+        return !culltest(b_min, b_max);
+    }
+
+    // Same as refine_applyCull in bintree_compute.glsl
+    void refineApplyCull(uvec4 key, int& targetLod, int& parentLod)
+    {
+        using namespace ltree64;
+        uint64 nodeID = lt_nodeID_64(uvec2(key.x, key.y));
+        XformPair xforms = lt_decodeTriangleXform_64(nodeID);
+        uint triangleID = ltree::lt_getTargetTriangleID(polygon_type_, key.z,
+                                                        key.w & 1u);
+        ltree::Triangle mesh_t;
+        ltree::lt_getIndexedTriangle(
+                    *mesh_data_, ltree::lt_getTargetTriangleIndices(
+                        *mesh_data_, polygon_type_, key.z, key.w & 1u),
+                    mesh_t);
+        if (!lt_isRoot_64(nodeID)
+                && refineIsCulled(mesh_t, triangleID, xforms.parent_xform)) {
+            parentLod = std::min(parentLod, params_.cull_floor);
+            targetLod = std::min(targetLod, params_.cull_floor);
+        } else if (refineIsCulled(mesh_t, triangleID, xforms.xform)) {
+            targetLod = std::min(targetLod, params_.cull_floor);
+        }
+    }
+
+    // GLSL's int() of the infinite level returned by distanceToLod when the
+    // camera sits on the node is undefined, and so is it in C++: clamp it
+    // above the deepest possible level instead
+    int toLod(float lvl)
+    {
+        return int(std::min(lvl, 64.0f));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Compute pass functions
+    ///
+
+    void compute_writeKey(uint64 new_nodeID, uvec4 current_key,
+                          ThreadOutput& out)
+    {
+        uvec2 nodeID = ltree64::lt_uvec2_64(new_nodeID);
+        out.full.push_back(uvec4(nodeID.x, nodeID.y,
+                                 current_key.z, current_key.w));
+    }
+
+    // Same as pool_reserveSplit in bintree_compute.glsl
+    bool reserveSplit(ThreadOutput& out)
+    {
+        if (split_count_.fetch_add(1, std::memory_order_relaxed) < split_budget_)
+            return true;
+        ++out.refused_splits;
+        return false;
+    }
+
+    void updateSubdBuffer(uvec4 key, int targetLod, int parentLod,
+                          ThreadOutput& out)
+    {
+        using namespace ltree64;
+        // extract subdivision level associated to the key
+        uint64 nodeID = lt_nodeID_64(uvec2(key.x, key.y));
+
+        int keyLod = int(lt_level_64(nodeID));
+
+        // update the key accordingly
+        if (/* subdivide ? */ keyLod < targetLod && !lt_isLeaf_64(nodeID)) {
+            if (reserveSplit(out)) {
+                Children children = lt_children_64(nodeID);
+                compute_writeKey(children.id[0], key, out);
+                compute_writeKey(children.id[1], key, out);
+            } else {
+                compute_writeKey(nodeID, key, out);
+            }
+        } else if (/* keep ? */ keyLod < (parentLod + 1)) {
+            compute_writeKey(nodeID, key, out);
+        } else /* merge ? */ {
+            if (/* is root ? */lt_isRoot_64(nodeID)) {
+                compute_writeKey(nodeID, key, out);
+            } else if (/* is zero child ? */lt_isZeroChild_64(nodeID)) {
+                compute_writeKey(lt_parent_64(nodeID), key, out);
+                ++out.merges;
+            }
+        }
+    }
+
+    // Same as rootCullPass in bintree_compute.glsl
+    bool isRootVisible(uvec4 key)
+    {
+        if (!params_.root_visibility)
+            return true;
+        uint triangleID = ltree::lt_getTargetTriangleID(polygon_type_, key.z,
+                                                        key.w & 1u);
+        return (params_.root_visibility[triangleID >> 5]
+                & (1u << (triangleID & 31u))) != 0u;
+    }
+
+    void collapseToRoot(uvec4 key, ThreadOutput& out)
+    {
+        using namespace ltree64;
+        uint64 nodeID = lt_nodeID_64(uvec2(key.x, key.y));
+        if (!lt_isZeroPath_64(nodeID))
+            return;
+        compute_writeKey(1u, key, out);
+        if (!lt_isRoot_64(nodeID))
+            ++out.merges;
+    }
+
+    void computePass(uvec4 key, ThreadOutput& out)
+    {
+        int parentLod, targetLod;
+
+        if (params_.uniform_on) {
+            targetLod = parentLod = params_.uniform_lvl;
+        } else {
+            float parentTargetLevel, targetLevel;
+            computeTessLvlWithParent(key, targetLevel, parentTargetLevel);
+            targetLod = toLod(targetLevel);
+            parentLod = toLod(parentTargetLevel);
+            if (params_.cull_on
+                    && (params_.cull_refine_on || params_.normal_cones))
+                refineApplyCull(key, targetLod, parentLod);
+        }
+
+        updateSubdBuffer(key, targetLod, parentLod, out);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Cull pass functions
+    ///
+
+    vec4 leafToMesh(vec2 p, const ltree::Triangle& mesh_t,
+                    const glm::mat3x2& xform, uint triangleID)
+    {
+        vec2 uv = xform * vec3(p, 1);
+        vec4 v = ltree::lt_mapTo3DTriangle(mesh_t, uv);
+        if (mesh_data_->base_map_res > 0)
+            v += vec4(ltree::lt_getBaseMapOffset(*mesh_data_, triangleID, uv),
+                      0.0f);
+        if (params_.displace_on)
+            v = noise::displaceVertex(v, transforms_.cam_pos,
+                                      params_.displace_factor);
+        return v;
+    }
+
+    void cull_writeKey(uvec4 key, uint key_idx, uint64 nodeID,
+                       const ltree64::Xform& xf, uvec3 vertexID,
+                       ThreadOutput& out)
+    {
+        if (params_.culled_indices) {
+            out.culled_idx.push_back(key_idx);
+            return;
+        }
+        RenderRecord record;
+        for (int i = 0; i < 3; ++i) {
+            record.xform[i] = vec2(xf.m[2*i], xf.m[2*i+1]);
+            record.vertexID[i] = vertexID[i];
+        }
+        record.level = ltree64::lt_level_64(nodeID);
+        record.triangleID = ltree::lt_getTargetTriangleID(polygon_type_,
+                                                          key.z, key.w & 1u);
+        record.align = 0;
+        out.records.push_back(record);
+    }
+
+    void cullPass(uvec4 key, uint key_idx, ThreadOutput& out)
+    {
+        using namespace ltree64;
+        uint64 nodeID = lt_nodeID_64(uvec2(key.x, key.y));
+        Xform xf = lt_decodeTriangleXform_64(nodeID).xform;
+        uvec3 vertexID = ltree::lt_getTargetTriangleIndices(
+                    *mesh_data_, polygon_type_, key.z, key.w & 1u);
+
+        if (!params_.cull_on) {
+            cull_writeKey(key, key_idx, nodeID, xf, vertexID, out);
+            return;
+        }
+        ltree::Triangle mesh_t;
+        ltree::lt_getIndexedTriangle(*mesh_data_, vertexID, mesh_t);
+        glm::mat3x2 xform = xf.toMat();
+
+        uint triangleID = ltree::lt_getTargetTriangleID(polygon_type_, key.z,
+                                                        key.w & 1u);
+        if (params_.normal_cones) {
+            vec3 f_min, f_max;
+            flatBounds(mesh_t, xform, f_min, f_max);
+            if (backfacing(triangleID, f_min, f_max))
+                return;
+        }
+        vec4 mesh_coord[3];
+        mesh_coord[0] = leafToMesh(unit_O, mesh_t, xform, triangleID);
+        mesh_coord[1] = leafToMesh(unit_R, mesh_t, xform, triangleID);
+        mesh_coord[2] = leafToMesh(unit_U, mesh_t, xform, triangleID);
+
+        vec4 b_min = glm::min(mesh_coord[0], glm::min(mesh_coord[1], mesh_coord[2]));
+        vec4 b_max = glm::max(mesh_coord[0], glm::max(mesh_coord[1], mesh_coord[2]));
+
+        if (culltest(vec3(b_min), vec3(b_max)))
+            cull_writeKey(key, key_idx, nodeID, xf, vertexID, out);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Merge of the per thread outputs
+    ///
+
+    /*
+     * Concatenates the per thread buffers in thread order: the prefix sum of
+     * the buffer sizes gives the offset of each thread in the output, so the
+     * copies are done in parallel without any synchronization
+     */
+    void mergeThreadOutputs()
+    {
+        size_t count = thread_outputs_.size();
+        vector<size_t> full_offsets(count + 1, 0), culled_offsets(count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            full_offsets[i + 1] = full_offsets[i] + thread_outputs_[i].full.size();
+            culled_offsets[i + 1] = culled_offsets[i]
+                                  + thread_outputs_[i].culled_idx.size()
+                                  + thread_outputs_[i].records.size();
+        }
+        nodes_out_full_.resize(full_offsets[count]);
+        nodes_out_culled_idx_.resize(params_.culled_indices ? culled_offsets[count] : 0);
+        render_records_.resize(params_.culled_indices ? 0 : culled_offsets[count]);
+
+        pool_.ParallelFor(count, 1, [&](int, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const ThreadOutput& out = thread_outputs_[i];
+                std::copy(out.full.begin(), out.full.end(),
+                          nodes_out_full_.begin() + full_offsets[i]);
+                std::copy(out.culled_idx.begin(), out.culled_idx.end(),
+                          nodes_out_culled_idx_.begin() + culled_offsets[i]);
+                std::copy(out.records.begin(), out.records.end(),
+                          render_records_.begin() + culled_offsets[i]);
+            }
+        });
+    }
+
+public:
+
+    /*
+     * Fills the initial key buffer with one root key per mesh triangle, or two
+     * per mesh quad, exactly like BinTree::initNodesBuffers
+     * With a level, each root is replaced by its 2^level descendants at that
+     * level, in the order of bintree_init.glsl
+     */
+    void Init(const Mesh_Data* m_data, int polygon_type, int level = 0)
+    {
+        mesh_data_ = m_data;
+        polygon_type_ = polygon_type;
+        nodes_in_.clear();
+        nodes_out_full_.clear();
+        nodes_out_culled_idx_.clear();
+        render_records_.clear();
+        if (polygon_type_ == TRIANGLES) {
+            for (int ctr = 0; ctr < mesh_data_->triangle_count; ++ctr)
+                nodes_in_.push_back(uvec4(0, 0x1, uint(ctr*3), 0));
+        } else if (polygon_type_ == QUADS) {
+            for (int ctr = 0; ctr < mesh_data_->quad_count; ++ctr) {
+                nodes_in_.push_back(uvec4(0, 0x1, uint(ctr*4), 0));
+                nodes_in_.push_back(uvec4(0, 0x1, uint(ctr*4), 1));
+            }
+        }
+        if (level == 0)
+            return;
+        vector<uvec4> roots;
+        roots.swap(nodes_in_);
+        nodes_in_.reserve(roots.size() << level);
+        for (size_t i = 0; i < roots.size(); ++i)
+            for (uint j = 0; j < (1u << level); ++j)
+                nodes_in_.push_back(uvec4(0, (1u << level) | j,
+                                          roots[i].z, roots[i].w));
+    }
+
+    /*
+     * Equivalent of one compute pass:
+     * - The subtree of a root outside the frustum (Params::root_visibility)
+     *   collapses to the root, without LoD nor cull test
+     * - Each key of the current tree is split, kept or merged
+     * - The keys of the current tree passing the frustum test get a render
+     *   record (or their index is stored, with Params::culled_indices)
+     * - The updated tree becomes the input of the next update
+     */
+    void Update(const TransformBlock& transforms, const Params& params)
+    {
+        transforms_ = transforms;
+        params_ = params;
+        if (params_.displace_on)
+            cam_height_ = noise::getHeight(vec2(transforms_.cam_pos),
+                                           float(params_.screen_res),
+                                           params_.displace_factor);
+        max_height_ = noise::maxHeight(params_.displace_factor);
+        // Last column of inverse(MV), see backfacing
+        cam_mesh_ = vec3(transforms_.invMV[0][3], transforms_.invMV[1][3],
+                         transforms_.invMV[2][3]);
+
+        thread_outputs_.resize(pool_.GetThreadCount());
+        for (size_t i = 0; i < thread_outputs_.size(); ++i) {
+            thread_outputs_[i].full.clear();
+            thread_outputs_[i].culled_idx.clear();
+            thread_outputs_[i].records.clear();
+            thread_outputs_[i].refused_splits = 0;
+            thread_outputs_[i].merges = 0;
+        }
+        split_count_ = 0;
+        split_budget_ = max_node_count_ > nodes_in_.size()
+                      ? max_node_count_ - nodes_in_.size() : 0;
+        pool_.ParallelFor(nodes_in_.size(), KEYS_PER_CHUNK,
+                          [&](int thread_id, size_t begin, size_t end) {
+            ThreadOutput& out = thread_outputs_[thread_id];
+            for (size_t i = begin; i < end; ++i) {
+                if (!isRootVisible(nodes_in_[i])) {
+                    collapseToRoot(nodes_in_[i], out);
+                    continue;
+                }
+                computePass(nodes_in_[i], out);
+                cullPass(nodes_in_[i], uint(i), out);
+            }
+        });
+        mergeThreadOutputs();
+        nodes_in_.swap(nodes_out_full_);
+
+        refused_split_count_ = 0;
+        merge_count_ = 0;
+        for (size_t i = 0; i < thread_outputs_.size(); ++i) {
+            refused_split_count_ += thread_outputs_[i].refused_splits;
+            merge_count_ += thread_outputs_[i].merges;
+        }
+        granted_split_count_ = std::min(size_t(split_count_), split_budget_);
+    }
+
+    // Number of threads used by Update, 0 uses all the hardware threads
+    void SetThreadCount(int count) { pool_.SetThreadCount(count); }
+
+    int GetThreadCount() const { return pool_.GetThreadCount(); }
+
+    // Size of the node pool: splits are refused past this number of keys
+    void SetMaxNodeCount(size_t count) { max_node_count_ = count; }
+
+    // Splits refused by the last update because the node pool was full
+    size_t GetRefusedSplitCount() const { return refused_split_count_; }
+
+    // Splits granted by the last update
+    size_t GetSplitCount() const { return granted_split_count_; }
+
+    // Pairs of sibling keys merged into their parent by the last update
+    size_t GetMergeCount() const { return merge_count_; }
+
+    // Keys split or merged by the last update: 0 once the tree has converged
+    size_t GetChangeCount() const { return granted_split_count_ + merge_count_; }
+
+    // Keys of the updated tree
+    const vector<uvec4>& GetFullNodes() const { return nodes_in_; }
+
+    // With Params::culled_indices, index of each key to render this frame in
+    // the keys the update was given (the previous GetFullNodes)
+    const vector<uint>& GetCulledIndices() const { return nodes_out_culled_idx_; }
+
+    // Render records of the keys to render this frame (empty with
+    // Params::culled_indices)
+    const vector<RenderRecord>& GetRenderRecords() const { return render_records_; }
+
+    // Number of keys to render this frame
+    size_t GetCulledCount() const
+    {
+        return render_records_.size() + nodes_out_culled_idx_.size();
+    }
+};
+
+#endif // BINTREE_CPU_H
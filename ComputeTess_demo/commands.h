@@ -15,6 +15,14 @@ enum {NODES_IN_B,
       MESH_T_IDX_B,
       LEAF_VERT_B,
       LEAF_IDX_B,
+      XFORM_LUT_B,
+      RENDER_RECORDS_B,
+      NODE_POOL_B,
+      PATCHES_B,
+      LOD_SCALES_B,
+      BASE_MAP_B,
+      ROOT_VISIBILITY_B,
+      NORMAL_CONES_B,
       BINDINGS_COUNT
      } Bindings;
 
@@ -43,11 +51,19 @@ private:
         DispatchIndirect,  // Dispatch command
         NodeCounterFull,   // Pingpong atomic counters for unculled nodes
         NodeCounterCulled, // Pingpong atomic counters for all nodes
+        NodePool,          // Split, merge and overflow counters of the node pool
         Proxy,              // Proxy buffer used to read back from GPU
+        ChangeReadback,    // Persistently mapped slots of the change counts
         BUFFER_COUNT
     };
 
-    GLuint buffers_[BUFFER_COUNT]; // Array of buffers
+    // Change counts in flight, read back without stalling (RequestChangeCount)
+    static const int CHANGE_SLOTS = 4;
+
+    GLuint buffers_[BUFFER_COUNT] = {}; // Array of buffers
+    const uint* change_counts_ = nullptr; // Mapping of ChangeReadback
+    GLsync change_fences_[CHANGE_SLOTS] = {};
+    uint change_requests_ = 0, change_reads_ = 0;
     DrawElementsIndirectCommand init_draw_;
     DispatchIndirectCommand     init_dispatch_;
 
@@ -62,16 +78,30 @@ private:
         utility::EmptyBuffer(&buffers_[NodeCounterCulled]);
         glCreateBuffers(1, &buffers_[NodeCounterCulled]);
         glNamedBufferStorage(buffers_[NodeCounterCulled], 2 * sizeof(uint),
-                             (const void*)&zeros, 0);
+                             (const void*)&zeros, GL_DYNAMIC_STORAGE_BIT);
 
         utility::EmptyBuffer(&buffers_[NodeCounterFull]);
         glCreateBuffers(1, &buffers_[NodeCounterFull]);
         glNamedBufferStorage(buffers_[NodeCounterFull], 2 * sizeof(uint),
-                             (const void*)&zeros, 0);
+                             (const void*)&zeros, GL_DYNAMIC_STORAGE_BIT);
 
         return (glGetError() == GL_NO_ERROR);
     }
 
+    // Loads the buffer of the node pool status:
+    // {split count, refused splits, dropped keys, last refused, last dropped,
+    //  merge count, last changes, occluded nodes, last occluded}
+    // the copy pass moves the counts of the compute pass to the last ones
+    bool loadPoolBuffer()
+    {
+        uint zeros[9] = {0};
+        utility::EmptyBuffer(&buffers_[NodePool]);
+        glCreateBuffers(1, &buffers_[NodePool]);
+        glNamedBufferStorage(buffers_[NodePool], 9 * sizeof(uint),
+                             (const void*)&zeros, GL_DYNAMIC_STORAGE_BIT);
+        return (glGetError() == GL_NO_ERROR);
+    }
+
     bool loadProxyBuffer()
     {
         utility::EmptyBuffer(&buffers_[Proxy]);
@@ -83,6 +113,28 @@ private:
 
     }
 
+    // Loads the slots of the change counts, mapped once for their lifetime,
+    // and drops the requests still in flight
+    bool loadChangeReadbackBuffer()
+    {
+        for (GLsync& fence : change_fences_) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+        change_requests_ = change_reads_ = 0;
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT
+                               | GL_MAP_COHERENT_BIT;
+        utility::EmptyBuffer(&buffers_[ChangeReadback]);
+        glCreateBuffers(1, &buffers_[ChangeReadback]);
+        glNamedBufferStorage(buffers_[ChangeReadback],
+                             CHANGE_SLOTS * sizeof(uint), NULL, flags);
+        change_counts_ = (const uint*) glMapNamedBufferRange(
+                    buffers_[ChangeReadback], 0, CHANGE_SLOTS * sizeof(uint),
+                    flags);
+        return (glGetError() == GL_NO_ERROR);
+    }
+
     bool loadDrawCommandBuffers()
     {
         utility::EmptyBuffer(&buffers_[DrawIndirect]);
@@ -105,20 +157,26 @@ private:
     {
         bool b = true;
         b &= loadProxyBuffer();
+        b &= loadChangeReadbackBuffer();
         b &= loadCounterBuffers();
+        b &= loadPoolBuffer();
         b &= loadDrawCommandBuffers();
         b &= loadComputeCommandBuffer();
         return b;
     }
 
 public:
-    void Init(uint leaf_num_idx, uint num_workgroup)
+    // node_count is the number of keys written in the node buffers, when
+    // there are more than the root keys the compute pass expects
+    void Init(uint leaf_num_idx, uint num_workgroup, uint node_count = 0)
     {
         num_idx_ = leaf_num_idx;
         init_draw_  = { GLuint(num_idx_),  0 , 0, 0, 0, uvec3(0)};
         init_dispatch_ = { GLuint(num_workgroup), 1, 1 };
         counters_read  = 0;
         loadCommandBuffers();
+        glNamedBufferSubData(buffers_[NodeCounterFull], 0, sizeof(uint),
+                             &node_count);
     }
 
     // Binds the relevant buffers for the compute pass
@@ -130,10 +188,37 @@ public:
                          buffers_[NodeCounterFull]);
         glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, NODECOUNTER_CULLED_B,
                          buffers_[NodeCounterCulled]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_POOL_B,
+                         buffers_[NodePool]);
         glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffers_[DispatchIndirect]);
         counters_read   = 1 - counters_read;
     }
 
+    // Writes the node counts produced by the CPU backend where the compute
+    // pass would have incremented its atomic counters
+    // Updates the pingpong index
+    void SetNodeCounts(uint full_count, uint culled_count)
+    {
+        glNamedBufferSubData(buffers_[NodeCounterFull],
+                             sizeof(uint) * (1 - counters_read),
+                             sizeof(uint), &full_count);
+        glNamedBufferSubData(buffers_[NodeCounterCulled],
+                             sizeof(uint) * (1 - counters_read),
+                             sizeof(uint), &culled_count);
+        counters_read   = 1 - counters_read;
+    }
+
+    // Writes the split requests, refused splits, dropped keys and merges of
+    // the CPU backend where the compute pass would have counted them
+    void SetPoolStatus(uint split_count, uint refused_count, uint dropped_count,
+                       uint merge_count)
+    {
+        uint counts[3] = {split_count, refused_count, dropped_count};
+        glNamedBufferSubData(buffers_[NodePool], 0, 3 * sizeof(uint), &counts);
+        glNamedBufferSubData(buffers_[NodePool], 5 * sizeof(uint), sizeof(uint),
+                             &merge_count);
+    }
+
     // Binds the relevant buffers for the copy pass
     void BindForCopy(GLuint program)
     {
@@ -146,6 +231,8 @@ public:
                          buffers_[DispatchIndirect]);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_INDIRECT_B,
                          buffers_[DrawIndirect]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_POOL_B,
+                         buffers_[NodePool]);
     }
 
     // Binds the relevant buffers for the render pass
@@ -174,6 +261,76 @@ public:
         return data[0];
     }
 
+    // Return the splits refused and the keys dropped by the last compute pass
+    // because the node pool was full
+    void GetPoolStatus(uint& refused_count, uint& dropped_count)
+    {
+        glCopyNamedBufferSubData(buffers_[NodePool], buffers_[Proxy],
+                                 3 * sizeof(uint), 0, 2 * sizeof(uint));
+        uint* data = (uint*) glMapNamedBuffer(buffers_[Proxy], GL_READ_ONLY);
+        refused_count = data[0];
+        dropped_count = data[1];
+        glUnmapNamedBuffer(buffers_[Proxy]);
+    }
+
+    // Return the number of keys split or merged by the last compute pass,
+    // 0 once the tree has converged
+    uint GetChangeCount()
+    {
+        glCopyNamedBufferSubData(buffers_[NodePool], buffers_[Proxy],
+                                 6 * sizeof(uint), 0, sizeof(uint));
+        uint* data = (uint*) glMapNamedBuffer(buffers_[Proxy], GL_READ_ONLY);
+        uint count = data[0];
+        glUnmapNamedBuffer(buffers_[Proxy]);
+        return count;
+    }
+
+    // Queues the read back of the change count of the last compute pass,
+    // without waiting for it (see PollChangeCount)
+    // Returns false when CHANGE_SLOTS requests are already in flight
+    bool RequestChangeCount()
+    {
+        if (change_requests_ - change_reads_ == CHANGE_SLOTS)
+            return false;
+        int slot = change_requests_ % CHANGE_SLOTS;
+        glCopyNamedBufferSubData(buffers_[NodePool], buffers_[ChangeReadback],
+                                 6 * sizeof(uint), slot * sizeof(uint),
+                                 sizeof(uint));
+        change_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ++change_requests_;
+        return true;
+    }
+
+    // Reads the oldest change count requested, if the GPU has written it
+    // Returns false when it is not ready yet, or when none was requested
+    bool PollChangeCount(uint& count)
+    {
+        if (change_reads_ == change_requests_)
+            return false;
+        int slot = change_reads_ % CHANGE_SLOTS;
+        GLenum status = glClientWaitSync(change_fences_[slot],
+                                         GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(change_fences_[slot]);
+        change_fences_[slot] = 0;
+        count = change_counts_[slot];
+        ++change_reads_;
+        return true;
+    }
+
+    // Return the number of nodes in the frustum that the last compute pass
+    // did not draw because the depth pyramid hid them (FLAG_OCCLUSION)
+    uint GetOccludedCount()
+    {
+        glCopyNamedBufferSubData(buffers_[NodePool], buffers_[Proxy],
+                                 8 * sizeof(uint), 0, sizeof(uint));
+        uint* data = (uint*) glMapNamedBuffer(buffers_[Proxy], GL_READ_ONLY);
+        uint count = data[0];
+        glUnmapNamedBuffer(buffers_[Proxy]);
+        return count;
+    }
+
     // Print the number of workgroup in the Dispatch command buffer
     void PrintWGCountInDispatch()
     {
@@ -187,6 +344,11 @@ public:
 
     void Cleanup()
     {
+        for (GLsync& fence : change_fences_) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
         for (int i = 0; i < BUFFER_COUNT; ++i)
             utility::EmptyBuffer(&buffers_[i]);
     }
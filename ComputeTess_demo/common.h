@@ -14,6 +14,7 @@
 #include <sstream>
 #include <algorithm>
 #include <map>
+#include <memory>
 #include <cmath>
 
 #include "glad/glad.h"
@@ -43,6 +44,7 @@ const char* shader_dir = "../ComputeTess_demo/shaders/";
 using glm::vec2;
 using glm::vec3;
 using glm::vec4;
+using glm::uvec2;
 using glm::uvec3;
 using glm::uvec4;
 using glm::mat3;
@@ -84,6 +86,50 @@ enum { LINEAR,
        PHONG
      } ItplTypes;
 
+enum { BACKEND_GPU,
+       BACKEND_CPU,
+       NUM_BACKENDS
+     } Backends;
+
+enum { KEYS_UVEC4,  // (nodeID msb, nodeID lsb, first mesh index, root ID)
+       KEYS_PACKED, // (nodeID msb, nodeID lsb, polygon ID << 1 | root ID)
+       NUM_KEY_LAYOUTS
+     } KeyLayouts;
+
+enum { KEY_BITS_AUTO, // 32 bits when the predicted depth allows it
+       KEY_BITS_32,   // FLAG_KEY32, at most 31 levels
+       KEY_BITS_64,
+       NUM_KEY_BITS
+     } KeyBits;
+
+enum { CULLED_RECORDS, // The cull pass writes the render record of the keys
+       CULLED_INDICES, // The cull pass stores their index in the key buffer,
+                       // the render pass decodes the keys
+       NUM_CULLED_LISTS
+     } CulledLists;
+
+enum { CONVERGE_OFF,      // One update per frame: one level of splits or merges
+       CONVERGE_ON_RESET, // Update until the tree is stable after a reset
+       CONVERGE_ALWAYS,   // Update until the tree is stable every frame
+       NUM_CONVERGE_MODES
+     } ConvergeModes;
+
+enum { VERTEX_FLOAT,     // Vertex: vec4 position, vec4 normal, vec2 uv (48 B)
+       VERTEX_QUANTIZED, // uvec4 of meshutils::QuantizeVertex (16 B)
+       NUM_VERTEX_FORMATS
+     } VertexFormats;
+
+enum { LOD_SCALE_GLOBAL,    // All the polygons sized by avg_e_length
+       LOD_SCALE_EDGE,      // Per polygon scale from its edge length
+       LOD_SCALE_CURVATURE, // and from its curvature
+       NUM_LOD_SCALES
+     } LodScales;
+
+enum { LOD_DISTANCE,  // Level from the distance of the camera to the node
+       LOD_PROJECTED, // from the projected length of its edges
+       NUM_LOD_METRICS
+     } LodMetrics;
+
 // Represents a buffer
 struct BufferData {
     GLuint bo;        // buffer object
@@ -120,24 +166,85 @@ struct Vertex
     }
 };
 
+// Transforms shared by the whole render pipeline
+// Mirrors the std140 uniform block declared in LoD.glsl
+struct TransformBlock
+{
+    mat4 M     = mat4(1.0);
+    mat4 V     = mat4(1.0);
+    mat4 P     = mat4(1.0);
+    mat4 MVP   = mat4(1.0);
+    mat4 MV    = mat4(1.0);
+    mat4 invMV = mat4(1.0);
+    vec4 frustum_planes[6];
+
+    vec3 cam_pos = vec3(1.0);
+    float fovy = 55.0;
+};
+
+// Per instance data of the render pass, written by the cull pass
+// Same std430 layout as the RenderRecord struct of ltree_jk.glsl
+struct RenderRecord
+{
+    vec2 xform[3];     // columns of the triangle xform of the node
+    uint vertexID[3];  // mesh vertices of the target triangle
+    uint level;        // subdivision level of the node
+    uint triangleID;   // target triangle, index of its interpolation patch
+    uint align;
+};
+static_assert(sizeof(RenderRecord) == 48, "RenderRecord must match std430");
+
+// Sample of the input surface over a triangle of a simplified base mesh
+// Same std430 layout as the BaseMapSample struct of ltree_jk.glsl
+struct BaseMapSample
+{
+    float offset[3]; // from the point of the base triangle to the surface
+    uint normal;     // octahedral snorm2x16 normal of the surface
+};
+static_assert(sizeof(BaseMapSample) == 16, "BaseMapSample must match std430");
+
 // Stores all data necessary to represent a mesh
 struct Mesh_Data
 {
-    Vertex* v_array;   // Array of vertices
-    uint* q_idx_array; // Array of indices for quad meshes
-    uint* t_idx_array; // Array of indices for triangle meshes
+    Vertex* v_array = NULL;   // Array of vertices
+    uint* q_idx_array = NULL; // Array of indices for quad meshes
+    uint* t_idx_array = NULL; // Array of indices for triangle meshes
 
     BufferData v, q_idx, t_idx; // Buffers for vertices, quad & triangle indices
     int triangle_count = 0, quad_count = 0;
     float avg_e_length;
 
+    // Base map of a simplified mesh (meshutils::BuildBaseMap): the samples
+    // of each triangle on a grid of base_map_res segments per edge, none
+    // for the meshes used as they are
+    vector<BaseMapSample> base_map_array;
+    BufferData base_map;
+    uint base_map_res = 0;
+
+    // Read only mapping of a .tessmesh cache the arrays point into, instead
+    // of arrays allocated with new[]
+    std::shared_ptr<const void> mapping;
+
     void CleanUp() {
         utility::EmptyBuffer(&v.bo);
         utility::EmptyBuffer(&t_idx.bo);
         utility::EmptyBuffer(&q_idx.bo);
-        delete v_array;
-        delete q_idx_array;
-        delete t_idx_array;
+        utility::EmptyBuffer(&base_map.bo);
+        FreeArrays();
+    }
+
+    void FreeArrays() {
+        if (!mapping) {
+            delete[] v_array;
+            delete[] q_idx_array;
+            delete[] t_idx_array;
+        }
+        mapping.reset();
+        v_array = NULL;
+        q_idx_array = NULL;
+        t_idx_array = NULL;
+        vector<BaseMapSample>().swap(base_map_array);
+        base_map_res = 0;
     }
 };
 
@@ -0,0 +1,364 @@
+#ifndef INTERPOLATION_CPU_H
+#define INTERPOLATION_CPU_H
+
+#include "common.h"
+#include "ltree_cpu.h"
+#include "thread_pool.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Patch setup of PN_interpolation.glsl and phong_interpolation.glsl, done
+/// once per target triangle of the mesh (a mesh triangle, or half a quad)
+/// instead of by every vertex of every instance.
+/// The render pass reads the coefficients at the triangleID of its record,
+/// and takes the other terms of the patches from the triangle vertices.
+/// The formulas are the ones the shaders used, but the compiler and the
+/// driver are free to round them differently (fused multiply adds, divisions
+/// and normalizations by reciprocals), so the patches may move by an ulp or
+/// so from what the shaders computed.
+///
+
+namespace itpl {
+
+// Coefficients of the PN triangle that do not come straight from its
+// vertices (std430 layout of PnCoeffs in PN_interpolation.glsl)
+struct PnCoeffs {
+    float b[21]; // b210, b120, b021, b012, b102, b201, b111
+    float n[9];  // n110, n011, n101
+};
+static_assert(sizeof(PnCoeffs) == 120, "PnCoeffs must match std430");
+
+// Edge terms of the Phong patch (std430 layout of PhongCoeffs in
+// phong_interpolation.glsl)
+struct PhongCoeffs {
+    float term[9]; // termIJ, termJK, termIK
+};
+static_assert(sizeof(PhongCoeffs) == 36, "PhongCoeffs must match std430");
+
+inline void store(float* dst, vec3 v)
+{
+    dst[0] = v.x;
+    dst[1] = v.y;
+    dst[2] = v.z;
+}
+
+inline float wij(vec3 pi, vec3 pj, vec3 ni)
+{
+    return glm::dot(pj - pi, ni);
+}
+
+inline float vij(vec3 pi, vec3 pj, vec3 ni, vec3 nj)
+{
+    vec3 Pj_minus_Pi = pj - pi;
+    vec3 Ni_plus_Nj  = ni + nj;
+    return 2.0f * glm::dot(Pj_minus_Pi, Ni_plus_Nj)
+         / glm::dot(Pj_minus_Pi, Pj_minus_Pi);
+}
+
+// Same control points and normals as the getPnPatch of the GLSL code
+inline PnCoeffs GetPnCoeffs(const ltree::Triangle& t)
+{
+    vec3 P0 = vec3(t.vertex[0].p), N0 = vec3(t.vertex[0].n);
+    vec3 P1 = vec3(t.vertex[1].p), N1 = vec3(t.vertex[1].n);
+    vec3 P2 = vec3(t.vertex[2].p), N2 = vec3(t.vertex[2].n);
+
+    vec3 b[7];
+    b[0] = (2.0f*P0 + P1 - wij(P0,P1,N0)*N0) / 3.0f; // b210
+    b[1] = (2.0f*P1 + P0 - wij(P1,P0,N1)*N1) / 3.0f; // b120
+    b[2] = (2.0f*P1 + P2 - wij(P1,P2,N1)*N1) / 3.0f; // b021
+    b[3] = (2.0f*P2 + P1 - wij(P2,P1,N2)*N2) / 3.0f; // b012
+    b[4] = (2.0f*P2 + P0 - wij(P2,P0,N2)*N2) / 3.0f; // b102
+    b[5] = (2.0f*P0 + P2 - wij(P0,P2,N0)*N0) / 3.0f; // b201
+    vec3 E = (b[0] + b[1] + b[2] + b[3] + b[4] + b[5]) / 6.0f;
+    vec3 V = (P0 + P1 + P2) / 3.0f;
+    b[6] = E + (E - V) * 0.5f;                       // b111
+
+    PnCoeffs c;
+    for (int i = 0; i < 7; ++i)
+        store(&c.b[3*i], b[i]);
+    store(&c.n[0], glm::normalize(N0 + N1 - vij(P0,P1,N0,N1) * (P1-P0)));
+    store(&c.n[3], glm::normalize(N1 + N2 - vij(P1,P2,N1,N2) * (P2-P1)));
+    store(&c.n[6], glm::normalize(N2 + N0 - vij(P2,P0,N2,N0) * (P0-P2)));
+    return c;
+}
+
+inline vec3 PIi(vec3 pi, vec3 ni, vec3 q)
+{
+    vec3 q_minus_p = q - pi;
+    return q - glm::dot(q_minus_p, ni) * ni;
+}
+
+// Same terms as the getPhongPatch of the GLSL code
+inline PhongCoeffs GetPhongCoeffs(const ltree::Triangle& t)
+{
+    vec3 Pi = vec3(t.vertex[0].p), Ni = vec3(t.vertex[0].n);
+    vec3 Pj = vec3(t.vertex[1].p), Nj = vec3(t.vertex[1].n);
+    vec3 Pk = vec3(t.vertex[2].p), Nk = vec3(t.vertex[2].n);
+
+    PhongCoeffs c;
+    store(&c.term[0], PIi(Pi, Ni, Pj) + PIi(Pj, Nj, Pi));
+    store(&c.term[3], PIi(Pj, Nj, Pk) + PIi(Pk, Nk, Pj));
+    store(&c.term[6], PIi(Pk, Nk, Pi) + PIi(Pi, Ni, Pk));
+    return c;
+}
+
+// Number of target triangles, i.e. of patches
+inline uint TargetTriangleCount(const Mesh_Data& mesh, int polygon_type)
+{
+    return (polygon_type == TRIANGLES) ? mesh.triangle_count
+                                       : 2 * mesh.quad_count;
+}
+
+/*
+ * Coefficients of all the target triangles of the mesh, in triangleID order
+ * (see lt_getTargetTriangleID), computed on thread_count threads, 0 for all
+ * the hardware threads
+ */
+template <typename Coeffs>
+void ComputePatches(const Mesh_Data& mesh, int polygon_type,
+                    Coeffs (*get)(const ltree::Triangle&),
+                    vector<Coeffs>& patches, int thread_count = 0)
+{
+    patches.resize(TargetTriangleCount(mesh, polygon_type));
+    int verts_per_polygon = (polygon_type == TRIANGLES) ? 3 : 4;
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    pool.ParallelFor(patches.size(), 1 << 12,
+                     [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            // Triangles: one root each, quads: roots 0 and 1
+            uint polygon = (polygon_type == TRIANGLES) ? uint(i) : uint(i / 2);
+            uint rootID = (polygon_type == TRIANGLES) ? 0u : uint(i & 1);
+            ltree::Triangle t;
+            ltree::lt_getIndexedTriangle(
+                        mesh, ltree::lt_getTargetTriangleIndices(
+                            mesh, polygon_type, polygon * verts_per_polygon,
+                            rootID), t);
+            patches[i] = get(t);
+        }
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Normal cones of the target triangles, for the backface test of the
+/// compute pass (FLAG_BACKFACE)
+/// The surface over a target triangle is its flat triangle F plus a
+/// deviation D: the PN or Phong patch minus F, or the base map offsets.
+/// D is given by a triangular net of samples (i, j) at uv = (i, j) / n,
+/// D being the Bezier patch of the net (PN: n = 3, Phong: n = 2) or its
+/// piecewise linear interpolation (base map: n = base_map_res), so that
+/// |D| and its derivatives are bounded by the samples and their differences.
+///
+
+// Outward normals of the surface over a target triangle, of its rendered
+// facets at any level included, and bound of its distance to the flat
+// triangle (std430 layout of NormalCone in bintree_compute.glsl)
+struct NormalCone {
+    float axis[3];   // Outward normal of the flat triangle
+    float cos_angle; // Half angle of the cone, 90 degrees when the surface
+    float sin_angle; // may face any direction
+    float bulge;     // Largest distance of the surface to the flat triangle
+    float align[2];
+};
+static_assert(sizeof(NormalCone) == 32, "NormalCone must match std430");
+
+// Index of the sample (i, j) of a deviation net of n segments per edge, in
+// the order of lt_baseMapIndex
+inline uint NetIndex(int n, int i, int j)
+{
+    return uint(j * (n + 1) - j * (j - 1) / 2 + i);
+}
+
+/*
+ * Cone of the surface F + D of the triangle t, D given by the net of n
+ * segments per edge, interpolated linearly in each cell of the net when
+ * piecewise_linear is set (the base map), else the Bezier patch of the net.
+ * orientation is 1 when the triangles of the mesh turn counterclockwise
+ * around their outward normal, else -1
+ * The facets of the tree are right isosceles triangles of uv, with legs a
+ * and b along (u, v) or along the diagonals (u + v, u - v). Their edges are
+ * F(a) + dA and F(b) + dB, where |dA| <= |a| m_a bounds the derivatives of
+ * D along a, so their normal is cross(F(a), F(b)) plus at most
+ * |a| |b| (|F(a)| m_b + m_a |F(b)| + m_a m_b), which bounds the sine of its
+ * angle with the axis
+ */
+inline NormalCone GetNormalCone(const ltree::Triangle& t, const vec3* net,
+                                int n, bool piecewise_linear,
+                                float orientation)
+{
+    vec3 P0 = vec3(t.vertex[0].p), P1 = vec3(t.vertex[1].p),
+         P2 = vec3(t.vertex[2].p);
+    vec3 Fs = P2 - P0, Ft = P1 - P0;
+    vec3 N = orientation * glm::cross(Ft, Fs);
+    float area2 = glm::length(N);
+
+    // Largest derivatives of D along u, v, u + v and u - v
+    float bulge = 0.0f, ms = 0.0f, mt = 0.0f, mp = 0.0f, mq = 0.0f;
+    for (int j = 0; j <= n; ++j)
+        for (int i = 0; i + j <= n; ++i) {
+            vec3 d = net[NetIndex(n, i, j)];
+            bulge = std::max(bulge, glm::length(d));
+            if (i + j == n)
+                continue;
+            vec3 ds = net[NetIndex(n, i + 1, j)] - d;
+            vec3 dt = net[NetIndex(n, i, j + 1)] - d;
+            ms = std::max(ms, glm::length(ds));
+            mt = std::max(mt, glm::length(dt));
+            mp = std::max(mp, glm::length(ds + dt));
+            mq = std::max(mq, glm::length(ds - dt));
+            // Upper cell of the net, (i + 1, j + 1) (i, j + 1) (i + 1, j)
+            if (piecewise_linear && i + j + 2 <= n) {
+                vec3 d11 = net[NetIndex(n, i + 1, j + 1)];
+                mp = std::max(mp, glm::length(2.0f * d11 - ds - dt - 2.0f * d));
+            }
+        }
+    ms *= float(n);
+    mt *= float(n);
+    mp *= float(n);
+    mq *= float(n);
+    // cross(Fs + Ft, Fs - Ft) has twice the length of cross(Fs, Ft)
+    float sin_uv = (glm::length(Fs) * mt + ms * glm::length(Ft) + ms * mt)
+                 / area2;
+    float sin_pq = (glm::length(Fs + Ft) * mq + mp * glm::length(Fs - Ft)
+                    + mp * mq) / (2.0f * area2);
+    // Margin for the rounding of the positions (and their quantization)
+    const float EPSILON = 1e-3f;
+    float sin_angle = std::max(sin_uv, sin_pq) + EPSILON;
+
+    NormalCone c = {};
+    if (area2 > 0.0f && sin_angle < 1.0f) {
+        store(c.axis, N / area2);
+        c.sin_angle = sin_angle;
+        c.cos_angle = std::sqrt(1.0f - sin_angle * sin_angle);
+    } else {
+        c.sin_angle = 1.0f;
+    }
+    c.bulge = bulge + EPSILON * (glm::length(Fs) + glm::length(Ft));
+    return c;
+}
+
+// PN patch of alpha 1 minus its flat triangle, as a net of 3 segments
+inline void GetPnDeviation(const ltree::Triangle& t, const PnCoeffs& pn,
+                           vec3 net[10])
+{
+    vec3 P[3] = {vec3(t.vertex[0].p), vec3(t.vertex[1].p),
+                 vec3(t.vertex[2].p)};
+    // Exponents of P0, P1 and P2 of b210, b120, b021, b012, b102, b201, b111
+    const int e[7][3] = {{2,1,0}, {1,2,0}, {0,2,1}, {0,1,2}, {1,0,2},
+                         {2,0,1}, {1,1,1}};
+    for (int k = 0; k < 10; ++k)
+        net[k] = vec3(0.0f);
+    for (int k = 0; k < 7; ++k) {
+        vec3 b = vec3(pn.b[3*k], pn.b[3*k+1], pn.b[3*k+2]);
+        vec3 flat = (float(e[k][0]) * P[0] + float(e[k][1]) * P[1]
+                     + float(e[k][2]) * P[2]) / 3.0f;
+        // u weighs P2 and v weighs P1
+        net[NetIndex(3, e[k][2], e[k][1])] = b - flat;
+    }
+}
+
+// Phong patch of alpha 1 (blended half way, see Interpolate_phong) minus its
+// flat triangle, as a net of 2 segments
+inline void GetPhongDeviation(const ltree::Triangle& t,
+                              const PhongCoeffs& phong, vec3 net[6])
+{
+    vec3 P[3] = {vec3(t.vertex[0].p), vec3(t.vertex[1].p),
+                 vec3(t.vertex[2].p)};
+    for (int k = 0; k < 6; ++k)
+        net[k] = vec3(0.0f);
+    // termIJ, termJK, termIK: edges P0P1, P1P2, P2P0
+    const int e[3][2] = {{0,1}, {1,2}, {2,0}};
+    const glm::ivec2 ij[3] = {glm::ivec2(0,1), glm::ivec2(1,1), glm::ivec2(1,0)};
+    for (int k = 0; k < 3; ++k) {
+        vec3 term = vec3(phong.term[3*k], phong.term[3*k+1], phong.term[3*k+2]);
+        vec3 flat = 0.5f * (P[e[k][0]] + P[e[k][1]]);
+        net[NetIndex(2, ij[k].x, ij[k].y)] = 0.5f * (0.5f * term - flat);
+    }
+}
+
+/*
+ * 1 when most of the area of the mesh turns counterclockwise around the
+ * normals of its vertices, else -1. Without vertex normals, 1 when the
+ * signed volume of the mesh is positive (counterclockwise seen from outside)
+ */
+inline float MeshOrientation(const Mesh_Data& mesh, int polygon_type)
+{
+    double sum = 0.0, volume = 0.0;
+    uint count = TargetTriangleCount(mesh, polygon_type);
+    int verts_per_polygon = (polygon_type == TRIANGLES) ? 3 : 4;
+    for (uint i = 0; i < count; ++i) {
+        uint polygon = (polygon_type == TRIANGLES) ? i : i / 2;
+        uint rootID = (polygon_type == TRIANGLES) ? 0u : (i & 1u);
+        ltree::Triangle t;
+        ltree::lt_getIndexedTriangle(
+                    mesh, ltree::lt_getTargetTriangleIndices(
+                        mesh, polygon_type, polygon * verts_per_polygon,
+                        rootID), t);
+        vec3 N = glm::cross(vec3(t.vertex[1].p - t.vertex[0].p),
+                            vec3(t.vertex[2].p - t.vertex[0].p));
+        vec3 n = vec3(t.vertex[0].n + t.vertex[1].n + t.vertex[2].n);
+        sum += glm::dot(N, n);
+        volume += glm::dot(vec3(t.vertex[0].p), N);
+    }
+    if (sum == 0.0)
+        sum = volume;
+    return (sum >= 0.0) ? 1.0f : -1.0f;
+}
+
+/*
+ * Normal cones of all the target triangles of the mesh, in triangleID order,
+ * for the surface drawn with itpl_type (with an alpha of 1, the widest), or
+ * with the base map of the mesh when it has one
+ */
+inline void ComputeNormalCones(const Mesh_Data& mesh, int polygon_type,
+                               int itpl_type, vector<NormalCone>& cones,
+                               int thread_count = 0)
+{
+    cones.resize(TargetTriangleCount(mesh, polygon_type));
+    float orientation = MeshOrientation(mesh, polygon_type);
+    int verts_per_polygon = (polygon_type == TRIANGLES) ? 3 : 4;
+    int n = int(mesh.base_map_res);
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    pool.ParallelFor(cones.size(), 1 << 10,
+                     [&](int, size_t begin, size_t end) {
+        vector<vec3> net;
+        for (size_t i = begin; i < end; ++i) {
+            uint polygon = (polygon_type == TRIANGLES) ? uint(i) : uint(i / 2);
+            uint rootID = (polygon_type == TRIANGLES) ? 0u : uint(i & 1);
+            ltree::Triangle t;
+            ltree::lt_getIndexedTriangle(
+                        mesh, ltree::lt_getTargetTriangleIndices(
+                            mesh, polygon_type, polygon * verts_per_polygon,
+                            rootID), t);
+            if (n > 0) {
+                net.resize((n + 1) * (n + 2) / 2);
+                const BaseMapSample* s = &mesh.base_map_array[
+                        ltree::lt_baseMapIndex(mesh.base_map_res, uint(i), 0, 0)];
+                for (size_t k = 0; k < net.size(); ++k)
+                    net[k] = vec3(s[k].offset[0], s[k].offset[1],
+                                  s[k].offset[2]);
+                cones[i] = GetNormalCone(t, net.data(), n, true, orientation);
+            } else if (itpl_type == PN) {
+                net.resize(10);
+                GetPnDeviation(t, GetPnCoeffs(t), net.data());
+                cones[i] = GetNormalCone(t, net.data(), 3, false,
+                                         orientation);
+            } else if (itpl_type == PHONG) {
+                net.resize(6);
+                GetPhongDeviation(t, GetPhongCoeffs(t), net.data());
+                cones[i] = GetNormalCone(t, net.data(), 2, false,
+                                         orientation);
+            } else {
+                net.assign(1, vec3(0.0f));
+                cones[i] = GetNormalCone(t, net.data(), 0, false,
+                                         orientation);
+            }
+        }
+    });
+}
+
+} // namespace itpl
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef LTREE64_H
+#define LTREE64_H
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Key algebra of ltree_jk.glsl on native 64 bit integers.
+/// The GLSL version simulates the 64 bit nodeID with a uvec2 and carries the
+/// shifted bits by hand; on the CPU a nodeID is a single uint64, and the
+/// level comes from a count leading zeros instruction instead of a findMSB
+/// loop.
+/// Everything is constexpr (C++11 flavour: single return statements), so it
+/// can be evaluated at compile time, e.g. to build tables; the triangle xforms
+/// also have a plain loop version for runtime use.
+/// The triangle xforms are composed in the exact same order as in the GLSL
+/// code, so that the results match the uvec2 port of ltree_cpu.h bit for bit.
+/// They can also be decoded from a table of the xforms of all the keys up to
+/// LT_XFORM_LUT_BITS levels, composing one matrix per chunk of
+/// LT_XFORM_LUT_BITS bits instead of one per bit (see lt_xformLUT_64).
+///
+
+// Chunk size of the table driven triangle xforms, 4 or 8 bits, 0 to decode
+// them bit by bit like ltree_jk.glsl does
+// Also selects FLAG_XFORM_LUT for the GPU programs (see BinTree)
+#ifndef LT_XFORM_LUT_BITS
+#define LT_XFORM_LUT_BITS 0
+#endif
+
+static_assert(LT_XFORM_LUT_BITS == 0 || LT_XFORM_LUT_BITS == 4 ||
+              LT_XFORM_LUT_BITS == 8, "LT_XFORM_LUT_BITS must be 0, 4 or 8");
+
+namespace ltree64 {
+
+// ---------------------------- uvec2 conversion ---------------------------- //
+
+// xy of the keys stored in the node buffers, x holds the msb
+constexpr uint64 lt_nodeID_64(uvec2 nodeID) {
+    return (uint64(nodeID.x) << 32) | uint64(nodeID.y);
+}
+
+inline uvec2 lt_uvec2_64(uint64 nodeID) {
+    return uvec2(uint(nodeID >> 32), uint(nodeID));
+}
+
+// ------------------------------- Packed keys ------------------------------ //
+
+// 12 bytes key layout of FLAG_KEY_PACKED: the first mesh index of the polygon
+// and the root ID are replaced by polygon ID << 1 | root ID
+inline uvec3 lt_packKey_64(uvec4 key, int polygon_type)
+{
+    uint polygonID = (polygon_type == QUADS) ? key.z / 4u : key.z / 3u;
+    return uvec3(key.x, key.y, (polygonID << 1) | (key.w & 1u));
+}
+
+inline uvec4 lt_unpackKey_64(uvec3 packed_key, int polygon_type)
+{
+    uint polygonID = packed_key.z >> 1;
+    uint first_idx = (polygon_type == QUADS) ? polygonID * 4u : polygonID * 3u;
+    return uvec4(packed_key.x, packed_key.y, first_idx, packed_key.z & 1u);
+}
+
+// ------------------------------- Bit scan --------------------------------- //
+
+// Portable fallback: binary search of the highest set bit
+constexpr int lt_findMSB_64_rec(uint64 x, int shift) {
+    return (shift == 0) ? 0
+         : (x >> shift) ? shift + lt_findMSB_64_rec(x >> shift, shift / 2)
+                        : lt_findMSB_64_rec(x, shift / 2);
+}
+
+// Same as the GLSL findMSB: -1 for 0
+constexpr int lt_findMSB_64(uint64 x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (x == 0) ? -1 : 63 - __builtin_clzll(x);
+#else
+    return (x == 0) ? -1 : lt_findMSB_64_rec(x, 32);
+#endif
+}
+
+// -------------------------- Children and Parents -------------------------- //
+
+struct Children {
+    uint64 id[2];
+};
+
+constexpr Children lt_children_64(uint64 nodeID) {
+    return Children{{ nodeID << 1, (nodeID << 1) | 1u }};
+}
+
+constexpr uint64 lt_parent_64(uint64 nodeID) {
+    return nodeID >> 1;
+}
+
+// --------------------------------- Level ---------------------------------- //
+
+constexpr uint lt_level_64(uint64 nodeID) {
+    return uint(lt_findMSB_64(nodeID));
+}
+
+// ------------------------------ Leaf & Root ------------------------------- //
+
+constexpr bool lt_isLeaf_64(uint64 nodeID) {
+    return lt_level_64(nodeID) == 63u;
+}
+
+constexpr bool lt_isRoot_64(uint64 nodeID) {
+    return nodeID == 1u;
+}
+
+// -------------------------------- Topology -------------------------------- //
+
+constexpr bool lt_isZeroChild_64(uint64 nodeID) {
+    return (nodeID & 1u) == 0u;
+}
+
+constexpr bool lt_isOneChild_64(uint64 nodeID) {
+    return (nodeID & 1u) == 1u;
+}
+
+// Node reached from the root by zero children only (the root included)
+constexpr bool lt_isZeroPath_64(uint64 nodeID) {
+    return (nodeID & (nodeID - 1u)) == 0u;
+}
+
+// ----------------------------- Triangle XForm ----------------------------- //
+
+// Column major 3x2 matrix: glm's mat3x2 is not a literal type before C++14
+struct Xform {
+    float m[6];
+
+    glm::mat3x2 toMat() const {
+        return glm::mat3x2(m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+};
+
+struct XformPair {
+    Xform xform;
+    Xform parent_xform;
+};
+
+constexpr Xform lt_identity_64() {
+    return Xform{{ 1, 0, 0, 1, 0, 0 }};
+}
+
+// Same operations, in the same order, as ltree::mul
+constexpr Xform mul(const Xform& A, const Xform& B) {
+    return Xform{{
+        A.m[0] * B.m[0] + A.m[2] * B.m[1],
+        A.m[1] * B.m[0] + A.m[3] * B.m[1],
+        A.m[0] * B.m[2] + A.m[2] * B.m[3],
+        A.m[1] * B.m[2] + A.m[3] * B.m[3],
+        A.m[0] * B.m[4] + A.m[2] * B.m[5] + A.m[4],
+        A.m[1] * B.m[4] + A.m[3] * B.m[5] + A.m[5]
+    }};
+}
+
+constexpr Xform jk_bitToMatrix(uint64 bit) {
+    return Xform{{ float(bit) - 0.5f, -0.5f,
+                   -0.5f, 0.5f - float(bit),
+                   0.5f, 0.5f }};
+}
+
+// Left multiplies xf by the matrices of the bits of nodeID, from the lsb up
+// to (excluding) the leading 1, like the loop of lt_getTriangleXform_64
+constexpr Xform lt_composeBits_64(uint64 nodeID, const Xform& xf) {
+    return (nodeID <= 1u) ? xf
+         : lt_composeBits_64(nodeID >> 1, mul(jk_bitToMatrix(nodeID & 1u), xf));
+}
+
+constexpr XformPair lt_xformFromParent_64(const Xform& parent_xform, uint64 lsb) {
+    return XformPair{ mul(parent_xform, jk_bitToMatrix(lsb)), parent_xform };
+}
+
+constexpr XformPair lt_getTriangleXform_64(uint64 nodeID) {
+    // Handles the root triangle case
+    return (nodeID == 1u)
+            ? XformPair{ lt_identity_64(), lt_identity_64() }
+            : lt_xformFromParent_64(lt_composeBits_64(nodeID >> 1,
+                                                      lt_identity_64()),
+                                    nodeID & 1u);
+}
+
+/*
+ * Same xforms as lt_getTriangleXform_64, for runtime use: the recursion of the
+ * constexpr version copies the partial products around and ends up slower
+ * than the uvec2 loop of ltree_cpu.h
+ */
+inline XformPair lt_getTriangleXformLoop_64(uint64 nodeID)
+{
+    Xform xf = lt_identity_64();
+
+    // Handles the root triangle case
+    if (nodeID == 1u)
+        return XformPair{ xf, xf };
+
+    for (uint64 id = nodeID >> 1; id > 1u; id >>= 1)
+        xf = mul(jk_bitToMatrix(id & 1u), xf);
+    return lt_xformFromParent_64(xf, nodeID & 1u);
+}
+
+// --------------------------- Table driven XForm --------------------------- //
+
+/*
+ * Xforms of all the nodeIDs of level 0 to BITS, i.e. table[k] is the xform of
+ * the node k, for k in [1, 2^(BITS+1)) (table[0] is unused)
+ * Same layout as the mat3x2 array of the GPU table (std430)
+ */
+template <int BITS>
+struct XformLUT
+{
+    static const int SIZE = 2 << BITS;
+
+    static const Xform* Get()
+    {
+        static const vector<Xform> table = build();
+        return table.data();
+    }
+
+    static vector<Xform> build()
+    {
+        vector<Xform> table(SIZE, lt_identity_64());
+        for (uint64 k = 1; k < uint64(SIZE); ++k)
+            table[k] = lt_getTriangleXform_64(k).xform;
+        return table;
+    }
+};
+
+/*
+ * Xform of nodeID composed from the table: the bits under the leading 1 are
+ * split in chunks of BITS bits from the lsb, the topmost chunk keeps the
+ * leading 1 and indexes the table directly, the other ones are prefixed with
+ * a 1 to get the index of the BITS levels subtree they encode
+ * xform(node) = xform(node >> BITS) * table[(1 << BITS) | (node & mask)]
+ */
+template <int BITS>
+inline Xform lt_xformLUT_64(uint64 nodeID)
+{
+    const Xform* table = XformLUT<BITS>::Get();
+    const uint64 mask = (uint64(1) << BITS) - 1u;
+    int lvl = lt_findMSB_64(nodeID);
+    if (lvl <= 0)
+        return lt_identity_64();
+    int shift = ((lvl - 1) / BITS) * BITS;
+    Xform xf = table[nodeID >> shift];
+    while (shift > 0) {
+        shift -= BITS;
+        xf = mul(xf, table[(mask + 1u) | ((nodeID >> shift) & mask)]);
+    }
+    return xf;
+}
+
+template <int BITS>
+inline XformPair lt_getTriangleXformLUT_64(uint64 nodeID)
+{
+    // Handles the root triangle case
+    if (nodeID == 1u)
+        return XformPair{ lt_identity_64(), lt_identity_64() };
+    return lt_xformFromParent_64(lt_xformLUT_64<BITS>(lt_parent_64(nodeID)),
+                                 nodeID & 1u);
+}
+
+// Triangle xforms used by the CPU backend, decoded as set by LT_XFORM_LUT_BITS
+inline XformPair lt_decodeTriangleXform_64(uint64 nodeID)
+{
+#if LT_XFORM_LUT_BITS > 0
+    return lt_getTriangleXformLUT_64<LT_XFORM_LUT_BITS>(nodeID);
+#else
+    return lt_getTriangleXformLoop_64(nodeID);
+#endif
+}
+
+// Compile time sanity checks
+static_assert(lt_findMSB_64(0) == -1 && lt_findMSB_64(1) == 0 &&
+              lt_findMSB_64(~uint64(0)) == 63 &&
+              lt_findMSB_64_rec(uint64(1) << 40 | 5u, 32) == 40,
+              "ltree64: findMSB");
+static_assert(lt_level_64(lt_children_64(1).id[1]) == 1 &&
+              lt_parent_64(lt_children_64(6).id[1]) == 6,
+              "ltree64: children / parent");
+static_assert(lt_getTriangleXform_64(2).xform.m[4] == 0.5f &&
+              lt_getTriangleXform_64(3).parent_xform.m[0] == 1.0f,
+              "ltree64: triangle xform");
+
+} // namespace ltree64
+
+#endif // LTREE64_H
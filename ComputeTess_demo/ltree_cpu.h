@@ -0,0 +1,372 @@
+#ifndef LTREE_CPU_H
+#define LTREE_CPU_H
+
+#include "common.h"
+#include "ltree64.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// C++ port of ltree_jk.glsl, used by the CPU backend of the bintree.
+/// The keys have the exact same layout as the ones in the node SSBOs:
+/// - xy: nodeID, 64 bits simulated as a uvec2 concatenation (x holds the msb)
+/// - z : index of the first vertex index of the mesh polygon
+/// - w : rootID in the lowest bit
+/// Function names follow their GLSL counterpart so both can be read side by
+/// side.
+/// The uvec2 key algebra is kept as the reference of the GLSL semantics, the
+/// mesh mappings use the native 64 bit version of ltree64.h.
+///
+
+namespace ltree {
+
+using glm::mat2;
+using glm::mat3x2;
+
+struct Triangle {
+    Vertex vertex[3];
+};
+
+struct Quad {
+    Vertex vertex[4];
+};
+
+// --------- Bitwise operations reimplemented for concatenated ints --------- //
+
+inline uvec2 lt_leftShift_64(uvec2 nodeID, uint shift)
+{
+    uvec2 result = nodeID;
+    //Extract the "shift" first bits of y and append them at the end of x
+    result.x = result.x << shift;
+    result.x |= result.y >> (32u - shift);
+    result.y  = result.y << shift;
+    return result;
+}
+
+inline uvec2 lt_rightShift_64(uvec2 nodeID, uint shift)
+{
+    uvec2 result = nodeID;
+    //Extract the "shift" last bits of x and prepend them to y
+    result.y = result.y >> shift;
+    result.y |= result.x << (32u - shift);
+    result.x = result.x >> shift;
+    return result;
+}
+
+// Same as the GLSL findMSB: -1 for 0
+inline int lt_findMSB(uint x)
+{
+    int msb = -1;
+    while (x > 0u) {
+        x >>= 1;
+        ++msb;
+    }
+    return msb;
+}
+
+inline int lt_findMSB_64(uvec2 nodeID)
+{
+    return (nodeID.x == 0) ? lt_findMSB(nodeID.y) : (lt_findMSB(nodeID.x) + 32);
+}
+
+// -------------------------- Children and Parents -------------------------- //
+
+inline void lt_children_64(uvec2 nodeID, uvec2 children[2])
+{
+    nodeID = lt_leftShift_64(nodeID, 1u);
+    children[0] = uvec2(nodeID.x, nodeID.y | 0u);
+    children[1] = uvec2(nodeID.x, nodeID.y | 1u);
+}
+
+inline uvec2 lt_parent_64(uvec2 nodeID) {
+    return lt_rightShift_64(nodeID, 1u);
+}
+
+// --------------------------------- Level ---------------------------------- //
+
+inline uint lt_level_64(uvec2 nodeID) {
+    return lt_findMSB_64(nodeID);
+}
+
+// ------------------------------ Leaf & Root ------------------------------- //
+
+inline bool lt_isLeaf_64(uvec2 nodeID) {
+    return (lt_level_64(nodeID) == 63u);
+}
+
+inline bool lt_isRoot_64(uvec2 nodeID) {
+    return (lt_findMSB_64(nodeID) == 0u);
+}
+
+// -------------------------------- Topology -------------------------------- //
+
+inline bool lt_isZeroChild_64(uvec2 nodeID) {
+    return ((nodeID.y & 1u) == 0u);
+}
+
+inline bool lt_isOneChild_64(uvec2 nodeID)
+{
+    return ((nodeID.y & 1u) == 1u);
+}
+
+// ----------------------------- Triangle XForm ----------------------------- //
+
+inline mat3x2 mul(const mat3x2& A, const mat3x2& B)
+{
+    mat2 tmp = mat2(A[0], A[1]) * mat2(B[0], B[1]);
+    mat3x2 r = mat3x2(tmp[0], tmp[1], vec2(0));
+    r[2].x = A[0].x * B[2].x + A[1].x * B[2].y + A[2].x;
+    r[2].y = A[0].y * B[2].x + A[1].y * B[2].y + A[2].y;
+    return r;
+}
+
+inline mat3x2 jk_bitToMatrix(uint bit)
+{
+    float s = float(bit) - 0.5f;
+    vec2 c1 = vec2(+s, -0.5f);
+    vec2 c2 = vec2(-0.5f, -s);
+    vec2 c3 = vec2(+0.5f, +0.5f);
+    return mat3x2(c1, c2, c3);
+}
+
+inline void lt_getTriangleXform_64(uvec2 nodeID, mat3x2& xform, mat3x2& parent_xform)
+{
+    vec2 c1 = vec2(1, 0);
+    vec2 c2 = vec2(0, 1);
+    vec2 c3 = vec2(0, 0);
+    mat3x2 xf = mat3x2(c1, c2, c3);
+
+    // Handles the root triangle case
+    if (nodeID.x == 0u && nodeID.y == 1u){
+        xform = parent_xform = xf;
+        return;
+    }
+
+    uint lsb = nodeID.y & 1u;
+    nodeID = lt_rightShift_64(nodeID, 1u);
+    while (nodeID.x > 0 || nodeID.y > 1) {
+        xf = mul(jk_bitToMatrix(nodeID.y & 1u) , xf);
+        nodeID = lt_rightShift_64(nodeID, 1u);
+    }
+
+    parent_xform = xf;
+    xform = mul(parent_xform, jk_bitToMatrix(lsb & 1u));
+}
+
+inline void lt_getTriangleXform_64(uvec2 nodeID, mat3x2& xform)
+{
+    mat3x2 tmp;
+    lt_getTriangleXform_64(nodeID, xform, tmp);
+}
+
+// ------------------------- Interpolate to polygon  ------------------------ //
+
+inline vec4 lt_mapTo3DTriangle(const Triangle& t, vec2 uv)
+{
+    vec4 result = (1.0f - uv.x - uv.y) * t.vertex[0].p +
+            uv.x * t.vertex[2].p +
+            uv.y * t.vertex[1].p;
+    return result;
+}
+
+// ------------------------- Fetching Mesh Polygon  ------------------------- //
+
+inline void lt_getMeshTriangle(const Mesh_Data& mesh, uint meshPolygonID,
+                               Triangle& triangle)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        const Vertex& v = mesh.v_array[mesh.t_idx_array[meshPolygonID + i]];
+        triangle.vertex[i].p = v.p;
+        triangle.vertex[i].n = v.n;
+        triangle.vertex[i].uv = v.uv;
+    }
+}
+
+inline void lt_getMeshQuad(const Mesh_Data& mesh, uint meshPolygonID, Quad& quad)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        const Vertex& v = mesh.v_array[mesh.q_idx_array[meshPolygonID + i]];
+        quad.vertex[i].p = v.p;
+        quad.vertex[i].n = v.n;
+        quad.vertex[i].uv = v.uv;
+    }
+}
+
+inline void lt_getQuadMeshTriangle(const Mesh_Data& mesh, uint meshPolygonID,
+                                   uint rootID, Triangle& mesh_t)
+{
+    Quad q;
+    lt_getMeshQuad(mesh, meshPolygonID, q);
+    if (rootID == 0) {
+        mesh_t.vertex[0] = q.vertex[0];
+        mesh_t.vertex[1] = q.vertex[3];
+        mesh_t.vertex[2] = q.vertex[1];
+    } else {
+        mesh_t.vertex[0] = q.vertex[2];
+        mesh_t.vertex[1] = q.vertex[1];
+        mesh_t.vertex[2] = q.vertex[3];
+    }
+}
+
+// The GLSL version selects the polygon type with FLAG_TRIANGLES / FLAG_QUADS
+inline void lt_getTargetTriangle(const Mesh_Data& mesh, int polygon_type,
+                                 uint meshPolygonID, uint rootID,
+                                 Triangle& mesh_t)
+{
+    if (polygon_type == TRIANGLES)
+        lt_getMeshTriangle(mesh, meshPolygonID, mesh_t);
+    else
+        lt_getQuadMeshTriangle(mesh, meshPolygonID, rootID, mesh_t);
+}
+
+// Mesh vertex indices of the target triangle, in lt_getTargetTriangle order
+inline uvec3 lt_getTargetTriangleIndices(const Mesh_Data& mesh, int polygon_type,
+                                         uint meshPolygonID, uint rootID)
+{
+    if (polygon_type == TRIANGLES)
+        return uvec3(mesh.t_idx_array[meshPolygonID + 0],
+                     mesh.t_idx_array[meshPolygonID + 1],
+                     mesh.t_idx_array[meshPolygonID + 2]);
+    const uint* q = mesh.q_idx_array + meshPolygonID;
+    return (rootID == 0) ? uvec3(q[0], q[3], q[1]) : uvec3(q[2], q[1], q[3]);
+}
+
+// Index of the target triangle among all the target triangles of the mesh:
+// the triangle index, or twice the quad index plus the rootID
+inline uint lt_getTargetTriangleID(int polygon_type, uint meshPolygonID,
+                                   uint rootID)
+{
+    if (polygon_type == TRIANGLES)
+        return meshPolygonID / 3u;
+    return (meshPolygonID / 4u) * 2u + rootID;
+}
+
+inline void lt_getIndexedTriangle(const Mesh_Data& mesh, uvec3 vertexID,
+                                  Triangle& mesh_t)
+{
+    for (int i = 0; i < 3; ++i)
+        mesh_t.vertex[i] = mesh.v_array[vertexID[i]];
+}
+
+// ------------------------------- Base map  -------------------------------- //
+
+// Index of the base map sample (i, j), at uv = (i, j) / res, of a triangle
+inline uint lt_baseMapIndex(uint res, uint triangleID, int i, int j)
+{
+    int n = int(res);
+    return triangleID * uint((n + 1) * (n + 2) / 2)
+         + uint(j * (n + 1) - j * (j - 1) / 2 + i);
+}
+
+// Samples of the base map cell holding uv, and their weights
+inline void lt_baseMapCell(uint res, vec2 uv, glm::ivec2 c[3], vec3& w)
+{
+    int n = int(res);
+    vec2 g = uv * float(n);
+    int i = glm::clamp(int(std::floor(g.x)), 0, n - 1);
+    int j = glm::clamp(int(std::floor(g.y)), 0, n - 1 - i);
+    vec2 f = g - vec2(i, j);
+    if (f.x + f.y > 1.0f && i + j + 2 <= n) {
+        c[0] = glm::ivec2(i + 1, j + 1);
+        c[1] = glm::ivec2(i, j + 1);
+        c[2] = glm::ivec2(i + 1, j);
+        w = vec3(f.x + f.y - 1.0f, 1.0f - f.x, 1.0f - f.y);
+    } else {
+        c[0] = glm::ivec2(i, j);
+        c[1] = glm::ivec2(i + 1, j);
+        c[2] = glm::ivec2(i, j + 1);
+        w = vec3(1.0f - f.x - f.y, f.x, f.y);
+    }
+}
+
+// Offset from the point uv of the base triangle to the input surface
+inline vec3 lt_getBaseMapOffset(const Mesh_Data& mesh, uint triangleID, vec2 uv)
+{
+    glm::ivec2 c[3];
+    vec3 w;
+    lt_baseMapCell(mesh.base_map_res, uv, c, w);
+    vec3 offset = vec3(0.0f);
+    for (int k = 0; k < 3; ++k) {
+        const BaseMapSample& s = mesh.base_map_array[
+                lt_baseMapIndex(mesh.base_map_res, triangleID, c[k].x, c[k].y)];
+        offset += w[k] * vec3(s.offset[0], s.offset[1], s.offset[2]);
+    }
+    return offset;
+}
+
+// ------------------------ Mapping from Leaf to QT  ------------------------ //
+
+inline vec2 lt_Leaf_to_Tree_64(vec2 p, uvec2 nodeID)
+{
+    mat3x2 xform = ltree64::lt_decodeTriangleXform_64(
+                ltree64::lt_nodeID_64(nodeID)).xform.toMat();
+    return xform * vec3(p, 1);
+}
+
+// ------------------------- Mapping from QT to Mesh ------------------------ //
+
+inline vec4 lt_Tree_to_MeshPosition(const Mesh_Data& mesh, int polygon_type,
+                                    vec2 p, uint meshPolygonID, uint rootID)
+{
+    Triangle mesh_t;
+    lt_getTargetTriangle(mesh, polygon_type, meshPolygonID, rootID, mesh_t);
+    return lt_mapTo3DTriangle(mesh_t, p);
+}
+
+// ------------------------ Mapping from Leaf to Mesh ----------------------- //
+
+inline vec4 lt_Leaf_to_MeshPosition(const Mesh_Data& mesh, int polygon_type,
+                                    vec2 p, uvec4 key)
+{
+    uvec2 nodeID = uvec2(key.x, key.y);
+    uint meshPolygonID = key.z;
+    uint rootID = key.w & 1u;
+    vec2 p2d = lt_Leaf_to_Tree_64(p, nodeID);
+    return lt_Tree_to_MeshPosition(mesh, polygon_type, p2d, meshPolygonID, rootID);
+}
+
+inline void lt_Leaf_n_Parent_to_MeshPosition(const Mesh_Data& mesh,
+                                             int polygon_type,
+                                             vec2 p, uvec4 key,
+                                             vec4& p_mesh, vec4& pp_mesh)
+{
+    uvec2 nodeID = uvec2(key.x, key.y);
+    uint meshPolygonID = key.z;
+    uint rootID = key.w & 1u;
+    vec2 p2D, pp2D;
+
+    ltree64::XformPair xforms =
+            ltree64::lt_decodeTriangleXform_64(ltree64::lt_nodeID_64(nodeID));
+    mat3x2 xf = xforms.xform.toMat(), pxf = xforms.parent_xform.toMat();
+    p2D = xf * vec3(p, 1);
+    pp2D = pxf * vec3(p, 1);
+
+    Triangle mesh_t;
+    lt_getTargetTriangle(mesh, polygon_type, meshPolygonID, rootID, mesh_t);
+    p_mesh  = lt_mapTo3DTriangle(mesh_t, p2D);
+    pp_mesh = lt_mapTo3DTriangle(mesh_t, pp2D);
+}
+
+// Mesh positions of the corners (O, R, U) of the node of the key and of its
+// parent
+inline void lt_Node_n_Parent_to_MeshCorners(const Mesh_Data& mesh,
+                                            int polygon_type, uvec4 key,
+                                            vec4 c[3], vec4 pc[3])
+{
+    static const vec2 corners[3] = {vec2(0, 0), vec2(1, 0), vec2(0, 1)};
+    ltree64::XformPair xforms = ltree64::lt_decodeTriangleXform_64(
+                ltree64::lt_nodeID_64(uvec2(key.x, key.y)));
+    mat3x2 xf = xforms.xform.toMat(), pxf = xforms.parent_xform.toMat();
+
+    Triangle mesh_t;
+    lt_getTargetTriangle(mesh, polygon_type, key.z, key.w & 1u, mesh_t);
+    for (int i = 0; i < 3; ++i) {
+        c[i]  = lt_mapTo3DTriangle(mesh_t, xf * vec3(corners[i], 1));
+        pc[i] = lt_mapTo3DTriangle(mesh_t, pxf * vec3(corners[i], 1));
+    }
+}
+
+} // namespace ltree
+
+#endif // LTREE_CPU_H
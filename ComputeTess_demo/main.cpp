@@ -247,6 +247,8 @@ void RenderImgui()
                 app.mesh.InitTransforms(app.cam);
                 app.mesh.bintree->UpdateLodFactor(app.cam.fb_width, app.cam.fov);
                 app.mesh.bintree->UploadSettings();
+                if (set.converge_mode != CONVERGE_OFF)
+                    app.mesh.bintree->Converge();
             }
 
             if (ImGui::Checkbox("Wireframe", &set.wireframe_on)) {
@@ -309,6 +311,16 @@ void RenderImgui()
                 ImGui::Text("Triangles: "); ImGui::SameLine();
                 ImGui::Text("%s", utility::LongToString(
                                 app.mesh.bintree->drawn_node_count*leaf_tri).c_str());
+                ImGui::Text("Pool     : "); ImGui::SameLine();
+                ImGui::Text("%s (%zu MB)", utility::LongToString(
+                                app.mesh.bintree->GetMaxNodeCount()).c_str(),
+                            app.mesh.bintree->GetNodePoolSize() >> 20);
+                ImGui::Text("Refused  : "); ImGui::SameLine();
+                ImGui::Text("%s", utility::LongToString(
+                                app.mesh.bintree->refused_split_count).c_str());
+                ImGui::Text("Dropped  : "); ImGui::SameLine();
+                ImGui::Text("%s", utility::LongToString(
+                                app.mesh.bintree->dropped_node_count).c_str());
             }
             if (app.mode == TERRAIN) {
                 if (ImGui::Combo("Polygon type", &set.polygon_type, "Triangle\0Quad\0\0")) {
@@ -338,6 +350,108 @@ void RenderImgui()
                 app.mesh.bintree->Reinitialize();
                 updateRenderParams();
             }
+            if (ImGui::Checkbox("Root BVH cull", &set.root_cull_on)) {
+                app.mesh.bintree->ReloadComputeProgram();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (set.cull_on && set.root_cull_on) {
+                ImGui::SameLine();
+                ImGui::Text("%s / %s roots", utility::LongToString(
+                                app.mesh.bintree->GetVisibleRootCount()).c_str(),
+                            utility::LongToString(
+                                app.mesh.bintree->GetRootCount()).c_str());
+            }
+            if (ImGui::Checkbox("Cull-aware LoD", &set.cull_refine_on)) {
+                app.mesh.bintree->ReloadComputeProgram();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (ImGui::Checkbox("Backface cull", &set.backface_on)) {
+                app.mesh.bintree->ReloadComputeProgram();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (set.cull_on && set.backface_on && !set.displace_on
+                    && app.mesh.bintree->GetBoundaryEdgeCount() > 0) {
+                ImGui::SameLine();
+                ImGui::Text("open mesh: %s boundary edges", utility::LongToString(
+                                app.mesh.bintree->GetBoundaryEdgeCount()).c_str());
+            }
+            if (ImGui::Checkbox("Hi-Z occlusion cull", &set.occlusion_on)) {
+                app.mesh.bintree->ReloadComputeProgram();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (set.cull_on && set.occlusion_on && set.map_nodecount
+                    && set.backend == BACKEND_GPU) {
+                ImGui::SameLine();
+                ImGui::Text("%s occluded", utility::LongToString(
+                                app.mesh.bintree->occluded_node_count).c_str());
+            }
+            if (set.cull_refine_on || set.backface_on) {
+                if (ImGui::SliderInt("Floor level", &set.cull_floor, 0, 16))
+                    app.mesh.bintree->UploadSettings();
+            }
+            if (ImGui::Combo("Update backend", &set.backend, "GPU\0CPU\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                app.mesh.bintree->UpdateLodFactor(app.cam.fb_width, app.cam.fov);
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (ImGui::SliderInt("Node budget (MB)", &set.node_budget_mb, 16,
+                                 2048)) {
+                app.mesh.bintree->Reinitialize();
+                updateRenderParams();
+            }
+            if (ImGui::Combo("Key bits", &set.key_bits, "Auto\0" "32\0" "64\0\0")) {
+                app.mesh.bintree->UploadSettings();
+            }
+            ImGui::Text("Keys: %d bit (max level %d)",
+                        app.mesh.bintree->IsKey32() ? 32 : 64,
+                        BinTree::PredictMaxLevel(
+                            set, app.mesh.bintree->GetMinLodScale()));
+            if (ImGui::Combo("Key layout", &set.key_layout,
+                             "uvec4\0Packed (12B)\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                updateRenderParams();
+            }
+            if (ImGui::Combo("Culled list", &set.culled_list,
+                             "Records\0Indices\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                updateRenderParams();
+            }
+            if (ImGui::Combo("LoD scale", &set.lod_scale,
+                             "Global\0Edge length\0Edge and curvature\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (ImGui::Combo("LoD metric", &set.lod_metric,
+                             "Distance\0Projected edges\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                app.mesh.bintree->UploadSettings();
+                updateRenderParams();
+            }
+            if (ImGui::Combo("Vertex format", &set.vertex_format,
+                             "Float (48B)\0Quantized (16B)\0\0")) {
+                app.mesh.bintree->Reinitialize();
+                updateRenderParams();
+            }
+            ImGui::Combo("Converge", &set.converge_mode,
+                         "Off\0On reset\0Every frame\0\0");
+            if (set.converge_mode != CONVERGE_OFF)
+                ImGui::SliderInt("Max updates", &set.converge_max_iter, 1, 64);
+            const BinTree::StableLatency& lat = app.mesh.bintree->stable_latency;
+            if (lat.stable)
+                ImGui::Text("Stable after %d frames, %d updates (%.1f ms)",
+                            lat.frames, lat.updates, lat.ms);
+            else
+                ImGui::Text("Not stable after %d frames", lat.frames);
+            if (set.backend == BACKEND_CPU) {
+                ImGui::SliderInt("CPU threads (0: all)", &set.cpu_threads, 0,
+                                 ThreadPool::HardwareThreadCount());
+            }
             if (app.mode == MESH) {
                 if (ImGui::Combo("Interpolation type", &set.itpl_type,
                                  "Linear\0PN Triangles\0Phong\0\0\0")) {
@@ -347,10 +461,27 @@ void RenderImgui()
                 if (ImGui::SliderFloat("alpha", &set.itpl_alpha, 0, 1)) {
                     app.mesh.bintree->UploadSettings();
                 }
+                // Input triangles per base mesh triangle: 4^base_mesh
+                int base_mesh = 0;
+                while ((1 << (2 * base_mesh)) < app.mesh.base_ratio)
+                    ++base_mesh;
+                if (ImGui::Combo("Base mesh", &base_mesh,
+                                 "Input\0" "1/4\0" "1/16\0" "1/64\0\0")) {
+                    app.mesh.base_ratio = 1 << (2 * base_mesh);
+                    app.mesh.CleanUp();
+                    app.mesh.Init(app.mode, app.cam, app.filepath);
+                    updateRenderParams();
+                    app.mesh.bintree->UpdateLodFactor(app.cam.fb_width, app.cam.fov);
+                    app.mesh.bintree->UploadSettings();
+                }
             }
             if (app.mesh.bintree->capped) {
                 ImGui::Text(" LOD FACTOR CAPPED \n");
             }
+            if (set.map_nodecount && (app.mesh.bintree->refused_split_count > 0 ||
+                                      app.mesh.bintree->dropped_node_count > 0)) {
+                ImGui::Text(" NODE POOL FULL \n");
+            }
         }
     }  ImGui::End();
 
@@ -517,7 +648,7 @@ void HandleArguments(int argc, char **argv)
         cout << "Using default mesh: " << app.default_filepath << endl;
     } else {
         if (argc > 2)
-            cout << "Only takes in 1 obj file name, ignoring other arguments" << endl;
+            cout << "Only takes in 1 mesh file name, ignoring other arguments" << endl;
         string file = argv[1];
         cout << "Trying to open " << file << " ... ";
         ifstream f(file.c_str());
@@ -14,6 +14,10 @@ public:
 
     Mesh_Data mesh_data;
 
+    // Input triangles per triangle of the base mesh the bintree refines, 1
+    // for the input mesh itself (see simplifyMeshData)
+    int base_ratio = 1;
+
     int roundUpToSq(int n)
     {
         int sq = ceil(sqrt(n));
@@ -22,9 +26,10 @@ public:
 
     /*
      * Reorder the triangle indices of a mesh such that the point 0 of each
-     * triangle faces the hypotenuse
+     * triangle faces the hypotenuse. The indices only rotate, so that the
+     * triangles keep their winding (FLAG_BACKFACE relies on it)
      */
-    void reorderIndices(uint* i_array, const Vertex* v, uint count){
+    static void reorderIndices(uint* i_array, const Vertex* v, uint count){
         uint  i0, i1, i2;
         float d01, d02, d12, max_d;
         for(uint i=0; i < count; i+= 3)
@@ -44,17 +49,81 @@ public:
                 i_array[i + 2] = i1;
             } else if (max_d == d02) {
                 i_array[i + 0] = i1;
-                i_array[i + 1] = i0;
-                i_array[i + 2] = i2;
+                i_array[i + 1] = i2;
+                i_array[i + 2] = i0;
             }
         }
     }
 
+    /*
+     * Fill mesh_data from the .tessmesh cache of the mesh file (.obj, .ply or
+     * .glb) when it is up to date. Otherwise parses the file with the
+     * importers in mesh_utils.h, reorders the triangle indices, sorts the
+     * polygons and vertices for the locality of the fetches, and writes the
+     * cache
+     */
+    static void LoadMeshFile(const string& filepath, Mesh_Data& mesh_data)
+    {
+        uint64_t hash = 0, size = 0;
+        bool cachable = meshutils::HashFile(filepath, hash, size);
+        if (cachable
+            && meshutils::LoadTessMesh(filepath, hash, size, 0, &mesh_data)) {
+            cout << "Loaded " << meshutils::TessMeshName(filepath) << endl;
+            return;
+        }
+        if (!meshutils::ParseMeshFile(filepath, 0, &mesh_data))
+            return;
+        reorderIndices(mesh_data.t_idx_array, mesh_data.v_array,
+                       mesh_data.t_idx.count);
+        meshutils::ReorderForLocality(&mesh_data);
+        if (cachable
+            && meshutils::WriteTessMesh(filepath, hash, size, 0, mesh_data))
+            cout << "Wrote " << meshutils::TessMeshName(filepath) << endl;
+    }
+
+    /*
+     * Replaces mesh_data by its simplification into a cage of about
+     * base_ratio input triangles per triangle (meshutils::SimplifyMesh),
+     * with the base map of the input surface over the cage, so that the
+     * bintree gets one root per cage triangle
+     */
+    void simplifyMeshData()
+    {
+        int polygon_type = (mesh_data.triangle_count > 0) ? TRIANGLES : QUADS;
+        uint input_count = (polygon_type == TRIANGLES)
+                         ? mesh_data.triangle_count : 2 * mesh_data.quad_count;
+        auto t0 = std::chrono::steady_clock::now();
+        Mesh_Data base;
+        if (!meshutils::SimplifyMesh(mesh_data, polygon_type,
+                                     input_count / base_ratio, &base)) {
+            cout << "ERROR when simplifying the mesh" << endl;
+            return;
+        }
+        reorderIndices(base.t_idx_array, base.v_array, base.t_idx.count);
+        meshutils::ReorderForLocality(&base);
+        auto t1 = std::chrono::steady_clock::now();
+        uint res = meshutils::BaseMapResolution(float(input_count)
+                                                / base.triangle_count);
+        meshutils::BuildBaseMap(mesh_data, polygon_type, res, &base);
+        auto t2 = std::chrono::steady_clock::now();
+        cout << "Base mesh: " << input_count << " triangles simplified into "
+             << base.triangle_count << " ("
+             << std::chrono::duration<double, std::milli>(t1 - t0).count()
+             << " ms), base map of " << res << " segments per edge: "
+             << base.base_map_array.size() * sizeof(BaseMapSample) / 1024
+             << " KB ("
+             << std::chrono::duration<double, std::milli>(t2 - t1).count()
+             << " ms)" << endl;
+        mesh_data.FreeArrays();
+        mesh_data = std::move(base);
+    }
+
     /*
      * Fill the Mesh_Data structure with vertices and indices
      * Either:
      * - Loads a grid for the terrain mode
-     * - Loads an .obj file using the parsing function in mesh_utils.h
+     * - Loads a mesh file (or its cache) with LoadMeshFile, and simplifies it
+     *   when base_ratio is above 1
      * Depending on the index array filled by the parsing function, sets the
      * bintree to the correct polygon rendering mode
      */
@@ -62,20 +131,24 @@ public:
     {
         if (mode == TERRAIN) {
             meshutils::LoadGrid(&mesh_data);
-            LoadMeshBuffers();
+            reorderIndices(mesh_data.t_idx_array, mesh_data.v_array,
+                           mesh_data.t_idx.count);
         } else if (mode == MESH){
-            meshutils::ParseObj(filepath, 0, &mesh_data);
+            LoadMeshFile(filepath, mesh_data);
+            if (base_ratio > 1 && mesh_data.v.count > 0)
+                simplifyMeshData();
             if (mesh_data.quad_count > 0 && mesh_data.triangle_count == 0)
                 init_settings.polygon_type = QUADS;
             else if (mesh_data.quad_count == 0 && mesh_data.triangle_count > 0)
                 init_settings.polygon_type = TRIANGLES;
             else
-                cout << "ERROR when parsing obj" << endl;
+                cout << "ERROR when parsing " << filepath << endl;
         }
     }
 
     /*
-     * Loads the data in the Mesh_Data structure into buffers.
+     * Loads the data in the Mesh_Data structure into buffers, straight from
+     * the mapped .tessmesh when the mesh comes from the cache.
      * Creates:
      * - 1 buffer for (unique) vertices
      * - 1 buffer for quad indices
@@ -102,9 +175,6 @@ public:
                                  0);
         }
 
-        reorderIndices(mesh_data.t_idx_array,
-                       mesh_data.v_array,
-                       mesh_data.t_idx.count);
         utility::EmptyBuffer(&mesh_data.t_idx.bo);
         glCreateBuffers(1, &(mesh_data.t_idx.bo));
         if (mesh_data.triangle_count > 0) {
@@ -114,6 +184,16 @@ public:
                                  0);
         }
 
+        utility::EmptyBuffer(&mesh_data.base_map.bo);
+        if (mesh_data.base_map_res > 0) {
+            glCreateBuffers(1, &(mesh_data.base_map.bo));
+            glNamedBufferStorage(mesh_data.base_map.bo,
+                                 sizeof(BaseMapSample)
+                                 * mesh_data.base_map_array.size(),
+                                 (const void*)(mesh_data.base_map_array.data()),
+                                 0);
+        }
+
         cout << "Mesh has " << mesh_data.quad_count << " quads, "
              << mesh_data.triangle_count << " triangles " << endl;
 
@@ -167,10 +247,28 @@ public:
         init_settings.itpl_type = PHONG;
         init_settings.itpl_alpha = 1;
 
+        init_settings.backend = BACKEND_GPU;
+        init_settings.cpu_threads = 0;
+        init_settings.node_budget_mb = 512;
+        init_settings.culled_list = CULLED_RECORDS;
+        init_settings.key_layout = KEYS_UVEC4;
+        init_settings.key_bits = KEY_BITS_AUTO;
+        init_settings.vertex_format = VERTEX_FLOAT;
+        init_settings.lod_scale = LOD_SCALE_CURVATURE;
+        init_settings.lod_metric = LOD_DISTANCE;
+        init_settings.root_cull_on = true;
+        init_settings.cull_refine_on = true;
+        init_settings.backface_on = (mode == MESH);
+        init_settings.occlusion_on = false;
+        init_settings.cull_floor = 4;
+        init_settings.converge_mode = CONVERGE_ON_RESET;
+        init_settings.converge_max_iter = 64;
+
         this->LoadMeshData(mode, filepath);
         this->LoadMeshBuffers();
 
         this->tranforms_manager->Init(cam);
+        init_settings.near_plane = this->tranforms_manager->GetNearPlane();
         bintree->Init(&(this->mesh_data), this->tranforms_manager->GetBo(),
                        init_settings);
     }
@@ -182,6 +280,8 @@ public:
                                            vec3(0.0f, 0.0f, 1.0f));
         }
         tranforms_manager->Upload();
+        bintree->UpdateRootVisibility(tranforms_manager->GetBlock());
+        bintree->UpdateOcclusion(tranforms_manager->GetBlock());
         bintree->Draw(deltaT);
     }
 
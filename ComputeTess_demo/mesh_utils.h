@@ -2,14 +2,33 @@
 #define MESHUTILS_H
 
 #include "common.h"
+#include "ltree_cpu.h"
+#include "thread_pool.h"
 
 #include <cassert>
+#include <cctype>
+#include <cfloat>
 #include <cstdio>
 #include <cstring>
+#include <cstdint>
+#include <initializer_list>
 #include <iterator>
 #include <fstream>
+#include <functional>
+#include <queue>
 #include <sstream>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 ///
@@ -66,105 +85,689 @@ void LoadGrid(Mesh_Data* mesh_data)
     mesh_data->avg_e_length = factor / (num_div + 1.0);
 }
 
-// Utility function to read from file
-static char const * sgets( char * s, int size, char ** stream ) {
-    for (int i=0; i<size; ++i) {
-        if ( (*stream)[i]=='\n' || (*stream)[i]=='\0') {
+// Read-only view of a whole file, memory mapped so that the parsers read its
+// bytes in place instead of copying them
+class MappedFile
+{
+public:
+    explicit MappedFile(const string& name)
+    {
+#ifdef _WIN32
+        file_ = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        GetFileSizeEx(file_, &size);
+        size_ = size_t(size.QuadPart);
+        open_ = true;
+        if (size_ == 0)
+            return;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ != NULL)
+            data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd_ = open(name.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            return;
+        struct stat st;
+        fstat(fd_, &st);
+        size_ = size_t(st.st_size);
+        open_ = true;
+        if (size_ == 0)
+            return;
+        void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = (const char*)data;
+        }
+#endif
+        open_ = (data_ != NULL);
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_ != NULL)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+#else
+        if (data_)
+            munmap((void*)data_, size_);
+        if (fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    bool IsOpen() const { return open_; }
+    const char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#else
+    int fd_ = -1;
+#endif
+    const char* data_ = NULL;
+    size_t size_ = 0;
+    bool open_ = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Tokenizer of the .obj parser: reads the numbers in place, between a
+/// pointer and the end of the file, instead of copying each line and calling
+/// sscanf (which depends on the locale, and on a line buffer)
+///
+
+namespace obj {
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isEol(const char* p, const char* end)
+{
+    return p == end || *p == '\n' || *p == '\r';
+}
+
+inline const char* skipBlanks(const char* p, const char* end)
+{
+    while (p != end && isBlank(*p))
+        ++p;
+    return p;
+}
+
+// Returns the beginning of the next line
+inline const char* skipLine(const char* p, const char* end)
+{
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+// Parses a decimal integer with an optional sign, advances p past it
+inline bool parseInt(const char*& p, const char* end, int& value)
+{
+    const char* s = p;
+    bool negative = false;
+    if (s != end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
+    if (s == end || !isDigit(*s))
+        return false;
+    int64_t v = 0;
+    while (s != end && isDigit(*s)) {
+        v = std::min(v * 10 + (*s - '0'), int64_t(INT32_MAX));
+        ++s;
+    }
+    value = int(negative ? -v : v);
+    p = s;
+    return true;
+}
 
-            memcpy(s, *stream, i);
-            s[i]='\0';
+/*
+ * Parses a decimal float ([sign] digits [. digits] [e [sign] digits]),
+ * advances p past it
+ * The first 19 significant digits are accumulated in an integer: when it
+ * stays under 2^53 and the power of ten under 10^22, both are exact doubles
+ * and the one multiplication or division rounds correctly, which covers the
+ * numbers written by modelling tools. Other numbers are within an ulp
+ */
+inline bool parseFloat(const char*& p, const char* end, float& value)
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* s = p;
+    bool negative = false;
+    if (s != end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
 
-            if ((*stream)[i]=='\0')
-                return 0;
-            else {
-                (*stream) += i+1;
-                return s;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any_digit = false;
+    for (; s != end && isDigit(*s); ++s) {
+        any_digit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits += (mantissa > 0);
+        } else {
+            ++exponent;
+        }
+    }
+    if (s != end && *s == '.') {
+        for (++s; s != end && isDigit(*s); ++s) {
+            any_digit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += (mantissa > 0);
+                --exponent;
             }
         }
     }
-    return 0;
+    if (!any_digit)
+        return false;
+    if (s != end && (*s == 'e' || *s == 'E')) {
+        const char* e = s + 1;
+        int e_value;
+        if (parseInt(e, end, e_value)) {
+            exponent += std::max(-1000, std::min(e_value, 1000));
+            s = e;
+        }
+    }
+
+    double v = double(mantissa);
+    if (mantissa == 0)
+        v = 0.0;
+    else if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent < 0)
+        v /= pow10[-exponent];
+    else if (mantissa < (uint64_t(1) << 53) && exponent >= 0 && exponent <= 22)
+        v *= pow10[exponent];
+    else
+        v *= std::pow(10.0, double(exponent));
+    value = float(negative ? -v : v);
+    p = s;
+    return true;
 }
 
-// Read a .obj from file and store it in mesh_data
-// Reads the data line by line
-// Creates unique Vertex objects for each unencountered set of pos / normal / UV
-// Stores the result in mesh_data
-// File parsing taken from OpenSubdiv
-void ParseObj(string name, int axis, Mesh_Data* mesh_data)
+// Parses count floats separated by blanks
+inline bool parseFloats(const char* p, const char* end, float* values, int count)
 {
-    // Opening file and stuff
-    ifstream instream(name);
-    string contents((istreambuf_iterator<char>(instream)),
-                    istreambuf_iterator<char>());
-
-    char const* shapestr = contents.c_str();
+    for (int i = 0; i < count; ++i) {
+        p = skipBlanks(p, end);
+        if (!parseFloat(p, end, values[i]))
+            return false;
+    }
+    return true;
+}
 
-    char* str = const_cast<char *>(shapestr), line[256];
-    bool done = false;
-    int face_count;
+// Index of the file (1-based, or relative to the end when negative) to a
+// 0-based index in an array holding count elements
+inline int toIndex(int idx, size_t count)
+{
+    return (idx < 0) ? int(count) + idx : idx - 1;
+}
 
+} // namespace obj
 
-    // Filling independent vectors from the data
+// Raw content of an .obj file: the attributes, and the attribute indices of
+// the face corners
+struct ObjData {
     vector<vec4> verts;
     vector<vec2> uvs;
     vector<vec4> normals;
     vector<int> faceverts;
     vector<int> faceuvs;
     vector<int> facenormals;
-    vec3 p, n, vmax = vec3(0), vmin = vec3(9999999);
-    int nvertsPerFace = -1;
-    while (! done) {
-        done = sgets(line, sizeof(line), &str)==0;
-        char* end = &line[strlen(line)-1];
-        if (*end == '\n') *end = '\0'; // strip trailing nl
-        float x, y, z, u, v;
-        switch (line[0]) {
-        case 'v':
-            switch (line[1]) {
-            case ' ':
-                if (sscanf(line, "v %f %f %f", &x, &y, &z) == 3) {
-                    p = (axis == 0) ? vec3(x, -z, y) : vec3(x,y,z);
-                    vmax = glm::max(vmax, p);
-                    vmin= glm::min(vmin, p);
-                    verts.push_back(vec4(p, 1.0));
-                } break;
-            case 't':
-                if (sscanf(line, "vt %f %f", &u, &v) == 2) {
-                    uvs.push_back(vec2(u,v));
-                } break;
-            case 'n' :
-                if (sscanf(line, "vn %f %f %f", &x, &y, &z) == 3) {
-                    n = (axis == 0) ? vec3(x, -z, y) : vec3(x,y,z);
-                    normals.push_back(vec4(glm::normalize(n), 0.0));
-                } break;
-            } break;
-        case 'f':
-            if (line[1] == ' ') {
-                int vi = -1, ti = -1, ni = -1;
-                const char* cp = &line[2];
-                while (*cp == ' ') cp++;
-                int nverts = 0, nitems=0;
-                while( (nitems=sscanf(cp, "%d/%d/%d", &vi, &ti, &ni))>0) {
-                    nverts++;
-                    faceverts.push_back(vi-1);
-                    if(ti > 0) faceuvs.push_back(ti-1);
-                    if(ni > 0) facenormals.push_back(ni-1);
-                    while (*cp && *cp != ' ') cp++;
-                    while (*cp == ' ') cp++;
-                }
-                if (nvertsPerFace == -1){
-                    nvertsPerFace = nverts;
+    vec3 vmin = vec3(9999999), vmax = vec3(0);
+    int nverts_per_face = -1;
+    int face_count = 0;
+    // Positions in faceverts, faceuvs and facenormals of the relative
+    // indices, resolved against the attributes parsed so far: the merge of
+    // the chunks of ParseObjTextParallel offsets them
+    vector<size_t> relative_verts, relative_uvs, relative_normals;
+};
+
+/*
+ * Parses the v, vt, vn and f lines of the .obj text between begin and end
+ * and appends them to obj
+ * Lines have no length limit, \r\n line endings are accepted, faces can be
+ * written as v, v/t, v//n or v/t/n and use negative (relative) indices
+ */
+void ParseObjText(const char* begin, const char* end, int axis, ObjData& obj)
+{
+    for (const char* p = begin; p != end; p = obj::skipLine(p, end)) {
+        float f[3];
+        vec3 x;
+        if (p[0] == 'v' && end - p > 1 && obj::isBlank(p[1])) {
+            if (obj::parseFloats(p + 1, end, f, 3)) {
+                x = (axis == 0) ? vec3(f[0], -f[2], f[1]) : vec3(f[0], f[1], f[2]);
+                obj.vmax = glm::max(obj.vmax, x);
+                obj.vmin = glm::min(obj.vmin, x);
+                obj.verts.push_back(vec4(x, 1.0));
+            }
+        } else if (p[0] == 'v' && end - p > 2 && p[1] == 't' && obj::isBlank(p[2])) {
+            if (obj::parseFloats(p + 2, end, f, 2))
+                obj.uvs.push_back(vec2(f[0], f[1]));
+        } else if (p[0] == 'v' && end - p > 2 && p[1] == 'n' && obj::isBlank(p[2])) {
+            if (obj::parseFloats(p + 2, end, f, 3)) {
+                x = (axis == 0) ? vec3(f[0], -f[2], f[1]) : vec3(f[0], f[1], f[2]);
+                obj.normals.push_back(vec4(glm::normalize(x), 0.0));
+            }
+        } else if (p[0] == 'f' && end - p > 1 && obj::isBlank(p[1])) {
+            const char* cp = obj::skipBlanks(p + 1, end);
+            int nverts = 0, vi, ti, ni;
+            while (!obj::isEol(cp, end) && obj::parseInt(cp, end, vi)) {
+                nverts++;
+                if (vi < 0)
+                    obj.relative_verts.push_back(obj.faceverts.size());
+                obj.faceverts.push_back(obj::toIndex(vi, obj.verts.size()));
+                if (cp != end && *cp == '/') {
+                    ++cp;
+                    if (obj::parseInt(cp, end, ti)) {
+                        if (ti < 0)
+                            obj.relative_uvs.push_back(obj.faceuvs.size());
+                        obj.faceuvs.push_back(obj::toIndex(ti, obj.uvs.size()));
+                    }
+                    if (cp != end && *cp == '/') {
+                        ++cp;
+                        if (obj::parseInt(cp, end, ni)) {
+                            if (ni < 0)
+                                obj.relative_normals.push_back(
+                                            obj.facenormals.size());
+                            obj.facenormals.push_back(
+                                        obj::toIndex(ni, obj.normals.size()));
+                        }
+                    }
                 }
-                if (nverts != 3 && nverts != 4)
-                    throw runtime_error("Need quad or triangle faces");
-                if (nverts != nvertsPerFace)
-                    throw runtime_error("Need faces with same nb of vertices");
-                face_count++;
-            } break;
-        default:
-            break;
+                while (!obj::isEol(cp, end) && !obj::isBlank(*cp))
+                    ++cp;
+                cp = obj::skipBlanks(cp, end);
+            }
+            if (obj.nverts_per_face == -1)
+                obj.nverts_per_face = nverts;
+            if (nverts != 3 && nverts != 4)
+                throw runtime_error("Need quad or triangle faces");
+            if (nverts != obj.nverts_per_face)
+                throw runtime_error("Need faces with same nb of vertices");
+            obj.face_count++;
+        }
+    }
+}
+
+// Smallest chunk of .obj text parsed by one task of ParseObjTextParallel
+static const size_t OBJ_MIN_CHUNK_SIZE = 64 << 10;
+
+// Chunks of the .obj text parsed by ParseObjTextParallel: at least
+// OBJ_MIN_CHUNK_SIZE bytes each, about 4 per thread for the work stealing to
+// balance them, and a single one without other threads
+size_t ObjChunkCount(size_t size, int thread_count)
+{
+    if (thread_count <= 1)
+        return 1;
+    size_t chunk_size = std::max(OBJ_MIN_CHUNK_SIZE, size / (4 * thread_count));
+    return std::max(size_t(1), size / chunk_size);
+}
+
+namespace obj {
+
+// Appends the elements of each chunk's array to out, in chunk order
+template <typename T>
+void concat(const vector<ObjData>& chunks, vector<T> ObjData::* array,
+            vector<T>& out, ThreadPool& pool)
+{
+    vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); ++i)
+        offsets[i + 1] = offsets[i] + (chunks[i].*array).size();
+    out.resize(offsets.back());
+    pool.ParallelFor(chunks.size(), 1, [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            std::copy((chunks[i].*array).begin(), (chunks[i].*array).end(),
+                      out.begin() + offsets[i]);
+    });
+}
+
+// Offsets the relative indices of each chunk by the attributes of the chunks
+// before it
+template <typename T>
+void fixRelativeIndices(const vector<ObjData>& chunks,
+                        vector<T> ObjData::* attributes,
+                        vector<int> ObjData::* corners,
+                        vector<size_t> ObjData::* relative,
+                        vector<int>& out)
+{
+    size_t attribute_offset = 0, corner_offset = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        for (size_t k : chunks[i].*relative)
+            out[corner_offset + k] += int(attribute_offset);
+        attribute_offset += (chunks[i].*attributes).size();
+        corner_offset += (chunks[i].*corners).size();
+    }
+}
+
+} // namespace obj
+
+/*
+ * Same result as ParseObjText, on the threads of pool: the text is split at
+ * line boundaries in ObjChunkCount chunks, each chunk is parsed in its own
+ * ObjData, and the chunks are concatenated in file order in the empty obj
+ * The absolute indices do not depend on the chunk, the relative ones are
+ * offset by the attributes of the previous chunks, so the result is the same
+ * for any number of threads
+ */
+void ParseObjTextParallel(const char* begin, const char* end, int axis,
+                          ThreadPool& pool, ObjData& obj)
+{
+    size_t size = end - begin;
+    size_t chunk_count = ObjChunkCount(size, pool.GetThreadCount());
+    if (chunk_count == 1) {
+        ParseObjText(begin, end, axis, obj);
+        return;
+    }
+    vector<const char*> bounds(chunk_count + 1, begin);
+    for (size_t i = 1; i < chunk_count; ++i)
+        bounds[i] = std::max(bounds[i - 1],
+                             obj::skipLine(begin + i * size / chunk_count - 1, end));
+    bounds[chunk_count] = end;
+
+    // Parse errors are thrown from the calling thread, first chunk first
+    vector<ObjData> chunks(chunk_count);
+    vector<string> errors(chunk_count);
+    pool.ParallelFor(chunk_count, 1, [&](int, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            try {
+                ParseObjText(bounds[i], bounds[i + 1], axis, chunks[i]);
+            } catch (const std::exception& e) {
+                errors[i] = e.what();
+            }
+        }
+    });
+    for (size_t i = 0; i < chunk_count; ++i) {
+        if (!errors[i].empty())
+            throw runtime_error(errors[i]);
+        const ObjData& chunk = chunks[i];
+        if (obj.nverts_per_face == -1)
+            obj.nverts_per_face = chunk.nverts_per_face;
+        else if (chunk.nverts_per_face != -1
+                 && chunk.nverts_per_face != obj.nverts_per_face)
+            throw runtime_error("Need faces with same nb of vertices");
+        obj.vmin = glm::min(obj.vmin, chunk.vmin);
+        obj.vmax = glm::max(obj.vmax, chunk.vmax);
+        obj.face_count += chunk.face_count;
+    }
+
+    obj::concat(chunks, &ObjData::verts, obj.verts, pool);
+    obj::concat(chunks, &ObjData::uvs, obj.uvs, pool);
+    obj::concat(chunks, &ObjData::normals, obj.normals, pool);
+    obj::concat(chunks, &ObjData::faceverts, obj.faceverts, pool);
+    obj::concat(chunks, &ObjData::faceuvs, obj.faceuvs, pool);
+    obj::concat(chunks, &ObjData::facenormals, obj.facenormals, pool);
+    obj::fixRelativeIndices(chunks, &ObjData::verts, &ObjData::faceverts,
+                            &ObjData::relative_verts, obj.faceverts);
+    obj::fixRelativeIndices(chunks, &ObjData::uvs, &ObjData::faceuvs,
+                            &ObjData::relative_uvs, obj.faceuvs);
+    obj::fixRelativeIndices(chunks, &ObjData::normals, &ObjData::facenormals,
+                            &ObjData::relative_normals, obj.facenormals);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Vertex welding: one Vertex per distinct (position, normal, uv) index
+/// triple of the face corners, numbered in order of first use
+///
+
+namespace weld {
+
+// Attribute indices of a face corner, 0 for the attributes the file lacks
+struct Corner {
+    int v, n, t;
+    bool operator==(const Corner& c) const
+    {
+        return v == c.v && n == c.n && t == c.t;
+    }
+};
+
+inline uint64_t hash(const Corner& c)
+{
+    uint64_t h = uint64_t(uint32_t(c.v)) | (uint64_t(uint32_t(c.n)) << 32);
+    h ^= uint64_t(uint32_t(c.t)) * 0x9E3779B97F4A7C15ull;
+    // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+/*
+ * Open addressing hash table from the corners to a uint (linear probing,
+ * power of two capacity, at most half full)
+ */
+class CornerTable
+{
+public:
+    explicit CornerTable(size_t max_count)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * max_count)
+            capacity *= 2;
+        slots_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    // Returns the value of the corner, after setting it to value if the
+    // corner was not in the table
+    uint FindOrInsert(const Corner& c, uint64_t h, uint value)
+    {
+        for (size_t i = size_t(h) & mask_; ; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if (slot.value == EMPTY) {
+                slot.key = c;
+                slot.value = value;
+                return value;
+            }
+            if (slot.key == c)
+                return slot.value;
+        }
+    }
+
+private:
+    static const uint EMPTY = ~0u;
+    struct Slot {
+        Corner key;
+        uint value = EMPTY;
+    };
+    vector<Slot> slots_;
+    size_t mask_;
+};
+
+struct Attributes {
+    const ObjData& obj;
+    bool with_normals, with_uvs;
+
+    explicit Attributes(const ObjData& o)
+        : obj(o),
+          with_normals(!o.facenormals.empty()
+                       && o.facenormals.size() == o.faceverts.size()),
+          with_uvs(!o.faceuvs.empty() && o.faceuvs.size() == o.faceverts.size())
+    {}
+
+    Corner corner(size_t i) const
+    {
+        Corner c = {obj.faceverts[i], with_normals ? obj.facenormals[i] : 0,
+                    with_uvs ? obj.faceuvs[i] : 0};
+        return c;
+    }
+
+    Vertex vertex(const Corner& c) const
+    {
+        Vertex v;
+        v.p = obj.verts[c.v];
+        if (with_normals) v.n = obj.normals[c.n];
+        if (with_uvs) v.uv = obj.uvs[c.t];
+        return v;
+    }
+};
+
+} // namespace weld
+
+/*
+ * Creates one vertex per distinct (position, normal, uv) of the face
+ * corners of obj, in order of first use, and the index of the vertex of
+ * each corner
+ */
+void WeldVertices(const ObjData& obj, vector<Vertex>& vertices,
+                  vector<uint>& indices)
+{
+    weld::Attributes attributes(obj);
+    size_t count = obj.faceverts.size();
+    weld::CornerTable table(count);
+    vertices.clear();
+    indices.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        weld::Corner c = attributes.corner(i);
+        uint idx = table.FindOrInsert(c, weld::hash(c), uint(vertices.size()));
+        if (idx == vertices.size())
+            vertices.push_back(attributes.vertex(c));
+        indices[i] = idx;
+    }
+}
+
+// Corners below which WeldVerticesParallel runs WeldVertices
+static const size_t WELD_MIN_PARALLEL_COUNT = 1 << 16;
+
+/*
+ * Same result as WeldVertices, on the threads of pool:
+ * - The corners are hashed, and sorted by shard (top bits of the hash) in
+ *   a stable way, from the prefix sum of the per chunk shard counts
+ * - Each shard finds the first corner of each of its triples with its own
+ *   table, so equal triples meet without any synchronization
+ * - The first corners are numbered in corner order from the prefix sum of
+ *   their per chunk counts, which gives the vertex order of WeldVertices
+ */
+void WeldVerticesParallel(const ObjData& obj, ThreadPool& pool,
+                          vector<Vertex>& vertices, vector<uint>& indices)
+{
+    size_t count = obj.faceverts.size();
+    if (pool.GetThreadCount() == 1 || count < WELD_MIN_PARALLEL_COUNT) {
+        WeldVertices(obj, vertices, indices);
+        return;
+    }
+    weld::Attributes attributes(obj);
+    int shard_bits = 2;
+    while ((1 << shard_bits) < 4 * pool.GetThreadCount())
+        ++shard_bits;
+    const size_t shard_count = size_t(1) << shard_bits;
+    const size_t chunk_size = 1 << 14;
+    const size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+    auto shardOf = [&](uint64_t h) { return size_t(h >> (64 - shard_bits)); };
+
+    // Hashes, and corners per chunk and shard
+    vector<uint64_t> hashes(count);
+    vector<size_t> offsets(chunk_count * shard_count, 0);
+    pool.ParallelFor(count, chunk_size, [&](int, size_t begin, size_t end) {
+        size_t* chunk_offsets = &offsets[(begin / chunk_size) * shard_count];
+        for (size_t i = begin; i < end; ++i) {
+            hashes[i] = weld::hash(attributes.corner(i));
+            ++chunk_offsets[shardOf(hashes[i])];
+        }
+    });
+
+    // Corners sorted by shard, in corner order within each shard
+    vector<size_t> shard_begin(shard_count + 1, 0);
+    size_t sum = 0;
+    for (size_t s = 0; s < shard_count; ++s) {
+        shard_begin[s] = sum;
+        for (size_t c = 0; c < chunk_count; ++c) {
+            size_t n = offsets[c * shard_count + s];
+            offsets[c * shard_count + s] = sum;
+            sum += n;
+        }
+    }
+    shard_begin[shard_count] = sum;
+    vector<uint> sorted(count);
+    pool.ParallelFor(count, chunk_size, [&](int, size_t begin, size_t end) {
+        size_t* chunk_offsets = &offsets[(begin / chunk_size) * shard_count];
+        for (size_t i = begin; i < end; ++i)
+            sorted[chunk_offsets[shardOf(hashes[i])]++] = uint(i);
+    });
+
+    // First corner of the triple of each corner
+    vector<uint> first(count);
+    pool.ParallelFor(shard_count, 1, [&](int, size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+            weld::CornerTable table(shard_begin[s + 1] - shard_begin[s]);
+            for (size_t j = shard_begin[s]; j < shard_begin[s + 1]; ++j) {
+                uint i = sorted[j];
+                first[i] = table.FindOrInsert(attributes.corner(i), hashes[i], i);
+            }
+        }
+    });
+
+    // Vertices of the first corners, numbered in corner order
+    vector<size_t> chunk_vertices(chunk_count + 1, 0);
+    pool.ParallelFor(count, chunk_size, [&](int, size_t begin, size_t end) {
+        size_t n = 0;
+        for (size_t i = begin; i < end; ++i)
+            n += (first[i] == i);
+        chunk_vertices[begin / chunk_size + 1] = n;
+    });
+    for (size_t c = 0; c < chunk_count; ++c)
+        chunk_vertices[c + 1] += chunk_vertices[c];
+    vertices.resize(chunk_vertices[chunk_count]);
+    indices.resize(count);
+    pool.ParallelFor(count, chunk_size, [&](int, size_t begin, size_t end) {
+        size_t idx = chunk_vertices[begin / chunk_size];
+        for (size_t i = begin; i < end; ++i) {
+            if (first[i] == i) {
+                vertices[idx] = attributes.vertex(attributes.corner(i));
+                indices[i] = uint(idx++);
+            }
         }
+    });
+    pool.ParallelFor(count, chunk_size, [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            if (first[i] != i)
+                indices[i] = indices[first[i]];
+    });
+}
+
+// Copies the vertices and the indices of the triangles (verts_per_face 3)
+// or quads (4) in mesh_data
+void StoreMeshData(const vector<Vertex>& vertices, const vector<uint>& indices,
+                   int verts_per_face, int face_count, Mesh_Data* mesh_data)
+{
+    if (verts_per_face == 3) {
+        mesh_data->t_idx_array = new uint[indices.size()];
+        std::copy(indices.begin(), indices.end(), mesh_data->t_idx_array);
+        mesh_data->t_idx.count = indices.size();
+        mesh_data->q_idx.count = 0;
+    } else {
+        mesh_data->q_idx_array = new uint[indices.size()];
+        std::copy(indices.begin(), indices.end(), mesh_data->q_idx_array);
+        mesh_data->q_idx.count = indices.size();
+        mesh_data->t_idx.count = 0;
+    }
+    mesh_data->v_array = new Vertex[vertices.size()];
+    std::copy(vertices.begin(), vertices.end(), mesh_data->v_array);
+    mesh_data->v.count = vertices.size();
+    mesh_data->triangle_count = mesh_data->t_idx.count / 3;
+    mesh_data->quad_count = mesh_data->q_idx.count / 4;
+    mesh_data->avg_e_length = 1.0 / cbrt(face_count);
+}
+
+// Read a .obj from file and store it in mesh_data
+// Reads the data line by line
+// Creates unique Vertex objects for each unencountered set of pos / normal / UV
+// Stores the result in mesh_data
+// File parsing adapted from OpenSubdiv
+// The text is parsed on thread_count threads, 0 for all the hardware threads
+void ParseObj(string name, int axis, Mesh_Data* mesh_data, int thread_count = 0)
+{
+    MappedFile file(name);
+    if (!file.IsOpen()) {
+        cout << "Could not open " << name << endl;
+        return;
     }
+    ObjData obj;
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    ParseObjTextParallel(file.Data(), file.Data() + file.Size(), axis, pool,
+                         obj);
+
+    // Filling independent vectors from the data
+    vector<vec4>& verts = obj.verts;
+    vector<vec2>& uvs = obj.uvs;
+    vector<vec4>& normals = obj.normals;
+    vector<int>& faceverts = obj.faceverts;
+    vector<int>& facenormals = obj.facenormals;
+    vec3 vmax = obj.vmax, vmin = obj.vmin;
+    int nvertsPerFace = obj.nverts_per_face;
+    int face_count = obj.face_count;
 
     // Normalize size and center on 0
     vec3 extent = vmax - vmin;
@@ -178,68 +781,2395 @@ void ParseObj(string name, int axis, Mesh_Data* mesh_data)
     // Putting this data in well constructed data structure
     vector<Vertex> vert_vector;
     vector<uint> idx_vector;
-    map<uint, uint> uniqueIDX_to_vectorIDX;
-    Vertex current_v;
-    int num_idx = faceverts.size();
-    int Nv = verts.size();
-    int Nn = normals.size();
-    int Nt = uvs.size();
     cout << "-- Mesh Data: --" << endl;
-    cout << Nv << " Vertice, " << endl;
-    cout << Nn << " Normals, " << endl;
-    cout << Nt << " UVs" << endl;
-    int iv = 0, it = 0, in = 0;
-    uint64 unique_idx;
-    bool with_normals = facenormals.size() > 0;
-    bool with_uvs = faceuvs.size() > 0;
-
-    for (int i = 0;  i < num_idx; i++)
-    {
-        iv = faceverts[i];
-        if (with_normals) in = facenormals[i];
-        if (with_uvs)  it = faceuvs[i];
-        unique_idx = iv + Nv * (in + Nn * it);
-        if (uniqueIDX_to_vectorIDX.count(unique_idx) == 0) {
-            current_v.p = verts[iv];
-            if (with_normals)  current_v.n = normals[in];
-            if (with_uvs) current_v.uv = uvs[it];
-            uniqueIDX_to_vectorIDX[unique_idx] = vert_vector.size();
-            vert_vector.push_back(current_v);
-        }
-        idx_vector.push_back(uniqueIDX_to_vectorIDX[unique_idx]);
-    }
+    cout << verts.size() << " Vertice, " << endl;
+    cout << normals.size() << " Normals, " << endl;
+    cout << uvs.size() << " UVs" << endl;
+    WeldVerticesParallel(obj, pool, vert_vector, idx_vector);
     cout << vert_vector.size() << " unique vertices created" << endl;
     cout << faceverts.size() << " faceverts" << endl;
     cout << facenormals.size() << " facenormals" << endl;
 
-    //Putting data in Mesh_data structure
-    if (nvertsPerFace == 3) {
-        mesh_data->t_idx_array = new uint[idx_vector.size()];
-        std::copy(idx_vector.begin(), idx_vector.end(), mesh_data->t_idx_array);
-        mesh_data->t_idx.count = idx_vector.size();
-        mesh_data->q_idx.count = 0;
-    } else {
-        mesh_data->q_idx_array = new uint[idx_vector.size()];
-        std::copy(idx_vector.begin(), idx_vector.end(), mesh_data->q_idx_array);
-        mesh_data->q_idx.count = idx_vector.size();
-        mesh_data->t_idx.count = 0;
+    StoreMeshData(vert_vector, idx_vector, nvertsPerFace, face_count,
+                  mesh_data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Binary importers (.ply, .glb): read the vertex and index data in place
+/// in the mapped file, without any text conversion
+///
+
+/*
+ * Vertices and polygons read by the importers, converted like those of the
+ * .obj files: axis 0 turns the y up files z up, and the mesh is centered
+ * and fit in the unit box. The polygons are stored as quads when they all
+ * are quads, otherwise triangulated (fans)
+ */
+class MeshBuilder
+{
+public:
+    explicit MeshBuilder(int axis) : axis_(axis) {}
+
+    size_t VertexCount() const { return vertices_.size(); }
+
+    void Reserve(size_t vertex_count, size_t corner_count)
+    {
+        vertices_.reserve(vertices_.size() + vertex_count);
+        corners_.reserve(corners_.size() + corner_count);
     }
-    mesh_data->v_array = new Vertex[vert_vector.size()];
-    std::copy(vert_vector.begin(), vert_vector.end(), mesh_data->v_array);
-    mesh_data->v.count = vert_vector.size();
-    mesh_data->triangle_count = mesh_data->t_idx.count / 3;
-    mesh_data->quad_count = mesh_data->q_idx.count / 4;
 
-    // Deleting old data structures
-    verts.clear();
-    uvs.clear();
-    normals.clear();
-    faceverts.clear();
-    faceuvs.clear();
-    facenormals.clear();
-    idx_vector.clear();
-    vert_vector.clear();
-    mesh_data->avg_e_length = 1.0 / cbrt(face_count);
+    void AddVertex(vec3 p, vec3 n, vec2 uv)
+    {
+        Vertex v;
+        if (axis_ == 0) {
+            p = vec3(p.x, -p.z, p.y);
+            n = vec3(n.x, -n.z, n.y);
+        }
+        vmax_ = glm::max(vmax_, p);
+        vmin_ = glm::min(vmin_, p);
+        v.p = vec4(p, 1.0);
+        if (n != vec3(0))
+            v.n = vec4(glm::normalize(n), 0.0);
+        v.uv = uv;
+        vertices_.push_back(v);
+    }
+
+    // Polygons with less than 3 corners are ignored
+    void AddPolygon(const uint* corners, int count)
+    {
+        if (count < 3)
+            return;
+        corners_.insert(corners_.end(), corners, corners + count);
+        sizes_.push_back(count);
+        all_quads_ &= (count == 4);
+    }
+
+    size_t PolygonCount() const { return sizes_.size(); }
+
+    // False if a polygon uses a vertex that does not exist
+    bool Store(Mesh_Data* mesh_data)
+    {
+        for (size_t i = 0; i < corners_.size(); ++i)
+            if (corners_[i] >= vertices_.size())
+                return false;
+
+        // Normalize size and center on 0, like ParseObj
+        vec3 extent = vmax_ - vmin_;
+        float scale = glm::compMax(extent);
+        vec3 shift = vmin_ + extent * vec3(0.5);
+        for (size_t i = 0; i < vertices_.size(); ++i) {
+            vertices_[i].p = (vertices_[i].p - vec4(shift, 0))
+                           / vec4(scale, scale, scale, 1);
+        }
+
+        if (all_quads_ && !sizes_.empty()) {
+            StoreMeshData(vertices_, corners_, 4, sizes_.size(), mesh_data);
+            return true;
+        }
+        vector<uint> triangles;
+        const uint* polygon = corners_.data();
+        for (size_t i = 0; i < sizes_.size(); polygon += sizes_[i++]) {
+            for (uint k = 2; k < sizes_[i]; ++k) {
+                triangles.push_back(polygon[0]);
+                triangles.push_back(polygon[k - 1]);
+                triangles.push_back(polygon[k]);
+            }
+        }
+        StoreMeshData(vertices_, triangles, 3, sizes_.size(), mesh_data);
+        return true;
+    }
+
+private:
+    int axis_;
+    vector<Vertex> vertices_;
+    vector<uint> corners_, sizes_;
+    bool all_quads_ = true;
+    // Same initial bounds as ObjData
+    vec3 vmin_ = vec3(9999999), vmax_ = vec3(0);
+};
+
+namespace ply {
+
+enum Type { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64,
+            INVALID };
+
+inline Type parseType(const string& name)
+{
+    static const char* names[][2] = {
+        {"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"},
+        {"ushort", "uint16"}, {"int", "int32"}, {"uint", "uint32"},
+        {"float", "float32"}, {"double", "float64"}
+    };
+    for (int i = 0; i < INVALID; ++i)
+        if (name == names[i][0] || name == names[i][1])
+            return Type(i);
+    return INVALID;
+}
+
+inline size_t typeSize(Type type)
+{
+    static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[type];
+}
+
+// Value of the given type at p, with its bytes reversed if swap
+inline double read(const char* p, Type type, bool swap)
+{
+    if (type == FLOAT32 && !swap) {  // Most common case
+        float v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    char b[8];
+    memcpy(b, p, typeSize(type));
+    if (swap)
+        std::reverse(b, b + typeSize(type));
+    switch (type) {
+    case INT8:    { int8_t v;   memcpy(&v, b, 1); return v; }
+    case UINT8:   { uint8_t v;  memcpy(&v, b, 1); return v; }
+    case INT16:   { int16_t v;  memcpy(&v, b, 2); return v; }
+    case UINT16:  { uint16_t v; memcpy(&v, b, 2); return v; }
+    case INT32:   { int32_t v;  memcpy(&v, b, 4); return v; }
+    case UINT32:  { uint32_t v; memcpy(&v, b, 4); return v; }
+    case FLOAT32: { float v;    memcpy(&v, b, 4); return v; }
+    default:      { double v;   memcpy(&v, b, 8); return v; }
+    }
+}
+
+struct Property {
+    string name;
+    Type type = INVALID;
+    Type count_type = INVALID;  // Type of the count of a list property
+};
+
+struct Element {
+    string name;
+    size_t count = 0;
+    vector<Property> properties;
+
+    // Index of the first property with one of the names, or -1
+    int Find(std::initializer_list<const char*> names) const
+    {
+        for (const char* name : names)
+            for (size_t i = 0; i < properties.size(); ++i)
+                if (properties[i].name == name)
+                    return int(i);
+        return -1;
+    }
+};
+
+struct Header {
+    bool swap = false;  // The file endianness is not the host one
+    vector<Element> elements;
+    const char* data = NULL;  // First byte after end_header
+};
+
+// Parses the header of a binary .ply, error is set on failure
+bool parseHeader(const char* begin, const char* end, Header& header,
+                 string& error)
+{
+    static const char end_header[] = "end_header";
+    const char* header_end = std::search(begin, end, end_header,
+                                         end_header + sizeof(end_header) - 1);
+    if (end - begin < 3 || memcmp(begin, "ply", 3) || header_end == end) {
+        error = "not a .ply file";
+        return false;
+    }
+    header.data = obj::skipLine(header_end, end);
+
+    uint16_t one = 1;
+    bool host_little_endian = (*(const char*)&one == 1);
+    std::istringstream lines(string(begin, header_end));
+    string line;
+    while (std::getline(lines, line)) {
+        std::istringstream tokens(line);
+        string keyword;
+        tokens >> keyword;
+        if (keyword == "format") {
+            string format;
+            tokens >> format;
+            if (format == "binary_little_endian") {
+                header.swap = !host_little_endian;
+            } else if (format == "binary_big_endian") {
+                header.swap = host_little_endian;
+            } else {
+                error = "only binary .ply files are supported";
+                return false;
+            }
+        } else if (keyword == "element") {
+            Element element;
+            tokens >> element.name >> element.count;
+            header.elements.push_back(element);
+        } else if (keyword == "property") {
+            if (header.elements.empty()) {
+                error = "property outside of an element";
+                return false;
+            }
+            Property property;
+            string type;
+            tokens >> type;
+            if (type == "list") {
+                string count_type;
+                tokens >> count_type >> type;
+                property.count_type = parseType(count_type);
+                if (property.count_type == INVALID
+                    || property.count_type >= FLOAT32) {
+                    error = "invalid list count type " + count_type;
+                    return false;
+                }
+            }
+            property.type = parseType(type);
+            if (property.type == INVALID) {
+                error = "invalid property type " + type;
+                return false;
+            }
+            tokens >> property.name;
+            header.elements.back().properties.push_back(property);
+        }
+    }
+    return true;
+}
+
+} // namespace ply
+
+/*
+ * Reads a binary (little or big endian) .ply and stores it in mesh_data
+ * The vertex element needs x, y and z, and can have normals (nx, ny, nz)
+ * and texture coordinates (u, v or s, t), of any type. The face element
+ * needs a vertex_indices (or vertex_index) list
+ */
+bool ParsePly(const string& name, int axis, Mesh_Data* mesh_data)
+{
+    MappedFile file(name);
+    if (!file.IsOpen()) {
+        cout << "Could not open " << name << endl;
+        return false;
+    }
+    const char* end = file.Data() + file.Size();
+    ply::Header header;
+    string error;
+    if (!ply::parseHeader(file.Data(), end, header, error)) {
+        cout << "ERROR in " << name << ": " << error << endl;
+        return false;
+    }
+
+    MeshBuilder builder(axis);
+    const char* p = header.data;
+    vector<uint> corners;
+    for (const ply::Element& element : header.elements) {
+        const vector<ply::Property>& properties = element.properties;
+        bool is_vertex = (element.name == "vertex");
+        bool is_face = (element.name == "face");
+        int position[3] = {element.Find({"x"}), element.Find({"y"}),
+                           element.Find({"z"})};
+        int normal[3] = {element.Find({"nx"}), element.Find({"ny"}),
+                         element.Find({"nz"})};
+        int uv[2] = {element.Find({"u", "s", "texture_u", "texture_s"}),
+                     element.Find({"v", "t", "texture_v", "texture_t"})};
+        int indices = element.Find({"vertex_indices", "vertex_index"});
+        bool with_normals = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+        bool with_uvs = uv[0] >= 0 && uv[1] >= 0;
+        if (is_vertex && (position[0] < 0 || position[1] < 0 || position[2] < 0)) {
+            cout << "ERROR in " << name << ": vertices without x, y, z" << endl;
+            return false;
+        }
+        if (is_face && (indices < 0 || properties[indices].count_type
+                                       == ply::INVALID)) {
+            cout << "ERROR in " << name << ": faces without vertex_indices"
+                 << endl;
+            return false;
+        }
+
+        // Elements without lists have rows of fixed size: their properties
+        // are read at fixed offsets, the others skipped
+        vector<size_t> offsets;
+        size_t row_size = 0;
+        for (const ply::Property& property : properties) {
+            offsets.push_back(row_size);
+            row_size += ply::typeSize(property.type);
+            if (property.count_type != ply::INVALID)
+                row_size = 0;
+            if (row_size == 0)
+                break;
+        }
+        if (row_size > 0 && !is_face) {
+            if (size_t(end - p) / row_size < element.count) {
+                cout << "ERROR in " << name << ": truncated file" << endl;
+                return false;
+            }
+            if (is_vertex)
+                builder.Reserve(element.count, 0);
+            for (size_t row = 0; is_vertex && row < element.count; ++row) {
+                const char* r = p + row * row_size;
+                auto get = [&](int i) {
+                    return float(ply::read(r + offsets[i], properties[i].type,
+                                           header.swap));
+                };
+                builder.AddVertex(
+                    vec3(get(position[0]), get(position[1]), get(position[2])),
+                    with_normals ? vec3(get(normal[0]), get(normal[1]),
+                                        get(normal[2]))
+                                 : vec3(0),
+                    with_uvs ? vec2(get(uv[0]), get(uv[1])) : vec2(0));
+            }
+            p += element.count * row_size;
+            continue;
+        }
+        if (is_face)  // Each face takes a few bytes at least
+            builder.Reserve(0, std::min(element.count, size_t(end - p)) * 4);
+
+        vector<double> values(properties.size(), 0.0);
+        for (size_t row = 0; row < element.count; ++row) {
+            bool truncated = false;
+            for (size_t i = 0; i < properties.size() && !truncated; ++i) {
+                const ply::Property& property = properties[i];
+                size_t size = ply::typeSize(property.type);
+                if (property.count_type == ply::INVALID) {
+                    truncated = size_t(end - p) < size;
+                    if (!truncated)
+                        values[i] = ply::read(p, property.type, header.swap);
+                    p += truncated ? 0 : size;
+                    continue;
+                }
+                size_t count_size = ply::typeSize(property.count_type);
+                size_t count = 0;
+                truncated = size_t(end - p) < count_size;
+                if (!truncated) {
+                    count = size_t(ply::read(p, property.count_type,
+                                             header.swap));
+                    p += count_size;
+                    truncated = size_t(end - p) < count * size;
+                }
+                if (truncated)
+                    break;
+                if (is_face && int(i) == indices) {
+                    corners.resize(count);
+                    for (size_t k = 0; k < count; ++k, p += size)
+                        corners[k] = uint(ply::read(p, property.type,
+                                                    header.swap));
+                } else {
+                    p += count * size;
+                }
+            }
+            if (truncated) {
+                cout << "ERROR in " << name << ": truncated file" << endl;
+                return false;
+            }
+            if (is_vertex) {
+                builder.AddVertex(
+                    vec3(values[position[0]], values[position[1]],
+                         values[position[2]]),
+                    with_normals ? vec3(values[normal[0]], values[normal[1]],
+                                        values[normal[2]])
+                                 : vec3(0),
+                    with_uvs ? vec2(values[uv[0]], values[uv[1]]) : vec2(0));
+            } else if (is_face) {
+                builder.AddPolygon(corners.data(), int(corners.size()));
+            }
+        }
+    }
+    if (!builder.Store(mesh_data)) {
+        cout << "ERROR in " << name << ": face index out of range" << endl;
+        return false;
+    }
+    cout << "Mesh " << name << ": " << builder.VertexCount() << " vertices, "
+         << builder.PolygonCount() << " faces" << endl;
+    return true;
+}
+
+namespace json {
+
+// Node of a parsed JSON document, its children are linked by index
+struct Node {
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+    double number = 0.0;  // Value of the numbers, 0 or 1 for the booleans
+    string text;          // Value of the strings
+    string key;           // Name of the member, in an object
+    int first = -1;       // First child of an array or object
+    int next = -1;        // Next sibling
+};
+
+/*
+ * Minimal JSON parser, enough for the glTF headers: the whole document is
+ * parsed in a node array, and the nodes are looked up by index (-1 when
+ * missing, which the accessors accept)
+ */
+class Document
+{
+public:
+    static const int ROOT = 0;
+
+    bool Parse(const char* begin, const char* end)
+    {
+        nodes_.clear();
+        const char* p = begin;
+        return parseValue(p, end, 0) == ROOT && skipSpaces(p, end) == end;
+    }
+
+    // Member of an object with the key, or -1
+    int Find(int node, const char* key) const
+    {
+        if (node < 0 || nodes_[node].type != Node::OBJECT)
+            return -1;
+        for (int c = nodes_[node].first; c >= 0; c = nodes_[c].next)
+            if (nodes_[c].key == key)
+                return c;
+        return -1;
+    }
+
+    // Element i of an array, or -1
+    int At(int node, int i) const
+    {
+        if (node < 0 || nodes_[node].type != Node::ARRAY)
+            return -1;
+        int c = nodes_[node].first;
+        for (; c >= 0 && i > 0; --i)
+            c = nodes_[c].next;
+        return c;
+    }
+
+    int Size(int node) const
+    {
+        int size = 0;
+        if (node >= 0)
+            for (int c = nodes_[node].first; c >= 0; c = nodes_[c].next)
+                ++size;
+        return size;
+    }
+
+    double Number(int node, double fallback) const
+    {
+        bool valid = node >= 0 && (nodes_[node].type == Node::NUMBER
+                                   || nodes_[node].type == Node::BOOLEAN);
+        return valid ? nodes_[node].number : fallback;
+    }
+
+    string Text(int node) const
+    {
+        return (node >= 0) ? nodes_[node].text : string();
+    }
+
+private:
+    static const int MAX_DEPTH = 256;
+
+    static const char* skipSpaces(const char*& p, const char* end)
+    {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n'
+                            || *p == '\r'))
+            ++p;
+        return p;
+    }
+
+    static bool parseHex(const char*& p, const char* end, uint& code)
+    {
+        code = 0;
+        for (int i = 0; i < 4; ++i, ++p) {
+            if (p == end || !isxdigit((unsigned char)*p))
+                return false;
+            char c = char(tolower(*p));
+            code = code * 16 + uint(obj::isDigit(c) ? c - '0' : c - 'a' + 10);
+        }
+        return true;
+    }
+
+    static bool parseString(const char*& p, const char* end, string& s)
+    {
+        if (p == end || *p != '"')
+            return false;
+        for (++p; p != end && *p != '"'; ++p) {
+            if (*p != '\\') {
+                s += *p;
+                continue;
+            }
+            if (++p == end)
+                return false;
+            switch (*p) {
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'n': s += '\n'; break;
+            case 'r': s += '\r'; break;
+            case 't': s += '\t'; break;
+            case 'u': {
+                uint code, low;
+                if (!parseHex(++p, end, code))
+                    return false;
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 2
+                    && p[0] == '\\' && p[1] == 'u') {
+                    p += 2;
+                    if (!parseHex(p, end, low))
+                        return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                --p;
+                // UTF-8 encoding
+                if (code < 0x80) {
+                    s += char(code);
+                } else if (code < 0x800) {
+                    s += char(0xC0 | (code >> 6));
+                    s += char(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    s += char(0xE0 | (code >> 12));
+                    s += char(0x80 | ((code >> 6) & 0x3F));
+                    s += char(0x80 | (code & 0x3F));
+                } else {
+                    s += char(0xF0 | (code >> 18));
+                    s += char(0x80 | ((code >> 12) & 0x3F));
+                    s += char(0x80 | ((code >> 6) & 0x3F));
+                    s += char(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: s += *p; break;  // \" \\ and \/
+            }
+        }
+        if (p == end)
+            return false;
+        ++p;
+        return true;
+    }
+
+    // Integers are read exactly (byte offsets), the others as floats
+    static bool parseNumber(const char*& p, const char* end, double& value)
+    {
+        const char* s = p;
+        if (s != end && *s == '-')
+            ++s;
+        int64_t integer = 0;
+        const char* digits = s;
+        while (s != end && obj::isDigit(*s) && s - digits < 18)
+            integer = integer * 10 + (*s++ - '0');
+        if (s != digits && (s == end || (*s != '.' && *s != 'e' && *s != 'E'
+                                         && !obj::isDigit(*s)))) {
+            value = double((*p == '-') ? -integer : integer);
+            p = s;
+            return true;
+        }
+        float f;
+        if (!obj::parseFloat(p, end, f))
+            return false;
+        value = f;
+        return true;
+    }
+
+    // Index of the parsed node, or -1
+    int parseValue(const char*& p, const char* end, int depth)
+    {
+        if (skipSpaces(p, end) == end || depth > MAX_DEPTH)
+            return -1;
+        int node = int(nodes_.size());
+        nodes_.push_back(Node());
+        char c = *p;
+        if (c == '{' || c == '[') {
+            bool object = (c == '{');
+            nodes_[node].type = object ? Node::OBJECT : Node::ARRAY;
+            ++p;
+            if (skipSpaces(p, end) != end && *p == (object ? '}' : ']')) {
+                ++p;
+                return node;
+            }
+            int last = -1;
+            for (;;) {
+                string key;
+                if (object) {
+                    skipSpaces(p, end);
+                    if (!parseString(p, end, key)
+                        || skipSpaces(p, end) == end || *p++ != ':')
+                        return -1;
+                }
+                int child = parseValue(p, end, depth + 1);
+                if (child < 0)
+                    return -1;
+                nodes_[child].key = key;
+                if (last < 0)
+                    nodes_[node].first = child;
+                else
+                    nodes_[last].next = child;
+                last = child;
+                if (skipSpaces(p, end) == end)
+                    return -1;
+                if (*p == ',') {
+                    ++p;
+                } else if (*p++ == (object ? '}' : ']')) {
+                    return node;
+                } else {
+                    return -1;
+                }
+            }
+        } else if (c == '"') {
+            nodes_[node].type = Node::STRING;
+            string text;
+            if (!parseString(p, end, text))
+                return -1;
+            nodes_[node].text = text;
+        } else if (end - p >= 4 && !memcmp(p, "true", 4)) {
+            nodes_[node].type = Node::BOOLEAN;
+            nodes_[node].number = 1.0;
+            p += 4;
+        } else if (end - p >= 5 && !memcmp(p, "false", 5)) {
+            nodes_[node].type = Node::BOOLEAN;
+            p += 5;
+        } else if (end - p >= 4 && !memcmp(p, "null", 4)) {
+            p += 4;
+        } else {
+            nodes_[node].type = Node::NUMBER;
+            double number;
+            if (!parseNumber(p, end, number))
+                return -1;
+            nodes_[node].number = number;
+        }
+        return node;
+    }
+
+    vector<Node> nodes_;
+};
+
+} // namespace json
+
+namespace gltf {
+
+enum ComponentType { BYTE = 5120, UNSIGNED_BYTE = 5121, SHORT = 5122,
+                     UNSIGNED_SHORT = 5123, UNSIGNED_INT = 5125,
+                     FLOAT = 5126 };
+static const int TRIANGLES_MODE = 4;
+
+inline size_t componentSize(int type)
+{
+    switch (type) {
+    case BYTE: case UNSIGNED_BYTE:  return 1;
+    case SHORT: case UNSIGNED_SHORT: return 2;
+    case UNSIGNED_INT: case FLOAT:  return 4;
+    default: return 0;
+    }
+}
+
+inline int componentCount(const string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+// Accessor resolved to its bytes in the BIN chunk of the .glb
+struct Accessor {
+    const char* data = NULL;
+    size_t count = 0, stride = 0;
+    int component_type = 0, components = 0;
+    bool normalized = false;
+
+    // Component c of element i, scaled to [0, 1] or [-1, 1] if normalized
+    // (the .glb data is little endian, like the hosts we build for)
+    float Get(size_t i, int c) const
+    {
+        const char* p = data + i * stride + c * componentSize(component_type);
+        switch (component_type) {
+        case BYTE:  { int8_t v;  memcpy(&v, p, 1);
+                      return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+        case UNSIGNED_BYTE:  { uint8_t v;  memcpy(&v, p, 1);
+                               return normalized ? v / 255.0f : v; }
+        case SHORT: { int16_t v; memcpy(&v, p, 2);
+                      return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+        case UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2);
+                               return normalized ? v / 65535.0f : v; }
+        case UNSIGNED_INT: { uint32_t v; memcpy(&v, p, 4); return float(v); }
+        default: { float v; memcpy(&v, p, 4); return v; }
+        }
+    }
+
+    uint Index(size_t i) const
+    {
+        const char* p = data + i * stride;
+        switch (component_type) {
+        case UNSIGNED_BYTE:  { uint8_t v;  memcpy(&v, p, 1); return v; }
+        case UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return v; }
+        default:             { uint32_t v; memcpy(&v, p, 4); return v; }
+        }
+    }
+};
+
+/*
+ * Resolves the accessor through its buffer view to the BIN chunk, and
+ * checks that all its elements lie in it. Sparse accessors and external
+ * buffers are not supported
+ */
+bool getAccessor(const json::Document& doc, int index, const char* bin,
+                 size_t bin_size, Accessor& accessor, string& error)
+{
+    int node = doc.At(doc.Find(json::Document::ROOT, "accessors"), index);
+    int view = doc.At(doc.Find(json::Document::ROOT, "bufferViews"),
+                      int(doc.Number(doc.Find(node, "bufferView"), -1)));
+    if (node < 0 || view < 0 || doc.Find(node, "sparse") >= 0) {
+        error = "unsupported accessor";
+        return false;
+    }
+    if (doc.Number(doc.Find(view, "buffer"), 0) != 0 || !bin) {
+        error = "accessor outside of the BIN chunk";
+        return false;
+    }
+    accessor.count = size_t(doc.Number(doc.Find(node, "count"), 0));
+    accessor.component_type = int(doc.Number(doc.Find(node, "componentType"), 0));
+    accessor.components = componentCount(doc.Text(doc.Find(node, "type")));
+    accessor.normalized = doc.Number(doc.Find(node, "normalized"), 0) != 0;
+    size_t element_size = accessor.components
+                        * componentSize(accessor.component_type);
+    if (element_size == 0) {
+        error = "invalid accessor type";
+        return false;
+    }
+    uint64_t view_offset = uint64_t(doc.Number(doc.Find(view, "byteOffset"), 0));
+    uint64_t view_size = uint64_t(doc.Number(doc.Find(view, "byteLength"), 0));
+    uint64_t offset = uint64_t(doc.Number(doc.Find(node, "byteOffset"), 0));
+    accessor.stride = size_t(doc.Number(doc.Find(view, "byteStride"),
+                                        double(element_size)));
+    uint64_t last_byte = offset + element_size
+                       + uint64_t(accessor.stride) * (accessor.count - 1);
+    if (view_offset + view_size > bin_size
+        || (accessor.count > 0 && last_byte > view_size)) {
+        error = "accessor out of its buffer view";
+        return false;
+    }
+    accessor.data = bin + view_offset + offset;
+    return true;
+}
+
+} // namespace gltf
+
+/*
+ * Reads a binary glTF (.glb) and stores the triangle primitives of all its
+ * meshes in mesh_data (node transforms are not applied)
+ * Uses the POSITION, NORMAL and TEXCOORD_0 attributes, and 8, 16 or 32 bit
+ * indices. The texture coordinates are flipped to the bottom left origin of
+ * the .obj files
+ */
+bool ParseGlb(const string& name, int axis, Mesh_Data* mesh_data)
+{
+    static const uint32_t GLB_MAGIC = 0x46546C67;  // "glTF"
+    static const uint32_t JSON_CHUNK = 0x4E4F534A, BIN_CHUNK = 0x004E4942;
+    MappedFile file(name);
+    if (!file.IsOpen()) {
+        cout << "Could not open " << name << endl;
+        return false;
+    }
+    const char* data = file.Data();
+    size_t size = file.Size();
+    uint32_t header[5];
+    if (size < sizeof(header)) {
+        cout << "ERROR in " << name << ": not a .glb file" << endl;
+        return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] != GLB_MAGIC || header[1] != 2 || header[4] != JSON_CHUNK
+        || header[3] > size - sizeof(header)) {
+        cout << "ERROR in " << name << ": not a glTF 2.0 .glb file" << endl;
+        return false;
+    }
+    const char* json_begin = data + sizeof(header);
+    const char* json_end = json_begin + header[3];
+    const char* bin = NULL;
+    size_t bin_size = 0;
+    size_t bin_header = (header[3] + 3) / 4 * 4 + sizeof(header);
+    if (bin_header + 8 <= size) {
+        uint32_t chunk[2];
+        memcpy(chunk, data + bin_header, sizeof(chunk));
+        if (chunk[1] == BIN_CHUNK && chunk[0] <= size - bin_header - 8) {
+            bin = data + bin_header + 8;
+            bin_size = chunk[0];
+        }
+    }
+    json::Document doc;
+    if (!doc.Parse(json_begin, json_end)) {
+        cout << "ERROR in " << name << ": invalid JSON chunk" << endl;
+        return false;
+    }
+
+    MeshBuilder builder(axis);
+    string error;
+    int meshes = doc.Find(json::Document::ROOT, "meshes");
+    for (int m = 0; m < doc.Size(meshes); ++m) {
+        int primitives = doc.Find(doc.At(meshes, m), "primitives");
+        for (int k = 0; k < doc.Size(primitives); ++k) {
+            int primitive = doc.At(primitives, k);
+            if (doc.Number(doc.Find(primitive, "mode"), gltf::TRIANGLES_MODE)
+                != gltf::TRIANGLES_MODE) {
+                cout << name << ": skipping a primitive that is not made of "
+                     << "triangles" << endl;
+                continue;
+            }
+            int attributes = doc.Find(primitive, "attributes");
+            int normal_id = doc.Find(attributes, "NORMAL");
+            int uv_id = doc.Find(attributes, "TEXCOORD_0");
+            int indices_id = doc.Find(primitive, "indices");
+            gltf::Accessor position, normal, uv, indices;
+            bool ok = gltf::getAccessor(
+                doc, int(doc.Number(doc.Find(attributes, "POSITION"), -1)),
+                bin, bin_size, position, error);
+            ok = ok && (normal_id < 0 || gltf::getAccessor(
+                doc, int(doc.Number(normal_id, -1)), bin, bin_size, normal,
+                error));
+            ok = ok && (uv_id < 0 || gltf::getAccessor(
+                doc, int(doc.Number(uv_id, -1)), bin, bin_size, uv, error));
+            ok = ok && (indices_id < 0 || gltf::getAccessor(
+                doc, int(doc.Number(indices_id, -1)), bin, bin_size, indices,
+                error));
+            if (ok && (position.components != 3
+                       || (normal_id >= 0 && (normal.components != 3
+                                              || normal.count != position.count))
+                       || (uv_id >= 0 && (uv.components != 2
+                                          || uv.count != position.count))
+                       || (indices_id >= 0 && (indices.components != 1
+                                               || indices.component_type
+                                                  == gltf::FLOAT)))) {
+                error = "invalid primitive attributes";
+                ok = false;
+            }
+            if (!ok) {
+                cout << "ERROR in " << name << ": " << error << endl;
+                return false;
+            }
+
+            uint base = uint(builder.VertexCount());
+            builder.Reserve(position.count,
+                            indices.data ? indices.count : position.count);
+            for (size_t i = 0; i < position.count; ++i) {
+                builder.AddVertex(
+                    vec3(position.Get(i, 0), position.Get(i, 1),
+                         position.Get(i, 2)),
+                    normal.data ? vec3(normal.Get(i, 0), normal.Get(i, 1),
+                                       normal.Get(i, 2))
+                                : vec3(0),
+                    uv.data ? vec2(uv.Get(i, 0), 1.0f - uv.Get(i, 1))
+                            : vec2(0));
+            }
+            size_t corner_count = indices.data ? indices.count : position.count;
+            for (size_t i = 0; i + 3 <= corner_count; i += 3) {
+                uint triangle[3];
+                for (int c = 0; c < 3; ++c) {
+                    size_t corner = i + c;
+                    triangle[c] = base + (indices.data ? indices.Index(corner)
+                                                       : uint(corner));
+                }
+                builder.AddPolygon(triangle, 3);
+            }
+        }
+    }
+    if (!builder.Store(mesh_data)) {
+        cout << "ERROR in " << name << ": index out of range" << endl;
+        return false;
+    }
+    cout << "Mesh " << name << ": " << builder.VertexCount() << " vertices, "
+         << builder.PolygonCount() << " triangles" << endl;
+    return true;
+}
+
+/*
+ * Reads a mesh file with the importer of its extension: .ply, .glb, or
+ * .obj for the others
+ */
+bool ParseMeshFile(const string& name, int axis, Mesh_Data* mesh_data,
+                   int thread_count = 0)
+{
+    size_t dot = name.find_last_of('.');
+    string extension = (dot == string::npos) ? "" : name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   ::tolower);
+    if (extension == ".ply")
+        return ParsePly(name, axis, mesh_data);
+    if (extension == ".glb")
+        return ParseGlb(name, axis, mesh_data);
+    ParseObj(name, axis, mesh_data, thread_count);
+    return mesh_data->v.count > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Fetch locality: the passes read the vertices of the root polygons in key
+/// order, and the keys start in polygon order
+///
+
+// Locality of the vertex fetches of the polygons, in polygon order
+struct LocalityStats {
+    float acmr = 0.0f;    // Misses of a 32 vertex FIFO cache per polygon
+    float stride = 0.0f;  // Mean distance between consecutive fetches (bytes)
+    float step = 0.0f;    // Mean distance between consecutive polygon
+                          // centroids, in average edge lengths
+};
+
+// Index array and polygon size (3 or 4) of the polygons that become roots
+inline uint* rootPolygons(const Mesh_Data& mesh_data, uint& count, int& size)
+{
+    bool quads = mesh_data.triangle_count == 0;
+    count = quads ? mesh_data.quad_count : mesh_data.triangle_count;
+    size = quads ? 4 : 3;
+    return quads ? mesh_data.q_idx_array : mesh_data.t_idx_array;
+}
+
+inline vec3 polygonCentroid(const Mesh_Data& mesh_data, const uint* polygon,
+                            int size)
+{
+    vec3 c = vec3(0);
+    for (int k = 0; k < size; ++k)
+        c += vec3(mesh_data.v_array[polygon[k]].p);
+    return c / float(size);
+}
+
+LocalityStats MeasureLocality(const Mesh_Data& mesh_data)
+{
+    static const int CACHE_SIZE = 32;
+    LocalityStats stats;
+    uint count;
+    int size;
+    const uint* idx = rootPolygons(mesh_data, count, size);
+    if (count == 0)
+        return stats;
+    uint cache[CACHE_SIZE];
+    std::fill(cache, cache + CACHE_SIZE, ~0u);
+    int head = 0;
+    size_t misses = 0;
+    double stride = 0.0, step = 0.0;
+    for (size_t i = 0; i < size_t(count) * size; ++i) {
+        if (std::find(cache, cache + CACHE_SIZE, idx[i]) == cache + CACHE_SIZE) {
+            cache[head] = idx[i];
+            head = (head + 1) % CACHE_SIZE;
+            ++misses;
+        }
+        if (i > 0)
+            stride += std::abs(double(idx[i]) - double(idx[i - 1]));
+    }
+    for (uint i = 1; i < count; ++i) {
+        step += glm::distance(polygonCentroid(mesh_data, &idx[i * size], size),
+                              polygonCentroid(mesh_data, &idx[(i - 1) * size],
+                                              size));
+    }
+    stats.acmr = float(misses) / count;
+    stats.stride = float(stride * sizeof(Vertex) / (size_t(count) * size));
+    stats.step = float(step / std::max(count - 1, 1u)
+                       / mesh_data.avg_e_length);
+    return stats;
+}
+
+// Interleaves the bits of 21 bit coordinates
+inline uint64_t mortonCode(uint x, uint y, uint z)
+{
+    auto spread = [](uint64_t v) {
+        v &= 0x1FFFFF;
+        v = (v | (v << 32)) & 0x1F00000000FFFFull;
+        v = (v | (v << 16)) & 0x1F0000FF0000FFull;
+        v = (v | (v << 8))  & 0x100F00F00F00F00Full;
+        v = (v | (v << 4))  & 0x10C30C30C30C30C3ull;
+        v = (v | (v << 2))  & 0x1249249249249249ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+/*
+ * Sorts the root polygons along the Morton curve of their centroids, then
+ * numbers the vertices in order of first use by the sorted polygons (the
+ * unused vertices go last), so that the vertex fetches of neighbour keys
+ * hit the same cache lines. Prints the locality before and after
+ * The corner order of the polygons is kept
+ */
+void ReorderForLocality(Mesh_Data* mesh_data)
+{
+    uint count;
+    int size;
+    uint* idx = rootPolygons(*mesh_data, count, size);
+    if (count == 0)
+        return;
+    LocalityStats before = MeasureLocality(*mesh_data);
+
+    // Polygons sorted by the Morton code of their centroids in the bounds
+    vector<vec3> centroids(count);
+    vec3 vmin = vec3(FLT_MAX), vmax = vec3(-FLT_MAX);
+    for (uint i = 0; i < count; ++i) {
+        centroids[i] = polygonCentroid(*mesh_data, &idx[i * size], size);
+        vmin = glm::min(vmin, centroids[i]);
+        vmax = glm::max(vmax, centroids[i]);
+    }
+    vec3 scale = float((1 << 21) - 1) / glm::max(vmax - vmin, vec3(1e-20f));
+    vector<std::pair<uint64_t, uint>> order(count);
+    for (uint i = 0; i < count; ++i) {
+        uvec3 q = uvec3((centroids[i] - vmin) * scale);
+        order[i] = std::make_pair(mortonCode(q.x, q.y, q.z), i);
+    }
+    std::sort(order.begin(), order.end());
+    vector<uint> sorted(size_t(count) * size);
+    for (uint i = 0; i < count; ++i)
+        std::copy(&idx[order[i].second * size],
+                  &idx[order[i].second * size] + size, &sorted[i * size]);
+
+    // Vertices numbered in order of first use
+    const uint UNUSED = ~0u;
+    vector<uint> new_id(mesh_data->v.count, UNUSED);
+    uint next_id = 0;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        if (new_id[sorted[i]] == UNUSED)
+            new_id[sorted[i]] = next_id++;
+    for (uint v = 0; v < mesh_data->v.count; ++v)
+        if (new_id[v] == UNUSED)
+            new_id[v] = next_id++;
+    Vertex* v_array = new Vertex[mesh_data->v.count];
+    for (uint v = 0; v < mesh_data->v.count; ++v)
+        v_array[new_id[v]] = mesh_data->v_array[v];
+    delete[] mesh_data->v_array;
+    mesh_data->v_array = v_array;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        idx[i] = new_id[sorted[i]];
+    // Index array of the other polygon type, if any
+    bool quads = (size == 4);
+    uint* other = quads ? mesh_data->t_idx_array : mesh_data->q_idx_array;
+    uint other_count = quads ? mesh_data->t_idx.count : mesh_data->q_idx.count;
+    for (uint i = 0; other && i < other_count; ++i)
+        other[i] = new_id[other[i]];
+
+    LocalityStats after = MeasureLocality(*mesh_data);
+    cout << "Fetch locality (before -> after reordering):" << endl;
+    cout << "  FIFO32 misses/polygon " << before.acmr << " -> " << after.acmr
+         << endl;
+    cout << "  mean fetch stride " << before.stride << " -> " << after.stride
+         << " B" << endl;
+    cout << "  mean centroid step " << before.step << " -> " << after.step
+         << " edges" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Per polygon LoD scale: the distance based LoD sizes the nodes as if all
+/// the root polygons had edges of avg_e_length, and the same curvature
+///
+
+// Level offsets of the curvature term are clamped to this range
+static const float LOD_CURVATURE_MIN_OFFSET = -4.0f; // Flat polygons
+static const float LOD_CURVATURE_MAX_OFFSET = 2.0f;
+
+// Size and curvature of a root polygon
+struct PolygonLodStats {
+    float edge = 0.0f;  // Mean length of the legs of its root triangles
+    float angle = 0.0f; // Largest angle between its vertex normals (radians)
+};
+
+/*
+ * Statistics of the root polygons of polygon_type (3 or 4 indices per
+ * polygon, in index order). The legs of the root triangles are the quad
+ * edges, or the triangle edges from vertex 0, which faces the hypotenuse
+ * after Mesh::reorderIndices
+ */
+void ComputePolygonLodStats(const Mesh_Data& mesh_data, int polygon_type,
+                            vector<PolygonLodStats>& stats)
+{
+    bool quads = (polygon_type == QUADS);
+    int size = quads ? 4 : 3;
+    const uint* idx = quads ? mesh_data.q_idx_array : mesh_data.t_idx_array;
+    stats.resize(quads ? mesh_data.quad_count : mesh_data.triangle_count);
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const uint* polygon = &idx[i * size];
+        vec3 p[4], n[4];
+        for (int k = 0; k < size; ++k) {
+            p[k] = vec3(mesh_data.v_array[polygon[k]].p);
+            n[k] = vec3(mesh_data.v_array[polygon[k]].n);
+        }
+        if (quads) {
+            for (int k = 0; k < 4; ++k)
+                stats[i].edge += glm::distance(p[k], p[(k + 1) % 4]);
+            stats[i].edge /= 4.0f;
+        } else {
+            stats[i].edge = (glm::distance(p[0], p[1])
+                             + glm::distance(p[0], p[2])) / 2.0f;
+        }
+        for (int a = 0; a < size; ++a) {
+            for (int b = a + 1; b < size; ++b) {
+                if (n[a] == vec3(0) || n[b] == vec3(0))
+                    continue;
+                vec3 na = glm::normalize(n[a]), nb = glm::normalize(n[b]);
+                float angle = std::atan2(glm::length(glm::cross(na, nb)),
+                                         glm::dot(na, nb));
+                stats[i].angle = std::max(stats[i].angle, angle);
+            }
+        }
+    }
+}
+
+/*
+ * Scale of u_lod_factor for each root polygon (FLAG_LOD_SCALE), returns the
+ * smallest one (at most 1). The level of a node is
+ * -2 log2(distance * lod_factor * scale), each level dividing its edges by
+ * sqrt(2):
+ * - avg_e_length / edge gives the nodes the edge length of the ones of a
+ *   polygon with edges of avg_e_length at the same distance. Left out
+ *   without with_edge, for FLAG_LOD_PROJECTED which measures the edges
+ * - with_curvature, the polygon gets log2(curvature / mean curvature) more
+ *   levels, the curvature being its angle / edge: once the node edges e are
+ *   even, the angle of a node is e * curvature, and its chord error
+ *   e * angle / 8 halves per level, so this evens out the chord error.
+ *   Ignored for meshes without normals
+ */
+float ComputeLodScales(const vector<PolygonLodStats>& stats,
+                       float avg_e_length, bool with_edge, bool with_curvature,
+                       vector<float>& scales)
+{
+    double mean_curvature = 0.0;
+    for (size_t i = 0; i < stats.size(); ++i)
+        if (stats[i].edge > 0.0f)
+            mean_curvature += stats[i].angle / stats[i].edge;
+    mean_curvature /= std::max(stats.size(), size_t(1));
+    with_curvature = with_curvature && (mean_curvature > 0.0);
+
+    scales.resize(stats.size());
+    float min_scale = 1.0f;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        float scale = 1.0f;
+        if (with_edge && stats[i].edge > 0.0f)
+            scale = avg_e_length / stats[i].edge;
+        if (with_curvature) {
+            float offset = LOD_CURVATURE_MIN_OFFSET;
+            if (stats[i].angle > 0.0f && stats[i].edge > 0.0f)
+                offset = glm::clamp(float(std::log2(stats[i].angle
+                                                    / stats[i].edge
+                                                    / mean_curvature)),
+                                    LOD_CURVATURE_MIN_OFFSET,
+                                    LOD_CURVATURE_MAX_OFFSET);
+            scale *= std::exp2(-offset / 2.0f);
+        }
+        scales[i] = scale;
+        min_scale = std::min(min_scale, scale);
+    }
+    return min_scale;
+}
+
+/*
+ * Smallest LoD scale for the depth predicted by BinTree::PredictMaxLevel
+ * with FLAG_LOD_PROJECTED, from the scales without their edge term (empty
+ * for LOD_SCALE_GLOBAL): the nodes are refined from their longest edge, the
+ * hypotenuse of their root triangle (sqrt(2) legs), instead of from
+ * avg_e_length, and an edge of length e at distance d subtends less than
+ * e / d radians
+ */
+float ProjectedMinLodScale(const vector<PolygonLodStats>& stats,
+                           float avg_e_length, const vector<float>& scales)
+{
+    float min_scale = 1.0f;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (stats[i].edge <= 0.0f)
+            continue;
+        float scale = scales.empty() ? 1.0f : scales[i];
+        min_scale = std::min(min_scale, scale * avg_e_length
+                                        / (std::sqrt(2.0f) * stats[i].edge));
+    }
+    return min_scale;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Quantized vertices: the 48 byte Vertex packed in a uvec4 for the
+/// FLAG_VERTEX_QUANTIZED shaders, see lt_getMeshVertex in ltree_jk.glsl
+///
+
+// (x | y << 21, y >> 11 | z << 10, octahedral normal, uv)
+// x and y are 21 bit, z 22 bit unorms in the bounding box of the positions,
+// the normal is a snorm2x16 and the uv a half2x16
+typedef uvec4 QuantizedVertex;
+
+// Header of the quantized vertex buffer (std430 layout): the position of
+// the unorm q is min + q * scale
+struct QuantizedBox {
+    vec4 min = vec4(0);   // w unused
+    vec4 scale = vec4(0); // box extent per unorm step, w unused
+};
+
+// Normal word of the zero normals (of the meshes without normals):
+// packSnorm2x16 never writes -32768
+static const uint QUANTIZED_ZERO_NORMAL = 0x80008000u;
+
+// Octahedral mapping of the unit vectors onto [-1, 1]^2
+inline vec2 octEncode(vec3 n)
+{
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    vec2 e = vec2(n);
+    if (n.z < 0.0f)
+        e = (vec2(1.0f) - glm::abs(vec2(e.y, e.x)))
+          * vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+    return e;
+}
+
+inline vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - std::abs(e.x) - std::abs(e.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += (n.x >= 0.0f) ? -t : t;
+    n.y += (n.y >= 0.0f) ? -t : t;
+    return glm::normalize(n);
+}
+
+QuantizedBox QuantizationBox(const Mesh_Data& mesh_data)
+{
+    vec3 vmin = vec3(FLT_MAX), vmax = vec3(-FLT_MAX);
+    for (uint i = 0; i < mesh_data.v.count; ++i) {
+        vmin = glm::min(vmin, vec3(mesh_data.v_array[i].p));
+        vmax = glm::max(vmax, vec3(mesh_data.v_array[i].p));
+    }
+    QuantizedBox box;
+    if (mesh_data.v.count == 0)
+        return box;
+    vec3 steps = vec3((1 << 21) - 1, (1 << 21) - 1, (1 << 22) - 1);
+    box.min = vec4(vmin, 0.0f);
+    box.scale = vec4((vmax - vmin) / steps, 0.0f);
+    return box;
+}
+
+QuantizedVertex QuantizeVertex(const Vertex& v, const QuantizedBox& box)
+{
+    uvec3 max_q = uvec3((1 << 21) - 1, (1 << 21) - 1, (1 << 22) - 1);
+    uvec3 q = uvec3(0);
+    for (int k = 0; k < 3; ++k) {
+        if (box.scale[k] > 0.0f) {
+            float f = std::round((v.p[k] - box.min[k]) / box.scale[k]);
+            q[k] = std::min(uint(std::max(f, 0.0f)), max_q[k]);
+        }
+    }
+    QuantizedVertex qv;
+    qv.x = q.x | (q.y << 21);
+    qv.y = (q.y >> 11) | (q.z << 10);
+    vec3 n = vec3(v.n);
+    qv.z = (n == vec3(0)) ? QUANTIZED_ZERO_NORMAL
+                          : glm::packSnorm2x16(octEncode(n));
+    qv.w = glm::packHalf2x16(v.uv);
+    return qv;
+}
+
+// Same decoding as lt_getMeshVertex
+Vertex DequantizeVertex(const QuantizedVertex& qv, const QuantizedBox& box)
+{
+    uvec3 q = uvec3(qv.x & 0x1FFFFFu,
+                    (qv.x >> 21) | ((qv.y & 0x3FFu) << 11),
+                    qv.y >> 10);
+    Vertex v;
+    v.p = vec4(vec3(box.min) + vec3(q) * vec3(box.scale), 1.0f);
+    if (qv.z != QUANTIZED_ZERO_NORMAL)
+        v.n = vec4(octDecode(glm::unpackSnorm2x16(qv.z)), 0.0f);
+    v.uv = glm::unpackHalf2x16(qv.w);
+    return v;
+}
+
+// Quantizes the vertices of mesh_data on thread_count threads, 0 for all
+// the hardware threads
+void QuantizeVertices(const Mesh_Data& mesh_data, QuantizedBox& box,
+                      vector<QuantizedVertex>& vertices, int thread_count = 0)
+{
+    box = QuantizationBox(mesh_data);
+    vertices.resize(mesh_data.v.count);
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    pool.ParallelFor(vertices.size(), 1 << 14,
+                     [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            vertices[i] = QuantizeVertex(mesh_data.v_array[i], box);
+    });
+}
+
+// Largest errors of the quantized vertices against the float ones
+struct QuantizationError {
+    float position = 0.0f; // In average edge lengths of the mesh
+    float normal = 0.0f;   // Angle, in degrees
+    float uv = 0.0f;
+};
+
+QuantizationError MeasureQuantization(const Mesh_Data& mesh_data,
+                                      const QuantizedBox& box,
+                                      const vector<QuantizedVertex>& vertices)
+{
+    QuantizationError error;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const Vertex& v = mesh_data.v_array[i];
+        Vertex q = DequantizeVertex(vertices[i], box);
+        error.position = std::max(error.position,
+                                  glm::distance(vec3(v.p), vec3(q.p)));
+        vec3 n = vec3(v.n);
+        if (n != vec3(0)) {
+            // atan2 is accurate at the small angles, unlike acos
+            n = glm::normalize(n);
+            vec3 qn = vec3(q.n);
+            float a = std::atan2(glm::length(glm::cross(n, qn)),
+                                 glm::dot(n, qn));
+            error.normal = std::max(error.normal, glm::degrees(a));
+        }
+        vec2 duv = glm::abs(v.uv - q.uv);
+        error.uv = std::max(error.uv, std::max(duv.x, duv.y));
+    }
+    error.position /= mesh_data.avg_e_length;
+    return error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Base mesh: a dense mesh simplified into a coarse cage whose triangles are
+/// the roots of the bintree, and the input surface sampled over each cage
+/// triangle (the base map), so that the leaves still land on the input
+/// surface while the passes only go through the cage roots
+///
+
+// Weight of the planes holding the open boundaries in place
+static const double SIMPLIFY_BOUNDARY_WEIGHT = 1000.0;
+// Smallest cosine between the normals of a triangle before and after a
+// collapse, to keep the cage from folding
+static const double SIMPLIFY_MIN_NORMAL_COS = 0.2;
+// Largest number of base map segments per edge
+static const uint BASE_MAP_MAX_RES = 32;
+
+namespace simplify {
+
+// Sum of the squared distances to weighted planes (symmetric 4x4 matrix:
+// xx xy xz xd yy yz yd zz zd dd)
+struct Quadric {
+    double a[10] = {};
+
+    void AddPlane(glm::dvec3 n, double d, double weight)
+    {
+        double p[4] = {n.x, n.y, n.z, d};
+        int k = 0;
+        for (int i = 0; i < 4; ++i)
+            for (int j = i; j < 4; ++j)
+                a[k++] += weight * p[i] * p[j];
+    }
+
+    void operator+=(const Quadric& q)
+    {
+        for (int k = 0; k < 10; ++k)
+            a[k] += q.a[k];
+    }
+
+    double Error(glm::dvec3 p) const
+    {
+        return a[0] * p.x * p.x + 2.0 * (a[1] * p.x * p.y + a[2] * p.x * p.z
+                                         + a[3] * p.x)
+             + a[4] * p.y * p.y + 2.0 * (a[5] * p.y * p.z + a[6] * p.y)
+             + a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+    }
+};
+
+// Collapse of the vertex u onto the vertex v, valid while neither of them
+// changed since it was queued
+struct Collapse {
+    double cost;
+    uint u, v;
+    uint stamp_u, stamp_v;
+    bool operator>(const Collapse& c) const { return cost > c.cost; }
+};
+
+inline bool hasVertex(uvec3 t, uint v)
+{
+    return t.x == v || t.y == v || t.z == v;
+}
+
+inline glm::dvec3 faceNormal(glm::dvec3 p0, glm::dvec3 p1, glm::dvec3 p2)
+{
+    glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    double length = glm::length(n);
+    return (length > 0.0) ? n / length : glm::dvec3(0.0);
+}
+
+} // namespace simplify
+
+// Vertex indices of the target triangles of polygon_type (the triangles, or
+// the two root triangles of each quad), in triangleID order
+void GetTargetTriangles(const Mesh_Data& mesh_data, int polygon_type,
+                        vector<uvec3>& triangles)
+{
+    bool quads = (polygon_type == QUADS);
+    triangles.resize(quads ? 2 * mesh_data.quad_count
+                           : mesh_data.triangle_count);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        uint polygon = quads ? uint(i / 2) * 4u : uint(i) * 3u;
+        triangles[i] = ltree::lt_getTargetTriangleIndices(
+                    mesh_data, polygon_type, polygon, quads ? uint(i & 1) : 0u);
+    }
+}
+
+/*
+ * Simplifies the target triangles of mesh_data down to target_count
+ * triangles by quadric error edge collapses (Garland and Heckbert), each
+ * vertex collapsing onto one of its neighbours, so that the cage vertices
+ * are input positions. The vertices sharing a position (attribute seams)
+ * are merged first, and get the mean of their normals. The open edges are
+ * held by boundary planes, and the collapses that would make the cage non
+ * manifold or fold a triangle are skipped.
+ * Fills base with the triangles of the cage (arrays allocated with new[],
+ * indices not reordered), its avg_e_length scaled from the input one by
+ * the square root of the reduction
+ */
+bool SimplifyMesh(const Mesh_Data& mesh_data, int polygon_type,
+                  uint target_count, Mesh_Data* base)
+{
+    using glm::dvec3;
+    using simplify::hasVertex;
+    vector<uvec3> input;
+    GetTargetTriangles(mesh_data, polygon_type, input);
+
+    // Vertices sorted by position, one cage vertex per distinct position
+    vector<uint> order(mesh_data.v.count);
+    for (uint i = 0; i < mesh_data.v.count; ++i)
+        order[i] = i;
+    auto less = [&](uint a, uint b) {
+        const vec4& pa = mesh_data.v_array[a].p;
+        const vec4& pb = mesh_data.v_array[b].p;
+        if (pa.x != pb.x)
+            return pa.x < pb.x;
+        if (pa.y != pb.y)
+            return pa.y < pb.y;
+        return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    vector<uint> position_of(mesh_data.v.count);
+    vector<dvec3> positions;
+    vector<vec3> normals;
+    vector<uint> first_vertex;
+    for (size_t k = 0; k < order.size(); ++k) {
+        uint i = order[k];
+        if (k == 0 || less(order[k - 1], i)) {
+            positions.push_back(dvec3(vec3(mesh_data.v_array[i].p)));
+            normals.push_back(vec3(0));
+            first_vertex.push_back(i);
+        }
+        position_of[i] = uint(positions.size() - 1);
+        normals.back() += vec3(mesh_data.v_array[i].n);
+    }
+    size_t vertex_count = positions.size();
+
+    vector<uvec3> tris;
+    tris.reserve(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+        uvec3 t = uvec3(position_of[input[i].x], position_of[input[i].y],
+                        position_of[input[i].z]);
+        if (t.x != t.y && t.y != t.z && t.z != t.x)
+            tris.push_back(t);
+    }
+
+    // Planes of the triangles, weighted by their area
+    vector<vector<uint>> around(vertex_count);
+    vector<dvec3> face_normals(tris.size());
+    vector<simplify::Quadric> quadrics(vertex_count);
+    for (size_t t = 0; t < tris.size(); ++t) {
+        dvec3 p0 = positions[tris[t].x], p1 = positions[tris[t].y];
+        dvec3 p2 = positions[tris[t].z];
+        face_normals[t] = simplify::faceNormal(p0, p1, p2);
+        double area = glm::length(glm::cross(p1 - p0, p2 - p0)) / 2.0;
+        for (int k = 0; k < 3; ++k) {
+            around[tris[t][k]].push_back(uint(t));
+            quadrics[tris[t][k]].AddPlane(face_normals[t],
+                                          -glm::dot(face_normals[t], p0),
+                                          area);
+        }
+    }
+
+    // Open and non manifold edges: planes through the edge, perpendicular
+    // to its triangle
+    vector<std::pair<uint64_t, uint>> edges;
+    edges.reserve(3 * tris.size());
+    for (size_t t = 0; t < tris.size(); ++t) {
+        for (int k = 0; k < 3; ++k) {
+            uint a = tris[t][k], b = tris[t][(k + 1) % 3];
+            edges.push_back(std::make_pair(
+                                (uint64_t(std::min(a, b)) << 32) | std::max(a, b),
+                                uint(t)));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    vector<char> boundary(vertex_count, 0);
+    for (size_t begin = 0, end; begin < edges.size(); begin = end) {
+        for (end = begin + 1; end < edges.size()
+                              && edges[end].first == edges[begin].first; ++end);
+        if (end - begin == 2)
+            continue;
+        for (size_t e = begin; e < end; ++e) {
+            uint a = uint(edges[e].first >> 32), b = uint(edges[e].first);
+            dvec3 d = positions[b] - positions[a];
+            dvec3 n = glm::cross(d, face_normals[edges[e].second]);
+            double length = glm::length(n);
+            if (length == 0.0)
+                continue;
+            n /= length;
+            double weight = SIMPLIFY_BOUNDARY_WEIGHT * glm::dot(d, d);
+            quadrics[a].AddPlane(n, -glm::dot(n, positions[a]), weight);
+            quadrics[b].AddPlane(n, -glm::dot(n, positions[a]), weight);
+            boundary[a] = boundary[b] = 1;
+        }
+    }
+    vector<std::pair<uint64_t, uint>>().swap(edges);
+
+    vector<uint> stamps(vertex_count, 0);
+    vector<char> dead_vertex(vertex_count, 0), dead_tri(tris.size(), 0);
+    std::priority_queue<simplify::Collapse, vector<simplify::Collapse>,
+                        std::greater<simplify::Collapse>> heap;
+    auto push = [&](uint u, uint v) {
+        simplify::Quadric q = quadrics[u];
+        q += quadrics[v];
+        simplify::Collapse c = {q.Error(positions[v]), u, v,
+                                stamps[u], stamps[v]};
+        heap.push(c);
+    };
+    auto prune = [&](uint w) {
+        vector<uint>& l = around[w];
+        l.erase(std::remove_if(l.begin(), l.end(),
+                               [&](uint t) { return dead_tri[t] != 0; }),
+                l.end());
+    };
+    auto neighbours = [&](uint w, vector<uint>& out) {
+        out.clear();
+        for (size_t i = 0; i < around[w].size(); ++i)
+            for (int k = 0; k < 3; ++k)
+                if (tris[around[w][i]][k] != w)
+                    out.push_back(tris[around[w][i]][k]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    for (size_t t = 0; t < tris.size(); ++t) {
+        for (int k = 0; k < 3; ++k) {
+            push(tris[t][k], tris[t][(k + 1) % 3]);
+            push(tris[t][(k + 1) % 3], tris[t][k]);
+        }
+    }
+
+    size_t alive = tris.size();
+    vector<uint> shared, ring_u, ring_v, common;
+    while (alive > target_count && !heap.empty()) {
+        simplify::Collapse c = heap.top();
+        heap.pop();
+        uint u = c.u, v = c.v;
+        if (dead_vertex[u] || dead_vertex[v]
+            || c.stamp_u != stamps[u] || c.stamp_v != stamps[v])
+            continue;
+        prune(u);
+        prune(v);
+        shared.clear();
+        for (size_t i = 0; i < around[u].size(); ++i)
+            if (hasVertex(tris[around[u][i]], v))
+                shared.push_back(around[u][i]);
+        // An open edge from a boundary vertex, or an inner edge
+        if (shared.empty() || shared.size() > 2
+            || (boundary[u] && shared.size() != 1))
+            continue;
+        // Link condition: u and v only share the vertices facing their edge
+        neighbours(u, ring_u);
+        neighbours(v, ring_v);
+        common.clear();
+        std::set_intersection(ring_u.begin(), ring_u.end(), ring_v.begin(),
+                              ring_v.end(), std::back_inserter(common));
+        if (common.size() != shared.size())
+            continue;
+        bool folds = false;
+        for (size_t i = 0; i < around[u].size() && !folds; ++i) {
+            uint t = around[u][i];
+            if (hasVertex(tris[t], v) || face_normals[t] == dvec3(0.0))
+                continue;
+            dvec3 p[3];
+            for (int k = 0; k < 3; ++k)
+                p[k] = positions[(tris[t][k] == u) ? v : tris[t][k]];
+            dvec3 n = simplify::faceNormal(p[0], p[1], p[2]);
+            folds = (glm::dot(n, face_normals[t]) < SIMPLIFY_MIN_NORMAL_COS);
+        }
+        if (folds)
+            continue;
+
+        for (size_t i = 0; i < around[u].size(); ++i) {
+            uint t = around[u][i];
+            if (hasVertex(tris[t], v)) {
+                dead_tri[t] = 1;
+                --alive;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k)
+                if (tris[t][k] == u)
+                    tris[t][k] = v;
+            face_normals[t] = simplify::faceNormal(positions[tris[t].x],
+                                                   positions[tris[t].y],
+                                                   positions[tris[t].z]);
+            around[v].push_back(t);
+        }
+        vector<uint>().swap(around[u]);
+        quadrics[v] += quadrics[u];
+        dead_vertex[u] = 1;
+        ++stamps[v];
+        prune(v);
+        neighbours(v, ring_v);
+        for (size_t i = 0; i < ring_v.size(); ++i) {
+            push(v, ring_v[i]);
+            push(ring_v[i], v);
+        }
+    }
+
+    // Cage vertices numbered in order of first use
+    vector<uint> remap(vertex_count, ~0u);
+    vector<Vertex> vertices;
+    vector<uint> indices;
+    indices.reserve(3 * alive);
+    for (size_t t = 0; t < tris.size(); ++t) {
+        if (dead_tri[t])
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            uint w = tris[t][k];
+            if (remap[w] == ~0u) {
+                remap[w] = uint(vertices.size());
+                Vertex vertex = mesh_data.v_array[first_vertex[w]];
+                float length = glm::length(normals[w]);
+                vertex.n = (length > 0.0f) ? vec4(normals[w] / length, 0.0f)
+                                           : vec4(0.0f);
+                vertices.push_back(vertex);
+            }
+            indices.push_back(remap[w]);
+        }
+    }
+    if (indices.empty())
+        return false;
+
+    *base = Mesh_Data();
+    base->v.count = uint(vertices.size());
+    base->v_array = new Vertex[vertices.size()];
+    std::copy(vertices.begin(), vertices.end(), base->v_array);
+    base->t_idx.count = uint(indices.size());
+    base->t_idx_array = new uint[indices.size()];
+    std::copy(indices.begin(), indices.end(), base->t_idx_array);
+    base->triangle_count = int(indices.size() / 3);
+    base->avg_e_length = mesh_data.avg_e_length
+                       * std::sqrt(float(input.size()) / base->triangle_count);
+    return true;
+}
+
+// Smallest and largest base map offsets of a mesh, 0 without base map
+void GetBaseMapBounds(const Mesh_Data& mesh_data, vec3& lo, vec3& hi)
+{
+    lo = hi = vec3(0.0f);
+    for (size_t i = 0; i < mesh_data.base_map_array.size(); ++i) {
+        const float* offset = mesh_data.base_map_array[i].offset;
+        vec3 v = vec3(offset[0], offset[1], offset[2]);
+        lo = glm::min(lo, v);
+        hi = glm::max(hi, v);
+    }
+}
+
+// Segments per edge of the base map of a cage with ratio input triangles per
+// cage triangle: about one grid cell per input triangle
+inline uint BaseMapResolution(float ratio)
+{
+    uint res = 1;
+    while (res < BASE_MAP_MAX_RES && float(res * res) < ratio)
+        res *= 2;
+    return res;
+}
+
+// Closest point of the triangle abc to p, and its barycentrics (Ericson,
+// Real-Time Collision Detection, 5.1.5)
+inline vec3 closestPointOnTriangle(vec3 p, vec3 a, vec3 b, vec3 c, vec3& bary)
+{
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) {
+        bary = vec3(1, 0, 0);
+        return a;
+    }
+    vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) {
+        bary = vec3(0, 1, 0);
+        return b;
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        float v = d1 / (d1 - d3);
+        bary = vec3(1.0f - v, v, 0);
+        return a + v * ab;
+    }
+    vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) {
+        bary = vec3(0, 0, 1);
+        return c;
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        float w = d2 / (d2 - d6);
+        bary = vec3(1.0f - w, 0, w);
+        return a + w * ac;
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        bary = vec3(0, 1.0f - w, w);
+        return b + w * (c - b);
+    }
+    if (!(va + vb + vc > 0.0f)) { // Degenerate triangle
+        bary = vec3(1, 0, 0);
+        return a;
+    }
+    float v = vb / (va + vb + vc), w = vc / (va + vb + vc);
+    bary = vec3(1.0f - v - w, v, w);
+    return a + v * ab + w * ac;
+}
+
+/*
+ * Uniform grid over the target triangles of a mesh for the closest point
+ * queries of the base map: each cell lists the triangles whose bounding box
+ * overlaps it (cells of about twice the mean edge length)
+ */
+class SurfaceGrid
+{
+public:
+    SurfaceGrid(const Mesh_Data& mesh_data, int polygon_type)
+        : mesh_data_(mesh_data)
+    {
+        GetTargetTriangles(mesh_data, polygon_type, triangles_);
+        min_ = vec3(FLT_MAX);
+        max_ = vec3(-FLT_MAX);
+        double edge = 0.0;
+        for (size_t t = 0; t < triangles_.size(); ++t) {
+            for (int k = 0; k < 3; ++k) {
+                min_ = glm::min(min_, point(t, k));
+                max_ = glm::max(max_, point(t, k));
+                edge += glm::distance(point(t, k), point(t, (k + 1) % 3));
+            }
+        }
+        edge /= std::max(size_t(1), 3 * triangles_.size());
+        vec3 extent = glm::max(max_ - min_, vec3(FLT_MIN));
+        cell_ = std::max(float(2.0 * edge), glm::compMax(extent) / 256.0f);
+        dims_ = glm::max(glm::ivec3(glm::ceil(extent / cell_)),
+                         glm::ivec3(1));
+
+        vector<uint> counts(cellCount() + 1, 0);
+        forEachCell([&](size_t, size_t c) { ++counts[c + 1]; });
+        for (size_t c = 0; c < cellCount(); ++c)
+            counts[c + 1] += counts[c];
+        cell_start_ = counts;
+        cell_triangles_.resize(counts.back());
+        forEachCell([&](size_t t, size_t c) {
+            cell_triangles_[counts[c]++] = uint(t);
+        });
+    }
+
+    /*
+     * Closest point of the surface to p, with the index of its triangle (in
+     * triangleID order) and its barycentrics there. Visits the cells by
+     * rings around the one of p, until the next ring cannot be closer: ring
+     * k + 1 is at least k cells plus the distance of q to the walls of its
+     * cell away from q
+     */
+    vec3 Closest(vec3 p, uint& triangle, vec3& bary) const
+    {
+        vec3 q = glm::clamp(p, min_, max_);
+        float outside = glm::distance(p, q);
+        glm::ivec3 c = cellOf(q);
+        vec3 in_cell = q - (min_ + vec3(c) * cell_);
+        float margin = std::max(0.0f, glm::compMin(
+                                    glm::min(in_cell, vec3(cell_) - in_cell)));
+        float best = FLT_MAX;
+        vec3 closest = q;
+        int max_ring = glm::compMax(dims_);
+        for (int k = 0; k <= max_ring; ++k) {
+            glm::ivec3 lo = glm::max(c - k, glm::ivec3(0));
+            glm::ivec3 hi = glm::min(c + k, dims_ - 1);
+            for (int z = lo.z; z <= hi.z; ++z)
+            for (int y = lo.y; y <= hi.y; ++y)
+            for (int x = lo.x; x <= hi.x; ++x) {
+                glm::ivec3 d = glm::abs(glm::ivec3(x, y, z) - c);
+                if (glm::compMax(d) != k)
+                    continue;
+                size_t cell = cellIndex(glm::ivec3(x, y, z));
+                for (uint i = cell_start_[cell]; i < cell_start_[cell + 1];
+                     ++i) {
+                    uint t = cell_triangles_[i];
+                    vec3 b;
+                    vec3 r = closestPointOnTriangle(p, point(t, 0),
+                                                    point(t, 1), point(t, 2),
+                                                    b);
+                    float dist = glm::distance(p, r);
+                    if (dist < best || (dist == best && t < triangle)) {
+                        best = dist;
+                        closest = r;
+                        triangle = t;
+                        bary = b;
+                    }
+                }
+            }
+            if (best <= k * cell_ + margin - outside)
+                break;
+        }
+        return closest;
+    }
+
+    // Normal of the surface at the barycentrics of a target triangle
+    vec3 Normal(uint triangle, vec3 bary) const
+    {
+        const uvec3& t = triangles_[triangle];
+        return bary.x * vec3(mesh_data_.v_array[t.x].n)
+             + bary.y * vec3(mesh_data_.v_array[t.y].n)
+             + bary.z * vec3(mesh_data_.v_array[t.z].n);
+    }
+
+private:
+    const Mesh_Data& mesh_data_;
+    vector<uvec3> triangles_;
+    vec3 min_, max_;
+    float cell_;
+    glm::ivec3 dims_;
+    vector<uint> cell_start_, cell_triangles_;
+
+    vec3 point(size_t t, int k) const
+    {
+        return vec3(mesh_data_.v_array[triangles_[t][k]].p);
+    }
+
+    size_t cellCount() const { return size_t(dims_.x) * dims_.y * dims_.z; }
+
+    glm::ivec3 cellOf(vec3 p) const
+    {
+        return glm::clamp(glm::ivec3((p - min_) / cell_), glm::ivec3(0),
+                          dims_ - 1);
+    }
+
+    size_t cellIndex(glm::ivec3 c) const
+    {
+        return (size_t(c.z) * dims_.y + c.y) * dims_.x + c.x;
+    }
+
+    // Calls f(triangle, cell) for the cells of the bounding box of each
+    // triangle
+    template <typename F>
+    void forEachCell(F f) const
+    {
+        for (size_t t = 0; t < triangles_.size(); ++t) {
+            vec3 lo = glm::min(point(t, 0), glm::min(point(t, 1), point(t, 2)));
+            vec3 hi = glm::max(point(t, 0), glm::max(point(t, 1), point(t, 2)));
+            glm::ivec3 a = cellOf(lo), b = cellOf(hi);
+            for (int z = a.z; z <= b.z; ++z)
+                for (int y = a.y; y <= b.y; ++y)
+                    for (int x = a.x; x <= b.x; ++x)
+                        f(t, cellIndex(glm::ivec3(x, y, z)));
+        }
+    }
+};
+
+/*
+ * Point (i, j) of the base map grid of a cage triangle, at the
+ * lt_mapTo3DTriangle coordinates (u, v) = (i, j) / res. The points of an
+ * edge only depend on its two vertices, taken in index order, so the
+ * triangles sharing the edge get the same points
+ */
+inline vec3 baseMapPoint(const Mesh_Data& base, const uint* idx, int i, int j)
+{
+    int n = int(base.base_map_res);
+    int w[3] = {n - i - j, j, i}; // Weights of vertices 0, 1 and 2
+    vec3 p[3];
+    for (int k = 0; k < 3; ++k)
+        p[k] = vec3(base.v_array[idx[k]].p);
+    for (int k = 0; k < 3; ++k) {
+        if (w[k] != 0)
+            continue;
+        int a = (k + 1) % 3, b = (k + 2) % 3;
+        if (idx[a] > idx[b])
+            std::swap(a, b);
+        return glm::mix(p[a], p[b], float(w[b]) / float(n));
+    }
+    return (float(w[0]) * p[0] + float(w[1]) * p[1] + float(w[2]) * p[2])
+         / float(n);
+}
+
+/*
+ * Samples the input surface of mesh_data over each triangle of its cage
+ * base (made by SimplifyMesh, with its final index order), on a grid of res
+ * segments per edge: the offset from the grid point of the flat cage
+ * triangle to the closest point of the input surface, and the surface
+ * normal there. The render pass adds the interpolated offsets to the
+ * linear interpolation of the cage (FLAG_BASE_MAP)
+ */
+void BuildBaseMap(const Mesh_Data& mesh_data, int polygon_type, uint res,
+                  Mesh_Data* base, int thread_count = 0)
+{
+    SurfaceGrid surface(mesh_data, polygon_type);
+    base->base_map_res = res;
+    int n = int(res);
+    size_t per_triangle = size_t((n + 1) * (n + 2) / 2);
+    base->base_map_array.resize(size_t(base->triangle_count) * per_triangle);
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    pool.ParallelFor(base->triangle_count, 64,
+                     [&](int, size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const uint* idx = &base->t_idx_array[3 * t];
+            for (int j = 0; j <= n; ++j) {
+                for (int i = 0; i <= n - j; ++i) {
+                    vec3 p = baseMapPoint(*base, idx, i, j);
+                    uint triangle = 0;
+                    vec3 bary;
+                    vec3 q = surface.Closest(p, triangle, bary);
+                    vec3 normal = surface.Normal(triangle, bary);
+                    BaseMapSample& s = base->base_map_array[
+                            ltree::lt_baseMapIndex(res, uint(t), i, j)];
+                    for (int k = 0; k < 3; ++k)
+                        s.offset[k] = q[k] - p[k];
+                    float length = glm::length(normal);
+                    s.normal = (length > 0.0f)
+                             ? glm::packSnorm2x16(octEncode(normal / length))
+                             : QUANTIZED_ZERO_NORMAL;
+                }
+            }
+        }
+    });
+}
+
+// Distance of the mapped cage surface to the input surface
+struct BaseMapError {
+    float mean = 0.0f; // In average edge lengths of the input mesh
+    float max = 0.0f;
+};
+
+/*
+ * Error of the base map between its samples: distance of the cage points
+ * plus their interpolated offset (lt_getBaseMapOffset) to the input
+ * surface, on a grid 6 times finer than the samples
+ */
+BaseMapError MeasureBaseMap(const Mesh_Data& mesh_data, int polygon_type,
+                            const Mesh_Data& base, int thread_count = 0)
+{
+    SurfaceGrid surface(mesh_data, polygon_type);
+    int n = 6 * int(base.base_map_res);
+    ThreadPool pool;
+    pool.SetThreadCount(thread_count);
+    vector<double> sums(pool.GetThreadCount(), 0.0);
+    vector<float> maxs(pool.GetThreadCount(), 0.0f);
+    vector<size_t> counts(pool.GetThreadCount(), 0);
+    pool.ParallelFor(base.triangle_count, 64,
+                     [&](int thread, size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            ltree::Triangle tri;
+            ltree::lt_getIndexedTriangle(
+                        base, uvec3(base.t_idx_array[3 * t],
+                                    base.t_idx_array[3 * t + 1],
+                                    base.t_idx_array[3 * t + 2]), tri);
+            for (int j = 0; j <= n; ++j) {
+                for (int i = 0; i <= n - j; ++i) {
+                    // Skip the samples themselves
+                    if (i % 6 == 0 && j % 6 == 0)
+                        continue;
+                    vec2 uv = vec2(i, j) / float(n);
+                    vec3 p = vec3(ltree::lt_mapTo3DTriangle(tri, uv))
+                           + ltree::lt_getBaseMapOffset(base, uint(t), uv);
+                    uint triangle = 0;
+                    vec3 bary;
+                    float d = glm::distance(p, surface.Closest(p, triangle,
+                                                               bary));
+                    sums[thread] += d;
+                    maxs[thread] = std::max(maxs[thread], d);
+                    ++counts[thread];
+                }
+            }
+        }
+    });
+    BaseMapError error;
+    size_t count = 0;
+    for (size_t k = 0; k < sums.size(); ++k) {
+        error.mean += float(sums[k]);
+        error.max = std::max(error.max, maxs[k]);
+        count += counts[k];
+    }
+    error.mean /= std::max(count, size_t(1)) * mesh_data.avg_e_length;
+    error.max /= mesh_data.avg_e_length;
+    return error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Root BVH: bounding boxes of the roots (the target triangles) in a binary
+/// tree over ranges of triangleIDs. ReorderForLocality sorts the polygons
+/// along a Morton curve, so halving the ranges gives compact boxes. Walked
+/// against the frustum before each update to find the roots whose whole
+/// subtree would be culled (FLAG_ROOT_CULL)
+///
+
+static const uint ROOT_BVH_LEAF_SIZE = 4;
+
+struct RootBvhNode {
+    vec3 min;
+    uint first; // First triangleID under the node
+    vec3 max;
+    uint count; // Number of triangleIDs under the node
+    uint right; // Index of the second child (the first one follows the
+                // node), 0 for the leaves
+};
+
+/*
+ * Bounding box of each target triangle in triangleID order, as tested by the
+ * cull pass: the flat triangle moved by its base map offsets. The boxes are
+ * padded by a few ulps, since the cull pass interpolates the corners of the
+ * nodes from the vertices
+ */
+void GetRootBounds(const Mesh_Data& mesh_data, int polygon_type,
+                   vector<vec3>& bmin, vector<vec3>& bmax)
+{
+    vector<uvec3> triangles;
+    GetTargetTriangles(mesh_data, polygon_type, triangles);
+    bmin.resize(triangles.size());
+    bmax.resize(triangles.size());
+    uint res = mesh_data.base_map_res;
+    size_t samples = size_t(res + 1) * (res + 2) / 2;
+    for (size_t t = 0; t < triangles.size(); ++t) {
+        vec3 lo = vec3(FLT_MAX), hi = vec3(-FLT_MAX);
+        for (int k = 0; k < 3; ++k) {
+            lo = glm::min(lo, vec3(mesh_data.v_array[triangles[t][k]].p));
+            hi = glm::max(hi, vec3(mesh_data.v_array[triangles[t][k]].p));
+        }
+        if (res > 0) {
+            vec3 offset_lo = vec3(FLT_MAX), offset_hi = vec3(-FLT_MAX);
+            const BaseMapSample* s = &mesh_data.base_map_array[t * samples];
+            for (size_t i = 0; i < samples; ++i) {
+                vec3 offset = vec3(s[i].offset[0], s[i].offset[1],
+                                   s[i].offset[2]);
+                offset_lo = glm::min(offset_lo, offset);
+                offset_hi = glm::max(offset_hi, offset);
+            }
+            lo += offset_lo;
+            hi += offset_hi;
+        }
+        float pad = 1e-5f * glm::compMax(glm::max(glm::abs(lo), glm::abs(hi)));
+        bmin[t] = lo - pad;
+        bmax[t] = hi + pad;
+    }
+}
+
+// Appends the node of the triangleIDs [first, first + count) and its
+// descendants to nodes, and returns its index
+uint buildRootBvhNode(const vector<vec3>& bmin, const vector<vec3>& bmax,
+                      uint first, uint count, vector<RootBvhNode>& nodes)
+{
+    uint index = uint(nodes.size());
+    nodes.push_back(RootBvhNode());
+    RootBvhNode node;
+    node.first = first;
+    node.count = count;
+    node.right = 0;
+    if (count <= ROOT_BVH_LEAF_SIZE) {
+        node.min = vec3(FLT_MAX);
+        node.max = vec3(-FLT_MAX);
+        for (uint t = first; t < first + count; ++t) {
+            node.min = glm::min(node.min, bmin[t]);
+            node.max = glm::max(node.max, bmax[t]);
+        }
+    } else {
+        uint half = count / 2;
+        buildRootBvhNode(bmin, bmax, first, half, nodes);
+        node.right = buildRootBvhNode(bmin, bmax, first + half, count - half,
+                                      nodes);
+        node.min = glm::min(nodes[index + 1].min, nodes[node.right].min);
+        node.max = glm::max(nodes[index + 1].max, nodes[node.right].max);
+    }
+    nodes[index] = node;
+    return index;
+}
+
+// BVH of the target triangles of polygon_type, root node first
+void BuildRootBvh(const Mesh_Data& mesh_data, int polygon_type,
+                  vector<RootBvhNode>& nodes)
+{
+    vector<vec3> bmin, bmax;
+    GetRootBounds(mesh_data, polygon_type, bmin, bmax);
+    nodes.clear();
+    if (bmin.empty())
+        return;
+    nodes.reserve(4 * (bmin.size() / ROOT_BVH_LEAF_SIZE + 1));
+    buildRootBvhNode(bmin, bmax, 0, uint(bmin.size()), nodes);
+}
+
+// Sets the bits [first, first + count) of a bit array
+inline void setBitRange(vector<uint>& bits, uint first, uint count)
+{
+    uint end = first + count;
+    while (first < end) {
+        uint bit = first & 31u;
+        uint n = std::min(32u - bit, end - first);
+        bits[first >> 5] |= (n == 32u ? ~0u : ((1u << n) - 1u)) << bit;
+        first += n;
+    }
+}
+
+/*
+ * Visibility of the roots against the frustum planes of TransformBlock (in
+ * mesh space), one bit per triangleID (bit i % 32 of word i / 32). A node
+ * outside of a plane is skipped, a node inside all of them marks all of its
+ * roots visible without visiting its children, and so does a leaf crossing a
+ * plane. A root is hidden exactly when its box fails the culltest of the
+ * cull pass, so its nodes would all be culled.
+ * With a positive displace_height, the boxes span the heights
+ * -displace_height to displace_height instead of their z range, since
+ * FLAG_DISPLACE moves the corners of the nodes to the terrain height.
+ * Returns the number of visible roots
+ */
+size_t CullRootBvh(const vector<RootBvhNode>& nodes, const vec4 planes[6],
+                   float displace_height, vector<uint>& visible)
+{
+    uint root_count = nodes.empty() ? 0u : nodes[0].count;
+    visible.assign((root_count + 31) / 32, 0u);
+    size_t visible_count = 0;
+    uint stack[64];
+    int top = 0;
+    if (!nodes.empty())
+        stack[top++] = 0;
+    while (top > 0) {
+        const RootBvhNode& node = nodes[stack[--top]];
+        vec3 lo = node.min, hi = node.max;
+        if (displace_height > 0.0f) {
+            lo.z = -displace_height;
+            hi.z = displace_height;
+        }
+        bool outside = false, inside = true;
+        for (int i = 0; i < 6 && !outside; ++i) {
+            const vec4& plane = planes[i];
+            vec3 p = vec3(plane.x > 0 ? hi.x : lo.x,
+                          plane.y > 0 ? hi.y : lo.y,
+                          plane.z > 0 ? hi.z : lo.z);
+            vec3 n = vec3(plane.x > 0 ? lo.x : hi.x,
+                          plane.y > 0 ? lo.y : hi.y,
+                          plane.z > 0 ? lo.z : hi.z);
+            outside = (glm::dot(vec4(p, 1.0f), plane) < 0);
+            inside = inside && (glm::dot(vec4(n, 1.0f), plane) >= 0);
+        }
+        if (outside)
+            continue;
+        if (inside || node.right == 0) {
+            setBitRange(visible, node.first, node.count);
+            visible_count += node.count;
+        } else {
+            stack[top++] = node.right;
+            stack[top++] = uint(&node - nodes.data()) + 1;
+        }
+    }
+    return visible_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Boundary of a mesh: the backface test (FLAG_BACKFACE) relies on the
+/// back of a closed surface being hidden by its front, which does not hold
+/// through the holes of an open one
+///
+
+/*
+ * Number of edges of the target triangles of a mesh used by a single
+ * triangle, the vertices being welded by position, 0 for a closed mesh
+ */
+size_t CountBoundaryEdges(const Mesh_Data& mesh_data, int polygon_type)
+{
+    vector<uvec3> triangles;
+    GetTargetTriangles(mesh_data, polygon_type, triangles);
+
+    vector<uint> order(mesh_data.v.count);
+    for (uint i = 0; i < mesh_data.v.count; ++i)
+        order[i] = i;
+    auto less = [&](uint a, uint b) {
+        const vec4& pa = mesh_data.v_array[a].p;
+        const vec4& pb = mesh_data.v_array[b].p;
+        if (pa.x != pb.x)
+            return pa.x < pb.x;
+        if (pa.y != pb.y)
+            return pa.y < pb.y;
+        return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    vector<uint> position_of(mesh_data.v.count);
+    uint position = 0;
+    for (size_t k = 0; k < order.size(); ++k) {
+        if (k > 0 && less(order[k - 1], order[k]))
+            ++position;
+        position_of[order[k]] = position;
+    }
+
+    vector<uint64_t> edges;
+    edges.reserve(3 * triangles.size());
+    for (size_t t = 0; t < triangles.size(); ++t)
+        for (int k = 0; k < 3; ++k) {
+            uint a = position_of[triangles[t][k]];
+            uint b = position_of[triangles[t][(k + 1) % 3]];
+            if (a != b)
+                edges.push_back((uint64_t(std::min(a, b)) << 32)
+                                | std::max(a, b));
+        }
+    std::sort(edges.begin(), edges.end());
+    size_t boundary = 0;
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i;
+        while (j < edges.size() && edges[j] == edges[i])
+            ++j;
+        if (j - i == 1)
+            ++boundary;
+        i = j;
+    }
+    return boundary;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// .tessmesh cache: the processed Mesh_Data of a mesh file, mapped in
+/// memory and uploaded as is on the next runs
+///
+
+// Magic and version of the .tessmesh files, bump the version when the
+// processing of the meshes changes
+static const char TESSMESH_MAGIC[8] = {'T','E','S','S','M','E','S','H'};
+static const uint32_t TESSMESH_VERSION = 3;
+
+// Header of a .tessmesh, followed by the vertex (std430 layout), triangle
+// and quad index arrays at 16 byte aligned offsets
+struct TessMeshHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertex_size;  // sizeof(Vertex) of the writer
+    uint64_t source_hash;  // HashBytes of the source file
+    uint64_t source_size;
+    int32_t axis;          // Axis the source was parsed with
+    uint32_t v_count, t_idx_count, q_idx_count;
+    float avg_e_length;
+    uint32_t padding;
+    uint64_t v_offset, t_idx_offset, q_idx_offset;
+};
+static_assert(sizeof(TessMeshHeader) == 80, "TessMeshHeader must be packed");
+
+// 64 bit hash of a byte array, 8 bytes per multiply
+inline uint64_t HashBytes(const char* data, size_t size)
+{
+    uint64_t h = uint64_t(size) * 0x9E3779B97F4A7C15ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    h = (h ^ tail) * 0xFF51AFD7ED558CCDull;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+// Hash and size of a file, false if it cannot be read
+bool HashFile(const string& name, uint64_t& hash, uint64_t& size)
+{
+    MappedFile file(name);
+    if (!file.IsOpen())
+        return false;
+    hash = HashBytes(file.Data(), file.Size());
+    size = file.Size();
+    return true;
+}
+
+// Cache of the mesh file name
+inline string TessMeshName(const string& name)
+{
+    return name + ".tessmesh";
+}
+
+/*
+ * Points the arrays of mesh_data into the mapped .tessmesh of the source
+ * file name, if it was made from the same source bytes (hash and size) with
+ * the same axis, version and Vertex layout. The mapping is owned by
+ * mesh_data and is read only
+ */
+bool LoadTessMesh(const string& name, uint64_t source_hash,
+                  uint64_t source_size, int axis, Mesh_Data* mesh_data)
+{
+    std::shared_ptr<MappedFile> file =
+        std::make_shared<MappedFile>(TessMeshName(name));
+    if (!file->IsOpen() || file->Size() < sizeof(TessMeshHeader))
+        return false;
+    TessMeshHeader header;
+    memcpy(&header, file->Data(), sizeof(header));
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % 16 == 0 && offset <= file->Size()
+            && count * size <= file->Size() - offset;
+    };
+    if (memcmp(header.magic, TESSMESH_MAGIC, sizeof(header.magic))
+        || header.version != TESSMESH_VERSION
+        || header.vertex_size != sizeof(Vertex)
+        || header.source_hash != source_hash
+        || header.source_size != source_size || header.axis != axis
+        || !fits(header.v_offset, header.v_count, sizeof(Vertex))
+        || !fits(header.t_idx_offset, header.t_idx_count, sizeof(uint))
+        || !fits(header.q_idx_offset, header.q_idx_count, sizeof(uint)))
+        return false;
+
+    char* data = const_cast<char*>(file->Data());
+    mesh_data->v_array = (Vertex*)(data + header.v_offset);
+    mesh_data->t_idx_array = header.t_idx_count
+                           ? (uint*)(data + header.t_idx_offset) : NULL;
+    mesh_data->q_idx_array = header.q_idx_count
+                           ? (uint*)(data + header.q_idx_offset) : NULL;
+    mesh_data->v.count = header.v_count;
+    mesh_data->t_idx.count = header.t_idx_count;
+    mesh_data->q_idx.count = header.q_idx_count;
+    mesh_data->triangle_count = header.t_idx_count / 3;
+    mesh_data->quad_count = header.q_idx_count / 4;
+    mesh_data->avg_e_length = header.avg_e_length;
+    mesh_data->mapping = file;
+    return true;
+}
+
+/*
+ * Writes the .tessmesh of the source file name from its processed
+ * mesh_data. Goes through a temporary file, so that a partial write never
+ * replaces a valid cache
+ */
+bool WriteTessMesh(const string& name, uint64_t source_hash,
+                   uint64_t source_size, int axis, const Mesh_Data& mesh_data)
+{
+    auto align = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+    TessMeshHeader header = {};
+    memcpy(header.magic, TESSMESH_MAGIC, sizeof(header.magic));
+    header.version = TESSMESH_VERSION;
+    header.vertex_size = sizeof(Vertex);
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.axis = axis;
+    header.v_count = mesh_data.v.count;
+    header.t_idx_count = mesh_data.t_idx.count;
+    header.q_idx_count = mesh_data.q_idx.count;
+    header.avg_e_length = mesh_data.avg_e_length;
+    header.v_offset = align(sizeof(header));
+    header.t_idx_offset = align(header.v_offset
+                                + uint64_t(header.v_count) * sizeof(Vertex));
+    header.q_idx_offset = align(header.t_idx_offset
+                                + uint64_t(header.t_idx_count) * sizeof(uint));
+
+    string cache_name = TessMeshName(name);
+    string tmp_name = cache_name + ".tmp";
+    {
+        std::ofstream out(tmp_name.c_str(), std::ios::binary);
+        auto write = [&](uint64_t offset, const void* data, uint64_t size) {
+            static const char zeros[16] = {};
+            if (!out)
+                return;
+            out.write(zeros, std::streamsize(offset - uint64_t(out.tellp())));
+            if (size > 0)
+                out.write((const char*)data, std::streamsize(size));
+        };
+        write(0, &header, sizeof(header));
+        write(header.v_offset, mesh_data.v_array,
+              uint64_t(header.v_count) * sizeof(Vertex));
+        write(header.t_idx_offset, mesh_data.t_idx_array,
+              uint64_t(header.t_idx_count) * sizeof(uint));
+        write(header.q_idx_offset, mesh_data.q_idx_array,
+              uint64_t(header.q_idx_count) * sizeof(uint));
+        if (!out) {
+            cout << "Could not write " << cache_name << endl;
+            out.close();
+            std::remove(tmp_name.c_str());
+            return false;
+        }
+    }
+    std::remove(cache_name.c_str());
+    if (std::rename(tmp_name.c_str(), cache_name.c_str()) != 0) {
+        cout << "Could not write " << cache_name << endl;
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+    return true;
 }
 
 
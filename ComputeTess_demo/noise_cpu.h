@@ -0,0 +1,134 @@
+#ifndef NOISE_CPU_H
+#define NOISE_CPU_H
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// C++ port of the procedural heightmap of noise.glsl, along with the only
+/// function of gpu_noise_lib.glsl it relies on (SimplexPerlin2D).
+/// Used by the CPU backend of the bintree to displace the terrain exactly
+/// like the compute pass does.
+///
+
+namespace noise {
+
+inline float fract(float x) { return x - std::floor(x); }
+
+inline vec4 fract(vec4 v) { return v - glm::floor(v); }
+
+// Generates 2 random numbers for each of the 4 cell corners
+inline void FAST32_hash_2D(vec2 gridcell, vec4& hash_0, vec4& hash_1)
+{
+    //    gridcell is assumed to be an integer coordinate
+    const vec2 OFFSET = vec2(26.0f, 161.0f);
+    const float DOMAIN = 71.0f;
+    const vec2 SOMELARGEFLOATS = vec2(951.135664f, 642.949883f);
+    vec4 P = vec4(gridcell.x, gridcell.y, gridcell.x + 1.0f, gridcell.y + 1.0f);
+    P = P - glm::floor(P * (1.0f / DOMAIN)) * DOMAIN;
+    P += vec4(OFFSET.x, OFFSET.y, OFFSET.x, OFFSET.y);
+    P *= P;
+    P = vec4(P.x, P.z, P.x, P.z) * vec4(P.y, P.y, P.w, P.w);
+    hash_0 = fract(P * (1.0f / SOMELARGEFLOATS.x));
+    hash_1 = fract(P * (1.0f / SOMELARGEFLOATS.y));
+}
+
+// SimplexPerlin2D  ( simplex gradient noise )
+// Perlin noise over a simplex (triangular) grid
+// Return value range of -1.0->1.0
+inline float SimplexPerlin2D(vec2 P)
+{
+    //	simplex math constants
+    const float SKEWFACTOR = 0.36602540378443864676372317075294f;
+    const float UNSKEWFACTOR = 0.21132486540518711774542560974902f;
+    const float SIMPLEX_TRI_HEIGHT = 0.70710678118654752440084436210485f;
+    const vec3 SIMPLEX_POINTS = vec3(1.0f - UNSKEWFACTOR,
+                                     -UNSKEWFACTOR,
+                                     1.0f - 2.0f * UNSKEWFACTOR);
+
+    //	establish our grid cell.
+    P *= SIMPLEX_TRI_HEIGHT;
+    vec2 Pi = glm::floor(P + glm::dot(P, vec2(SKEWFACTOR)));
+
+    //	calculate the hash.
+    vec4 hash_x, hash_y;
+    FAST32_hash_2D(Pi, hash_x, hash_y);
+
+    //	establish vectors to the 3 corners of our simplex triangle
+    vec2 v0 = Pi - glm::dot(Pi, vec2(UNSKEWFACTOR)) - P;
+    vec4 v1pos_v1hash = (v0.x < v0.y)
+            ? vec4(SIMPLEX_POINTS.x, SIMPLEX_POINTS.y, hash_x.y, hash_y.y)
+            : vec4(SIMPLEX_POINTS.y, SIMPLEX_POINTS.x, hash_x.z, hash_y.z);
+    vec4 v12 = vec4(v1pos_v1hash.x, v1pos_v1hash.y,
+                    SIMPLEX_POINTS.z, SIMPLEX_POINTS.z)
+            + vec4(v0.x, v0.y, v0.x, v0.y);
+
+    //	calculate the dotproduct of our 3 corner vectors with 3 random normalized vectors
+    vec3 grad_x = vec3(hash_x.x, v1pos_v1hash.z, hash_x.w) - 0.49999f;
+    vec3 grad_y = vec3(hash_y.x, v1pos_v1hash.w, hash_y.w) - 0.49999f;
+    vec3 grad_results = glm::inversesqrt(grad_x * grad_x + grad_y * grad_y)
+            * (grad_x * vec3(v0.x, v12.x, v12.z)
+               + grad_y * vec3(v0.y, v12.y, v12.w));
+
+    //	Normalization factor to scale the final result to a strict 1.0->-1.0 range
+    const float FINAL_NORMALIZATION = 99.204334582718712976990005025589f;
+
+    //	evaluate the surflet, sum and return
+    vec3 m = vec3(v0.x, v12.x, v12.z) * vec3(v0.x, v12.x, v12.z)
+            + vec3(v0.y, v12.y, v12.w) * vec3(v0.y, v12.y, v12.w);
+    m = glm::max(0.5f - m, 0.0f);
+    m = m*m;
+    m = m*m;
+    return glm::dot(m, grad_results) * FINAL_NORMALIZATION;
+}
+
+// ---------------------------- noise.glsl port ----------------------------- //
+
+const float H = 0.96f;
+const float lacunarity = 1.99f;
+
+inline float displace(vec2 p, float screen_resolution)
+{
+    const float max_octaves = 16.0f;
+    float frequency = 1.5f;
+    float octaves = utility::clamp(std::log2(screen_resolution) - 2.0f,
+                                   0.0f, max_octaves);
+    float value = 0.0f;
+
+    for (float i = 0.0f; i < octaves - 1.0f; i += 1.0f) {
+        value += SimplexPerlin2D(p) * std::pow(frequency, -H);
+        p *= lacunarity;
+        frequency *= lacunarity;
+    }
+    value += fract(octaves) * SimplexPerlin2D(p) * std::pow(frequency, -H);
+    return value;
+}
+
+inline vec3 displaceVertex(vec3 v, vec3 eye, float displace_factor)
+{
+    float f = 3e3f / glm::distance(v, eye);
+    v.z = displace(vec2(v), f) * displace_factor;
+    return v;
+}
+
+inline vec4 displaceVertex(vec4 v, vec3 eye, float displace_factor)
+{
+    return vec4(displaceVertex(vec3(v), eye, displace_factor), v.w);
+}
+
+inline float getHeight(vec2 v, float f, float displace_factor)
+{
+    return displace(v, f) * displace_factor;
+}
+
+// Bound of |getHeight| at any resolution: each octave of displace is in
+// [-1, 1], weighted by frequency^-H
+inline float maxHeight(float displace_factor)
+{
+    return std::pow(1.5f, -H) / (1.0f - std::pow(lacunarity, -H))
+         * displace_factor;
+}
+
+} // namespace noise
+
+#endif // NOISE_CPU_H
@@ -4,6 +4,7 @@
 #define LOD_GLSL
 
 uniform float u_lod_factor;
+uniform int u_screen_res;
 
 layout(std140, binding = 0) uniform TransformBlock
 {
@@ -21,16 +22,100 @@ layout(std140, binding = 0) uniform TransformBlock
 
 const vec2 triangle_centroid = vec2(0.5);
 
-float distanceToLod(vec3 pos)
+#if FLAG_LOD_SCALE
+// Scale of u_lod_factor per root polygon, see meshutils::ComputeLodScales
+layout (std430, binding = LOD_SCALES_B) readonly buffer Lod_Scales {
+    float u_LodScale[];
+};
+#endif
+
+// Scale of u_lod_factor for the root polygon of the key
+float lodScale(uvec4 key)
+{
+#if FLAG_LOD_SCALE && FLAG_TRIANGLES
+    return u_LodScale[key.z / 3u];
+#elif FLAG_LOD_SCALE && FLAG_QUADS
+    return u_LodScale[key.z / 4u];
+#else
+    return 1.0;
+#endif
+}
+
+float distanceToLod(vec3 pos, float lod_scale)
 {
     float d = distance(pos, u_transforms.cam_pos);
-    float lod = (d * u_lod_factor);
+    float lod = (d * u_lod_factor * lod_scale);
     lod = clamp(lod, 0.0, 1.0) ;
     return - 2.0 * log2(lod);
 }
 
+#if FLAG_LOD_PROJECTED
+uniform float u_target_edge_length;
+uniform int u_cpu_lod;
+
+/**
+ * Length in pixels of the longest edge of the triangle of world space
+ * corners c: the angle it subtends from the camera, times the pixels per
+ * radian of u_transforms.P at the center of the screen. Unlike the
+ * distance to the centroid, it shrinks with the foreshortening of the
+ * triangle, and unlike its projection on the screen, it stays defined
+ * behind the camera
+ */
+float projectedEdgeLength(vec3 c[3])
+{
+    float angle = 0.0;
+    for (int i = 0; i < 3; ++i) {
+        vec3 a = c[i] - u_transforms.cam_pos;
+        vec3 b = c[(i + 1) % 3] - u_transforms.cam_pos;
+        angle = max(angle, atan(length(cross(a, b)), dot(a, b)));
+    }
+    return angle * u_transforms.P[1][1] * 0.5 * float(u_screen_res);
+}
+
+/**
+ * Level at which the longest edge of the rendered grid of a node of level
+ * key_lvl is u_target_edge_length pixels long, each level dividing the
+ * edges of the node by sqrt(2)
+ */
+float projectedToLod(vec3 c[3], float key_lvl, float lod_scale)
+{
+    float e = projectedEdgeLength(c) / exp2(float(u_cpu_lod));
+    return max(key_lvl + 2.0 * log2(e / (u_target_edge_length * lod_scale)),
+               0.0);
+}
+
+// World space corners of the node of the key and of its parent
+void nodeCornersWithParent(uvec4 key, out vec3 c[3], out vec3 pc[3])
+{
+    vec4 c_mesh[3], pc_mesh[3];
+    lt_Node_n_Parent_to_MeshCorners(key, c_mesh, pc_mesh);
+    for (int i = 0; i < 3; ++i) {
+        c[i]  = (u_transforms.M * c_mesh[i]).xyz;
+        pc[i] = (u_transforms.M * pc_mesh[i]).xyz;
+    }
+}
+
+void projectedTessLvlWithParent(uvec4 key, vec3 c[3], vec3 pc[3],
+                                out float lvl, out float parent_lvl)
+{
+    float key_lvl = float(lt_level_64(key.xy));
+    float lod_scale = lodScale(key);
+    lvl        = projectedToLod(c, key_lvl, lod_scale);
+    parent_lvl = projectedToLod(pc, key_lvl - 1.0, lod_scale);
+}
+#endif
+
 #if FLAG_DISPLACE
 void computeTessLvlWithParent(uvec4 key, float height, out float lvl, out float parent_lvl) {
+#if FLAG_LOD_PROJECTED
+    vec3 c[3], pc[3];
+    nodeCornersWithParent(key, c, pc);
+    for (int i = 0; i < 3; ++i) {
+        c[i].z = height;
+        pc[i].z = height;
+    }
+    projectedTessLvlWithParent(key, c, pc, lvl, parent_lvl);
+#else
     vec4 p_mesh, pp_mesh;
     lt_Leaf_n_Parent_to_MeshPosition(triangle_centroid, key, p_mesh, pp_mesh);
     p_mesh  = u_transforms.M * p_mesh;
@@ -38,19 +123,28 @@ void computeTessLvlWithParent(uvec4 key, float height, out float lvl, out float
     p_mesh.z = height;
     pp_mesh.z = height;
 
-    lvl        = distanceToLod(p_mesh.xyz);
-    parent_lvl = distanceToLod(pp_mesh.xyz);
+    float lod_scale = lodScale(key);
+    lvl        = distanceToLod(p_mesh.xyz, lod_scale);
+    parent_lvl = distanceToLod(pp_mesh.xyz, lod_scale);
+#endif
 }
 #endif
 
 void computeTessLvlWithParent(uvec4 key, out float lvl, out float parent_lvl) {
+#if FLAG_LOD_PROJECTED
+    vec3 c[3], pc[3];
+    nodeCornersWithParent(key, c, pc);
+    projectedTessLvlWithParent(key, c, pc, lvl, parent_lvl);
+#else
     vec4 p_mesh, pp_mesh;
     lt_Leaf_n_Parent_to_MeshPosition(triangle_centroid, key, p_mesh, pp_mesh);
     p_mesh  = u_transforms.M * p_mesh;
     pp_mesh = u_transforms.M * pp_mesh;
 
-    lvl        = distanceToLod(p_mesh.xyz);
-    parent_lvl = distanceToLod(pp_mesh.xyz);
+    float lod_scale = lodScale(key);
+    lvl        = distanceToLod(p_mesh.xyz, lod_scale);
+    parent_lvl = distanceToLod(pp_mesh.xyz, lod_scale);
+#endif
 }
 
 bool culltest(mat4 mvp, vec3 bmin, vec3 bmax)
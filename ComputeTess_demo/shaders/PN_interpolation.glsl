@@ -34,59 +34,60 @@ struct PnPatch
     vec3 n101;
 };
 
-float wij(vec3 pi, vec3 pj, vec3 ni)
+// Coefficients of the PN triangle that do not come straight from its
+// vertices, computed once per target triangle by itpl::GetPnCoeffs
+struct PnCoeffs {
+    float b[21]; // b210, b120, b021, b012, b102, b201, b111
+    float n[9];  // n110, n011, n101
+};
+
+layout (std430, binding = PATCHES_B) readonly buffer Pn_Patches {
+    PnCoeffs u_PnCoeffs[];
+};
+
+vec3 pnControlPoint(uint triangleID, int i)
 {
-    return dot(pj - pi, ni);
+    return vec3(u_PnCoeffs[triangleID].b[3*i + 0],
+                u_PnCoeffs[triangleID].b[3*i + 1],
+                u_PnCoeffs[triangleID].b[3*i + 2]);
 }
 
-float vij(vec3 pi, vec3 pj, vec3 ni, vec3 nj)
+vec3 pnNormal(uint triangleID, int i)
 {
-    vec3 Pj_minus_Pi = pj - pi;
-    vec3 Ni_plus_Nj  = ni + nj;
-    return 2.0*dot(Pj_minus_Pi, Ni_plus_Nj)/dot(Pj_minus_Pi, Pj_minus_Pi);
+    return vec3(u_PnCoeffs[triangleID].n[3*i + 0],
+                u_PnCoeffs[triangleID].n[3*i + 1],
+                u_PnCoeffs[triangleID].n[3*i + 2]);
 }
 
-void getPnPatch(Triangle t, out PnPatch oPnPatch)
+void getPnPatch(Triangle t, uint triangleID, out PnPatch oPnPatch)
 {
-    vec3 P0 = t.vertex[0].p.xyz;
-    vec3 P1 = t.vertex[1].p.xyz;
-    vec3 P2 = t.vertex[2].p.xyz;
-
-    vec3 N0 = t.vertex[0].n.xyz;
-    vec3 N1 = t.vertex[1].n.xyz;
-    vec3 N2 = t.vertex[2].n.xyz;
-
-    oPnPatch.b300 = P0;
-    oPnPatch.b030 = P1;
-    oPnPatch.b003 = P2;
-    oPnPatch.n200 = normalize(N0);
-    oPnPatch.n020 = normalize(N1);
-    oPnPatch.n002 = normalize(N2);
-
-    oPnPatch.b210 = (2.0*P0 + P1 - wij(P0,P1,N0)*N0)/3.0;
-    oPnPatch.b120 = (2.0*P1 + P0 - wij(P1,P0,N1)*N1)/3.0;
-    oPnPatch.b021 = (2.0*P1 + P2 - wij(P1,P2,N1)*N1)/3.0;
-    oPnPatch.b012 = (2.0*P2 + P1 - wij(P2,P1,N2)*N2)/3.0;
-    oPnPatch.b102 = (2.0*P2 + P0 - wij(P2,P0,N2)*N2)/3.0;
-    oPnPatch.b201 = (2.0*P0 + P2 - wij(P0,P2,N0)*N0)/3.0;
-
-    vec3 E = ( oPnPatch.b210 + oPnPatch.b120 + oPnPatch.b021 +
-               oPnPatch.b012 + oPnPatch.b102 + oPnPatch.b201 ) / 6.0;
-    vec3 V = (P0 + P1 + P2)/3.0;
-
-    oPnPatch.b111 = E + (E - V) * 0.5;
-
-    oPnPatch.n110 = normalize(N0 + N1 - vij(P0,P1,N0,N1) * (P1-P0));
-    oPnPatch.n011 = normalize(N1 + N2 - vij(P1,P2,N1,N2) * (P2-P1));
-    oPnPatch.n101 = normalize(N2 + N0 - vij(P2,P0,N2,N0) * (P0-P2));
+    oPnPatch.b300 = t.vertex[0].p.xyz;
+    oPnPatch.b030 = t.vertex[1].p.xyz;
+    oPnPatch.b003 = t.vertex[2].p.xyz;
+    oPnPatch.n200 = normalize(t.vertex[0].n.xyz);
+    oPnPatch.n020 = normalize(t.vertex[1].n.xyz);
+    oPnPatch.n002 = normalize(t.vertex[2].n.xyz);
+
+    oPnPatch.b210 = pnControlPoint(triangleID, 0);
+    oPnPatch.b120 = pnControlPoint(triangleID, 1);
+    oPnPatch.b021 = pnControlPoint(triangleID, 2);
+    oPnPatch.b012 = pnControlPoint(triangleID, 3);
+    oPnPatch.b102 = pnControlPoint(triangleID, 4);
+    oPnPatch.b201 = pnControlPoint(triangleID, 5);
+    oPnPatch.b111 = pnControlPoint(triangleID, 6);
+
+    oPnPatch.n110 = pnNormal(triangleID, 0);
+    oPnPatch.n011 = pnNormal(triangleID, 1);
+    oPnPatch.n101 = pnNormal(triangleID, 2);
 }
 
 
-Vertex Interpolate_pn(Triangle target_T, vec3 uvw, float alpha)
+Vertex Interpolate_pn(Triangle target_T, uint triangleID, vec3 uvw,
+                      float alpha)
 {
     Vertex vertex;
     PnPatch pnPatch;
-    getPnPatch(target_T, pnPatch);
+    getPnPatch(target_T, triangleID, pnPatch);
 
     vec3 uvwSquared = uvw*uvw;
     vec3 uvwCubed   = uvwSquared*uvw;
@@ -137,12 +138,12 @@ Vertex Interpolate_pn(Triangle target_T, vec3 uvw, float alpha)
     return vertex;
 }
 
-Vertex PNInterpolation(Triangle mesh_t, vec2 uv, float alpha)
+Vertex PNInterpolation(Triangle mesh_t, uint triangleID, vec2 uv, float alpha)
 {
     float u = uv.x, v = uv.y, w = 1.0-u-v;
     vec3 uvw = vec3(v, u, w);
     uvw = uvw / (u+v+w);
 
-    return Interpolate_pn(mesh_t, uvw, alpha);
+    return Interpolate_pn(mesh_t, triangleID, uvw, alpha);
 }
 #endif
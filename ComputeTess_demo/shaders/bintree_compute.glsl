@@ -9,6 +9,43 @@ layout (local_size_x = LOCAL_WG_SIZE_X,
 layout (binding = NODECOUNTER_FULL_B)   uniform atomic_uint nodeCount_full[2];
 layout (binding = NODECOUNTER_CULLED_B) uniform atomic_uint nodeCount_culled[2];
 
+// Node pool status, reset by the copy pass
+layout (std430, binding = NODE_POOL_B) buffer pool_buffer {
+    uint pool_split_count;   // Splits granted during this pass
+    uint pool_refused_count; // Splits refused because the pool was full
+    uint pool_dropped_count; // Keys that did not fit in the pool
+    uint pool_last_refused_count;
+    uint pool_last_dropped_count;
+    uint pool_merge_count;   // Sibling pairs merged during this pass
+    uint pool_last_change_count;
+    uint pool_occluded_count; // Nodes in the frustum hidden by the Hi-Z
+    uint pool_last_occluded_count;
+};
+
+#if FLAG_ROOT_CULL
+// One visibility bit per root (triangleID), set by
+// BinTree::UpdateRootVisibility from the root BVH
+layout (std430, binding = ROOT_VISIBILITY_B) readonly buffer Root_Visibility {
+    uint u_RootVisible[];
+};
+#endif
+
+#if FLAG_BACKFACE || (FLAG_OCCLUSION && !FLAG_DISPLACE)
+// Normals of the surface over each target triangle (triangleID), computed by
+// itpl::ComputeNormalCones. The occlusion test only reads their bulge
+struct NormalCone {
+    vec3 axis;       // Outward normal of the flat triangle
+    float cos_angle; // Half angle of the cone
+    float sin_angle;
+    float bulge;     // Largest distance of the surface to the flat triangle
+    vec2 align;
+};
+
+layout (std430, binding = NORMAL_CONES_B) readonly buffer Normal_Cones {
+    NormalCone u_NormalCones[];
+};
+#endif
+
 shared float cam_height_local;
 
 uniform int u_read_index;
@@ -19,7 +56,26 @@ uniform int u_uniform_level;
 uniform int u_num_mesh_tri;
 uniform int u_num_mesh_quad;
 
-uniform int u_screen_res;
+
+uniform int u_max_node_count;
+
+#if FLAG_CULL_REFINE || FLAG_BACKFACE
+uniform int u_cull_floor; // Deepest level of the culled nodes
+#endif
+#if FLAG_OCCLUSION
+// Depth pyramid of the previous frame (bintree_hiz.glsl): farthest depth of
+// the pixels under each texel of each level
+uniform sampler2D u_hiz;
+uniform ivec2 u_hiz_size;  // Size of its level 0, the viewport
+uniform int u_hiz_levels;
+uniform int u_hiz_valid;   // Built from the transforms of this frame
+#endif
+#if FLAG_CULL_REFINE
+#if FLAG_BASE_MAP
+uniform vec3 u_base_map_min; // Range of the base map offsets of the mesh
+uniform vec3 u_base_map_max;
+#endif
+#endif
 
 /**
  *   U
@@ -51,19 +107,37 @@ const vec2 unit_U = vec2(0,1);
  * all parents and children of a leaf always lie on the same mesh primitive
  * Store the resulting key in the SBBO for the next compute pass
  * Increments the dispatch counter every n times such that we only use enough Workgroups
+ * Keys past the end of the node pool are dropped (and counted)
  */
 void compute_writeKey(uvec2 new_nodeID, uvec4 current_key)
 {
     uvec4 new_key = uvec4(new_nodeID, current_key.zw);
     uint idx = atomicCounterIncrement(nodeCount_full[1-u_read_index]);
-    u_SubdBufferOut[idx] = new_key;
+    if (idx < uint(u_max_node_count))
+        lt_setKey_64(idx, new_key);
+    else
+        atomicAdd(pool_dropped_count, 1u);
+}
+
+/**
+ * Every key writes at most one key, plus one more if it splits: granting at
+ * most (pool size - active nodes) splits guarantees that the next buffer fits
+ * in the pool. A refused split keeps its key, and may be granted next frame
+ */
+bool pool_reserveSplit(int active_nodes)
+{
+    uint split_idx = atomicAdd(pool_split_count, 1u);
+    if (int(split_idx) < u_max_node_count - active_nodes)
+        return true;
+    atomicAdd(pool_refused_count, 1u);
+    return false;
 }
 
 /**
  * Writes the keys in the buffer as dictated by the merge / split operators
  */
 
-void updateSubdBuffer(uvec4 key, int targetLod, int parentLod)
+void updateSubdBuffer(uvec4 key, int targetLod, int parentLod, int active_nodes)
 {
     // extract subdivision level associated to the key
     uvec2 nodeID = key.xy;
@@ -72,9 +146,13 @@ void updateSubdBuffer(uvec4 key, int targetLod, int parentLod)
 
     // update the key accordingly
     if (/* subdivide ? */ keyLod < targetLod && !lt_isLeaf_64(nodeID)) {
-        uvec2 children[2]; lt_children_64(nodeID, children);
-        compute_writeKey(children[0], key);
-        compute_writeKey(children[1], key);
+        if (pool_reserveSplit(active_nodes)) {
+            uvec2 children[2]; lt_children_64(nodeID, children);
+            compute_writeKey(children[0], key);
+            compute_writeKey(children[1], key);
+        } else {
+            compute_writeKey(nodeID, key);
+        }
     } else if (/* keep ? */ keyLod < (parentLod + 1)) {
         compute_writeKey(nodeID, key);
     } else /* merge ? */ {
@@ -82,15 +160,123 @@ void updateSubdBuffer(uvec4 key, int targetLod, int parentLod)
             compute_writeKey(nodeID, key);
         } else if (/* is zero child ? */lt_isZeroChild_64(nodeID)) {
             compute_writeKey(lt_parent_64(nodeID), key);
+            atomicAdd(pool_merge_count, 1u);
         }
     }
 }
 
+#if FLAG_ROOT_CULL
+/**
+ * The subtree of a root outside the frustum is neither refined nor culled: it
+ * collapses to the root in one pass, written by the node of its zero path
+ * (exactly one key of the subtree lies on it)
+ * Returns false for the keys of such roots
+ */
+bool rootCullPass(uvec4 key)
+{
+    uint triangleID = lt_getTargetTriangleID(key.z, key.w & 1u);
+    if ((u_RootVisible[triangleID >> 5] & (1u << (triangleID & 31u))) != 0u)
+        return true;
+    if (lt_isZeroPath_64(key.xy)) {
+        compute_writeKey(uvec2(0u, 1u), key);
+        if (!lt_isRoot_64(key.xy))
+            atomicAdd(pool_merge_count, 1u);
+    }
+    return false;
+}
+#endif
+
+#if FLAG_BACKFACE
+/**
+ * Whether the surface over the flat box [b_min, b_max] of a node faces away
+ * from the camera: the sphere around the box, grown by the bulge of the
+ * surface, lies behind every plane with a normal in the cone. The camera
+ * position in mesh space is the last column of inverse(MV)
+ */
+bool backfacing(uint triangleID, vec3 b_min, vec3 b_max)
+{
+    NormalCone cone = u_NormalCones[triangleID];
+    vec3 cam = vec3(u_transforms.invMV[0][3], u_transforms.invMV[1][3],
+                    u_transforms.invMV[2][3]);
+    vec3 d = 0.5 * (b_min + b_max) - cam;
+    float r = 0.5 * distance(b_min, b_max) + cone.bulge;
+    float dist = length(d);
+    if (dist <= r)
+        return false;
+    // cos(phi + angle), phi the angle between d and the axis
+    float cos_phi = dot(d, cone.axis) / dist;
+    float sin_phi = sqrt(max(0.0, 1.0 - cos_phi * cos_phi));
+    return dist * (cos_phi * cone.cos_angle - sin_phi * cone.sin_angle) > r;
+}
+#endif
+
+#if FLAG_CULL_REFINE || FLAG_BACKFACE
+/**
+ * Cull test of a node for the refinement, on bounds holding all of its
+ * descendants. When it succeeds, none of its descendants can pass the cull
+ * pass:
+ * - FLAG_BACKFACE: the surface over the node faces away from the camera
+ * - FLAG_CULL_REFINE: the box of its flat triangle, grown by the range of
+ *   the base map offsets (FLAG_BASE_MAP) and spanning all the terrain
+ *   heights (FLAG_DISPLACE), is outside the frustum
+ */
+bool refine_isCulled(uvec2 nodeID, Triangle mesh_t, uint triangleID)
+{
+    mat3x2 xform;
+    lt_getTriangleXform_64(nodeID, xform);
+    vec3 p_O = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_O, 1)).xyz;
+    vec3 p_U = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_U, 1)).xyz;
+    vec3 p_R = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_R, 1)).xyz;
+    vec3 b_min = min(p_O, min(p_U, p_R));
+    vec3 b_max = max(p_O, max(p_U, p_R));
+#if FLAG_BACKFACE
+    if (backfacing(triangleID, b_min, b_max))
+        return true;
+#endif
+#if FLAG_CULL_REFINE
+#if FLAG_BASE_MAP
+    b_min += u_base_map_min;
+    b_max += u_base_map_max;
+#endif
+#if FLAG_DISPLACE
+    b_min.z = -maxHeight();
+    b_max.z = maxHeight();
+#endif
+    return !culltest(u_transforms.MVP, b_min, b_max);
+#else
+    return false;
+#endif
+}
+
+/**
+ * The culled nodes split no deeper than u_cull_floor, and merge down to it.
+ * The merge tests the parent, the same for both siblings, so that they
+ * always merge together
+ */
+void refine_applyCull(uvec4 key, inout int targetLod, inout int parentLod)
+{
+    uvec2 nodeID = key.xy;
+    uint triangleID = lt_getTargetTriangleID(key.z, key.w & 1u);
+    Triangle mesh_t;
+    lt_getIndexedTriangle(lt_getTargetTriangleIndices(key.z, key.w & 1u),
+                          mesh_t);
+    if (!lt_isRoot_64(nodeID)
+            && refine_isCulled(lt_parent_64(nodeID), mesh_t, triangleID)) {
+        parentLod = min(parentLod, u_cull_floor);
+        targetLod = min(targetLod, u_cull_floor);
+    } else if (refine_isCulled(nodeID, mesh_t, triangleID)) {
+        targetLod = min(targetLod, u_cull_floor);
+    }
+}
+#endif
+
 /* Emulates what was previously the Compute Pass:
  * - Compute the LoD stored in the key
  * - Decides wether to merge, divide or just pass forward the current leaf
  *		- if uniform  subdivision: criterion with target level set by user
- *		- if adaptive subdivision: criterion using the LoD functions
+ *		- if adaptive subdivision: criterion using the LoD functions, capped
+ *		  outside the frustum with FLAG_CULL_REFINE, and facing away with
+ *		  FLAG_BACKFACE
  * - Store the obtained key(s) in the SSBO for the next compute pass
  */
 void computePass(uvec4 key, uint invocation_idx, int active_nodes)
@@ -113,9 +299,12 @@ void computePass(uvec4 key, uint invocation_idx, int active_nodes)
 #endif
         targetLod = int(targetLevel);
         parentLod = int(parentTargetLevel);
+#if FLAG_CULL_REFINE || FLAG_BACKFACE
+        refine_applyCull(key, targetLod, parentLod);
+#endif
     }
 
-    updateSubdBuffer(key, targetLod, parentLod);
+    updateSubdBuffer(key, targetLod, parentLod, active_nodes);
 }
 
 
@@ -124,29 +313,111 @@ void computePass(uvec4 key, uint invocation_idx, int active_nodes)
 /// CULL PASS FUNCTIONS
 ///
 
-// Store the new key in the Culled SSBO for the Render Pass
-void cull_writeKey(uvec4 new_key)
+// Store the record of the new key for the Render Pass (or its index in the
+// input SSBO with FLAG_CULLED_INDICES)
+void cull_writeKey(uvec4 new_key, uint key_idx, mat3x2 xform, uvec3 vertexID)
 {
     uint idx = atomicCounterIncrement(nodeCount_culled[1-u_read_index]);
-    u_SubdBufferOut_culled[idx] =  new_key;
+    if (idx >= uint(u_max_node_count))
+        return;
+#if FLAG_CULLED_INDICES
+    u_SubdBufferOut_culled[idx] = key_idx;
+#else
+    uint triangleID = lt_getTargetTriangleID(new_key.z, new_key.w & 1u);
+    u_RenderRecords[idx] = lt_makeRenderRecord(new_key.xy, xform, vertexID,
+                                               triangleID);
+#endif
+}
+
+#if FLAG_OCCLUSION
+/**
+ * Whether the box [b_min, b_max], holding all the surface drawn for a node,
+ * is hidden in the depth pyramid of the previous frame: its nearest depth is
+ * behind the farthest one of the pixels under it. The pyramid is only
+ * trusted when the previous frame drew the same keys (the last update split
+ * and merged nothing) from the same transforms; otherwise the node is kept,
+ * so that a disoccluded node is never dropped
+ */
+bool occlusion_isHidden(vec3 b_min, vec3 b_max)
+{
+    if (u_hiz_valid == 0 || pool_last_change_count != 0u)
+        return false;
+    vec3 n_min = vec3(1.0), n_max = vec3(-1.0);
+    for (int i = 0; i < 8; ++i) {
+        vec3 c = vec3((i & 1) != 0 ? b_max.x : b_min.x,
+                      (i & 2) != 0 ? b_max.y : b_min.y,
+                      (i & 4) != 0 ? b_max.z : b_min.z);
+        vec4 p = u_transforms.MVP * vec4(c, 1.0);
+        if (p.w <= 0.0)
+            return false;
+        n_min = min(n_min, p.xyz / p.w);
+        n_max = max(n_max, p.xyz / p.w);
+    }
+    if (n_min.z <= -1.0)
+        return false;
+    // Pixels whose center may lie in the box, plus one for the rounding
+    ivec2 t_min = ivec2(floor((n_min.xy * 0.5 + 0.5) * vec2(u_hiz_size))) - 1;
+    ivec2 t_max = ivec2(floor((n_max.xy * 0.5 + 0.5) * vec2(u_hiz_size))) + 1;
+    t_min = clamp(t_min, ivec2(0), u_hiz_size - 1);
+    t_max = clamp(t_max, ivec2(0), u_hiz_size - 1);
+    // Level where they span at most 2x2 texels. The last texel of a level
+    // also covers the odd pixels left by the levels below
+    int extent = max(t_max.x - t_min.x, t_max.y - t_min.y) + 1;
+    int level = min(findMSB(extent - 1) + 1, u_hiz_levels - 1);
+    ivec2 size = max(u_hiz_size >> level, ivec2(1));
+    t_min = min(t_min >> level, size - 1);
+    t_max = min(t_max >> level, size - 1);
+    float depth = 0.0;
+    for (int y = t_min.y; y <= t_max.y; ++y)
+        for (int x = t_min.x; x <= t_max.x; ++x)
+            depth = max(depth, texelFetch(u_hiz, ivec2(x, y), level).r);
+    return n_min.z * 0.5 + 0.5 > depth + 1e-5;
 }
+#endif
 
 /**
  * Emulates what was previously the Cull Pass:
- * - Compute the mesh space bounding box of the primitive
+ * - Resolve the xform and mesh triangle of the key, once for all the
+ *   vertices of the instance in the Render Pass
+ * - Compute the mesh space bounding box of the primitive (of its corners
+ *   moved by the base map with FLAG_BASE_MAP)
  * - Use the BB to check for culling
- * - If not culled, store the (possibly morphed) key in the SSBO for Render
+ * - If not culled, store the record of the (possibly morphed) key for Render
+ *   (or its index with FLAG_CULLED_INDICES)
  */
-void cullPass(uvec4 key)
+void cullPass(uvec4 key, uint invocation_idx)
 {
+    mat3x2 xform;
+    lt_getTriangleXform_64(key.xy, xform);
+    uvec3 vertexID = lt_getTargetTriangleIndices(key.z, key.w & 1u);
 #if FLAG_CULL
+    Triangle mesh_t;
+    lt_getIndexedTriangle(vertexID, mesh_t);
+
     mat4 mesh_coord;
     vec4 b_min = vec4(10e6);
     vec4 b_max = vec4(-10e6);
 
-    mesh_coord[O] = lt_Leaf_to_MeshPosition(unit_O, key);
-    mesh_coord[U] = lt_Leaf_to_MeshPosition(unit_U, key);
-    mesh_coord[R] = lt_Leaf_to_MeshPosition(unit_R, key);
+    mesh_coord[O] = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_O, 1));
+    mesh_coord[U] = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_U, 1));
+    mesh_coord[R] = lt_mapTo3DTriangle(mesh_t, xform * vec3(unit_R, 1));
+    uint triangleID = lt_getTargetTriangleID(key.z, key.w & 1u);
+
+#if FLAG_BACKFACE || FLAG_OCCLUSION
+    // Box of the flat triangle: the cone bounds the surface around it
+    vec4 f_min = min(mesh_coord[O], min(mesh_coord[U], mesh_coord[R]));
+    vec4 f_max = max(mesh_coord[O], max(mesh_coord[U], mesh_coord[R]));
+#endif
+#if FLAG_BACKFACE
+    if (backfacing(triangleID, f_min.xyz, f_max.xyz))
+        return;
+#endif
+
+#if FLAG_BASE_MAP
+    mesh_coord[O].xyz += lt_getBaseMapOffset(triangleID, xform * vec3(unit_O, 1));
+    mesh_coord[U].xyz += lt_getBaseMapOffset(triangleID, xform * vec3(unit_U, 1));
+    mesh_coord[R].xyz += lt_getBaseMapOffset(triangleID, xform * vec3(unit_R, 1));
+#endif
 
 #if FLAG_DISPLACE
     mesh_coord[O] = displaceVertex(mesh_coord[O], u_transforms.cam_pos);
@@ -162,10 +433,36 @@ void cullPass(uvec4 key)
     b_max = max(b_max, mesh_coord[U]);
     b_max = max(b_max, mesh_coord[R]);
 
-    if (culltest(u_transforms.MVP, b_min.xyz, b_max.xyz))
-        cull_writeKey(key);
+    if (!culltest(u_transforms.MVP, b_min.xyz, b_max.xyz))
+        return;
+
+#if FLAG_OCCLUSION
+    // Box of all the drawn surface, not only of the corners
+#if FLAG_DISPLACE
+    // The heights inside the triangle differ from the ones of its corners by
+    // at most the slope of the octaves they share times its length, plus the
+    // octaves that their distances to the eye add or fade
+    vec3 eye = u_transforms.cam_pos;
+    float d_max = length(max(abs(eye - f_min.xyz), abs(eye - f_max.xyz)));
+    float grow = maxSlope() * distance(f_min.xy, f_max.xy)
+               + 2.0 * maxDetailHeight(d_max);
+    vec3 o_min = vec3(b_min.xy, max(b_min.z - grow, -maxHeight()));
+    vec3 o_max = vec3(b_max.xy, min(b_max.z + grow, maxHeight()));
 #else
-    cull_writeKey(key);
+    // The interpolated surface and the base map stay within the bulge of
+    // the flat triangle
+    float bulge = u_NormalCones[triangleID].bulge;
+    vec3 o_min = f_min.xyz - bulge;
+    vec3 o_max = f_max.xyz + bulge;
+#endif
+    if (occlusion_isHidden(o_min, o_max)) {
+        atomicAdd(pool_occluded_count, 1u);
+        return;
+    }
+#endif
+    cull_writeKey(key, invocation_idx, xform, vertexID);
+#else
+    cull_writeKey(key, invocation_idx, xform, vertexID);
 #endif
 }
 
@@ -175,7 +472,6 @@ void main(void)
 {
 
     uint invocation_idx = int(gl_GlobalInvocationID.x);
-    uvec4 key = lt_getKey_64(invocation_idx);
 
     // Check if the current instance should work
     int active_nodes;
@@ -185,10 +481,13 @@ void main(void)
 #elif FLAG_QUADS
     active_nodes = max(u_num_mesh_quad * 2, int(atomicCounter(nodeCount_full[u_read_index])));
 #endif
+    active_nodes = min(active_nodes, u_max_node_count);
 
     if (invocation_idx >= active_nodes)
         return;
 
+    uvec4 key = lt_getKey_64(invocation_idx);
+
 #if FLAG_DISPLACE
     // When subdividing heightfield, we set the plane height to the heightmap
     // value under the camera for more fidelity.
@@ -201,8 +500,12 @@ void main(void)
     memoryBarrierShared();
 #endif
 
+#if FLAG_ROOT_CULL
+    if (!rootCullPass(key))
+        return;
+#endif
     computePass(key, invocation_idx, active_nodes);
-    cullPass(key);
+    cullPass(key, invocation_idx);
 
     return;
 }
@@ -27,13 +27,29 @@ layout (std430, binding = DRAW_INDIRECT_B) buffer draw_out {
     uvec3  align;
 };
 
+layout (std430, binding = NODE_POOL_B) buffer pool_buffer {
+    uint pool_split_count;
+    uint pool_refused_count;
+    uint pool_dropped_count;
+    uint pool_last_refused_count;
+    uint pool_last_dropped_count;
+    uint pool_merge_count;
+    uint pool_last_change_count;
+    uint pool_occluded_count;
+    uint pool_last_occluded_count;
+};
+
 uniform int u_read_index;
 uniform int u_num_vertices, u_num_indices;
+uniform int u_max_node_count;
 
 void main(void)
 {
-    uint full_count = nodeCount_full[u_read_index];
-    uint culled_count = nodeCount_culled[u_read_index];
+    // The counters keep counting the keys dropped by a full pool
+    uint full_count = min(nodeCount_full[u_read_index], uint(u_max_node_count));
+    uint culled_count = min(nodeCount_culled[u_read_index], uint(u_max_node_count));
+    nodeCount_full[u_read_index] = full_count;
+    nodeCount_culled[u_read_index] = culled_count;
 
     //Set the nodeCount for the draw pass
     count = u_num_indices;
@@ -43,6 +59,17 @@ void main(void)
     // Reset the counters for next round
     nodeCount_full[1-u_read_index] = 0;
     nodeCount_culled[1-u_read_index] = 0;
+    pool_last_refused_count = pool_refused_count;
+    pool_last_dropped_count = pool_dropped_count;
+    // Granted splits plus merges: 0 once the tree has converged
+    pool_last_change_count = pool_split_count - pool_refused_count
+                           + pool_merge_count;
+    pool_last_occluded_count = pool_occluded_count;
+    pool_split_count = 0;
+    pool_refused_count = 0;
+    pool_dropped_count = 0;
+    pool_merge_count = 0;
+    pool_occluded_count = 0;
 }
 
 #endif
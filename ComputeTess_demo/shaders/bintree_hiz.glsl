@@ -0,0 +1,47 @@
+#line 2
+
+#ifdef COMPUTE_SHADER
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+// Depth of the viewport, read for level 0
+uniform sampler2D u_depth;
+// Levels l - 1 and l of the pyramid, for l > 0
+layout (r32f) uniform readonly image2D u_src;
+layout (r32f) uniform writeonly image2D u_dst;
+
+uniform int u_level;
+uniform ivec2 u_src_size;
+
+/**
+ * Writes one level of the depth pyramid of FLAG_OCCLUSION: each texel holds
+ * the farthest depth of the 2x2 texels under it in the level below (level 0
+ * is a copy of the depth buffer). The last row and column of a level also
+ * take the odd ones of the level below, so that every pixel is covered
+ */
+void main(void)
+{
+    ivec2 dst_size = max(u_src_size >> min(u_level, 1), ivec2(1));
+    ivec2 t = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(t, dst_size)))
+        return;
+
+    if (u_level == 0) {
+        imageStore(u_dst, t, vec4(texelFetch(u_depth, t, 0).r));
+        return;
+    }
+
+    ivec2 s_min = 2 * t;
+    ivec2 s_max = min(2 * t + 1, u_src_size - 1);
+    if (t.x == dst_size.x - 1)
+        s_max.x = u_src_size.x - 1;
+    if (t.y == dst_size.y - 1)
+        s_max.y = u_src_size.y - 1;
+    float depth = 0.0;
+    for (int y = s_min.y; y <= s_max.y; ++y)
+        for (int x = s_min.x; x <= s_max.x; ++x)
+            depth = max(depth, imageLoad(u_src, ivec2(x, y)).r);
+    imageStore(u_dst, t, vec4(depth));
+}
+
+#endif
@@ -0,0 +1,33 @@
+#line 2
+
+#ifdef COMPUTE_SHADER
+
+layout (local_size_x = LOCAL_WG_SIZE_X,
+        local_size_y = LOCAL_WG_SIZE_Y,
+        local_size_z = LOCAL_WG_SIZE_Z) in;
+
+uniform int u_num_roots;
+uniform int u_level;
+
+/**
+ * Writes the root key of each mesh polygon in the bound node buffer:
+ * one per triangle, two per quad (root ID 0 and 1 in the w component)
+ * With u_level > 0, each root is replaced by its 2^u_level descendants at
+ * that level (u_level < 32, so the nodeID fits in the y component)
+ */
+void main(void)
+{
+    uint idx = gl_GlobalInvocationID.x;
+    if (idx >= (uint(u_num_roots) << u_level))
+        return;
+
+    uint root = idx >> u_level;
+    uint nodeID = (1u << u_level) | (idx & ((1u << u_level) - 1u));
+#if FLAG_TRIANGLES
+    lt_setKey_64(idx, uvec4(0u, nodeID, root * 3u, 0u));
+#elif FLAG_QUADS
+    lt_setKey_64(idx, uvec4(0u, nodeID, (root / 2u) * 4u, root & 1u));
+#endif
+}
+
+#endif
@@ -33,14 +33,20 @@ vec4 levelColor(uint lvl)
     return vec4(c[(lvl + 2) % 4], 1);
 }
 
-Vertex interpolate(Triangle mesh_t, vec2 v, float itpl_alpha)
+// triangleID: index of the coefficients of the PN and Phong patches, or of
+// the base map, whose offsets replace the interpolation
+Vertex interpolate(Triangle mesh_t, uint triangleID, vec2 v, float itpl_alpha)
 {
-#if FLAG_ITPL_LINEAR
+#if FLAG_BASE_MAP
+    Vertex vertex = lt_interpolateVertex(mesh_t, v);
+    lt_applyBaseMap(vertex, triangleID, v);
+    return vertex;
+#elif FLAG_ITPL_LINEAR
     return lt_interpolateVertex(mesh_t, v);
 #elif FLAG_ITPL_PN
-    return PNInterpolation(mesh_t, v, itpl_alpha);
+    return PNInterpolation(mesh_t, triangleID, v, itpl_alpha);
 #elif FLAG_ITPL_PHONG
-    return PhongInterpolation(mesh_t, v, itpl_alpha);
+    return PhongInterpolation(mesh_t, triangleID, v, itpl_alpha);
 #else
     return lt_interpolateVertex(mesh_t, v);
 #endif
@@ -22,23 +22,20 @@ void main()
     // Read VAO
     vec2 leaf_pos = i_vpos.xy;
 
-    // Decode key
-    uint instanceID = gl_InstanceID;
-    uvec4 key = lt_getKey_64(instanceID);
-    uvec2 nodeID = key.xy;
-    uint meshPolygonID = key.z;
-    uint rootID = key.w & 1u;
-    uint key_lod = lt_level_64(key.xy);
+    // Read the record resolved by the cull pass for this instance
+    RenderRecord record = lt_getInstanceRecord(gl_InstanceID);
+    uint key_lod = record.level;
 
     // Fetch target mesh-space triangle
     Triangle mesh_t;
-    lt_getTargetTriangle(meshPolygonID, rootID, mesh_t);
+    lt_getRecordTriangle(record, mesh_t);
 
     // Map from leaf to bintree position
-    vec2 tree_pos = lt_Leaf_to_Tree_64(leaf_pos, nodeID);
+    vec2 tree_pos = lt_getRecordXform(record) * vec3(leaf_pos, 1);
 
     // Interpolate
-    Vertex current_v = interpolate(mesh_t, tree_pos, u_itpl_alpha);
+    Vertex current_v = interpolate(mesh_t, record.triangleID, tree_pos,
+                                   u_itpl_alpha);
 
 #if FLAG_DISPLACE
         current_v.p.xyz =  displaceVertex(current_v.p.xyz, u_transforms.cam_pos);
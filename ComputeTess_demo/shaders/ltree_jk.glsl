@@ -26,21 +26,43 @@ struct Key {
     uint rootID;
 };
 
+// The keys are handled as uvec4 (nodeID msb, nodeID lsb, first mesh index of
+// the polygon, root ID) but with FLAG_KEY_PACKED they are stored in 3 uints:
+// (nodeID msb, nodeID lsb, polygon ID << 1 | root ID), see lt_packKey_64
+#if FLAG_KEY_PACKED
+#define KEY_STRIDE 3
+#define KEY_T uint
+#else
+#define KEY_T uvec4
+#endif
+
 layout (std430, binding = NODES_IN_B) readonly buffer Data_In {
-    uvec4 u_SubdBufferIn[];
+    KEY_T u_SubdBufferIn[];
 };
 
 layout (std430, binding = NODES_OUT_FULL_B) buffer Data_Out_F {
-    uvec4 u_SubdBufferOut[];
+    KEY_T u_SubdBufferOut[];
 };
 
+#if FLAG_CULLED_INDICES
+// Index of each culled key in u_SubdBufferIn, instead of its render record
 layout (std430, binding = NODES_OUT_CULLED_B) buffer Data_Out_C {
-    uvec4 u_SubdBufferOut_culled[];
+    uint u_SubdBufferOut_culled[];
 };
+#endif
 
+#if FLAG_VERTEX_QUANTIZED
+// uvec4 vertices of meshutils::QuantizeVertex, after the box of the positions
+layout (std430, binding = MESH_V_B) readonly buffer Mesh_V {
+    vec4 u_MeshVertexMin;
+    vec4 u_MeshVertexScale;
+    uvec4 u_MeshVertex[];
+};
+#else
 layout (std430, binding = MESH_V_B) readonly buffer Mesh_V {
     Vertex u_MeshVertex[];
 };
+#endif
 
 layout (std430, binding = MESH_Q_IDX_B) readonly buffer Mesh_Q_Idx {
     uint u_QuadIdx[];
@@ -50,35 +72,142 @@ layout (std430, binding = MESH_T_IDX_B) readonly buffer Mesh_T_Idx {
     uint  u_TriangleIdx[];
 };
 
+#if FLAG_BASE_MAP
+// Samples of the input surface over the triangles of a simplified base
+// mesh, BASE_MAP_RES segments per edge (meshutils::BuildBaseMap)
+struct BaseMapSample {
+    vec3 offset;
+    uint normal;
+};
+
+layout (std430, binding = BASE_MAP_B) readonly buffer Base_Map {
+    BaseMapSample u_BaseMap[];
+};
+#endif
+
+// Per instance data of the render pass, written by the cull pass for each
+// culled key, so that the vertex shaders do not decode the key (unless
+// FLAG_CULLED_INDICES, see lt_getInstanceRecord)
+struct RenderRecord {
+    vec2 xform[3];    // columns of the triangle xform of the node
+    uint vertexID[3]; // mesh vertices of the target triangle
+    uint level;       // subdivision level of the node
+    uint triangleID;  // target triangle, index of its interpolation patch
+    uint align;
+};
+
+layout (std430, binding = RENDER_RECORDS_B) buffer Render_Records {
+    RenderRecord u_RenderRecords[];
+};
+
+#ifdef FLAG_XFORM_LUT
+// Xforms of the nodes of level 0 to FLAG_XFORM_LUT (see lt_xformLUT_64)
+layout (std430, binding = XFORM_LUT_B) readonly buffer Xform_LUT {
+    mat3x2 u_XformLUT[];
+};
+#endif
+
+#if FLAG_KEY_PACKED
+// The polygon ID is the index of the mesh polygon, not of its first vertex
+uvec3 lt_packKey_64(uvec4 key)
+{
+#if FLAG_TRIANGLES
+    uint polygonID = key.z / 3u;
+#elif FLAG_QUADS
+    uint polygonID = key.z / 4u;
+#endif
+    return uvec3(key.xy, (polygonID << 1) | (key.w & 1u));
+}
+
+uvec4 lt_unpackKey_64(uvec3 packed_key)
+{
+    uint polygonID = packed_key.z >> 1;
+#if FLAG_TRIANGLES
+    uint firstIdx = polygonID * 3u;
+#elif FLAG_QUADS
+    uint firstIdx = polygonID * 4u;
+#endif
+    return uvec4(packed_key.xy, firstIdx, packed_key.z & 1u);
+}
+#endif
+
 uvec4 lt_getKey_64(uint idx)
 {
+#if FLAG_KEY_PACKED
+    uint i = idx * KEY_STRIDE;
+    return lt_unpackKey_64(uvec3(u_SubdBufferIn[i], u_SubdBufferIn[i + 1u],
+                                 u_SubdBufferIn[i + 2u]));
+#else
     return u_SubdBufferIn[idx];
+#endif
+}
+
+// Stores the key at idx in the full output buffer
+void lt_setKey_64(uint idx, uvec4 key)
+{
+#if FLAG_KEY_PACKED
+    uint i = idx * KEY_STRIDE;
+    uvec3 packed_key = lt_packKey_64(key);
+    u_SubdBufferOut[i] = packed_key.x;
+    u_SubdBufferOut[i + 1u] = packed_key.y;
+    u_SubdBufferOut[i + 2u] = packed_key.z;
+#else
+    u_SubdBufferOut[idx] = key;
+#endif
 }
 
+#if FLAG_CULLED_INDICES
+// Key of the culled node idx, read through the index list
+uvec4 lt_getCulledKey_64(uint idx)
+{
+    return lt_getKey_64(u_SubdBufferOut_culled[idx]);
+}
+#endif
+
 // --------- Bitwise operations reimplemented for concatenated ints --------- //
+// With FLAG_KEY32 the trees are at most 31 levels deep: the nodeIDs fit in the
+// y component (x is always 0) and the operations are done on a single uint
+
+#if FLAG_KEY32
+#define LT_MAX_LEVEL 31u
+#else
+#define LT_MAX_LEVEL 63u
+#endif
 
 uvec2 lt_leftShift_64(uvec2 nodeID, uint shift)
 {
+#if FLAG_KEY32
+    return uvec2(0u, nodeID.y << shift);
+#else
     uvec2 result = nodeID;
     //Extract the "shift" first bits of y and append them at the end of x
     result.x = result.x << shift;
     result.x |= result.y >> (32u - shift);
     result.y  = result.y << shift;
     return result;
+#endif
 }
 uvec2 lt_rightShift_64(uvec2 nodeID, uint shift)
 {
+#if FLAG_KEY32
+    return uvec2(0u, nodeID.y >> shift);
+#else
     uvec2 result = nodeID;
     //Extract the "shift" last bits of x and prepend them to y
     result.y = result.y >> shift;
     result.y |= result.x << (32u - shift);
     result.x = result.x >> shift;
     return result;
+#endif
 }
 
 int lt_findMSB_64(uvec2 nodeID)
 {
+#if FLAG_KEY32
+    return findMSB(nodeID.y);
+#else
     return (nodeID.x == 0) ? findMSB(nodeID.y) : (findMSB(nodeID.x) + 32);
+#endif
 }
 
 // -------------------------- Children and Parents -------------------------- //
@@ -103,7 +232,7 @@ uint lt_level_64(uvec2 nodeID) {
 // ------------------------------ Leaf & Root ------------------------------- //
 
 bool lt_isLeaf_64(uvec2 nodeID) {
-    return (lt_level_64(nodeID) == 63u);
+    return (lt_level_64(nodeID) == LT_MAX_LEVEL);
 }
 
 bool lt_isRoot_64(uvec2 nodeID) {
@@ -121,6 +250,12 @@ bool lt_isOneChild_64(uvec2 nodeID)
     return ((nodeID.y & 1u) == 1u);
 }
 
+// Node reached from the root by zero children only (the root included)
+bool lt_isZeroPath_64(uvec2 nodeID)
+{
+    return (bitCount(nodeID.x) + bitCount(nodeID.y)) == 1;
+}
+
 // ----------------------------- Triangle XForm ----------------------------- //
 mat3x2 mul(mat3x2 A, mat3x2 B)
 {
@@ -141,6 +276,42 @@ mat3x2 jk_bitToMatrix(in uint bit)
     return mat3x2(c1, c2, c3);
 }
 
+#ifdef FLAG_XFORM_LUT
+// Bits [shift, shift + 32) of the nodeID, for any shift in [0, 63]
+uint lt_bitsAt_64(uvec2 nodeID, uint shift)
+{
+#if FLAG_KEY32
+    return nodeID.y >> shift;
+#else
+    if (shift >= 32u)
+        return nodeID.x >> (shift - 32u);
+    if (shift == 0u)
+        return nodeID.y;
+    return (nodeID.y >> shift) | (nodeID.x << (32u - shift));
+#endif
+}
+
+// Composes the xform of the nodeID from the table, one matrix per chunk of
+// FLAG_XFORM_LUT bits instead of one per bit:
+// xform(node) = xform(node >> FLAG_XFORM_LUT) * u_XformLUT[1 << FLAG_XFORM_LUT | chunk]
+mat3x2 lt_xformLUT_64(uvec2 nodeID)
+{
+    const uint bits = uint(FLAG_XFORM_LUT);
+    const uint mask = (1u << bits) - 1u;
+    int lvl = lt_findMSB_64(nodeID);
+    if (lvl <= 0)
+        return mat3x2(vec2(1, 0), vec2(0, 1), vec2(0, 0));
+
+    uint shift = (uint(lvl - 1) / bits) * bits;
+    mat3x2 xf = u_XformLUT[lt_bitsAt_64(nodeID, shift)];
+    while (shift > 0u) {
+        shift -= bits;
+        xf = mul(xf, u_XformLUT[(mask + 1u) | (lt_bitsAt_64(nodeID, shift) & mask)]);
+    }
+    return xf;
+}
+#endif
+
 void lt_getTriangleXform_64(uvec2 nodeID, out mat3x2 xform, out mat3x2 parent_xform)
 {
     vec2 c1 = vec2(1, 0);
@@ -156,10 +327,19 @@ void lt_getTriangleXform_64(uvec2 nodeID, out mat3x2 xform, out mat3x2 parent_xf
 
     uint lsb = nodeID.y & 1u;
     nodeID = lt_rightShift_64(nodeID, 1u);
+#ifdef FLAG_XFORM_LUT
+    xf = lt_xformLUT_64(nodeID);
+#else
+#if FLAG_KEY32
+    for (uint id = nodeID.y; id > 1u; id >>= 1)
+        xf = mul(jk_bitToMatrix(id & 1u), xf);
+#else
     while (nodeID.x > 0 || nodeID.y > 1) {
         xf = mul(jk_bitToMatrix(nodeID.y & 1u) , xf);
         nodeID = lt_rightShift_64(nodeID, 1u);
     }
+#endif
+#endif
 
     parent_xform = xf;
     xform = mul(parent_xform, jk_bitToMatrix(lsb & 1u));
@@ -207,14 +387,107 @@ Vertex lt_interpolateVertex(Triangle t, vec2 uv)
 
 // ------------------------- Fetching Mesh Polygon  ------------------------- //
 
+#if FLAG_VERTEX_QUANTIZED || FLAG_BASE_MAP
+vec3 lt_octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+#endif
+
+// Same decoding as meshutils::DequantizeVertex with FLAG_VERTEX_QUANTIZED
+Vertex lt_getMeshVertex(uint vertexID)
+{
+#if FLAG_VERTEX_QUANTIZED
+    uvec4 q = u_MeshVertex[vertexID];
+    uvec3 p = uvec3(q.x & 0x1FFFFFu,
+                    (q.x >> 21) | ((q.y & 0x3FFu) << 11),
+                    q.y >> 10);
+    Vertex v;
+    v.p = vec4(u_MeshVertexMin.xyz + vec3(p) * u_MeshVertexScale.xyz, 1.0);
+    // 0x80008000u: zero normal
+    v.n = (q.z == 0x80008000u) ? vec4(0.0)
+                               : vec4(lt_octDecode(unpackSnorm2x16(q.z)), 0.0);
+    v.uv = unpackHalf2x16(q.w);
+    v.align = vec2(0.0);
+    return v;
+#else
+    return u_MeshVertex[vertexID];
+#endif
+}
+
+#if FLAG_BASE_MAP
+// Index of the base map sample (i, j), at uv = (i, j) / BASE_MAP_RES, of a
+// triangle (same grid as ltree_cpu.h)
+uint lt_baseMapIndex(uint triangleID, int i, int j)
+{
+    const int n = BASE_MAP_RES;
+    return triangleID * uint((n + 1) * (n + 2) / 2)
+         + uint(j * (n + 1) - j * (j - 1) / 2 + i);
+}
+
+// Samples of the base map cell holding uv, and their weights
+void lt_baseMapCell(vec2 uv, out ivec2 c[3], out vec3 w)
+{
+    const int n = BASE_MAP_RES;
+    vec2 g = uv * float(n);
+    int i = clamp(int(floor(g.x)), 0, n - 1);
+    int j = clamp(int(floor(g.y)), 0, n - 1 - i);
+    vec2 f = g - vec2(i, j);
+    if (f.x + f.y > 1.0 && i + j + 2 <= n) {
+        c[0] = ivec2(i + 1, j + 1);
+        c[1] = ivec2(i, j + 1);
+        c[2] = ivec2(i + 1, j);
+        w = vec3(f.x + f.y - 1.0, 1.0 - f.x, 1.0 - f.y);
+    } else {
+        c[0] = ivec2(i, j);
+        c[1] = ivec2(i + 1, j);
+        c[2] = ivec2(i, j + 1);
+        w = vec3(1.0 - f.x - f.y, f.x, f.y);
+    }
+}
+
+// Offset from the point uv of the base triangle to the input surface
+vec3 lt_getBaseMapOffset(uint triangleID, vec2 uv)
+{
+    ivec2 c[3];
+    vec3 w;
+    lt_baseMapCell(uv, c, w);
+    vec3 offset = vec3(0.0);
+    for (int k = 0; k < 3; ++k)
+        offset += w[k] * u_BaseMap[lt_baseMapIndex(triangleID, c[k].x, c[k].y)].offset;
+    return offset;
+}
+
+// Moves the vertex interpolated at uv on the flat base triangle onto the
+// input surface, and gives it the normal of the surface
+void lt_applyBaseMap(inout Vertex v, uint triangleID, vec2 uv)
+{
+    ivec2 c[3];
+    vec3 w;
+    lt_baseMapCell(uv, c, w);
+    vec3 offset = vec3(0.0), n = vec3(0.0);
+    for (int k = 0; k < 3; ++k) {
+        BaseMapSample s = u_BaseMap[lt_baseMapIndex(triangleID, c[k].x, c[k].y)];
+        offset += w[k] * s.offset;
+        // 0x80008000u: zero normal
+        if (s.normal != 0x80008000u)
+            n += w[k] * lt_octDecode(unpackSnorm2x16(s.normal));
+    }
+    v.p.xyz += offset;
+    if (dot(n, n) > 0.0)
+        v.n = vec4(normalize(n), 0.0);
+}
+#endif
+
 #if FLAG_TRIANGLES
 void lt_getMeshTriangle(uint meshPolygonID, out Triangle triangle)
 {
     for (int i = 0; i < 3; ++i)
     {
-        triangle.vertex[i].p = u_MeshVertex[u_TriangleIdx[meshPolygonID + i]].p;
-        triangle.vertex[i].n = u_MeshVertex[u_TriangleIdx[meshPolygonID + i]].n;
-        triangle.vertex[i].uv = u_MeshVertex[u_TriangleIdx[meshPolygonID + i]].uv;
+        triangle.vertex[i] = lt_getMeshVertex(u_TriangleIdx[meshPolygonID + i]);
     }
 }
 #elif FLAG_QUADS
@@ -222,9 +495,7 @@ void lt_getMeshQuad(uint meshPolygonID, out Quad quad)
 {
     for (int i = 0; i < 4; ++i)
     {
-        quad.vertex[i].p = u_MeshVertex[u_QuadIdx[meshPolygonID + i]].p;
-        quad.vertex[i].n = u_MeshVertex[u_QuadIdx[meshPolygonID + i]].n;
-        quad.vertex[i].uv = u_MeshVertex[u_QuadIdx[meshPolygonID + i]].uv;
+        quad.vertex[i] = lt_getMeshVertex(u_QuadIdx[meshPolygonID + i]);
     }
 }
 
@@ -254,6 +525,87 @@ void lt_getTargetTriangle(uint meshPolygonID, uint rootID, out Triangle mesh_t)
 
 }
 
+// Mesh vertex indices of the target triangle, in lt_getTargetTriangle order
+uvec3 lt_getTargetTriangleIndices(uint meshPolygonID, uint rootID)
+{
+#if FLAG_TRIANGLES
+    return uvec3(u_TriangleIdx[meshPolygonID + 0],
+                 u_TriangleIdx[meshPolygonID + 1],
+                 u_TriangleIdx[meshPolygonID + 2]);
+#elif FLAG_QUADS
+    if (rootID == 0)
+        return uvec3(u_QuadIdx[meshPolygonID + 0],
+                     u_QuadIdx[meshPolygonID + 3],
+                     u_QuadIdx[meshPolygonID + 1]);
+    else
+        return uvec3(u_QuadIdx[meshPolygonID + 2],
+                     u_QuadIdx[meshPolygonID + 1],
+                     u_QuadIdx[meshPolygonID + 3]);
+#endif
+}
+
+// Index of the target triangle among all the target triangles of the mesh:
+// the triangle index, or twice the quad index plus the rootID
+uint lt_getTargetTriangleID(uint meshPolygonID, uint rootID)
+{
+#if FLAG_TRIANGLES
+    return meshPolygonID / 3u;
+#elif FLAG_QUADS
+    return (meshPolygonID / 4u) * 2u + rootID;
+#endif
+}
+
+void lt_getIndexedTriangle(uvec3 vertexID, out Triangle mesh_t)
+{
+    for (int i = 0; i < 3; ++i)
+        mesh_t.vertex[i] = lt_getMeshVertex(vertexID[i]);
+}
+
+// -------------------------------- Records --------------------------------- //
+
+RenderRecord lt_makeRenderRecord(uvec2 nodeID, mat3x2 xform, uvec3 vertexID,
+                                 uint triangleID)
+{
+    RenderRecord record;
+    record.xform[0] = xform[0];
+    record.xform[1] = xform[1];
+    record.xform[2] = xform[2];
+    record.vertexID[0] = vertexID.x;
+    record.vertexID[1] = vertexID.y;
+    record.vertexID[2] = vertexID.z;
+    record.level = lt_level_64(nodeID);
+    record.triangleID = triangleID;
+    record.align = 0u;
+    return record;
+}
+
+mat3x2 lt_getRecordXform(RenderRecord record)
+{
+    return mat3x2(record.xform[0], record.xform[1], record.xform[2]);
+}
+
+void lt_getRecordTriangle(RenderRecord record, out Triangle mesh_t)
+{
+    lt_getIndexedTriangle(uvec3(record.vertexID[0], record.vertexID[1],
+                                record.vertexID[2]), mesh_t);
+}
+
+// Record of the instance idx of the render pass: the one written by the cull
+// pass, or with FLAG_CULLED_INDICES, rebuilt from the key it points to
+RenderRecord lt_getInstanceRecord(uint idx)
+{
+#if FLAG_CULLED_INDICES
+    uvec4 key = lt_getCulledKey_64(idx);
+    mat3x2 xform;
+    lt_getTriangleXform_64(key.xy, xform);
+    return lt_makeRenderRecord(key.xy, xform,
+                               lt_getTargetTriangleIndices(key.z, key.w & 1u),
+                               lt_getTargetTriangleID(key.z, key.w & 1u));
+#else
+    return u_RenderRecords[idx];
+#endif
+}
+
 // ------------------------ Mapping from Leaf to QT  ------------------------ //
 
 vec2 lt_Leaf_to_Tree_64(vec2 p, uvec2 nodeID)
@@ -299,4 +651,20 @@ void lt_Leaf_n_Parent_to_MeshPosition(vec2 p, uvec4 key, out vec4 p_mesh, out ve
     pp_mesh = lt_Tree_to_MeshPosition(pp2D, meshPolygonID, rootID);
 }
 
+// Mesh positions of the corners (O, R, U) of the node of the key and of its
+// parent
+void lt_Node_n_Parent_to_MeshCorners(uvec4 key, out vec4 c[3], out vec4 pc[3])
+{
+    const vec2 corners[3] = vec2[3](vec2(0, 0), vec2(1, 0), vec2(0, 1));
+    mat3x2 xf, pxf;
+    lt_getTriangleXform_64(key.xy, xf, pxf);
+
+    Triangle mesh_t;
+    lt_getTargetTriangle(key.z, key.w & 1u, mesh_t);
+    for (int i = 0; i < 3; ++i) {
+        c[i]  = lt_mapTo3DTriangle(mesh_t, xf * vec3(corners[i], 1));
+        pc[i] = lt_mapTo3DTriangle(mesh_t, pxf * vec3(corners[i], 1));
+    }
+}
+
 #endif
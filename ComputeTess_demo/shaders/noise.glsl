@@ -57,5 +57,30 @@ float getHeight(vec2 v, float f) {
     return displace(v, f) * u_displace_factor;
 }
 
+// Bound of |getHeight| at any resolution: each octave of displace is in
+// [-1, 1], weighted by frequency^-H
+float maxHeight() {
+    return pow(1.5, -H) / (1.0 - pow(lacunarity, -H)) * u_displace_factor;
+}
+
+// Bound of the slope of getHeight at any resolution: octave i of displace
+// is SimplexPerlin2D at lacunarity^i times the position, whose gradient is
+// below 6 (5.2 at most measured), weighted by frequency^-H
+float maxSlope() {
+    float r = pow(lacunarity, 1.0 - H);
+    return 6.0 * pow(1.5, -H) * (pow(r, 16.0) - 1.0) / (r - 1.0)
+         * u_displace_factor;
+}
+
+// Bound of the octaves of displaceVertex that the points closer to the eye
+// than d do not all fully share: the part of their heights that depends on
+// their distance
+float maxDetailHeight(float d) {
+    float octaves = clamp(log2(3e3 / d) - 2.0, 0.0, 16.0);
+    float k = max(floor(octaves) - 1.0, 0.0);
+    return pow(1.5, -H) * pow(lacunarity, -H * k)
+         / (1.0 - pow(lacunarity, -H)) * u_displace_factor;
+}
+
 
 #endif
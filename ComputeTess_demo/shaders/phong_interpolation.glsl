@@ -10,28 +10,32 @@ struct PhongPatch
     vec3 termIK;
 };
 
-vec3 PIi(vec3 pi, vec3 ni, vec3 q)
+// Edge terms of the Phong patch, computed once per target triangle by
+// itpl::GetPhongCoeffs
+struct PhongCoeffs {
+    float term[9]; // termIJ, termJK, termIK
+};
+
+layout (std430, binding = PATCHES_B) readonly buffer Phong_Patches {
+    PhongCoeffs u_PhongCoeffs[];
+};
+
+vec3 phongTerm(uint triangleID, int i)
 {
-    vec3 q_minus_p = q - pi;
-    return q - dot(q_minus_p, ni) * ni;
+    return vec3(u_PhongCoeffs[triangleID].term[3*i + 0],
+                u_PhongCoeffs[triangleID].term[3*i + 1],
+                u_PhongCoeffs[triangleID].term[3*i + 2]);
 }
 
-void getPhongPatch(Triangle t, out PhongPatch oPhongPatch)
+void getPhongPatch(uint triangleID, out PhongPatch oPhongPatch)
 {
-    vec3 Pi = t.vertex[0].p.xyz;
-    vec3 Pj = t.vertex[1].p.xyz;
-    vec3 Pk = t.vertex[2].p.xyz;
-
-    vec3 Ni = t.vertex[0].n.xyz;
-    vec3 Nj = t.vertex[1].n.xyz;
-    vec3 Nk = t.vertex[2].n.xyz;
-
-    oPhongPatch.termIJ = PIi(Pi, Ni, Pj) + PIi(Pj, Nj, Pi);
-    oPhongPatch.termJK = PIi(Pj, Nj, Pk) + PIi(Pk, Nk, Pj);
-    oPhongPatch.termIK = PIi(Pk, Nk, Pi) + PIi(Pi, Ni, Pk);
+    oPhongPatch.termIJ = phongTerm(triangleID, 0);
+    oPhongPatch.termJK = phongTerm(triangleID, 1);
+    oPhongPatch.termIK = phongTerm(triangleID, 2);
 }
 
-Vertex Interpolate_phong(Triangle target_T, vec3 uvw, float alpha)
+Vertex Interpolate_phong(Triangle target_T, uint triangleID, vec3 uvw,
+                         float alpha)
 {
     Vertex vertex;
     vec3 Pi = target_T.vertex[0].p.xyz;
@@ -40,7 +44,7 @@ Vertex Interpolate_phong(Triangle target_T, vec3 uvw, float alpha)
 
 
     PhongPatch phongPatch;
-    getPhongPatch(target_T, phongPatch);
+    getPhongPatch(triangleID, phongPatch);
     vec3 tc1 = uvw;
     vec3 tc2 = tc1*tc1;
 
@@ -74,13 +78,14 @@ Vertex Interpolate_phong(Triangle target_T, vec3 uvw, float alpha)
 
 }
 
-Vertex PhongInterpolation(Triangle mesh_t, vec2 uv, float alpha)
+Vertex PhongInterpolation(Triangle mesh_t, uint triangleID, vec2 uv,
+                          float alpha)
 {
     float u = uv.x, v = uv.y, w = 1-u-v;
     vec3 uvw = vec3(w,v,u);
     uvw = uvw / (u+v+w);
 
-    return Interpolate_phong(mesh_t, uvw, alpha);
+    return Interpolate_phong(mesh_t, triangleID, uvw, alpha);
 }
 
 
@@ -0,0 +1,200 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Work stealing thread pool used by the CPU side of the project.
+/// ParallelFor splits an index range in chunks, and hands each thread a
+/// contiguous run of chunks. A thread pops chunks from the front of its own
+/// run, and once it is empty steals from the back of the other runs, so
+/// uneven chunks (e.g. keys that split vs keys that merge) do not leave
+/// threads idle.
+/// The calling thread takes part in the work as thread 0, and the task
+/// receives the index of the thread running it so it can write to
+/// per-thread storage without synchronization.
+///
+
+class ThreadPool
+{
+public:
+    // task(thread_id, begin, end)
+    typedef std::function<void(int, size_t, size_t)> Task;
+
+private:
+    // Run of chunks [begin, end) owned by one thread, packed in one atomic
+    // so that the owner (front) and the thieves (back) can race on it
+    // Padded to a cache line to avoid false sharing between runs
+    struct ChunkRun {
+        std::atomic<uint64_t> bounds;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::vector<std::thread> workers_;
+    std::vector<ChunkRun> runs_;
+    int thread_count_ = 1;
+
+    std::mutex mutex_;
+    std::condition_variable wake_cv_, done_cv_;
+    uint64_t generation_ = 0;
+    int busy_count_ = 0;
+    bool quit_ = false;
+
+    // Current job
+    const Task* task_ = nullptr;
+    size_t count_ = 0, grain_ = 1;
+
+    static uint64_t pack(uint32_t begin, uint32_t end) {
+        return (uint64_t(begin) << 32) | uint64_t(end);
+    }
+
+    // Pops the first chunk of the run
+    bool popFront(ChunkRun& run, uint32_t& chunk)
+    {
+        uint64_t b = run.bounds.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t begin = uint32_t(b >> 32), end = uint32_t(b);
+            if (begin >= end)
+                return false;
+            if (run.bounds.compare_exchange_weak(b, pack(begin + 1, end))) {
+                chunk = begin;
+                return true;
+            }
+        }
+    }
+
+    // Steals the last chunk of the run
+    bool popBack(ChunkRun& run, uint32_t& chunk)
+    {
+        uint64_t b = run.bounds.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t begin = uint32_t(b >> 32), end = uint32_t(b);
+            if (begin >= end)
+                return false;
+            if (run.bounds.compare_exchange_weak(b, pack(begin, end - 1))) {
+                chunk = end - 1;
+                return true;
+            }
+        }
+    }
+
+    void runChunk(int thread_id, uint32_t chunk)
+    {
+        size_t begin = size_t(chunk) * grain_;
+        size_t end = std::min(begin + grain_, count_);
+        (*task_)(thread_id, begin, end);
+    }
+
+    void work(int thread_id)
+    {
+        uint32_t chunk;
+        while (popFront(runs_[thread_id], chunk))
+            runChunk(thread_id, chunk);
+        for (int i = 1; i < thread_count_; ++i) {
+            ChunkRun& victim = runs_[(thread_id + i) % thread_count_];
+            while (popBack(victim, chunk))
+                runChunk(thread_id, chunk);
+        }
+    }
+
+    void workerLoop(int thread_id, uint64_t seen)
+    {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_cv_.wait(lock, [&] { return quit_ || generation_ != seen; });
+                if (quit_)
+                    return;
+                seen = generation_;
+            }
+            work(thread_id);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--busy_count_ == 0)
+                    done_cv_.notify_one();
+            }
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        wake_cv_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i)
+            workers_[i].join();
+        workers_.clear();
+        quit_ = false;
+    }
+
+public:
+    ThreadPool() { SetThreadCount(0); }
+    ~ThreadPool() { stopWorkers(); }
+
+    static int HardwareThreadCount()
+    {
+        return std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    // Number of threads running the tasks, calling thread included
+    // 0 uses all the hardware threads
+    void SetThreadCount(int count)
+    {
+        if (count <= 0)
+            count = HardwareThreadCount();
+        if (count == thread_count_ && int(runs_.size()) == count)
+            return;
+        stopWorkers();
+        thread_count_ = count;
+        runs_ = std::vector<ChunkRun>(count);
+        for (int i = 1; i < count; ++i)
+            workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i,
+                                           generation_));
+    }
+
+    int GetThreadCount() const { return thread_count_; }
+
+    // Runs task over [0, count) in chunks of grain indices, and returns once
+    // every chunk is done
+    void ParallelFor(size_t count, size_t grain, const Task& task)
+    {
+        if (count == 0)
+            return;
+        grain = std::max(grain, size_t(1));
+        size_t chunk_count = (count + grain - 1) / grain;
+        if (thread_count_ == 1 || chunk_count == 1) {
+            for (size_t c = 0; c < chunk_count; ++c)
+                task(0, c * grain, std::min((c + 1) * grain, count));
+            return;
+        }
+        task_ = &task;
+        count_ = count;
+        grain_ = grain;
+        for (int i = 0; i < thread_count_; ++i) {
+            uint32_t begin = uint32_t(chunk_count * i / thread_count_);
+            uint32_t end = uint32_t(chunk_count * (i + 1) / thread_count_);
+            runs_[i].bounds.store(pack(begin, end));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_count_ = thread_count_ - 1;
+            ++generation_;
+        }
+        wake_cv_.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&] { return busy_count_ == 0; });
+        task_ = nullptr;
+    }
+};
+
+#endif // THREAD_POOL_H
@@ -128,19 +128,7 @@ public:
 class TransformsManager
 {
 private:
-    struct TransformBlock
-    {
-        mat4 M     = mat4(1.0);
-        mat4 V     = mat4(1.0);
-        mat4 P     = mat4(1.0);
-        mat4 MVP   = mat4(1.0);
-        mat4 MV    = mat4(1.0);
-        mat4 invMV = mat4(1.0);
-        vec4 frustum_planes[6];
-
-        vec3 cam_pos = vec3(1.0);
-        float fovy = 55.0;
-    } block_;
+    TransformBlock block_;
 
     GLuint bo_;
     bool modified_ = true;
@@ -217,12 +205,18 @@ public:
         updateMV();
     }
 
-    void Init(CameraManager& cam)
-    {
-        utility::EmptyBuffer(&bo_);
-        glCreateBuffers(1, &bo_);
-        glNamedBufferStorage(bo_, sizeof(TransformBlock), NULL, GL_DYNAMIC_STORAGE_BIT);
+    const TransformBlock& GetBlock() const {
+        return block_;
+    }
+
+    float GetNearPlane() const {
+        return near_;
+    }
 
+    // Computes the transforms without any OpenGL call
+    // Used as is by the headless CPU tools
+    void SetUp(CameraManager& cam)
+    {
         near_ = 0.01f;
         far_ = 1024.0f;
 
@@ -235,6 +229,14 @@ public:
         updateMV();
     }
 
+    void Init(CameraManager& cam)
+    {
+        utility::EmptyBuffer(&bo_);
+        glCreateBuffers(1, &bo_);
+        glNamedBufferStorage(bo_, sizeof(TransformBlock), NULL, GL_DYNAMIC_STORAGE_BIT);
+        SetUp(cam);
+    }
+
     void CleanUp()
     {
         delete &block_;
@@ -42,6 +42,12 @@ static void SetUniformVec2(GLuint pid, string name, const glm::vec2& value)
     glProgramUniform2fv(pid, location, 1, glm::value_ptr(value));
 }
 
+static void SetUniformIVec2(GLuint pid, string name, const glm::ivec2& value)
+{
+    GLuint location = glGetUniformLocation(pid, name.c_str());
+    glProgramUniform2iv(pid, location, 1, glm::value_ptr(value));
+}
+
 static void SetUniformVec3(GLuint pid, string name, const glm::vec3& value)
 {
     GLuint location = glGetUniformLocation(pid, name.c_str());
@@ -67,6 +73,13 @@ void EmptyBuffer(GLuint* bo)
     *bo = 0;
 }
 
+void EmptyTexture(GLuint* tex)
+{
+    if(glIsTexture(*tex))
+        glDeleteTextures(1, tex);
+    *tex = 0;
+}
+
 float clamp(float f, float min, float max) {
     if (f < min) f = min;
     if (f > max) f = max;